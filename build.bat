@@ -19,4 +19,8 @@ pushd bin
 REM del *.pdb > NUL 2> NUL
 cl %ROOT%\src\*.c %ROOT%\src\renderer\*.c %COMPILER_FLAGS% /link %LINKER_FLAGS%
 
+REM Offline asset cooker, only the GL free parts of the renderer
+SET COOK_SOURCES=%ROOT%\src\cook\*.c %ROOT%\src\memory.c %ROOT%\src\win64_platform.c %ROOT%\src\renderer\model_import.c %ROOT%\src\renderer\obj_loader.c %ROOT%\src\renderer\meshlet.c %ROOT%\src\renderer\cooked.c
+cl %COOK_SOURCES% %INCLUDES% %FLAGS% -O2 -Oi -Fecook -Zi -nologo /MT /link kernel32.lib %ROOT%\vendors\assimp\lib\%ASSIMP_LIB_NAME%
+
 popd
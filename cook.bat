@@ -0,0 +1,6 @@
+@echo off
+
+REM Cooks everything in bin\assets that changed into bin\cooked, pass -force to rebuild all of it
+pushd bin
+cook.exe %*
+popd
@@ -0,0 +1,610 @@
+#include <stdio.h> // printf, FILE
+#include <stdbool.h>
+#include <string.h>
+#include <sys/stat.h> // stat
+
+/*
+  Headless asset cooker, run from the bin folder (see cook.bat).
+
+  Walks assets\ and runs every model and texture through the same import,
+  clustering and quantization the renderer would otherwise do at startup,
+  writing the result to cooked\ (formats in renderer\cooked.h).
+
+  cooked\cook.db records for every output which source files went into it
+  (their size and modification time), a hash of the settings that shape the
+  output and the tool version. Only outputs where any of those changed are
+  rebuilt, pass -force to rebuild everything.
+
+  Textures are cooked in parallel on the work queue. Models are cooked one at
+  a time since the OBJ parser already spreads itself over the work queue.
+*/
+
+#define GFX_MATH_IMPL
+#include "..\gfx_math.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb/stb_image.h"
+
+#include "..\defines.h"
+#include "..\memory.h"
+#include "..\platform.h"
+#include "..\renderer\model_import.h"
+#include "..\renderer\cooked.h"
+
+// Bump when the cooker produces different output without a format or settings change
+#define COOK_TOOL_VERSION 1
+
+#define COOK_DB_PATH "cooked\\cook.db"
+#define COOK_MAX_ASSETS 2048
+#define COOK_MAX_INPUTS (MODEL_MAX_DEPENDENCIES + 1)
+#define COOK_MAX_PATH 512
+
+typedef enum {
+    ASSET_TEXTURE,
+    ASSET_MODEL,
+} AssetType;
+
+typedef struct {
+    char path[COOK_MAX_PATH];
+    u64 modified;
+    u64 size;
+} CookInput;
+
+// One node of the dependency graph: an output and everything it was built from
+typedef struct {
+    char output[COOK_MAX_PATH];
+    u64 settings_hash;
+    u32 tool_version;
+
+    CookInput inputs[COOK_MAX_INPUTS];
+    u32 input_count;
+
+    bool used; // Still produced by an asset, the others are stale
+} CookRecord;
+
+typedef struct {
+    AssetType type;
+    char source[COOK_MAX_PATH];
+    char output[COOK_MAX_PATH];
+
+    CookRecord *previous; // From cook.db, 0 when it was never cooked
+    CookRecord record;    // Filled in once the job succeeded
+
+    bool dirty;
+    bool succeeded;
+} CookJob;
+
+typedef struct {
+    CookJob *jobs;
+    u32 job_count;
+
+    CookRecord *records;
+    u32 record_count;
+} CookState;
+
+// Shared by the texture jobs, each of them pulls work until nothing is left
+typedef struct {
+    CookJob **jobs;
+    u32 job_count;
+    u32 volatile next_job;
+} TextureJobs;
+
+//----------------------
+// SETTINGS
+//----------------------
+
+// Everything that changes the bytes of an output, hashed into its record.
+// @Note: Only u32 members, so there is no padding with garbage in it.
+typedef struct {
+    u32 format_version;
+    u32 channels;
+    u32 flip_vertically;
+    u32 box_filtered_mips;
+} TextureSettings;
+
+typedef struct {
+    u32 format_version;
+    u32 meshlet_max_vertices;
+    u32 meshlet_max_triangles;
+    u32 packed_vertex_size;
+    u32 meshlet_size;
+    u32 native_obj_loader;
+} ModelSettings;
+
+static u64 TextureSettingsHash(void)
+{
+    TextureSettings settings = {COOKED_FORMAT_VERSION, 4, 1, 1};
+    return fnv_1a((u8*)&settings, sizeof(settings));
+}
+
+static u64 ModelSettingsHash(void)
+{
+    ModelSettings settings = {COOKED_FORMAT_VERSION, MESHLET_MAX_VERTICES, MESHLET_MAX_TRIANGLES,
+                              sizeof(PackedVertex), sizeof(Meshlet), NATIVE_OBJ_LOADER};
+    return fnv_1a((u8*)&settings, sizeof(settings));
+}
+
+//----------------------
+// DEPENDENCY DATABASE
+//----------------------
+static bool StatInput(char *path, CookInput *input)
+{
+    struct stat file_stat;
+    if(stat(path, &file_stat) != 0) return false;
+
+    strcpy(input->path, path);
+    input->modified = (u64)file_stat.st_mtime;
+    input->size = (u64)file_stat.st_size;
+
+    return true;
+}
+
+static bool FileExists(char *path)
+{
+    struct stat file_stat;
+    return stat(path, &file_stat) == 0;
+}
+
+static void StripNewline(char *line)
+{
+    size_t length = strlen(line);
+    while(length && (line[length - 1] == '\n' || line[length - 1] == '\r')) line[--length] = '\0';
+}
+
+/*
+  Text, so it can be inspected and diffed:
+
+    cook_db <tool version>
+    O <settings hash> <tool version> <input count> <output path>
+    I <modified> <size> <input path>
+
+  Fields are separated by tabs, the path always comes last.
+*/
+static void LoadCookDatabase(ArenaMemory *memory, CookState *state)
+{
+    state->records = (CookRecord*) ArenaAlloc16(memory, COOK_MAX_ASSETS * sizeof(CookRecord));
+    state->record_count = 0;
+
+    FILE *fp = fopen(COOK_DB_PATH, "rb");
+    if(!fp) return;
+
+    char line[COOK_MAX_PATH + 128];
+    CookRecord *record = 0;
+
+    while(fgets(line, sizeof(line), fp))
+    {
+        StripNewline(line);
+
+        unsigned long long hash, modified, size;
+        u32 tool_version, input_count;
+        s32 path_offset = 0;
+
+        if(sscanf(line, "O\t%llx\t%u\t%u\t%n", &hash, &tool_version, &input_count, &path_offset) == 3 && path_offset)
+        {
+            if(state->record_count == COOK_MAX_ASSETS) break;
+
+            record = &state->records[state->record_count++];
+            memset(record, 0, sizeof(CookRecord));
+
+            strncpy(record->output, line + path_offset, COOK_MAX_PATH - 1);
+            record->settings_hash = hash;
+            record->tool_version = tool_version;
+        }
+        else if(record && sscanf(line, "I\t%llu\t%llu\t%n", &modified, &size, &path_offset) == 2 && path_offset)
+        {
+            if(record->input_count == COOK_MAX_INPUTS) continue;
+
+            CookInput *input = &record->inputs[record->input_count++];
+            strncpy(input->path, line + path_offset, COOK_MAX_PATH - 1);
+            input->modified = modified;
+            input->size = size;
+        }
+    }
+
+    fclose(fp);
+}
+
+static bool SaveCookDatabase(CookState *state)
+{
+    if(!CreateDirectoriesForFile(COOK_DB_PATH)) return false;
+
+    FILE *fp = fopen(COOK_DB_PATH, "wb");
+    if(!fp)
+    {
+        printf("Could not write %s\n", COOK_DB_PATH);
+        return false;
+    }
+
+    fprintf(fp, "cook_db %u\n", COOK_TOOL_VERSION);
+
+    for(u32 job_index = 0; job_index < state->job_count; job_index++)
+    {
+        CookJob *job = &state->jobs[job_index];
+        CookRecord *record = 0;
+
+        // Failed jobs are left out, so they are retried on the next run
+        if(job->dirty && job->succeeded) record = &job->record;
+        else if(!job->dirty) record = job->previous;
+
+        if(!record) continue;
+
+        fprintf(fp, "O\t%llx\t%u\t%u\t%s\n", (unsigned long long)record->settings_hash, record->tool_version,
+                record->input_count, record->output);
+
+        for(u32 input_index = 0; input_index < record->input_count; input_index++)
+        {
+            CookInput *input = &record->inputs[input_index];
+            fprintf(fp, "I\t%llu\t%llu\t%s\n", (unsigned long long)input->modified, (unsigned long long)input->size,
+                    input->path);
+        }
+    }
+
+    fclose(fp);
+
+    return true;
+}
+
+static CookRecord *FindRecord(CookState *state, char *output)
+{
+    for(u32 record_index = 0; record_index < state->record_count; record_index++)
+    {
+        if(!strcmp(state->records[record_index].output, output)) return &state->records[record_index];
+    }
+
+    return 0;
+}
+
+// Read back like the renderer does, an output it would reject is cooked again
+static bool IsValidOutput(CookJob *job, ArenaMemory *scratch)
+{
+    if(job->type == ASSET_TEXTURE)
+    {
+        CookedTexture texture;
+        if(!OpenCookedTexture(job->output, &texture)) return false;
+
+        CloseCookedTexture(&texture);
+        return true;
+    }
+
+    ResetArena(scratch);
+
+    ModelData model;
+    return ReadCookedModel(scratch, job->output, &model);
+}
+
+static bool IsUpToDate(CookJob *job, u64 settings_hash, ArenaMemory *scratch)
+{
+    CookRecord *previous = job->previous;
+
+    if(!previous) return false;
+    if(previous->tool_version != COOK_TOOL_VERSION) return false;
+    if(previous->settings_hash != settings_hash) return false;
+    if(!FileExists(job->output)) return false;
+
+    // The first input is always the source itself
+    if(previous->input_count == 0 || strcmp(previous->inputs[0].path, job->source)) return false;
+
+    for(u32 input_index = 0; input_index < previous->input_count; input_index++)
+    {
+        CookInput *recorded = &previous->inputs[input_index];
+        CookInput current;
+
+        if(!StatInput(recorded->path, &current)) return false;
+        if(current.modified != recorded->modified || current.size != recorded->size) return false;
+    }
+
+    return IsValidOutput(job, scratch);
+}
+
+//----------------------
+// ASSET DISCOVERY
+//----------------------
+static bool HasExtension(char *path, char **extensions, u32 extension_count)
+{
+    char *dot = strrchr(path, '.');
+    if(!dot) return false;
+
+    for(u32 extension_index = 0; extension_index < extension_count; extension_index++)
+    {
+        if(!_stricmp(dot, extensions[extension_index])) return true;
+    }
+
+    return false;
+}
+
+static void VisitAsset(char *file_path, void *data)
+{
+    static char *model_extensions[] = {".obj", ".fbx", ".gltf", ".glb", ".dae", ".3ds"};
+    static char *texture_extensions[] = {".png", ".jpg", ".jpeg", ".tga", ".bmp", ".psd", ".hdr"};
+
+    CookState *state = (CookState*)data;
+    AssetType type;
+    char *extension;
+
+    if(HasExtension(file_path, model_extensions, ArrayCount(model_extensions)))
+    {
+        type = ASSET_MODEL;
+        extension = COOKED_MODEL_EXTENSION;
+    }
+    else if(HasExtension(file_path, texture_extensions, ArrayCount(texture_extensions)))
+    {
+        type = ASSET_TEXTURE;
+        extension = COOKED_TEXTURE_EXTENSION;
+    }
+    else return; // .mtl and friends are picked up as dependencies of their model
+
+    if(state->job_count == COOK_MAX_ASSETS)
+    {
+        printf("More than %u assets, skipping %s\n", COOK_MAX_ASSETS, file_path);
+        return;
+    }
+
+    CookJob *job = &state->jobs[state->job_count];
+    memset(job, 0, sizeof(CookJob));
+
+    job->type = type;
+    strncpy(job->source, file_path, COOK_MAX_PATH - 1);
+
+    if(!CookedPathFromSource(job->output, sizeof(job->output), job->source, extension))
+    {
+        printf("Path too long, skipping %s\n", file_path);
+        return;
+    }
+
+    state->job_count++;
+}
+
+//----------------------
+// TEXTURES
+//----------------------
+
+// Averages 2x2 blocks, odd edges reuse their last row or column
+static void DownsampleMip(u8 *source, u32 source_width, u32 source_height,
+                          u8 *dest, u32 dest_width, u32 dest_height)
+{
+    for(u32 y = 0; y < dest_height; y++)
+    {
+        u32 y0 = y * 2;
+        u32 y1 = (y0 + 1 < source_height) ? y0 + 1 : y0;
+
+        for(u32 x = 0; x < dest_width; x++)
+        {
+            u32 x0 = x * 2;
+            u32 x1 = (x0 + 1 < source_width) ? x0 + 1 : x0;
+
+            u8 *p00 = source + ((size_t)y0 * source_width + x0) * 4;
+            u8 *p01 = source + ((size_t)y0 * source_width + x1) * 4;
+            u8 *p10 = source + ((size_t)y1 * source_width + x0) * 4;
+            u8 *p11 = source + ((size_t)y1 * source_width + x1) * 4;
+            u8 *out = dest + ((size_t)y * dest_width + x) * 4;
+
+            for(u32 channel = 0; channel < 4; channel++)
+                out[channel] = (u8)((p00[channel] + p01[channel] + p10[channel] + p11[channel] + 2) / 4);
+        }
+    }
+}
+
+static bool CookTexture(CookJob *job)
+{
+    s32 width, height, channels_in_file;
+    u8 *pixels = stbi_load(job->source, &width, &height, &channels_in_file, 4);
+
+    if(!pixels)
+    {
+        printf("Could not decode %s: %s\n", job->source, stbi_failure_reason());
+        return false;
+    }
+
+    // Full chain down to 1x1
+    u32 mip_count = 1;
+    size_t total_size = 0;
+
+    for(u32 w = width, h = height;; mip_count++)
+    {
+        total_size += (size_t)w * h * 4;
+        if(w == 1 && h == 1) break;
+
+        w = (w > 1) ? w / 2 : 1;
+        h = (h > 1) ? h / 2 : 1;
+    }
+
+    // @Note: Texture jobs run on the worker threads, the arenas are only touched by the main thread
+    u8 *mips = (u8*) ALLOC_MEM(total_size);
+    memcpy(mips, pixels, (size_t)width * height * 4);
+    stbi_image_free(pixels);
+
+    u8 *source = mips;
+    u32 source_width = width, source_height = height;
+
+    for(u32 mip = 1; mip < mip_count; mip++)
+    {
+        u32 dest_width = (source_width > 1) ? source_width / 2 : 1;
+        u32 dest_height = (source_height > 1) ? source_height / 2 : 1;
+        u8 *dest = source + (size_t)source_width * source_height * 4;
+
+        DownsampleMip(source, source_width, source_height, dest, dest_width, dest_height);
+
+        source = dest;
+        source_width = dest_width;
+        source_height = dest_height;
+    }
+
+    bool result = CreateDirectoriesForFile(job->output) &&
+        WriteCookedTexture(job->output, width, height, mip_count, 4, mips);
+
+    free(mips);
+
+    if(result)
+    {
+        job->record.input_count = 0;
+        result = StatInput(job->source, &job->record.inputs[job->record.input_count++]);
+    }
+
+    return result;
+}
+
+static void CookTextureJobs(WorkQueue *queue, void *data)
+{
+    TextureJobs *shared = (TextureJobs*)data;
+
+    for(;;)
+    {
+        u32 job_index = AtomicIncrement(&shared->next_job) - 1;
+        if(job_index >= shared->job_count) break;
+
+        CookJob *job = shared->jobs[job_index];
+        job->succeeded = CookTexture(job);
+
+        printf("%s %s\n", job->succeeded ? "Cooked" : "FAILED", job->output);
+    }
+}
+
+//----------------------
+// MODELS
+//----------------------
+static bool CookModel(ArenaMemory *memory, ArenaMemory *scratch, CookJob *job)
+{
+    // Split "assets\folder\name.obj" into the folder (with separator) and the name
+    char folder_path[COOK_MAX_PATH];
+    strcpy(folder_path, job->source);
+
+    char *separator = strrchr(folder_path, '\\');
+    char *model_name = job->source + (separator - folder_path) + 1;
+    separator[1] = '\0';
+
+    ResetArena(memory);
+    ResetArena(scratch);
+
+    ModelData model;
+    if(!ImportModel(memory, scratch, folder_path, model_name, &model)) return false;
+
+    if(!CreateDirectoriesForFile(job->output) || !WriteCookedModel(job->output, &model)) return false;
+
+    CookRecord *record = &job->record;
+    record->input_count = 0;
+
+    if(!StatInput(job->source, &record->inputs[record->input_count++])) return false;
+
+    for(u32 dependency_index = 0; dependency_index < model.dependency_count; dependency_index++)
+    {
+        char dependency_path[COOK_MAX_PATH];
+        strcpy(dependency_path, folder_path);
+        strcat(dependency_path, model.dependencies[dependency_index]);
+
+        // A dependency that does not exist was not read either, the import still succeeded without it
+        if(StatInput(dependency_path, &record->inputs[record->input_count])) record->input_count++;
+    }
+
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    bool force = false;
+
+    for(s32 arg_index = 1; arg_index < argc; arg_index++)
+    {
+        if(!strcmp(argv[arg_index], "-force")) force = true;
+        else
+        {
+            printf("Usage: cook [-force]\n");
+            return 1;
+        }
+    }
+
+    u64 start = GetWallClock();
+
+    u32 processor_count = GetProcessorCount();
+    InitWorkQueue(&work_queue, processor_count > 1 ? processor_count - 1 : 0);
+
+    ArenaMemory memory, scratch, state_memory;
+    InitArena(&memory, ALLOC_MEM(GB(1)), GB(1));
+    InitArena(&scratch, ALLOC_MEM(MB(512)), MB(512));
+    InitArena(&state_memory, ALLOC_MEM(MB(64)), MB(64));
+
+    CookState state = {0};
+    state.jobs = (CookJob*) ArenaAlloc16(&state_memory, COOK_MAX_ASSETS * sizeof(CookJob));
+
+    LoadCookDatabase(&state_memory, &state);
+    WalkDirectory("assets", VisitAsset, &state);
+
+    u64 texture_settings = TextureSettingsHash();
+    u64 model_settings = ModelSettingsHash();
+
+    // Find out what changed
+    CookJob **texture_jobs = (CookJob**) ArenaAlloc16(&state_memory, state.job_count * sizeof(CookJob*));
+    u32 texture_job_count = 0;
+    u32 up_to_date_count = 0;
+
+    for(u32 job_index = 0; job_index < state.job_count; job_index++)
+    {
+        CookJob *job = &state.jobs[job_index];
+        u64 settings_hash = (job->type == ASSET_TEXTURE) ? texture_settings : model_settings;
+
+        job->previous = FindRecord(&state, job->output);
+        if(job->previous) job->previous->used = true;
+
+        job->dirty = force || !IsUpToDate(job, settings_hash, &scratch);
+
+        strcpy(job->record.output, job->output);
+        job->record.settings_hash = settings_hash;
+        job->record.tool_version = COOK_TOOL_VERSION;
+
+        if(!job->dirty) up_to_date_count++;
+        else if(job->type == ASSET_TEXTURE) texture_jobs[texture_job_count++] = job;
+    }
+
+    // Textures in parallel, the main thread helps out in CompleteAllWork
+    stbi_set_flip_vertically_on_load(true); // The renderer expects the first row at the bottom
+
+    TextureJobs shared = {0};
+    shared.jobs = texture_jobs;
+    shared.job_count = texture_job_count;
+
+    if(texture_job_count)
+    {
+        u32 worker_count = work_queue.thread_count + 1;
+        if(worker_count > texture_job_count) worker_count = texture_job_count;
+
+        for(u32 worker_index = 0; worker_index < worker_count; worker_index++)
+            AddWorkEntry(&work_queue, CookTextureJobs, &shared);
+
+        CompleteAllWork(&work_queue);
+    }
+
+    // Models one by one, their import is threaded on its own
+    for(u32 job_index = 0; job_index < state.job_count; job_index++)
+    {
+        CookJob *job = &state.jobs[job_index];
+        if(job->type != ASSET_MODEL || !job->dirty) continue;
+
+        job->succeeded = CookModel(&memory, &scratch, job);
+        printf("%s %s\n", job->succeeded ? "Cooked" : "FAILED", job->output);
+    }
+
+    // Outputs whose source is gone would otherwise be loaded forever
+    for(u32 record_index = 0; record_index < state.record_count; record_index++)
+    {
+        CookRecord *record = &state.records[record_index];
+        if(record->used) continue;
+
+        if(remove(record->output) == 0) printf("Removed stale %s\n", record->output);
+    }
+
+    u32 cooked_count = 0, failed_count = 0;
+    for(u32 job_index = 0; job_index < state.job_count; job_index++)
+    {
+        CookJob *job = &state.jobs[job_index];
+        if(!job->dirty) continue;
+
+        if(job->succeeded) cooked_count++;
+        else failed_count++;
+    }
+
+    SaveCookDatabase(&state);
+
+    printf("Cooked %u, up to date %u, failed %u in %.2f s (%u threads)\n", cooked_count, up_to_date_count, failed_count,
+           GetSecondsElapsed(start, GetWallClock()), work_queue.thread_count + 1);
+
+    return failed_count ? 1 : 0;
+}
@@ -18,4 +18,9 @@ typedef double f64;
 
 #define ArrayCount(A) (sizeof((A)) / sizeof((A)[0]))
 
+// Compile time check that also works without C11, an array of negative size does not compile
+#define StaticAssertJoin_(A, B) A##B
+#define StaticAssertJoin(A, B) StaticAssertJoin_(A, B)
+#define StaticAssert(Expr) typedef char StaticAssertJoin(static_assert_, __COUNTER__)[(Expr) ? 1 : -1]
+
 #endif
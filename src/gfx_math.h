@@ -100,6 +100,7 @@ mat4x4 create_diag_mat4x4   (float scalar);
 mat4x4 copy_mat4x4          (mat4x4 target);
 mat4x4 mult_mat4x4          (mat4x4 a, mat4x4 b);
 mat4x4 scale_mat4x4         (mat4x4 a, float x, float y, float z); // Last row untouched
+mat4x4 inverse_mat4x4       (mat4x4 a);
 
 // Transforms
 vec4 mat4x4_mult_vec4(mat4x4 mat, vec4 v);
@@ -636,14 +637,48 @@ mat4x4 scale_mat4x4(mat4x4 a, float x, float y, float z)
     return result;
 }
 
+/* General inverse by cofactors, returns the zero matrix when 'a' is singular */
+mat4x4 inverse_mat4x4(mat4x4 a)
+{
+    mat4x4 result = {0};
+    float inv[16];
+    float *m = a.matrix;
+    
+    inv[0]  =  m[5]*m[10]*m[15] - m[5]*m[11]*m[14] - m[9]*m[6]*m[15] + m[9]*m[7]*m[14] + m[13]*m[6]*m[11] - m[13]*m[7]*m[10];
+    inv[4]  = -m[4]*m[10]*m[15] + m[4]*m[11]*m[14] + m[8]*m[6]*m[15] - m[8]*m[7]*m[14] - m[12]*m[6]*m[11] + m[12]*m[7]*m[10];
+    inv[8]  =  m[4]*m[9]*m[15]  - m[4]*m[11]*m[13] - m[8]*m[5]*m[15] + m[8]*m[7]*m[13] + m[12]*m[5]*m[11] - m[12]*m[7]*m[9];
+    inv[12] = -m[4]*m[9]*m[14]  + m[4]*m[10]*m[13] + m[8]*m[5]*m[14] - m[8]*m[6]*m[13] - m[12]*m[5]*m[10] + m[12]*m[6]*m[9];
+    inv[1]  = -m[1]*m[10]*m[15] + m[1]*m[11]*m[14] + m[9]*m[2]*m[15] - m[9]*m[3]*m[14] - m[13]*m[2]*m[11] + m[13]*m[3]*m[10];
+    inv[5]  =  m[0]*m[10]*m[15] - m[0]*m[11]*m[14] - m[8]*m[2]*m[15] + m[8]*m[3]*m[14] + m[12]*m[2]*m[11] - m[12]*m[3]*m[10];
+    inv[9]  = -m[0]*m[9]*m[15]  + m[0]*m[11]*m[13] + m[8]*m[1]*m[15] - m[8]*m[3]*m[13] - m[12]*m[1]*m[11] + m[12]*m[3]*m[9];
+    inv[13] =  m[0]*m[9]*m[14]  - m[0]*m[10]*m[13] - m[8]*m[1]*m[14] + m[8]*m[2]*m[13] + m[12]*m[1]*m[10] - m[12]*m[2]*m[9];
+    inv[2]  =  m[1]*m[6]*m[15]  - m[1]*m[7]*m[14]  - m[5]*m[2]*m[15] + m[5]*m[3]*m[14] + m[13]*m[2]*m[7]  - m[13]*m[3]*m[6];
+    inv[6]  = -m[0]*m[6]*m[15]  + m[0]*m[7]*m[14]  + m[4]*m[2]*m[15] - m[4]*m[3]*m[14] - m[12]*m[2]*m[7]  + m[12]*m[3]*m[6];
+    inv[10] =  m[0]*m[5]*m[15]  - m[0]*m[7]*m[13]  - m[4]*m[1]*m[15] + m[4]*m[3]*m[13] + m[12]*m[1]*m[7]  - m[12]*m[3]*m[5];
+    inv[14] = -m[0]*m[5]*m[14]  + m[0]*m[6]*m[13]  + m[4]*m[1]*m[14] - m[4]*m[2]*m[13] - m[12]*m[1]*m[6]  + m[12]*m[2]*m[5];
+    inv[3]  = -m[1]*m[6]*m[11]  + m[1]*m[7]*m[10]  + m[5]*m[2]*m[11] - m[5]*m[3]*m[10] - m[9]*m[2]*m[7]   + m[9]*m[3]*m[6];
+    inv[7]  =  m[0]*m[6]*m[11]  - m[0]*m[7]*m[10]  - m[4]*m[2]*m[11] + m[4]*m[3]*m[10] + m[8]*m[2]*m[7]   - m[8]*m[3]*m[6];
+    inv[11] = -m[0]*m[5]*m[11]  + m[0]*m[7]*m[9]   + m[4]*m[1]*m[11] - m[4]*m[3]*m[9]  - m[8]*m[1]*m[7]   + m[8]*m[3]*m[5];
+    inv[15] =  m[0]*m[5]*m[10]  - m[0]*m[6]*m[9]   - m[4]*m[1]*m[10] + m[4]*m[2]*m[9]  + m[8]*m[1]*m[6]   - m[8]*m[2]*m[5];
+
+    float det = m[0]*inv[0] + m[1]*inv[4] + m[2]*inv[8] + m[3]*inv[12];
+    if(det == 0.0f) return result;
+
+    det = 1.0f / det;
+    for(int i = 0; i < 16; i++)
+        result.matrix[i] = inv[i] * det;
+    
+    return result;
+}
+
 vec4 mat4x4_mult_vec4(mat4x4 a, vec4 v)
 {
     vec4 result = {0};
     
     result.x = a.matrix[0] * v.x      + a.matrix[4] * v.y     + a.matrix[8]  * v.z     + a.matrix[12] * v.w;
     result.y = a.matrix[1] * v.x      + a.matrix[5] * v.y     + a.matrix[9]  * v.z     + a.matrix[13] * v.w;
-    result.w = a.matrix[2] * v.x      + a.matrix[6] * v.y     + a.matrix[10] * v.z     + a.matrix[14] * v.w;
-    result.z = a.matrix[3] * v.x       + a.matrix[7] * v.y     + a.matrix[11] * v.z     + a.matrix[15] * v.w;
+    result.z = a.matrix[2] * v.x      + a.matrix[6] * v.y     + a.matrix[10] * v.z     + a.matrix[14] * v.w;
+    result.w = a.matrix[3] * v.x      + a.matrix[7] * v.y     + a.matrix[11] * v.z     + a.matrix[15] * v.w;
 
     return result;
 }
@@ -0,0 +1,78 @@
+#ifndef PLATFORM_H
+#define PLATFORM_H
+
+#include <stdbool.h>
+#include <stddef.h> // size_t
+
+#include "defines.h"
+
+/*
+  Services the platform layer provides to the rest of the program.
+  The implementation lives in win64_platform.c
+*/
+
+//----------------------
+// FILES
+//----------------------
+typedef struct {
+    u8 *data;
+    size_t size;
+
+    void *file_handle;
+    void *mapping_handle;
+} MappedFile;
+
+bool MapFileReadOnly(char *path, MappedFile *file);
+void UnmapFile(MappedFile *file);
+
+// Called for every file below the walked directory, with its path relative to the working directory
+typedef void DirectoryVisitor(char *file_path, void *data);
+void WalkDirectory(char *path, DirectoryVisitor *visitor, void *data);
+
+// Creates every missing directory leading up to the file at 'file_path'
+bool CreateDirectoriesForFile(char *file_path);
+
+//----------------------
+// WORK QUEUE
+//----------------------
+typedef struct WorkQueue WorkQueue;
+typedef void WorkQueueCallback(WorkQueue *queue, void *data);
+
+typedef struct {
+    WorkQueueCallback *callback;
+    void *data;
+} WorkQueueEntry;
+
+// @Note: Entries may only be added from the main thread, the workers only consume.
+struct WorkQueue {
+    u32 volatile completion_goal;
+    u32 volatile completion_count;
+
+    u32 volatile next_entry_to_write;
+    u32 volatile next_entry_to_read;
+
+    void *semaphore_handle;
+    u32 thread_count; // Worker threads, the main thread helps out in CompleteAllWork
+
+    WorkQueueEntry entries[256];
+};
+
+extern WorkQueue work_queue;
+
+void InitWorkQueue(WorkQueue *queue, u32 thread_count);
+void AddWorkEntry(WorkQueue *queue, WorkQueueCallback *callback, void *data);
+void CompleteAllWork(WorkQueue *queue);
+
+u32 GetProcessorCount(void);
+
+// Both return the new value
+u32 AtomicIncrement(u32 volatile *value);
+u32 AtomicAdd(u32 volatile *value, u32 addend);
+
+//----------------------
+// TIMING
+//----------------------
+u64 GetWallClock(void);
+f64 GetSecondsElapsed(u64 start, u64 end);
+
+#endif
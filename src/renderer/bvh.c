@@ -0,0 +1,742 @@
+#include <assert.h>
+#include <string.h> // memset
+#include <float.h> // FLT_MAX
+
+#include "bvh.h"
+#include "..\platform.h"
+
+// Small nodes use fewer bins, setting up and sweeping all of them would cost more than binning the primitives
+#define BVH_BIN_COUNT 16
+#define BVH_MIN_BIN_COUNT 4
+
+// Cost of visiting a node relative to testing one primitive
+#define BVH_TRAVERSAL_COST 1.0f
+
+// Trees over fewer primitives are built on the calling thread only
+#define BVH_PARALLEL_BUILD_MIN 4096
+
+// Nodes at least this big bin their primitives on all threads
+#define BVH_PARALLEL_BIN_MIN 65536
+
+// Smaller subtrees are not worth a job, the main thread builds them right away
+#define BVH_MIN_SUBTREE_SIZE 256
+
+#define AXIS(v, axis) (((f32*)&(v))[(axis)])
+#define POSITION(index) (*(vec3*)((u8*)positions + (size_t)(index) * position_stride))
+
+typedef struct {
+    vec3 min, max; // Of the primitives that fall into the bin
+    vec3 centroid_min, centroid_max;
+    u32 count;
+} BVHBin;
+
+typedef struct {
+    BVHBin bins[3][BVH_BIN_COUNT];
+    u32 bin_count;
+} BVHBins;
+
+// A node whose primitives are known but that was not split yet.
+// Its bounds are already stored in the node itself.
+typedef struct {
+    u32 node_index;
+    u32 first, count; // Range of 'primitive_indices'
+    u32 depth;
+
+    vec3 centroid_min, centroid_max;
+} BVHBuildTask;
+
+typedef struct {
+    ArenaMemory *scratch;
+
+    vec3 *primitive_min, *primitive_max;
+    vec3 *centroids; // min + max, twice the actual centroid saves a multiply per primitive
+    u32 *primitive_indices;
+
+    // Children are linked by index while building, every subtree job fills its own range.
+    // The final layout is made afterwards by FlattenNodes.
+    BVHNode *nodes;
+} BVHBuildContext;
+
+// These run several times per primitive and bin, so they stay in this file where they can be inlined
+static vec3 MinVec3(vec3 a, vec3 b)
+{
+    vec3 result;
+    result.x = (a.x < b.x) ? a.x : b.x;
+    result.y = (a.y < b.y) ? a.y : b.y;
+    result.z = (a.z < b.z) ? a.z : b.z;
+    return result;
+}
+
+static vec3 MaxVec3(vec3 a, vec3 b)
+{
+    vec3 result;
+    result.x = (a.x > b.x) ? a.x : b.x;
+    result.y = (a.y > b.y) ? a.y : b.y;
+    result.z = (a.z > b.z) ? a.z : b.z;
+    return result;
+}
+
+// Half the surface area, the factor cancels out in every comparison
+static f32 HalfArea(vec3 min, vec3 max)
+{
+    f32 x = max.x - min.x, y = max.y - min.y, z = max.z - min.z;
+    return x*y + y*z + z*x;
+}
+
+static void ComputeRangeBounds(BVHBuildContext *context, u32 first, u32 count,
+                               vec3 *min, vec3 *max, vec3 *centroid_min, vec3 *centroid_max)
+{
+    *min = *centroid_min = create_vec3(FLT_MAX, FLT_MAX, FLT_MAX);
+    *max = *centroid_max = create_vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+
+    for(u32 index = first; index < first + count; index++)
+    {
+        u32 primitive = context->primitive_indices[index];
+
+        *min = MinVec3(*min, context->primitive_min[primitive]);
+        *max = MaxVec3(*max, context->primitive_max[primitive]);
+        *centroid_min = MinVec3(*centroid_min, context->centroids[primitive]);
+        *centroid_max = MaxVec3(*centroid_max, context->centroids[primitive]);
+    }
+}
+
+//----------------------
+// BINNING
+//----------------------
+
+static u32 BinCount(u32 primitive_count)
+{
+    if(primitive_count < BVH_MIN_BIN_COUNT) return BVH_MIN_BIN_COUNT;
+    if(primitive_count > BVH_BIN_COUNT) return BVH_BIN_COUNT;
+    return primitive_count;
+}
+
+// Maps a centroid to its bin, 0 on axes where all centroids are the same
+static vec3 BinScale(vec3 centroid_min, vec3 centroid_max, u32 bin_count)
+{
+    vec3 result;
+    for(u32 axis = 0; axis < 3; axis++)
+    {
+        f32 extent = AXIS(centroid_max, axis) - AXIS(centroid_min, axis);
+        AXIS(result, axis) = (extent > 0.0f) ? (bin_count * 0.9999f) / extent : 0.0f;
+    }
+
+    return result;
+}
+
+static u32 BinIndex(vec3 centroid, vec3 centroid_min, vec3 bin_scale, u32 axis, u32 bin_count)
+{
+    s32 bin = (s32)((AXIS(centroid, axis) - AXIS(centroid_min, axis)) * AXIS(bin_scale, axis));
+    if(bin < 0) bin = 0;
+    if(bin >= (s32)bin_count) bin = bin_count - 1;
+
+    return (u32)bin;
+}
+
+static void InitBins(BVHBins *bins, u32 bin_count)
+{
+    bins->bin_count = bin_count;
+
+    for(u32 axis = 0; axis < 3; axis++)
+    {
+        for(u32 bin_index = 0; bin_index < bin_count; bin_index++)
+        {
+            BVHBin *bin = &bins->bins[axis][bin_index];
+            bin->min = bin->centroid_min = create_vec3(FLT_MAX, FLT_MAX, FLT_MAX);
+            bin->max = bin->centroid_max = create_vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+            bin->count = 0;
+        }
+    }
+}
+
+static void MergeBins(BVHBins *dest, BVHBins *source)
+{
+    for(u32 axis = 0; axis < 3; axis++)
+    {
+        for(u32 bin_index = 0; bin_index < dest->bin_count; bin_index++)
+        {
+            BVHBin *a = &dest->bins[axis][bin_index];
+            BVHBin *b = &source->bins[axis][bin_index];
+
+            a->min = MinVec3(a->min, b->min);
+            a->max = MaxVec3(a->max, b->max);
+            a->centroid_min = MinVec3(a->centroid_min, b->centroid_min);
+            a->centroid_max = MaxVec3(a->centroid_max, b->centroid_max);
+            a->count += b->count;
+        }
+    }
+}
+
+// 'count' can be a part of the node, 'bin_count' is what the whole node uses
+static void BinPrimitives(BVHBuildContext *context, u32 first, u32 count, u32 bin_count,
+                          vec3 centroid_min, vec3 centroid_max, BVHBins *bins)
+{
+    InitBins(bins, bin_count);
+    vec3 bin_scale = BinScale(centroid_min, centroid_max, bin_count);
+
+    for(u32 index = first; index < first + count; index++)
+    {
+        u32 primitive = context->primitive_indices[index];
+        vec3 centroid = context->centroids[primitive];
+        vec3 min = context->primitive_min[primitive];
+        vec3 max = context->primitive_max[primitive];
+
+        for(u32 axis = 0; axis < 3; axis++)
+        {
+            BVHBin *bin = &bins->bins[axis][BinIndex(centroid, centroid_min, bin_scale, axis, bin_count)];
+
+            bin->min = MinVec3(bin->min, min);
+            bin->max = MaxVec3(bin->max, max);
+            bin->centroid_min = MinVec3(bin->centroid_min, centroid);
+            bin->centroid_max = MaxVec3(bin->centroid_max, centroid);
+            bin->count++;
+        }
+    }
+}
+
+typedef struct {
+    BVHBuildContext *context;
+    u32 first, count, bin_count;
+    vec3 centroid_min, centroid_max;
+
+    BVHBins bins;
+} BVHBinJob;
+
+static void BinPrimitivesJob(WorkQueue *queue, void *data)
+{
+    BVHBinJob *job = (BVHBinJob*)data;
+    BinPrimitives(job->context, job->first, job->count, job->bin_count, job->centroid_min, job->centroid_max, &job->bins);
+}
+
+// @Note: Uses the work queue, so only the main thread may call this
+static void BinPrimitivesParallel(BVHBuildContext *context, u32 first, u32 count,
+                                  vec3 centroid_min, vec3 centroid_max, BVHBins *bins)
+{
+    size_t scratch_mark = context->scratch->used;
+
+    u32 job_count = work_queue.thread_count + 1;
+    u32 job_size = (count + job_count - 1) / job_count;
+
+    BVHBinJob *jobs = (BVHBinJob*) ArenaAlloc16(context->scratch, job_count * sizeof(BVHBinJob));
+
+    for(u32 job_index = 0; job_index < job_count; job_index++)
+    {
+        BVHBinJob *job = &jobs[job_index];
+        u32 job_first = job_index * job_size;
+
+        job->context = context;
+        job->first = first + job_first;
+        job->count = (job_first < count) ? count - job_first : 0;
+        if(job->count > job_size) job->count = job_size;
+        job->bin_count = BinCount(count);
+        job->centroid_min = centroid_min;
+        job->centroid_max = centroid_max;
+
+        AddWorkEntry(&work_queue, BinPrimitivesJob, job);
+    }
+    CompleteAllWork(&work_queue);
+
+    InitBins(bins, BinCount(count));
+    for(u32 job_index = 0; job_index < job_count; job_index++)
+        MergeBins(bins, &jobs[job_index].bins);
+
+    context->scratch->used = scratch_mark;
+}
+
+//----------------------
+// SPLITTING
+//----------------------
+typedef struct {
+    u32 axis;
+    u32 bin; // The last bin that goes to the left child
+    f32 cost; // Area weighted primitive count of both children
+} BVHSplit;
+
+static bool FindBestSplit(BVHBins *bins, vec3 centroid_min, vec3 centroid_max, BVHSplit *split)
+{
+    bool found = false;
+    split->cost = FLT_MAX;
+
+    for(u32 axis = 0; axis < 3; axis++)
+    {
+        if(AXIS(centroid_max, axis) - AXIS(centroid_min, axis) <= 0.0f) continue;
+
+        BVHBin *axis_bins = bins->bins[axis];
+
+        // Sweep from the right first, then evaluate every plane while sweeping from the left
+        f32 right_costs[BVH_BIN_COUNT];
+        u32 right_counts[BVH_BIN_COUNT];
+
+        vec3 min = create_vec3(FLT_MAX, FLT_MAX, FLT_MAX);
+        vec3 max = create_vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+        u32 count = 0;
+
+        for(u32 bin_index = bins->bin_count - 1; bin_index > 0; bin_index--)
+        {
+            BVHBin *bin = &axis_bins[bin_index];
+            if(bin->count)
+            {
+                min = MinVec3(min, bin->min);
+                max = MaxVec3(max, bin->max);
+                count += bin->count;
+            }
+
+            right_counts[bin_index - 1] = count;
+            right_costs[bin_index - 1] = count ? HalfArea(min, max) * count : 0.0f;
+        }
+
+        min = create_vec3(FLT_MAX, FLT_MAX, FLT_MAX);
+        max = create_vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+        count = 0;
+
+        for(u32 bin_index = 0; bin_index < bins->bin_count - 1; bin_index++)
+        {
+            BVHBin *bin = &axis_bins[bin_index];
+            if(bin->count)
+            {
+                min = MinVec3(min, bin->min);
+                max = MaxVec3(max, bin->max);
+                count += bin->count;
+            }
+
+            if(!count || !right_counts[bin_index]) continue;
+
+            f32 cost = HalfArea(min, max) * count + right_costs[bin_index];
+            if(cost < split->cost)
+            {
+                split->axis = axis;
+                split->bin = bin_index;
+                split->cost = cost;
+                found = true;
+            }
+        }
+    }
+
+    return found;
+}
+
+// Bounds of the bins on either side of the split
+static void SplitBounds(BVHBins *bins, BVHSplit *split, bool left,
+                        vec3 *min, vec3 *max, vec3 *centroid_min, vec3 *centroid_max)
+{
+    *min = *centroid_min = create_vec3(FLT_MAX, FLT_MAX, FLT_MAX);
+    *max = *centroid_max = create_vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+
+    u32 begin = left ? 0 : split->bin + 1;
+    u32 end = left ? split->bin + 1 : bins->bin_count;
+
+    for(u32 bin_index = begin; bin_index < end; bin_index++)
+    {
+        BVHBin *bin = &bins->bins[split->axis][bin_index];
+        if(!bin->count) continue;
+
+        *min = MinVec3(*min, bin->min);
+        *max = MaxVec3(*max, bin->max);
+        *centroid_min = MinVec3(*centroid_min, bin->centroid_min);
+        *centroid_max = MaxVec3(*centroid_max, bin->centroid_max);
+    }
+}
+
+// Either splits the node of 'task' and returns its children, or leaves it as a leaf and returns false
+static bool SplitTask(BVHBuildContext *context, BVHBuildTask *task, u32 *next_node,
+                      BVHBuildTask *children, bool bin_in_parallel)
+{
+    BVHNode *node = &context->nodes[task->node_index];
+    node->left_first = task->first;
+    node->primitive_count = task->count;
+
+    if(task->count == 1 || task->depth >= BVH_MAX_DEPTH - 1) return false;
+
+    BVHBins bins;
+    if(bin_in_parallel) BinPrimitivesParallel(context, task->first, task->count, task->centroid_min, task->centroid_max, &bins);
+    else                BinPrimitives(context, task->first, task->count, BinCount(task->count), task->centroid_min, task->centroid_max, &bins);
+
+    BVHSplit split;
+    bool found = FindBestSplit(&bins, task->centroid_min, task->centroid_max, &split);
+
+    f32 node_area = HalfArea(node->min, node->max);
+    f32 leaf_cost = node_area * task->count;
+    f32 split_cost = node_area * BVH_TRAVERSAL_COST + split.cost;
+
+    if(task->count <= BVH_MAX_LEAF_SIZE && (!found || split_cost >= leaf_cost)) return false;
+
+    u32 left_index = *next_node;
+    *next_node += 2;
+
+    BVHNode *left = &context->nodes[left_index];
+    BVHNode *right = &context->nodes[left_index + 1];
+    u32 left_count;
+
+    if(found)
+    {
+        // Same bin mapping as BinPrimitives, so the counts match the bins exactly
+        vec3 bin_scale = BinScale(task->centroid_min, task->centroid_max, bins.bin_count);
+        u32 *indices = context->primitive_indices;
+        u32 begin = task->first, end = task->first + task->count;
+
+        while(begin < end)
+        {
+            if(BinIndex(context->centroids[indices[begin]], task->centroid_min, bin_scale, split.axis, bins.bin_count) <= split.bin)
+            {
+                begin++;
+            }
+            else
+            {
+                end--;
+                u32 temp = indices[begin];
+                indices[begin] = indices[end];
+                indices[end] = temp;
+            }
+        }
+        left_count = begin - task->first;
+
+        SplitBounds(&bins, &split, true, &left->min, &left->max, &children[0].centroid_min, &children[0].centroid_max);
+        SplitBounds(&bins, &split, false, &right->min, &right->max, &children[1].centroid_min, &children[1].centroid_max);
+    }
+    else
+    {
+        // Every centroid is in the same spot, there is no plane that separates them
+        left_count = task->count / 2;
+
+        ComputeRangeBounds(context, task->first, left_count,
+                           &left->min, &left->max, &children[0].centroid_min, &children[0].centroid_max);
+        ComputeRangeBounds(context, task->first + left_count, task->count - left_count,
+                           &right->min, &right->max, &children[1].centroid_min, &children[1].centroid_max);
+    }
+
+    assert(left_count > 0 && left_count < task->count);
+
+    node->left_first = left_index;
+    node->primitive_count = 0;
+
+    children[0].node_index = left_index;
+    children[0].first = task->first;
+    children[0].count = left_count;
+    children[0].depth = task->depth + 1;
+
+    children[1].node_index = left_index + 1;
+    children[1].first = task->first + left_count;
+    children[1].count = task->count - left_count;
+    children[1].depth = task->depth + 1;
+
+    return true;
+}
+
+//----------------------
+// BUILDING
+//----------------------
+
+// Depth first, a subtree over n primitives allocates at most 2n - 2 nodes below its root
+static void BuildSubtree(BVHBuildContext *context, BVHBuildTask *root, u32 *next_node)
+{
+    // One pending right child per level
+    BVHBuildTask stack[BVH_MAX_DEPTH + 1];
+    u32 stack_count = 0;
+
+    stack[stack_count++] = *root;
+
+    while(stack_count)
+    {
+        BVHBuildTask task = stack[--stack_count];
+        BVHBuildTask children[2];
+
+        if(!SplitTask(context, &task, next_node, children, false)) continue;
+
+        stack[stack_count++] = children[1];
+        stack[stack_count++] = children[0];
+    }
+}
+
+typedef struct {
+    BVHBuildTask task;
+    u32 first_node; // Start of the node range reserved for it
+    u32 node_count; // Of that range actually used
+} BVHSubtree;
+
+typedef struct {
+    BVHBuildContext *context;
+
+    BVHSubtree *subtrees;
+    u32 subtree_count;
+    u32 volatile next_subtree;
+} BVHSubtreeJobs;
+
+static void BuildSubtreeJobs(WorkQueue *queue, void *data)
+{
+    BVHSubtreeJobs *shared = (BVHSubtreeJobs*)data;
+
+    for(;;)
+    {
+        u32 subtree_index = AtomicIncrement(&shared->next_subtree) - 1;
+        if(subtree_index >= shared->subtree_count) break;
+
+        BVHSubtree *subtree = &shared->subtrees[subtree_index];
+
+        u32 next_node = subtree->first_node;
+        BuildSubtree(shared->context, &subtree->task, &next_node);
+        subtree->node_count = next_node - subtree->first_node;
+    }
+}
+
+// Splits the top of the tree on this thread (binning the biggest nodes on all threads) until
+// the nodes are small enough to hand them out as subtrees. Returns the number of nodes used.
+static u32 BuildParallel(BVHBuildContext *context, BVHBuildTask *root, u32 primitive_count, u32 worker_count)
+{
+    u32 subtree_size = primitive_count / (4 * worker_count);
+    if(subtree_size < BVH_MIN_SUBTREE_SIZE) subtree_size = BVH_MIN_SUBTREE_SIZE;
+
+    // Every deferred subtree owns at least BVH_MIN_SUBTREE_SIZE primitives
+    u32 max_subtree_count = primitive_count / BVH_MIN_SUBTREE_SIZE + 1;
+    BVHSubtree *subtrees = (BVHSubtree*) ArenaAlloc16(context->scratch, max_subtree_count * sizeof(BVHSubtree));
+    u32 subtree_count = 0;
+
+    u32 next_node = 1;
+    u32 node_count = 1;
+
+    BVHBuildTask stack[BVH_MAX_DEPTH + 1];
+    u32 stack_count = 0;
+
+    stack[stack_count++] = *root;
+
+    while(stack_count)
+    {
+        BVHBuildTask task = stack[--stack_count];
+
+        if(task.count < BVH_MIN_SUBTREE_SIZE)
+        {
+            u32 first_node = next_node;
+            BuildSubtree(context, &task, &next_node);
+            node_count += next_node - first_node;
+            continue;
+        }
+
+        if(task.count <= subtree_size)
+        {
+            assert(subtree_count < max_subtree_count);
+
+            BVHSubtree *subtree = &subtrees[subtree_count++];
+            subtree->task = task;
+            subtree->first_node = next_node;
+            subtree->node_count = 0;
+
+            next_node += 2 * task.count - 2;
+            continue;
+        }
+
+        BVHBuildTask children[2];
+        if(!SplitTask(context, &task, &next_node, children, task.count >= BVH_PARALLEL_BIN_MIN)) continue;
+
+        node_count += 2;
+        stack[stack_count++] = children[1];
+        stack[stack_count++] = children[0];
+    }
+
+    // Bin jobs are all done, so the queue only holds subtree builders from here on
+    BVHSubtreeJobs shared = {0};
+    shared.context = context;
+    shared.subtrees = subtrees;
+    shared.subtree_count = subtree_count;
+
+    if(subtree_count)
+    {
+        u32 job_count = (worker_count < subtree_count) ? worker_count : subtree_count;
+
+        for(u32 job_index = 0; job_index < job_count; job_index++)
+            AddWorkEntry(&work_queue, BuildSubtreeJobs, &shared);
+
+        CompleteAllWork(&work_queue);
+    }
+
+    for(u32 subtree_index = 0; subtree_index < subtree_count; subtree_index++)
+        node_count += subtrees[subtree_index].node_count;
+
+    return node_count;
+}
+
+// Copies the reachable nodes depth first, every child pair right after the other,
+// which drops the gaps the subtree jobs left in their reserved ranges
+static u32 FlattenNodes(BVHNode *source, BVHNode *dest)
+{
+    u32 source_stack[BVH_MAX_DEPTH + 2];
+    u32 dest_stack[BVH_MAX_DEPTH + 2];
+    u32 stack_count = 0;
+
+    dest[0] = source[0];
+    u32 node_count = 1;
+
+    source_stack[stack_count] = 0;
+    dest_stack[stack_count] = 0;
+    stack_count++;
+
+    while(stack_count)
+    {
+        stack_count--;
+        BVHNode *node = &source[source_stack[stack_count]];
+        u32 dest_index = dest_stack[stack_count];
+
+        if(node->primitive_count) continue;
+
+        u32 left_index = node_count;
+        node_count += 2;
+
+        dest[left_index] = source[node->left_first];
+        dest[left_index + 1] = source[node->left_first + 1];
+        dest[dest_index].left_first = left_index;
+
+        source_stack[stack_count] = node->left_first + 1;
+        dest_stack[stack_count] = left_index + 1;
+        stack_count++;
+
+        source_stack[stack_count] = node->left_first;
+        dest_stack[stack_count] = left_index;
+        stack_count++;
+    }
+
+    return node_count;
+}
+
+void BuildBVH(ArenaMemory *memory, ArenaMemory *scratch,
+              vec3 *primitive_min, vec3 *primitive_max, u32 primitive_count,
+              BVH *bvh)
+{
+    bvh->node_count = 0;
+    bvh->primitive_count = 0;
+    if(!primitive_count) return;
+
+    size_t scratch_mark = scratch->used;
+
+    BVHBuildContext context = {0};
+    context.scratch = scratch;
+    context.primitive_min = primitive_min;
+    context.primitive_max = primitive_max;
+    context.centroids = (vec3*) ArenaAlloc16(scratch, primitive_count * sizeof(vec3));
+
+    if(primitive_count > bvh->primitive_capacity)
+    {
+        bvh->primitive_indices = (u32*) ArenaAlloc16(memory, primitive_count * sizeof(u32));
+        bvh->primitive_capacity = primitive_count;
+    }
+    context.primitive_indices = bvh->primitive_indices;
+
+    // A binary tree with one primitive per leaf is the worst case
+    context.nodes = (BVHNode*) ArenaAlloc16(scratch, (2 * primitive_count - 1) * sizeof(BVHNode));
+
+    for(u32 primitive = 0; primitive < primitive_count; primitive++)
+    {
+        context.centroids[primitive] = add_vec3(primitive_min[primitive], primitive_max[primitive]);
+        context.primitive_indices[primitive] = primitive;
+    }
+
+    BVHBuildTask root = {0};
+    root.count = primitive_count;
+    ComputeRangeBounds(&context, 0, primitive_count,
+                       &context.nodes[0].min, &context.nodes[0].max, &root.centroid_min, &root.centroid_max);
+
+    u32 worker_count = work_queue.thread_count + 1;
+    u32 node_count;
+
+    if(worker_count > 1 && primitive_count >= BVH_PARALLEL_BUILD_MIN)
+    {
+        node_count = BuildParallel(&context, &root, primitive_count, worker_count);
+    }
+    else
+    {
+        node_count = 1;
+        BuildSubtree(&context, &root, &node_count);
+    }
+
+    if(node_count > bvh->node_capacity)
+    {
+        bvh->nodes = (BVHNode*) ArenaAlloc16(memory, node_count * sizeof(BVHNode));
+        bvh->node_capacity = node_count;
+    }
+    bvh->node_count = FlattenNodes(context.nodes, bvh->nodes);
+    assert(bvh->node_count == node_count);
+
+    bvh->primitive_count = primitive_count;
+
+    scratch->used = scratch_mark;
+}
+
+void RefitBVH(BVH *bvh, vec3 *primitive_min, vec3 *primitive_max)
+{
+    // Children come after their parent, so going backwards every child is done before its parent
+    for(u32 node_index = bvh->node_count; node_index-- > 0;)
+    {
+        BVHNode *node = &bvh->nodes[node_index];
+
+        if(node->primitive_count)
+        {
+            node->min = create_vec3(FLT_MAX, FLT_MAX, FLT_MAX);
+            node->max = create_vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+
+            for(u32 index = node->left_first; index < node->left_first + node->primitive_count; index++)
+            {
+                u32 primitive = bvh->primitive_indices[index];
+                node->min = MinVec3(node->min, primitive_min[primitive]);
+                node->max = MaxVec3(node->max, primitive_max[primitive]);
+            }
+        }
+        else
+        {
+            BVHNode *left = &bvh->nodes[node->left_first];
+            BVHNode *right = left + 1;
+
+            node->min = MinVec3(left->min, right->min);
+            node->max = MaxVec3(left->max, right->max);
+        }
+    }
+}
+
+void ComputeTriangleBounds(vec3 *positions, u32 position_stride,
+                           u32 *indices, u32 index_count,
+                           vec3 *triangle_min, vec3 *triangle_max)
+{
+    for(u32 triangle = 0; triangle < index_count / 3; triangle++)
+    {
+        vec3 p0 = POSITION(indices[triangle*3 + 0]);
+        vec3 p1 = POSITION(indices[triangle*3 + 1]);
+        vec3 p2 = POSITION(indices[triangle*3 + 2]);
+
+        triangle_min[triangle] = MinVec3(p0, MinVec3(p1, p2));
+        triangle_max[triangle] = MaxVec3(p0, MaxVec3(p1, p2));
+    }
+}
+
+void BuildTriangleBVH(ArenaMemory *memory, ArenaMemory *scratch,
+                      vec3 *positions, u32 position_stride,
+                      u32 *indices, u32 index_count,
+                      BVH *bvh)
+{
+    size_t scratch_mark = scratch->used;
+
+    u32 triangle_count = index_count / 3;
+    vec3 *triangle_min = (vec3*) ArenaAlloc16(scratch, triangle_count * sizeof(vec3));
+    vec3 *triangle_max = (vec3*) ArenaAlloc16(scratch, triangle_count * sizeof(vec3));
+
+    ComputeTriangleBounds(positions, position_stride, indices, index_count, triangle_min, triangle_max);
+    BuildBVH(memory, scratch, triangle_min, triangle_max, triangle_count, bvh);
+
+    scratch->used = scratch_mark;
+}
+
+void TransformBounds(mat4x4 transform, vec3 min, vec3 max, vec3 *result_min, vec3 *result_max)
+{
+    f32 *m = transform.matrix;
+
+    // Start at the translation and add the smaller/larger end of every rotated and scaled extent
+    *result_min = create_vec3(m[12], m[13], m[14]);
+    *result_max = *result_min;
+
+    for(u32 row = 0; row < 3; row++)
+    {
+        for(u32 column = 0; column < 3; column++)
+        {
+            f32 a = m[column*4 + row] * AXIS(min, column);
+            f32 b = m[column*4 + row] * AXIS(max, column);
+
+            AXIS(*result_min, row) += (a < b) ? a : b;
+            AXIS(*result_max, row) += (a < b) ? b : a;
+        }
+    }
+}
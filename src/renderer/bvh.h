@@ -0,0 +1,65 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "..\memory.h"
+#include "..\gfx_math.h"
+#include "..\defines.h"
+
+/*
+  Bounding volume hierarchy over a set of primitives that are only known by their AABBs,
+  e.g. the mesh instances of a scene or the triangles of a mesh.
+
+  Built top down with binned SAH (Wald, "On fast Construction of SAH-based Bounding Volume
+  Hierarchies"). The first splits bin in parallel, the subtrees below them are built as
+  separate jobs on the work queue.
+*/
+
+// 32 bytes, two nodes per cache line. The children of a node are always stored next to each
+// other and after their parent, so walking the nodes backwards visits children first.
+typedef struct {
+    vec3 min;
+    u32 left_first; // Interior: index of the left child, the right one follows it. Leaf: first entry in 'primitive_indices'
+    vec3 max;
+    u32 primitive_count; // 0 for interior nodes
+} BVHNode;
+
+typedef struct {
+    BVHNode *nodes; // The root is nodes[0]
+    u32 node_count;
+
+    u32 *primitive_indices; // Leaves reference contiguous ranges of this
+    u32 primitive_count;
+
+    // Room in 'nodes' and 'primitive_indices', a rebuild only allocates them again when it needs more
+    u32 node_capacity;
+    u32 primitive_capacity;
+} BVH;
+
+#define BVH_MAX_DEPTH 64
+
+// Leaves hold at most this many primitives, smaller ones only when splitting does not pay off
+#define BVH_MAX_LEAF_SIZE 8
+
+// 'primitive_min'/'primitive_max' are the bounds of every primitive, the BVH refers to them by index.
+// 'bvh' has to be zeroed or hold an earlier build, whose storage is reused when it is large enough.
+void BuildBVH(ArenaMemory *memory, ArenaMemory *scratch,
+              vec3 *primitive_min, vec3 *primitive_max, u32 primitive_count,
+              BVH *bvh);
+
+// Same topology, new bounds. Much cheaper than a rebuild but the tree degrades when primitives move far.
+void RefitBVH(BVH *bvh, vec3 *primitive_min, vec3 *primitive_max);
+
+// One primitive per triangle, in the order they appear in 'indices'
+void ComputeTriangleBounds(vec3 *positions, u32 position_stride,
+                           u32 *indices, u32 index_count,
+                           vec3 *triangle_min, vec3 *triangle_max);
+
+void BuildTriangleBVH(ArenaMemory *memory, ArenaMemory *scratch,
+                      vec3 *positions, u32 position_stride,
+                      u32 *indices, u32 index_count,
+                      BVH *bvh);
+
+// World space bounds of a box placed with 'transform' (Arvo, "Transforming Axis-Aligned Bounding Boxes")
+void TransformBounds(mat4x4 transform, vec3 min, vec3 max, vec3 *result_min, vec3 *result_max);
+
+#endif
@@ -0,0 +1,300 @@
+#include <stdio.h> // FILE, printf
+#include <string.h> // memcpy, memset, strlen, strncmp
+
+#include "cooked.h"
+
+#define COOKED_ALIGNMENT 16
+
+static const char *assets_prefix = "assets\\";
+static const char *cooked_prefix = "cooked\\";
+
+bool CookedPathFromSource(char *dest, size_t dest_size, char *source_path, char *extension)
+{
+    size_t prefix_length = strlen(assets_prefix);
+    if(strncmp(source_path, assets_prefix, prefix_length)) return false;
+
+    size_t length = strlen(cooked_prefix) + strlen(source_path + prefix_length) + strlen(extension);
+    if(length >= dest_size) return false;
+
+    strcpy(dest, cooked_prefix);
+    strcat(dest, source_path + prefix_length);
+    strcat(dest, extension);
+
+    return true;
+}
+
+//----------------------
+// WRITING
+//----------------------
+
+// Writes a section and pads the file so the next one starts aligned
+static bool WriteSection(FILE *fp, void *data, size_t size, size_t *offset)
+{
+    static const u8 zeros[COOKED_ALIGNMENT] = {0};
+
+    if(size && fwrite(data, 1, size, fp) != size) return false;
+    *offset += size;
+
+    size_t padding = (COOKED_ALIGNMENT - (*offset % COOKED_ALIGNMENT)) % COOKED_ALIGNMENT;
+    if(padding && fwrite(zeros, 1, padding, fp) != padding) return false;
+    *offset += padding;
+
+    return true;
+}
+
+bool WriteCookedModel(char *path, ModelData *model)
+{
+    FILE *fp = fopen(path, "wb");
+    if(!fp)
+    {
+        printf("Could not open %s for writing\n", path);
+        return false;
+    }
+
+    CookedModelHeader header = {0};
+    header.magic = COOKED_MODEL_MAGIC;
+    header.version = COOKED_FORMAT_VERSION;
+    header.mesh_count = model->mesh_count;
+    header.material_count = model->material_count;
+    header.instance_count = model->instance_count;
+    header.dependency_count = model->dependency_count;
+
+    size_t offset = 0;
+    bool ok = WriteSection(fp, &header, sizeof(header), &offset);
+
+    for(u32 mesh_index = 0; ok && mesh_index < model->mesh_count; mesh_index++)
+    {
+        MeshData *mesh = &model->meshes[mesh_index];
+
+        CookedMeshHeader mesh_header = {0};
+        mesh_header.vertex_count = mesh->vertex_count;
+        mesh_header.index_count = mesh->index_count;
+        mesh_header.meshlet_count = mesh->meshlet_count;
+        mesh_header.material_index = mesh->material_index;
+        mesh_header.aabb_min = mesh->aabb_min;
+        mesh_header.aabb_max = mesh->aabb_max;
+        mesh_header.sphere_center = mesh->sphere_center;
+        mesh_header.sphere_radius = mesh->sphere_radius;
+        mesh_header.uv_density = mesh->uv_density;
+
+        ok = WriteSection(fp, &mesh_header, sizeof(mesh_header), &offset) &&
+             WriteSection(fp, mesh->vertices, mesh->vertex_count * sizeof(PackedVertex), &offset) &&
+             WriteSection(fp, mesh->indices, mesh->index_count * sizeof(u32), &offset) &&
+             WriteSection(fp, mesh->meshlets, mesh->meshlet_count * sizeof(Meshlet), &offset);
+    }
+
+    ok = ok &&
+        WriteSection(fp, model->materials, model->material_count * sizeof(MaterialData), &offset) &&
+        WriteSection(fp, model->instances, model->instance_count * sizeof(MeshInstance), &offset) &&
+        WriteSection(fp, model->dependencies, model->dependency_count * sizeof(model->dependencies[0]), &offset);
+
+    if(fclose(fp) != 0) ok = false;
+    if(!ok) printf("Could not write %s\n", path);
+
+    return ok;
+}
+
+bool WriteCookedTexture(char *path, u32 width, u32 height, u32 mip_count, u32 channels, u8 *mips)
+{
+    FILE *fp = fopen(path, "wb");
+    if(!fp)
+    {
+        printf("Could not open %s for writing\n", path);
+        return false;
+    }
+
+    CookedTextureHeader header = {0};
+    header.magic = COOKED_TEXTURE_MAGIC;
+    header.version = COOKED_FORMAT_VERSION;
+    header.width = width;
+    header.height = height;
+    header.mip_count = mip_count;
+    header.channels = channels;
+
+    size_t offset = 0;
+    bool ok = WriteSection(fp, &header, sizeof(header), &offset);
+
+    for(u32 mip = 0; ok && mip < mip_count; mip++)
+    {
+        size_t mip_size = (size_t)width * height * channels;
+
+        ok = WriteSection(fp, mips, mip_size, &offset);
+        mips += mip_size;
+
+        width = (width > 1) ? width / 2 : 1;
+        height = (height > 1) ? height / 2 : 1;
+    }
+
+    if(fclose(fp) != 0) ok = false;
+    if(!ok) printf("Could not write %s\n", path);
+
+    return ok;
+}
+
+//----------------------
+// READING
+//----------------------
+typedef struct {
+    u8 *data;
+    size_t size;
+    size_t offset;
+} CookedReader;
+
+// Returns a pointer to the next section inside the file, 0 when the file is too short
+static void *NextSection(CookedReader *reader, size_t size)
+{
+    if(size > reader->size - reader->offset) return 0;
+
+    void *result = reader->data + reader->offset;
+    reader->offset += size;
+    reader->offset += (COOKED_ALIGNMENT - (reader->offset % COOKED_ALIGNMENT)) % COOKED_ALIGNMENT;
+    if(reader->offset > reader->size) reader->offset = reader->size;
+
+    return result;
+}
+
+// Copies the next section into the arena
+static bool ReadSection(CookedReader *reader, ArenaMemory *memory, size_t size, void **dest)
+{
+    void *section = NextSection(reader, size);
+    if(!section) return false;
+
+    *dest = size ? ArenaAlloc16(memory, size) : 0;
+    if(size) memcpy(*dest, section, size);
+
+    return true;
+}
+
+bool ReadCookedModel(ArenaMemory *memory, char *path, ModelData *model)
+{
+    memset(model, 0, sizeof(ModelData));
+
+    MappedFile file;
+    if(!MapFileReadOnly(path, &file)) return false;
+
+    CookedReader reader = {file.data, file.size, 0};
+    CookedModelHeader *header = (CookedModelHeader*) NextSection(&reader, sizeof(CookedModelHeader));
+
+    if(!header || header->magic != COOKED_MODEL_MAGIC || header->version != COOKED_FORMAT_VERSION ||
+       header->dependency_count > MODEL_MAX_DEPENDENCIES)
+    {
+        printf("%s is not a cooked model of version %u, it needs to be recooked\n", path, COOKED_FORMAT_VERSION);
+        UnmapFile(&file);
+        return false;
+    }
+
+    // Restore the arena on failure so a fallback import starts from a clean slate
+    size_t memory_mark = memory->used;
+    bool ok = true;
+
+    model->mesh_count = header->mesh_count;
+    model->material_count = header->material_count;
+    model->instance_count = header->instance_count;
+    model->meshes = (MeshData*) ArenaAlloc16(memory, model->mesh_count * sizeof(MeshData));
+
+    for(u32 mesh_index = 0; ok && mesh_index < model->mesh_count; mesh_index++)
+    {
+        MeshData *mesh = &model->meshes[mesh_index];
+        memset(mesh, 0, sizeof(MeshData));
+
+        CookedMeshHeader *mesh_header = (CookedMeshHeader*) NextSection(&reader, sizeof(CookedMeshHeader));
+        if(!mesh_header)
+        {
+            ok = false;
+            break;
+        }
+
+        mesh->vertex_count = mesh_header->vertex_count;
+        mesh->index_count = mesh_header->index_count;
+        mesh->meshlet_count = mesh_header->meshlet_count;
+        mesh->material_index = mesh_header->material_index;
+        mesh->aabb_min = mesh_header->aabb_min;
+        mesh->aabb_max = mesh_header->aabb_max;
+        mesh->sphere_center = mesh_header->sphere_center;
+        mesh->sphere_radius = mesh_header->sphere_radius;
+        mesh->uv_density = mesh_header->uv_density;
+
+        ok = ReadSection(&reader, memory, mesh->vertex_count * sizeof(PackedVertex), (void**)&mesh->vertices) &&
+             ReadSection(&reader, memory, mesh->index_count * sizeof(u32), (void**)&mesh->indices) &&
+             ReadSection(&reader, memory, mesh->meshlet_count * sizeof(Meshlet), (void**)&mesh->meshlets);
+
+        if(ok && mesh->material_index >= model->material_count) ok = false;
+    }
+
+    ok = ok &&
+        ReadSection(&reader, memory, model->material_count * sizeof(MaterialData), (void**)&model->materials) &&
+        ReadSection(&reader, memory, model->instance_count * sizeof(MeshInstance), (void**)&model->instances);
+
+    for(u32 instance_index = 0; ok && instance_index < model->instance_count; instance_index++)
+    {
+        if(model->instances[instance_index].mesh_index >= model->mesh_count) ok = false;
+    }
+
+    // Fixed size paths, copied straight into the model
+    u8 *dependencies = ok ? (u8*) NextSection(&reader, header->dependency_count * sizeof(model->dependencies[0])) : 0;
+    if(dependencies)
+    {
+        model->dependency_count = header->dependency_count;
+        memcpy(model->dependencies, dependencies, model->dependency_count * sizeof(model->dependencies[0]));
+    }
+    else ok = false;
+
+    UnmapFile(&file);
+
+    if(!ok)
+    {
+        printf("Cooked model %s is truncated or corrupt, it needs to be recooked\n", path);
+        memory->used = memory_mark;
+        memset(model, 0, sizeof(ModelData));
+    }
+
+    return ok;
+}
+
+bool OpenCookedTexture(char *path, CookedTexture *texture)
+{
+    memset(texture, 0, sizeof(CookedTexture));
+
+    if(!MapFileReadOnly(path, &texture->file)) return false;
+
+    CookedReader reader = {texture->file.data, texture->file.size, 0};
+    CookedTextureHeader *header = (CookedTextureHeader*) NextSection(&reader, sizeof(CookedTextureHeader));
+
+    bool ok = header &&
+        header->magic == COOKED_TEXTURE_MAGIC &&
+        header->version == COOKED_FORMAT_VERSION &&
+        header->mip_count > 0 && header->mip_count <= ArrayCount(texture->mips) &&
+        header->channels == 4; // Uploaded as GL_RGBA, anything else would read past the levels
+
+    u32 width = ok ? header->width : 0;
+    u32 height = ok ? header->height : 0;
+
+    for(u32 mip = 0; ok && mip < header->mip_count; mip++)
+    {
+        texture->mips[mip] = (u8*) NextSection(&reader, (size_t)width * height * header->channels);
+        texture->mip_widths[mip] = width;
+        texture->mip_heights[mip] = height;
+
+        if(!texture->mips[mip]) ok = false;
+
+        width = (width > 1) ? width / 2 : 1;
+        height = (height > 1) ? height / 2 : 1;
+    }
+
+    if(!ok)
+    {
+        printf("%s is not a valid cooked texture of version %u\n", path, COOKED_FORMAT_VERSION);
+        CloseCookedTexture(texture);
+        return false;
+    }
+
+    texture->header = header;
+
+    return true;
+}
+
+void CloseCookedTexture(CookedTexture *texture)
+{
+    UnmapFile(&texture->file);
+    texture->header = 0;
+}
@@ -0,0 +1,83 @@
+#ifndef COOKED_H
+#define COOKED_H
+
+#include <stdbool.h>
+
+#include "model_import.h"
+#include "..\platform.h"
+#include "..\memory.h"
+#include "..\defines.h"
+
+/*
+  Binary formats written by the cooker (src\cook) and read by the renderer.
+  Cooked files live in cooked\ and mirror the layout of assets\, with an extra
+  extension: assets\sponza\sponza.obj -> cooked\sponza\sponza.obj.model
+
+  Model:   CookedModelHeader, then per mesh a CookedMeshHeader followed by its
+           vertices, indices and meshlets, then the materials, instances and
+           the paths of the other source files the model was imported from.
+  Texture: CookedTextureHeader, then every mip level from largest to smallest.
+
+  Every section starts 16 byte aligned.
+*/
+
+#define COOKED_MODEL_MAGIC   0x4C444F4D // "MODL"
+#define COOKED_TEXTURE_MAGIC 0x58455443 // "CTEX"
+
+// Bump whenever one of the layouts below or the data they point at changes
+#define COOKED_FORMAT_VERSION 5
+
+#define COOKED_MODEL_EXTENSION ".model"
+#define COOKED_TEXTURE_EXTENSION ".tex"
+
+typedef struct {
+    u32 magic;
+    u32 version;
+
+    u32 mesh_count;
+    u32 material_count;
+    u32 instance_count;
+    u32 dependency_count;
+} CookedModelHeader;
+
+typedef struct {
+    u32 vertex_count, index_count;
+    u32 meshlet_count;
+    u32 material_index;
+
+    vec3 aabb_min, aabb_max;
+    vec3 sphere_center;
+    f32 sphere_radius;
+    f32 uv_density;
+} CookedMeshHeader;
+
+typedef struct {
+    u32 magic;
+    u32 version;
+
+    u32 width, height; // Of mip 0
+    u32 mip_count;
+    u32 channels; // Always RGBA8 for now
+} CookedTextureHeader;
+
+// A cooked texture mapped into memory, the mips point into the mapping
+typedef struct {
+    CookedTextureHeader *header;
+    u8 *mips[32];
+    u32 mip_widths[32], mip_heights[32];
+
+    MappedFile file;
+} CookedTexture;
+
+// "assets\x\y.png" -> "cooked\x\y.png.tex", false when the source is not inside the assets folder
+bool CookedPathFromSource(char *dest, size_t dest_size, char *source_path, char *extension);
+
+bool WriteCookedModel(char *path, ModelData *model);
+bool ReadCookedModel(ArenaMemory *memory, char *path, ModelData *model);
+
+// 'mips' holds all levels back to back, 'channels' bytes per texel
+bool WriteCookedTexture(char *path, u32 width, u32 height, u32 mip_count, u32 channels, u8 *mips);
+bool OpenCookedTexture(char *path, CookedTexture *texture);
+void CloseCookedTexture(CookedTexture *texture);
+
+#endif
@@ -0,0 +1,183 @@
+#include <immintrin.h>
+
+#include "culling.h"
+#include "..\platform.h"
+
+/*
+  Gribb & Hartmann, "Fast Extraction of Viewing Frustum Planes from the World-View-Projection Matrix".
+  Matrices are column-major, so row i is (m[i], m[4+i], m[8+i], m[12+i])
+*/
+Frustum ExtractFrustumPlanes(mat4x4 vp)
+{
+    Frustum result;
+    f32 *m = vp.matrix;
+
+    vec4 row0 = create_vec4(m[0], m[4], m[8],  m[12]);
+    vec4 row1 = create_vec4(m[1], m[5], m[9],  m[13]);
+    vec4 row2 = create_vec4(m[2], m[6], m[10], m[14]);
+    vec4 row3 = create_vec4(m[3], m[7], m[11], m[15]);
+
+    result.planes[0] = add_vec4(row3, row0); // Left
+    result.planes[1] = sub_vec4(row3, row0); // Right
+    result.planes[2] = add_vec4(row3, row1); // Bottom
+    result.planes[3] = sub_vec4(row3, row1); // Top
+    result.planes[4] = add_vec4(row3, row2); // Near
+    result.planes[5] = sub_vec4(row3, row2); // Far
+
+    // Normalize so that sphere tests can compare against the radius
+    for(u32 plane_index = 0; plane_index < 6; plane_index++)
+    {
+        vec4 p = result.planes[plane_index];
+        f32 length = length_vec3(create_vec3(p.x, p.y, p.z));
+        result.planes[plane_index] = scale_vec4(p, 1.0f / length);
+    }
+
+    return result;
+}
+
+bool SphereInFrustum(Frustum *frustum, vec3 center, f32 radius)
+{
+    for(u32 plane_index = 0; plane_index < 6; plane_index++)
+    {
+        vec4 p = frustum->planes[plane_index];
+        if(p.x*center.x + p.y*center.y + p.z*center.z + p.w < -radius)
+            return false;
+    }
+
+    return true;
+}
+
+// Conservative, only tests the corner that is furthest along each plane normal
+bool AABBInFrustum(Frustum *frustum, vec3 min, vec3 max)
+{
+    for(u32 plane_index = 0; plane_index < 6; plane_index++)
+    {
+        vec4 p = frustum->planes[plane_index];
+
+        f32 x = (p.x >= 0.0f) ? max.x : min.x;
+        f32 y = (p.y >= 0.0f) ? max.y : min.y;
+        f32 z = (p.z >= 0.0f) ? max.z : min.z;
+
+        if(p.x*x + p.y*y + p.z*z + p.w < 0.0f)
+            return false;
+    }
+
+    return true;
+}
+
+bool ConeBackfacing(vec3 cone_apex, vec3 cone_axis, f32 cone_cutoff, vec3 eye)
+{
+    vec3 view = normalize_vec3(sub_vec3(cone_apex, eye));
+    return dot_vec3(view, cone_axis) >= cone_cutoff;
+}
+
+// Tests bounds [first, first + count), returns how many are visible
+static u32 CullBoundsRange(Frustum *frustum, CullBounds *bounds, u32 first, u32 count, u8 *visible)
+{
+    u32 visible_count = 0;
+    u32 index = first;
+    u32 end = first + count;
+
+#if CULLING_AVX
+    __m256 plane_x[6], plane_y[6], plane_z[6], plane_w[6];
+    for(u32 plane_index = 0; plane_index < 6; plane_index++)
+    {
+        plane_x[plane_index] = _mm256_set1_ps(frustum->planes[plane_index].x);
+        plane_y[plane_index] = _mm256_set1_ps(frustum->planes[plane_index].y);
+        plane_z[plane_index] = _mm256_set1_ps(frustum->planes[plane_index].z);
+        plane_w[plane_index] = _mm256_set1_ps(frustum->planes[plane_index].w);
+    }
+
+    for(; index + 8 <= end; index += 8)
+    {
+        __m256 x = _mm256_loadu_ps(&bounds->center_x[index]);
+        __m256 y = _mm256_loadu_ps(&bounds->center_y[index]);
+        __m256 z = _mm256_loadu_ps(&bounds->center_z[index]);
+        __m256 negative_radius = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(&bounds->radius[index]));
+
+        // All bits set in the lanes that are inside every plane so far
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for(u32 plane_index = 0; plane_index < 6; plane_index++)
+        {
+            __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(plane_x[plane_index], x),
+                                                          _mm256_mul_ps(plane_y[plane_index], y)),
+                                            _mm256_add_ps(_mm256_mul_ps(plane_z[plane_index], z), plane_w[plane_index]));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, negative_radius, _CMP_GE_OQ));
+        }
+
+        u32 mask = (u32)_mm256_movemask_ps(inside);
+        for(u32 lane = 0; lane < 8; lane++)
+        {
+            bool lane_visible = (mask >> lane) & 1;
+            if(lane_visible) lane_visible = AABBInFrustum(frustum, bounds->aabb_min[index + lane], bounds->aabb_max[index + lane]);
+
+            visible[index + lane] = lane_visible;
+            visible_count += lane_visible;
+        }
+    }
+#endif
+
+    for(; index < end; index++)
+    {
+        vec3 center = create_vec3(bounds->center_x[index], bounds->center_y[index], bounds->center_z[index]);
+
+        bool object_visible = SphereInFrustum(frustum, center, bounds->radius[index]) &&
+                              AABBInFrustum(frustum, bounds->aabb_min[index], bounds->aabb_max[index]);
+
+        visible[index] = object_visible;
+        visible_count += object_visible;
+    }
+
+    return visible_count;
+}
+
+typedef struct {
+    Frustum *frustum;
+    CullBounds *bounds;
+    u8 *visible;
+
+    u32 volatile next_batch;
+    u32 batch_count;
+    u32 volatile visible_count;
+} CullJob;
+
+// Every worker takes batches until none are left
+static void CullBatches(WorkQueue *queue, void *data)
+{
+    CullJob *job = (CullJob*)data;
+    u32 visible_count = 0;
+
+    for(;;)
+    {
+        u32 batch = AtomicIncrement(&job->next_batch) - 1;
+        if(batch >= job->batch_count) break;
+
+        u32 first = batch * CULL_BATCH_SIZE;
+        u32 count = (job->bounds->count - first < CULL_BATCH_SIZE) ? job->bounds->count - first : CULL_BATCH_SIZE;
+
+        visible_count += CullBoundsRange(job->frustum, job->bounds, first, count, job->visible);
+    }
+
+    AtomicAdd(&job->visible_count, visible_count);
+}
+
+u32 CullBoundsParallel(Frustum *frustum, CullBounds *bounds, u8 *visible)
+{
+    if(bounds->count < CULL_PARALLEL_MIN_COUNT)
+        return CullBoundsRange(frustum, bounds, 0, bounds->count, visible);
+
+    CullJob job = {0};
+    job.frustum = frustum;
+    job.bounds = bounds;
+    job.visible = visible;
+    job.batch_count = (bounds->count + CULL_BATCH_SIZE - 1) / CULL_BATCH_SIZE;
+
+    u32 worker_count = work_queue.thread_count + 1;
+    if(worker_count > job.batch_count) worker_count = job.batch_count;
+
+    for(u32 worker_index = 0; worker_index < worker_count; worker_index++)
+        AddWorkEntry(&work_queue, CullBatches, &job);
+    CompleteAllWork(&work_queue);
+
+    return job.visible_count;
+}
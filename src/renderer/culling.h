@@ -0,0 +1,48 @@
+#ifndef CULLING_H
+#define CULLING_H
+
+#include <stdbool.h>
+
+#include "..\gfx_math.h"
+#include "..\defines.h"
+
+// Planes point inwards: xyz is the normal, w the distance.
+// A point p is inside a plane when dot(xyz, p) + w >= 0
+typedef struct {
+    vec4 planes[6];
+} Frustum;
+
+Frustum ExtractFrustumPlanes(mat4x4 view_projection);
+
+bool SphereInFrustum(Frustum *frustum, vec3 center, f32 radius);
+bool AABBInFrustum(Frustum *frustum, vec3 min, vec3 max);
+bool ConeBackfacing(vec3 cone_apex, vec3 cone_axis, f32 cone_cutoff, vec3 eye);
+
+// Batches are tested with AVX, 8 spheres at a time, otherwise one by one
+#ifndef CULLING_AVX
+#define CULLING_AVX 1
+#endif
+
+// Objects are handed out to the threads in batches of this many
+#define CULL_BATCH_SIZE 256
+
+// Fewer objects are culled on the calling thread only, the work queue costs more than it saves
+#define CULL_PARALLEL_MIN_COUNT 1024
+
+// World space bounds of many objects, one array per component so a batch of spheres
+// loads straight into SIMD registers. The spheres are tested first, the AABBs only for
+// the objects whose sphere touches the frustum.
+typedef struct {
+    f32 *center_x, *center_y, *center_z;
+    f32 *radius;
+
+    vec3 *aabb_min, *aabb_max;
+    u32 count;
+} CullBounds;
+
+// Sets 'visible[i]' to 1 for every object that touches the frustum, 0 for the others, and
+// returns how many did. Spread over the work queue when there are enough objects.
+// @Note: Uses the work queue, so only the main thread may call this
+u32 CullBoundsParallel(Frustum *frustum, CullBounds *bounds, u8 *visible);
+
+#endif
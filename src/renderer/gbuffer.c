@@ -0,0 +1,108 @@
+#include <stdio.h> // printf
+#include <string.h> // memset
+
+#include "gbuffer.h"
+#include "shader_bank.h"
+#include "gl_state.h"
+
+static struct {
+    UniformHandle textures[GBUFFER_TEXTURE_COUNT];
+} uniforms;
+
+void InitGBuffer(GBuffer *gbuffer)
+{
+    memset(gbuffer, 0, sizeof(*gbuffer));
+
+    glCreateFramebuffers(1, &gbuffer->framebuffer);
+    glCreateFramebuffers(1, &gbuffer->light_framebuffer);
+    glCreateVertexArrays(1, &gbuffer->empty_vertex_array);
+
+    GLenum draw_buffers[3] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
+    glNamedFramebufferDrawBuffers(gbuffer->framebuffer, 3, draw_buffers);
+
+    uniforms.textures[0] = query_uniform("gbuffer_albedo_specular");
+    uniforms.textures[1] = query_uniform("gbuffer_normal_shininess");
+    uniforms.textures[2] = query_uniform("gbuffer_ambient");
+    uniforms.textures[3] = query_uniform("gbuffer_depth");
+}
+
+static GLuint CreateAttachment(GLenum format, s32 width, s32 height)
+{
+    // Read with texelFetch only
+    GLuint texture;
+    glCreateTextures(GL_TEXTURE_2D, 1, &texture);
+    glTextureStorage2D(texture, 1, format, width, height);
+    glTextureParameteri(texture, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTextureParameteri(texture, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    return texture;
+}
+
+void ResizeGBuffer(GBuffer *gbuffer, RenderTarget *scene)
+{
+    if(gbuffer->albedo_specular && gbuffer->width == scene->width && gbuffer->height == scene->height &&
+       gbuffer->scene_color == scene->color && gbuffer->scene_depth == scene->depth)
+    {
+        return;
+    }
+
+    if(gbuffer->albedo_specular)
+    {
+        GLuint textures[3] = { gbuffer->albedo_specular, gbuffer->normal_shininess, gbuffer->ambient };
+        for(u32 texture_index = 0; texture_index < 3; texture_index++) StateForgetTexture(textures[texture_index]);
+        glDeleteTextures(3, textures);
+    }
+
+    gbuffer->albedo_specular = CreateAttachment(GL_SRGB8_ALPHA8, scene->width, scene->height);
+    gbuffer->normal_shininess = CreateAttachment(GL_RGB10_A2, scene->width, scene->height);
+    gbuffer->ambient = CreateAttachment(GL_SRGB8_ALPHA8, scene->width, scene->height);
+
+    glNamedFramebufferTexture(gbuffer->framebuffer, GL_COLOR_ATTACHMENT0, gbuffer->albedo_specular, 0);
+    glNamedFramebufferTexture(gbuffer->framebuffer, GL_COLOR_ATTACHMENT1, gbuffer->normal_shininess, 0);
+    glNamedFramebufferTexture(gbuffer->framebuffer, GL_COLOR_ATTACHMENT2, gbuffer->ambient, 0);
+    glNamedFramebufferTexture(gbuffer->framebuffer, GL_DEPTH_ATTACHMENT, scene->depth, 0);
+    glNamedFramebufferTexture(gbuffer->light_framebuffer, GL_COLOR_ATTACHMENT0, scene->color, 0);
+
+    GLenum status = glCheckNamedFramebufferStatus(gbuffer->framebuffer, GL_FRAMEBUFFER);
+    if(status != GL_FRAMEBUFFER_COMPLETE) printf("G-buffer of %dx%d is incomplete: 0x%x\n", scene->width, scene->height, status);
+
+    status = glCheckNamedFramebufferStatus(gbuffer->light_framebuffer, GL_FRAMEBUFFER);
+    if(status != GL_FRAMEBUFFER_COMPLETE) printf("G-buffer lighting framebuffer is incomplete: 0x%x\n", status);
+
+    gbuffer->width = scene->width;
+    gbuffer->height = scene->height;
+    gbuffer->scene_color = scene->color;
+    gbuffer->scene_depth = scene->depth;
+}
+
+void BindGBuffer(GBuffer *gbuffer)
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, gbuffer->framebuffer);
+    glViewport(0, 0, gbuffer->width, gbuffer->height);
+
+    // The colors are written in linear and stored as sRGB, only then are they linear again when read
+    glEnable(GL_FRAMEBUFFER_SRGB);
+}
+
+void LightGBuffer(GBuffer *gbuffer)
+{
+    glDisable(GL_FRAMEBUFFER_SRGB);
+    glBindFramebuffer(GL_FRAMEBUFFER, gbuffer->light_framebuffer);
+    glViewport(0, 0, gbuffer->width, gbuffer->height);
+
+    // Constant, but a reloaded program starts over from the defaults
+    GLuint textures[GBUFFER_TEXTURE_COUNT] = { gbuffer->albedo_specular, gbuffer->normal_shininess, gbuffer->ambient, gbuffer->scene_depth };
+    for(u32 texture_index = 0; texture_index < GBUFFER_TEXTURE_COUNT; texture_index++)
+        set_int_handle(uniforms.textures[texture_index], GBUFFER_TEXTURE_UNIT + texture_index);
+    StateBindTextures(GBUFFER_TEXTURE_UNIT, GBUFFER_TEXTURE_COUNT, textures);
+
+    // Nothing to test against, and the triangle must not be culled whatever winding the last draw left
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_CULL_FACE);
+
+    StateBindVertexArray(gbuffer->empty_vertex_array);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    glEnable(GL_CULL_FACE);
+    glEnable(GL_DEPTH_TEST);
+}
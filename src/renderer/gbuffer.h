@@ -0,0 +1,62 @@
+#ifndef GBUFFER_H
+#define GBUFFER_H
+
+#include <stdbool.h>
+
+#include "glad/glad.h"
+#include "render_target.h"
+#include "shadow_atlas.h" // SHADOW_ATLAS_TEXTURE_UNIT
+#include "..\defines.h"
+
+/*
+  Deferred shading. The scene is drawn once into the G-buffer with the materials of the forward
+  path, and a triangle over the screen then lights every pixel once, with the lights of the
+  cluster it is in. Overdraw and the lights no longer multiply, a pixel under many overlapping
+  lights costs the same however many triangles were drawn over it.
+
+  12 bytes a pixel besides the depth:
+    albedo_specular   GL_SRGB8_ALPHA8  diffuse color, the average of the specular color in alpha
+    normal_shininess  GL_RGB10_A2      octahedral normal in xy, log2 of the shininess in z
+    ambient           GL_SRGB8_ALPHA8  ambient color
+
+  The depth is the one of the scene render target, positions are got back from it with the
+  inverse of the view projection, so the depth pre-pass and the pyramid of hiz.h work as before.
+  The specular color comes back as a grey of the same intensity.
+
+  The programs are default.glsl built with GBUFFER_PASS and with DEFERRED_LIGHTING.
+*/
+
+// The lighting pass reads the attachments from here on, in the order above and the depth last
+#define GBUFFER_TEXTURE_UNIT (SHADOW_ATLAS_TEXTURE_UNIT + 1)
+#define GBUFFER_TEXTURE_COUNT 4
+
+typedef struct {
+    GLuint framebuffer;       // The attachments and the depth of the scene, the scene is drawn into it
+    GLuint light_framebuffer; // Only the color of the scene, the lighting pass samples the depth
+
+    GLuint albedo_specular;
+    GLuint normal_shininess;
+    GLuint ambient;
+
+    GLuint empty_vertex_array; // The triangle of the lighting pass has no attributes
+
+    // Of the scene render target the textures were made for
+    s32 width, height;
+    GLuint scene_color, scene_depth;
+} GBuffer;
+
+void InitGBuffer(GBuffer *gbuffer);
+
+// Makes the attachments the size of 'scene' again and attaches its color and depth, when any
+// of them changed
+void ResizeGBuffer(GBuffer *gbuffer, RenderTarget *scene);
+
+// The scene is drawn into the G-buffer from now on. Nothing is cleared, the lighting pass only
+// reads pixels whose depth was written.
+void BindGBuffer(GBuffer *gbuffer);
+
+// Draws the triangle over the color of the scene with the program that is in use, the deferred
+// one. Binds the attachments to their units and leaves the depth state as the scene passes expect it.
+void LightGBuffer(GBuffer *gbuffer);
+
+#endif
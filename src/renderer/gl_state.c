@@ -0,0 +1,285 @@
+#include <assert.h>
+#include <stdint.h> // UINT32_MAX
+#include <string.h> // memcmp, memcpy, memset
+
+#include "gl_state.h"
+
+// Never a GL name in practice, the next bind is issued whatever it is
+#define UNKNOWN_NAME UINT32_MAX
+
+typedef enum {
+    BUFFER_SLOT_ARRAY,
+    BUFFER_SLOT_ELEMENT_ARRAY, // Part of the bound vertex array
+    BUFFER_SLOT_UNIFORM,
+    BUFFER_SLOT_SHADER_STORAGE,
+    BUFFER_SLOT_DRAW_INDIRECT,
+    BUFFER_SLOT_PIXEL_UNPACK,
+
+    BUFFER_SLOT_COUNT
+} BufferSlot;
+
+#define UNIFORM_TABLE_SIZE 2048
+#define UNIFORM_VALUE_SIZE (16 * sizeof(f32))
+
+typedef struct {
+    GLuint program; // 0 when empty
+    GLint location;
+    u32 size;
+    u8 value[UNIFORM_VALUE_SIZE];
+} CachedUniform;
+
+static GLuint program_bound = UNKNOWN_NAME;
+static GLuint vertex_array_bound = UNKNOWN_NAME;
+static u32 active_unit = UNKNOWN_NAME;
+static GLuint textures_bound[GL_STATE_TEXTURE_UNITS];
+static GLuint buffers_bound[BUFFER_SLOT_COUNT];
+// Size 0 is the whole buffer, bound with glBindBufferBase
+typedef struct {
+    GLuint buffer;
+    GLintptr offset;
+    GLsizeiptr size;
+} IndexedBinding;
+
+static IndexedBinding uniform_buffers_bound[GL_STATE_BUFFER_INDICES];
+static IndexedBinding storage_buffers_bound[GL_STATE_BUFFER_INDICES];
+
+// Open addressing on program and location. Reloaded shaders are new programs, the table
+// is emptied when it fills up with the old ones.
+static CachedUniform uniforms[UNIFORM_TABLE_SIZE];
+static u32 uniform_count;
+
+GLStateCounters gl_state_counters;
+
+// Whole frames are compared, so the counters only move forward in between
+void ResetGLStateCounters(void)
+{
+    memset(&gl_state_counters, 0, sizeof(gl_state_counters));
+}
+
+void InvalidateGLState(void)
+{
+    program_bound = UNKNOWN_NAME;
+    vertex_array_bound = UNKNOWN_NAME;
+    active_unit = UNKNOWN_NAME;
+
+    for(u32 unit = 0; unit < GL_STATE_TEXTURE_UNITS; unit++) textures_bound[unit] = UNKNOWN_NAME;
+    for(u32 slot = 0; slot < BUFFER_SLOT_COUNT; slot++) buffers_bound[slot] = UNKNOWN_NAME;
+
+    for(u32 index = 0; index < GL_STATE_BUFFER_INDICES; index++)
+    {
+        uniform_buffers_bound[index].buffer = UNKNOWN_NAME;
+        storage_buffers_bound[index].buffer = UNKNOWN_NAME;
+    }
+}
+
+// Increments the matching counter, true when the call has to be issued
+static bool Changes(GLCallCounter *counter, GLuint *cached, GLuint wanted)
+{
+    if(*cached == wanted)
+    {
+        counter->elided++;
+        return false;
+    }
+
+    *cached = wanted;
+    counter->issued++;
+    return true;
+}
+
+void StateUseProgram(GLuint program)
+{
+    if(Changes(&gl_state_counters.programs, &program_bound, program)) glUseProgram(program);
+}
+
+void StateBindVertexArray(GLuint vertex_array)
+{
+    if(Changes(&gl_state_counters.vertex_arrays, &vertex_array_bound, vertex_array))
+    {
+        glBindVertexArray(vertex_array);
+
+        // Whatever the new vertex array had bound, we never saw it
+        buffers_bound[BUFFER_SLOT_ELEMENT_ARRAY] = UNKNOWN_NAME;
+    }
+}
+
+void StateActiveTexture(u32 unit)
+{
+    if(unit != active_unit)
+    {
+        active_unit = unit;
+        glActiveTexture(GL_TEXTURE0 + unit);
+    }
+}
+
+void StateBindTexture(GLenum target, GLuint texture)
+{
+    // A texture has one target for its lifetime, the same name is the same binding
+    if(active_unit >= GL_STATE_TEXTURE_UNITS)
+    {
+        gl_state_counters.textures.issued++;
+        glBindTexture(target, texture);
+    }
+    else if(Changes(&gl_state_counters.textures, &textures_bound[active_unit], texture))
+    {
+        glBindTexture(target, texture);
+    }
+}
+
+void StateBindTextures(u32 first, u32 count, GLuint *textures)
+{
+    assert(first + count <= GL_STATE_TEXTURE_UNITS);
+
+    bool changed = false;
+    for(u32 index = 0; index < count; index++)
+    {
+        if(textures_bound[first + index] != textures[index])
+        {
+            textures_bound[first + index] = textures[index];
+            changed = true;
+        }
+    }
+
+    if(changed)
+    {
+        gl_state_counters.textures.issued++;
+        glBindTextures(first, count, textures);
+    }
+    else gl_state_counters.textures.elided++;
+}
+
+static bool GetBufferSlot(GLenum target, BufferSlot *slot)
+{
+    switch(target)
+    {
+        case GL_ARRAY_BUFFER: *slot = BUFFER_SLOT_ARRAY; return true;
+        case GL_ELEMENT_ARRAY_BUFFER: *slot = BUFFER_SLOT_ELEMENT_ARRAY; return true;
+        case GL_UNIFORM_BUFFER: *slot = BUFFER_SLOT_UNIFORM; return true;
+        case GL_SHADER_STORAGE_BUFFER: *slot = BUFFER_SLOT_SHADER_STORAGE; return true;
+        case GL_DRAW_INDIRECT_BUFFER: *slot = BUFFER_SLOT_DRAW_INDIRECT; return true;
+        case GL_PIXEL_UNPACK_BUFFER: *slot = BUFFER_SLOT_PIXEL_UNPACK; return true;
+    }
+
+    return false;
+}
+
+void StateBindBuffer(GLenum target, GLuint buffer)
+{
+    BufferSlot slot;
+    if(!GetBufferSlot(target, &slot))
+    {
+        gl_state_counters.buffers.issued++;
+        glBindBuffer(target, buffer);
+    }
+    else if(Changes(&gl_state_counters.buffers, &buffers_bound[slot], buffer))
+    {
+        glBindBuffer(target, buffer);
+    }
+}
+
+void StateBindBufferRange(GLenum target, u32 index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+{
+    IndexedBinding *indexed = 0;
+    if(target == GL_UNIFORM_BUFFER) indexed = uniform_buffers_bound;
+    else if(target == GL_SHADER_STORAGE_BUFFER) indexed = storage_buffers_bound;
+
+    if(indexed && index < GL_STATE_BUFFER_INDICES)
+    {
+        IndexedBinding *binding = &indexed[index];
+        if(binding->buffer == buffer && binding->offset == offset && binding->size == size)
+        {
+            gl_state_counters.buffers.elided++;
+            return;
+        }
+
+        binding->buffer = buffer;
+        binding->offset = offset;
+        binding->size = size;
+    }
+
+    gl_state_counters.buffers.issued++;
+    if(size) glBindBufferRange(target, index, buffer, offset, size);
+    else glBindBufferBase(target, index, buffer);
+
+    BufferSlot slot;
+    if(GetBufferSlot(target, &slot)) buffers_bound[slot] = buffer;
+}
+
+void StateBindBufferBase(GLenum target, u32 index, GLuint buffer)
+{
+    StateBindBufferRange(target, index, buffer, 0, 0);
+}
+
+void StateForgetTexture(GLuint texture)
+{
+    for(u32 unit = 0; unit < GL_STATE_TEXTURE_UNITS; unit++)
+    {
+        if(textures_bound[unit] == texture) textures_bound[unit] = UNKNOWN_NAME;
+    }
+}
+
+void StateForgetBuffer(GLuint buffer)
+{
+    for(u32 slot = 0; slot < BUFFER_SLOT_COUNT; slot++)
+    {
+        if(buffers_bound[slot] == buffer) buffers_bound[slot] = UNKNOWN_NAME;
+    }
+
+    for(u32 index = 0; index < GL_STATE_BUFFER_INDICES; index++)
+    {
+        if(uniform_buffers_bound[index].buffer == buffer) uniform_buffers_bound[index].buffer = UNKNOWN_NAME;
+        if(storage_buffers_bound[index].buffer == buffer) storage_buffers_bound[index].buffer = UNKNOWN_NAME;
+    }
+}
+
+void StateForgetVertexArray(GLuint vertex_array)
+{
+    if(vertex_array_bound == vertex_array) vertex_array_bound = UNKNOWN_NAME;
+}
+
+bool StateUniformChanged(GLuint program, GLint location, void *value, u32 size)
+{
+    assert(program);
+
+    if(size > UNIFORM_VALUE_SIZE)
+    {
+        gl_state_counters.uniforms.issued++;
+        return true;
+    }
+
+    u32 probe = (program * 2654435761u ^ (u32)location * 40503u) & (UNIFORM_TABLE_SIZE - 1);
+    while(uniforms[probe].program &&
+          (uniforms[probe].program != program || uniforms[probe].location != location))
+    {
+        probe = (probe + 1) & (UNIFORM_TABLE_SIZE - 1);
+    }
+
+    CachedUniform *cached = &uniforms[probe];
+    if(cached->program && cached->size == size && !memcmp(cached->value, value, size))
+    {
+        gl_state_counters.uniforms.elided++;
+        return false;
+    }
+
+    if(!cached->program)
+    {
+        // Keep probes short, dropping everything only costs one call per uniform
+        if(uniform_count + 1 > UNIFORM_TABLE_SIZE * 3 / 4)
+        {
+            memset(uniforms, 0, sizeof(uniforms));
+            uniform_count = 0;
+
+            gl_state_counters.uniforms.issued++;
+            return true;
+        }
+
+        uniform_count++;
+        cached->program = program;
+        cached->location = location;
+    }
+
+    cached->size = size;
+    memcpy(cached->value, value, size);
+
+    gl_state_counters.uniforms.issued++;
+    return true;
+}
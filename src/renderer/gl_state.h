@@ -0,0 +1,65 @@
+#ifndef GL_STATE_H
+#define GL_STATE_H
+
+#include <stdbool.h>
+
+#include "glad/glad.h"
+#include "..\defines.h"
+
+/*
+  Shadow copy of the GL state the renderer touches. Binds and uniform updates go through
+  here and are only sent to the driver when they change something. Anything that binds
+  directly with gl* calls must call InvalidateGLState afterwards, the cache would be lying
+  otherwise.
+*/
+
+#define GL_STATE_TEXTURE_UNITS 32
+#define GL_STATE_BUFFER_INDICES 16 // Per indexed target, uniform and shader storage
+
+typedef struct {
+    u32 issued; // Sent to the driver
+    u32 elided; // Dropped, the state was already set
+} GLCallCounter;
+
+// Counters of the current frame, reset by ResetGLStateCounters
+typedef struct {
+    GLCallCounter programs;
+    GLCallCounter vertex_arrays;
+    GLCallCounter textures;
+    GLCallCounter buffers;
+    GLCallCounter uniforms;
+} GLStateCounters;
+
+extern GLStateCounters gl_state_counters;
+
+void ResetGLStateCounters(void);
+
+// Forgets everything, the next call of each kind is always issued
+void InvalidateGLState(void);
+
+void StateUseProgram(GLuint program);
+void StateBindVertexArray(GLuint vertex_array);
+
+// On the active unit, like glBindTexture
+void StateActiveTexture(u32 unit);
+void StateBindTexture(GLenum target, GLuint texture);
+
+// Units 'first' to 'first' + 'count', like glBindTextures. One call when any of them differ.
+void StateBindTextures(u32 first, u32 count, GLuint *textures);
+
+void StateBindBuffer(GLenum target, GLuint buffer);
+
+// Like glBindBufferBase and glBindBufferRange, which also bind the buffer to the generic target
+void StateBindBufferBase(GLenum target, u32 index, GLuint buffer);
+void StateBindBufferRange(GLenum target, u32 index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+
+// Deleted names go back to 0 in GL and get handed out again, the cache has to follow
+void StateForgetTexture(GLuint texture);
+void StateForgetBuffer(GLuint buffer);
+void StateForgetVertexArray(GLuint vertex_array);
+
+// True when 'value' differs from what was last set at the location of the program, and
+// remembers it. Values larger than a mat4 are never cached.
+bool StateUniformChanged(GLuint program, GLint location, void *value, u32 size);
+
+#endif
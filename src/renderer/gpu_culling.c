@@ -0,0 +1,181 @@
+#include <assert.h>
+#include <stdio.h> // snprintf
+#include <string.h> // memset
+
+#include "gpu_culling.h"
+#include "shader_bank.h"
+#include "gl_state.h"
+#include "render_queue.h" // DrawElementsIndirectCommand, SetFaceCullMode
+
+StaticAssert(GPU_CULL_LISTS == 2 * FACE_CULL_MODE_COUNT);
+
+GPUCullStats gpu_cull_stats;
+extern ShaderBank shaders;
+
+static struct {
+    UniformHandle instance_count, instance_capacity, frustum_planes[6], phase, hiz_enabled;
+    UniformHandle pyramid, cull_view_projection, depth_size, level_count;
+} uniforms;
+
+void InitGPUCulling(GPUCulling *culling)
+{
+    memset(culling, 0, sizeof(*culling));
+
+    culling->program = query_program_index("gpu_cull");
+
+    uniforms.instance_count = query_uniform("instance_count");
+    uniforms.instance_capacity = query_uniform("instance_capacity");
+    for(u32 plane_index = 0; plane_index < 6; plane_index++)
+    {
+        char plane_name[32];
+        snprintf(plane_name, sizeof(plane_name), "frustum_planes[%u]", plane_index);
+        uniforms.frustum_planes[plane_index] = query_uniform(plane_name);
+    }
+    uniforms.phase = query_uniform("phase");
+    uniforms.hiz_enabled = query_uniform("hiz_enabled");
+    uniforms.pyramid = query_uniform("pyramid");
+    uniforms.cull_view_projection = query_uniform("cull_view_projection");
+    uniforms.depth_size = query_uniform("depth_size");
+    uniforms.level_count = query_uniform("level_count");
+
+    glCreateBuffers(1, &culling->instances);
+    glCreateBuffers(1, &culling->draws);
+    glCreateBuffers(1, &culling->pending);
+    glCreateBuffers(1, &culling->commands);
+
+    // Only ever written by the GPU, cleared at the start of the frame
+    glCreateBuffers(1, &culling->counters);
+    glNamedBufferData(culling->counters, sizeof(GPUCullCounters), 0, GL_DYNAMIC_COPY);
+
+    u32 zero = 0;
+    glClearNamedBufferData(culling->counters, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+
+    GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glCreateBuffers(1, &culling->readback);
+    glNamedBufferStorage(culling->readback, GPU_CULL_READBACK_SLOTS * sizeof(GPUCullCounters), 0, flags);
+    culling->readback_mapped = (GPUCullCounters*) glMapNamedBufferRange(culling->readback, 0, GPU_CULL_READBACK_SLOTS * sizeof(GPUCullCounters), flags);
+    assert(culling->readback_mapped);
+}
+
+void UploadGPUCullInstances(GPUCulling *culling, GPUCullInstance *instances, DrawBlock *draws, u32 count)
+{
+    culling->instance_count = count;
+    if(!count) return;
+
+    // Only changes when models load or reload, a new store is fine
+    if(count > culling->instance_capacity)
+    {
+        glNamedBufferData(culling->instances, count * sizeof(GPUCullInstance), instances, GL_STATIC_DRAW);
+        glNamedBufferData(culling->draws, count * sizeof(DrawBlock), draws, GL_STATIC_DRAW);
+        glNamedBufferData(culling->pending, count * sizeof(u32), 0, GL_DYNAMIC_COPY);
+        glNamedBufferData(culling->commands, GPU_CULL_LISTS * count * sizeof(DrawElementsIndirectCommand), 0, GL_DYNAMIC_COPY);
+        culling->instance_capacity = count;
+    }
+    else
+    {
+        glNamedBufferSubData(culling->instances, 0, count * sizeof(GPUCullInstance), instances);
+        glNamedBufferSubData(culling->draws, 0, count * sizeof(DrawBlock), draws);
+    }
+}
+
+// The counters of the last frame go into the next slot, after the ones of GPU_CULL_READBACK_SLOTS frames ago are read
+static void ReadBackCounters(GPUCulling *culling)
+{
+    culling->readback_slot = (culling->readback_slot + 1) % GPU_CULL_READBACK_SLOTS;
+
+    GLsync fence = culling->readback_fences[culling->readback_slot];
+    if(fence)
+    {
+        // Signaled frames ago unless the CPU is far ahead of the GPU
+        while(glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED);
+        glDeleteSync(fence);
+
+        GPUCullCounters *counters = &culling->readback_mapped[culling->readback_slot];
+        gpu_cull_stats.drawn_first = gpu_cull_stats.drawn_second = 0;
+        for(u32 face_cull = 0; face_cull < FACE_CULL_MODE_COUNT; face_cull++)
+        {
+            gpu_cull_stats.drawn_first += counters->draw_counts[face_cull];
+            gpu_cull_stats.drawn_second += counters->draw_counts[FACE_CULL_MODE_COUNT + face_cull];
+        }
+        gpu_cull_stats.frustum_culled = counters->frustum_culled;
+        gpu_cull_stats.occluded = counters->occluded;
+        gpu_cull_stats.instances = culling->instance_count;
+    }
+
+    // The shader wrote them, the copy reads them
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    glCopyNamedBufferSubData(culling->counters, culling->readback, 0,
+                             culling->readback_slot * sizeof(GPUCullCounters), sizeof(GPUCullCounters));
+
+    glMemoryBarrier(GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT);
+    culling->readback_fences[culling->readback_slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void CullInstancesGPU(GPUCulling *culling, GPUCullPhase phase, Frustum *frustum, HiZ *hiz)
+{
+    if(!culling->instance_count || !shaders.programs[culling->program]) return;
+
+    bool hiz_enabled = hiz && hiz->valid;
+    if(phase == GPU_CULL_PHASE_FIRST)
+    {
+        ReadBackCounters(culling);
+
+        u32 zero = 0;
+        glClearNamedBufferData(culling->counters, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+
+        culling->hiz_tested = hiz_enabled;
+    }
+    else if(!culling->hiz_tested) return; // Nothing was left for it
+
+    use_program_index(culling->program);
+    set_int_handle(uniforms.instance_count, culling->instance_count);
+    set_int_handle(uniforms.instance_capacity, culling->instance_capacity);
+    for(u32 plane_index = 0; plane_index < 6; plane_index++)
+        set_vec4f_handle(uniforms.frustum_planes[plane_index], frustum->planes[plane_index]);
+    set_int_handle(uniforms.phase, phase);
+    set_int_handle(uniforms.hiz_enabled, hiz_enabled);
+
+    if(hiz_enabled)
+    {
+        set_int_handle(uniforms.pyramid, HIZ_TEXTURE_UNIT);
+        set_mat4f_handle(uniforms.cull_view_projection, hiz->view_projection.matrix);
+        set_ivec2_handle(uniforms.depth_size, hiz->depth_width, hiz->depth_height);
+        set_int_handle(uniforms.level_count, hiz->level_count);
+
+        StateActiveTexture(HIZ_TEXTURE_UNIT);
+        StateBindTexture(GL_TEXTURE_2D, hiz->pyramid);
+    }
+
+    StateBindBufferBase(GL_SHADER_STORAGE_BUFFER, GPU_CULL_INSTANCE_BINDING, culling->instances);
+    StateBindBufferBase(GL_SHADER_STORAGE_BUFFER, GPU_CULL_PENDING_BINDING, culling->pending);
+    StateBindBufferBase(GL_SHADER_STORAGE_BUFFER, GPU_CULL_COMMAND_BINDING, culling->commands);
+    StateBindBufferBase(GL_SHADER_STORAGE_BUFFER, GPU_CULL_COUNTER_BINDING, culling->counters);
+
+    glDispatchCompute((culling->instance_count + 63) / 64, 1, 1);
+
+    // The commands and their counts are read by the draws, the pending flags by the second phase
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+u32 DrawCulledInstances(GPUCulling *culling, GPUCullPhase phase, u32 index_type)
+{
+    if(!culling->instance_count || !shaders.programs[culling->program]) return 0;
+    if(phase == GPU_CULL_PHASE_SECOND && !culling->hiz_tested) return 0;
+
+    StateBindBuffer(GL_DRAW_INDIRECT_BUFFER, culling->commands);
+    StateBindBuffer(GL_PARAMETER_BUFFER, culling->counters);
+    StateBindBufferBase(GL_SHADER_STORAGE_BUFFER, DRAW_STORAGE_BINDING, culling->draws);
+
+    for(u32 face_cull = 0; face_cull < FACE_CULL_MODE_COUNT; face_cull++)
+    {
+        u32 list = phase * FACE_CULL_MODE_COUNT + face_cull;
+
+        SetFaceCullMode((FaceCullMode) face_cull);
+        glMultiDrawElementsIndirectCount(GL_TRIANGLES, index_type,
+                                         (void*)(list * culling->instance_capacity * sizeof(DrawElementsIndirectCommand)),
+                                         list * sizeof(u32), culling->instance_capacity, 0);
+    }
+
+    SetFaceCullMode(FACE_CULL_BACK_CCW);
+    return FACE_CULL_MODE_COUNT;
+}
@@ -0,0 +1,108 @@
+#ifndef GPU_CULLING_H
+#define GPU_CULLING_H
+
+#include <stddef.h> // offsetof
+#include <stdbool.h>
+
+#include "glad/glad.h"
+#include "culling.h"
+#include "hiz.h"
+#include "uniform_blocks.h"
+#include "..\gfx_math.h"
+#include "..\defines.h"
+
+/*
+  GPU driven culling. The bounds and draw data of every instance stay on the GPU, a compute
+  shader (gpu_cull.glsl) tests all of them against the frustum and appends the visible ones
+  to indirect command lists with an atomic counter. The counters are the draw counts of
+  glMultiDrawElementsIndirectCount, so the CPU never sees a single instance per frame.
+
+  With a hierarchical-Z pyramid it runs in two phases like hiz.h: instances hidden behind
+  the pyramid of the last frame are kept for a second test against the pyramid of what the
+  first phase drew.
+
+  There is a list per phase and face cull mode (render_queue.h), every instance is drawn whole with the program of
+  the caller.
+*/
+
+#define GPU_CULL_INSTANCE_BINDING 4 // Shader storage, GPUCullInstance
+#define GPU_CULL_PENDING_BINDING 5  // Shader storage, a u32 per instance
+#define GPU_CULL_COMMAND_BINDING 6  // Shader storage, the indirect command lists
+#define GPU_CULL_COUNTER_BINDING 7  // Shader storage, GPUCullCounters
+
+// Phase times FACE_CULL_MODE_COUNT
+#define GPU_CULL_LISTS 6
+
+// Frames the counters are read back later
+#define GPU_CULL_READBACK_SLOTS 4
+
+typedef enum {
+    GPU_CULL_PHASE_FIRST,
+    GPU_CULL_PHASE_SECOND,
+} GPUCullPhase;
+
+// Mirrors CullInstance in gpu_cull.glsl (std430)
+typedef struct {
+    vec3 world_min; // Of the transformed mesh AABB
+    u32 index_count;
+    vec3 world_max;
+    u32 first_index; // In the shared index buffer of the model
+    s32 base_vertex;
+    u32 face_cull; // FaceCullMode
+    u32 padding[2];
+} GPUCullInstance;
+
+StaticAssert(offsetof(GPUCullInstance, world_max) == 16);
+StaticAssert(offsetof(GPUCullInstance, base_vertex) == 32);
+StaticAssert(sizeof(GPUCullInstance) == 48);
+
+// Mirrors Counters in gpu_cull.glsl
+typedef struct {
+    u32 draw_counts[GPU_CULL_LISTS];
+    u32 frustum_culled;
+    u32 occluded; // By the second phase
+} GPUCullCounters;
+
+// From GPU_CULL_READBACK_SLOTS frames ago
+typedef struct {
+    u32 instances;
+    u32 drawn_first, drawn_second;
+    u32 frustum_culled, occluded;
+} GPUCullStats;
+
+extern GPUCullStats gpu_cull_stats;
+
+typedef struct {
+    GLuint instances; // GPUCullInstance per instance
+    GLuint draws;     // DrawBlock per instance, the base instance of a command is its index
+    GLuint pending;
+    GLuint commands;  // GPU_CULL_LISTS lists of 'instance_capacity' commands
+    GLuint counters;
+    u32 instance_count, instance_capacity;
+
+    u32 program;
+    bool hiz_tested; // The first phase left instances for the second one
+
+    GLuint readback; // GPU_CULL_READBACK_SLOTS copies of the counters, persistently mapped
+    GPUCullCounters *readback_mapped;
+    GLsync readback_fences[GPU_CULL_READBACK_SLOTS];
+    u32 readback_slot;
+} GPUCulling;
+
+// After init_shader_bank, the program has to be registered as "gpu_cull"
+void InitGPUCulling(GPUCulling *culling);
+
+// Replaces the instances, call again when the model changes
+void UploadGPUCullInstances(GPUCulling *culling, GPUCullInstance *instances, DrawBlock *draws, u32 count);
+
+// The first phase clears the lists and tests against 'frustum', then against the pyramid of
+// the last frame when 'hiz' is not 0 and valid. The second phase tests what the first one
+// left against the pyramid in 'hiz', which has to be built from this frame by now.
+void CullInstancesGPU(GPUCulling *culling, GPUCullPhase phase, Frustum *frustum, HiZ *hiz);
+
+// One call per face cull mode of the phase. The caller binds the program and the vertex array of the
+// model and passes the type of its shared indices, the draw blocks are bound to DRAW_STORAGE_BINDING
+// here. Returns the calls made.
+u32 DrawCulledInstances(GPUCulling *culling, GPUCullPhase phase, u32 index_type);
+
+#endif
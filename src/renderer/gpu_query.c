@@ -0,0 +1,52 @@
+#include <assert.h>
+
+#include "gpu_query.h"
+
+void InitGPUQuery(GPUQuery *query, GLenum target)
+{
+    query->target = target;
+
+    // Not glCreateQueries, older Mesa hands out no names for some targets. The objects are
+    // created by the first glBeginQuery.
+    for(u32 slot = 0; slot < GPU_QUERY_FRAMES; slot++)
+    {
+        glGenQueries(GPU_QUERY_MAX_SPANS, query->ids[slot]);
+        query->span_counts[slot] = 0;
+    }
+
+    query->slot = 0;
+    query->result = 0;
+}
+
+void AdvanceGPUQuery(GPUQuery *query)
+{
+    query->slot = (query->slot + 1) % GPU_QUERY_FRAMES;
+
+    // Nothing measured that frame is a result of 0
+    query->result = 0;
+    for(u32 span = 0; span < query->span_counts[query->slot]; span++)
+    {
+        u64 span_result;
+        glGetQueryObjectui64v(query->ids[query->slot][span], GL_QUERY_RESULT, &span_result);
+        query->result += span_result;
+    }
+
+    query->span_counts[query->slot] = 0;
+}
+
+void BeginGPUQuery(GPUQuery *query)
+{
+    assert(query->span_counts[query->slot] < GPU_QUERY_MAX_SPANS);
+    glBeginQuery(query->target, query->ids[query->slot][query->span_counts[query->slot]]);
+}
+
+void EndGPUQuery(GPUQuery *query)
+{
+    glEndQuery(query->target);
+    query->span_counts[query->slot]++;
+}
+
+f32 GPUQueryMilliseconds(GPUQuery *query)
+{
+    return (f32)(query->result / 1000000.0);
+}
@@ -0,0 +1,41 @@
+#ifndef GPU_QUERY_H
+#define GPU_QUERY_H
+
+#include <stdbool.h>
+
+#include "glad/glad.h"
+#include "..\defines.h"
+
+/*
+  GL queries read back without waiting on the GPU. Every query has a ring of query objects,
+  one set per frame, and the result of a frame is picked up when its set comes around
+  again, GPU_QUERY_FRAMES - 1 frames later. The GPU is long done with it by then.
+
+  Only one query per target can be active at a time. A query can be begun and ended a few
+  times in a frame around the work it measures, the results of the spans add up.
+*/
+
+#define GPU_QUERY_FRAMES 4
+#define GPU_QUERY_MAX_SPANS 4 // Per frame
+
+typedef struct {
+    GLenum target; // GL_TIME_ELAPSED, GL_SAMPLES_PASSED, ...
+    GLuint ids[GPU_QUERY_FRAMES][GPU_QUERY_MAX_SPANS];
+    u32 span_counts[GPU_QUERY_FRAMES];
+    u32 slot;
+
+    u64 result; // Of GPU_QUERY_FRAMES - 1 frames ago, nanoseconds for GL_TIME_ELAPSED
+} GPUQuery;
+
+void InitGPUQuery(GPUQuery *query, GLenum target);
+
+// Once per frame before the first span, picks up the result of the set it reuses
+void AdvanceGPUQuery(GPUQuery *query);
+
+void BeginGPUQuery(GPUQuery *query);
+void EndGPUQuery(GPUQuery *query);
+
+// GL_TIME_ELAPSED results in milliseconds
+f32 GPUQueryMilliseconds(GPUQuery *query);
+
+#endif
@@ -0,0 +1,173 @@
+#include <assert.h>
+#include <string.h> // memcpy, memset
+
+#include "hiz.h"
+#include "shader_bank.h"
+#include "gl_state.h"
+#include "render_queue.h" // DrawElementsIndirectCommand
+
+HiZStats hiz_stats;
+extern ShaderBank shaders;
+
+static struct {
+    UniformHandle depth_texture, from_depth, source_size;
+    UniformHandle pyramid, cull_view_projection, depth_size, level_count, command_count, phase;
+} uniforms;
+
+void InitHiZ(HiZ *hiz)
+{
+    memset(hiz, 0, sizeof(*hiz));
+
+    hiz->build_program = query_program_index("hiz_build");
+    hiz->cull_program = query_program_index("hiz_cull");
+
+    uniforms.depth_texture = query_uniform("depth_texture");
+    uniforms.from_depth = query_uniform("from_depth");
+    uniforms.source_size = query_uniform("source_size");
+    uniforms.pyramid = query_uniform("pyramid");
+    uniforms.cull_view_projection = query_uniform("cull_view_projection");
+    uniforms.depth_size = query_uniform("depth_size");
+    uniforms.level_count = query_uniform("level_count");
+    uniforms.command_count = query_uniform("command_count");
+    uniforms.phase = query_uniform("phase");
+
+    // Bound as shader storage at the offset of a slot
+    GLint storage_alignment;
+    glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &storage_alignment);
+    hiz->stats_stride = (sizeof(HiZStats) + storage_alignment - 1) & ~((size_t)storage_alignment - 1);
+
+    GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glCreateBuffers(1, &hiz->stats_buffer);
+    glNamedBufferStorage(hiz->stats_buffer, hiz->stats_stride * HIZ_STATS_SLOTS, 0, flags);
+    hiz->stats_mapped = (u8*) glMapNamedBufferRange(hiz->stats_buffer, 0, hiz->stats_stride * HIZ_STATS_SLOTS, flags);
+    assert(hiz->stats_mapped);
+
+    memset(hiz->stats_mapped, 0, hiz->stats_stride * HIZ_STATS_SLOTS);
+}
+
+void InvalidateHiZ(HiZ *hiz)
+{
+    hiz->valid = false;
+}
+
+// Level 0 is half the size of the depth buffer, rounded down, then down to 1x1
+static void ResizePyramid(HiZ *hiz, s32 width, s32 height)
+{
+    if(hiz->pyramid && hiz->depth_width == width && hiz->depth_height == height) return;
+
+    if(hiz->pyramid)
+    {
+        StateForgetTexture(hiz->pyramid);
+        glDeleteTextures(1, &hiz->pyramid);
+    }
+
+    s32 level_width = (width / 2 > 1) ? width / 2 : 1;
+    s32 level_height = (height / 2 > 1) ? height / 2 : 1;
+
+    hiz->level_count = 1;
+    for(s32 size = (level_width > level_height) ? level_width : level_height; size > 1; size /= 2) hiz->level_count++;
+
+    glCreateTextures(GL_TEXTURE_2D, 1, &hiz->pyramid);
+    glTextureStorage2D(hiz->pyramid, hiz->level_count, GL_R32F, level_width, level_height);
+    glTextureParameteri(hiz->pyramid, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTextureParameteri(hiz->pyramid, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    hiz->depth_width = width;
+    hiz->depth_height = height;
+    hiz->valid = false;
+}
+
+void BuildHiZPyramid(HiZ *hiz, GLuint depth_texture, s32 width, s32 height, mat4x4 view_projection)
+{
+    if(!shaders.programs[hiz->build_program]) return;
+
+    ResizePyramid(hiz, width, height);
+
+    use_program_index(hiz->build_program);
+    set_int_handle(uniforms.depth_texture, HIZ_TEXTURE_UNIT);
+
+    StateActiveTexture(HIZ_TEXTURE_UNIT);
+    StateBindTexture(GL_TEXTURE_2D, depth_texture);
+
+    s32 source_width = width, source_height = height;
+    for(u32 level = 0; level < hiz->level_count; level++)
+    {
+        s32 level_width = (source_width / 2 > 1) ? source_width / 2 : 1;
+        s32 level_height = (source_height / 2 > 1) ? source_height / 2 : 1;
+
+        // Level 0 reads the depth texture, unit 0 is unused then
+        if(level) glBindImageTexture(0, hiz->pyramid, level - 1, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+        glBindImageTexture(1, hiz->pyramid, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+
+        set_int_handle(uniforms.from_depth, level == 0);
+        set_ivec2_handle(uniforms.source_size, source_width, source_height);
+
+        glDispatchCompute((level_width + 7) / 8, (level_height + 7) / 8, 1);
+
+        // The next level reads this one
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+        source_width = level_width;
+        source_height = level_height;
+    }
+
+    // The cull reads it through a sampler
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+    hiz->view_projection = view_projection;
+    hiz->valid = true;
+}
+
+// The slot of HIZ_STATS_SLOTS frames ago is read and cleared for this frame
+static void RotateStatsSlot(HiZ *hiz)
+{
+    hiz->stats_slot = (hiz->stats_slot + 1) % HIZ_STATS_SLOTS;
+
+    GLsync fence = hiz->stats_fences[hiz->stats_slot];
+    if(!fence) return;
+
+    // Signaled frames ago unless the CPU is far ahead of the GPU
+    while(glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED);
+    glDeleteSync(fence);
+    hiz->stats_fences[hiz->stats_slot] = 0;
+
+    u8 *slot = hiz->stats_mapped + hiz->stats_slot * hiz->stats_stride;
+    memcpy(&hiz_stats, slot, sizeof(HiZStats));
+    memset(slot, 0, sizeof(HiZStats));
+}
+
+void CullIndirectCommands(HiZ *hiz, HiZPhase phase, GLuint buffer, size_t offset, u32 command_count)
+{
+    if(!command_count || !shaders.programs[hiz->cull_program]) return;
+    if(phase == HIZ_PHASE_FIRST && !hiz->valid) return;
+
+    // Once per frame
+    if(phase == HIZ_PHASE_SECOND) RotateStatsSlot(hiz);
+
+    use_program_index(hiz->cull_program);
+    set_int_handle(uniforms.pyramid, HIZ_TEXTURE_UNIT);
+    set_mat4f_handle(uniforms.cull_view_projection, hiz->view_projection.matrix);
+    set_ivec2_handle(uniforms.depth_size, hiz->depth_width, hiz->depth_height);
+    set_int_handle(uniforms.level_count, hiz->level_count);
+    set_int_handle(uniforms.command_count, command_count);
+    set_int_handle(uniforms.phase, phase);
+
+    StateActiveTexture(HIZ_TEXTURE_UNIT);
+    StateBindTexture(GL_TEXTURE_2D, hiz->pyramid);
+
+    StateBindBufferRange(GL_SHADER_STORAGE_BUFFER, HIZ_COMMAND_BINDING, buffer, offset,
+                         command_count * sizeof(DrawElementsIndirectCommand));
+    StateBindBufferRange(GL_SHADER_STORAGE_BUFFER, HIZ_STATS_BINDING, hiz->stats_buffer,
+                         hiz->stats_slot * hiz->stats_stride, sizeof(HiZStats));
+
+    glDispatchCompute((command_count + 63) / 64, 1, 1);
+
+    // The draws read the instance counts as indirect commands
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT);
+
+    if(phase == HIZ_PHASE_SECOND)
+    {
+        glMemoryBarrier(GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT);
+        hiz->stats_fences[hiz->stats_slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+}
@@ -0,0 +1,81 @@
+#ifndef HIZ_H
+#define HIZ_H
+
+#include <stdbool.h>
+
+#include "glad/glad.h"
+#include "model.h" // MAX_TEXTURE_ARRAYS
+#include "..\gfx_math.h"
+#include "..\defines.h"
+
+/*
+  Hierarchical-Z occlusion culling of the indirect commands, on the GPU.
+
+  The pyramid keeps the largest depth of every 2x2 texels of the level below it, level 0
+  covers 2x2 pixels of the depth buffer. A box is occluded when its closest depth is
+  behind the largest one of the texels it covers, on the finest level where that is 2x2.
+
+  Two phases a frame, so nothing that comes into view pops in a frame late:
+    1. Every command is tested against the pyramid of the last frame, with the view of
+       the last frame, and what passes is drawn.
+    2. The pyramid is built from what phase 1 drew. The commands phase 1 culled are tested
+       against it and drawn if they pass. The pyramid is then kept for the next frame.
+
+  hiz_build.glsl and hiz_cull.glsl are compute shaders, GL 4.3 is enough.
+*/
+
+#define HIZ_COMMAND_BINDING 2 // Shader storage, the indirect commands
+#define HIZ_STATS_BINDING 3   // Shader storage, HiZStats
+
+// After the units of the material textures
+#define HIZ_TEXTURE_UNIT MAX_TEXTURE_ARRAYS
+
+// Frames the stats are read back later, the GPU is done with them by then
+#define HIZ_STATS_SLOTS 4
+
+typedef enum {
+    HIZ_PHASE_FIRST,
+    HIZ_PHASE_SECOND,
+} HiZPhase;
+
+// Indirect commands, counted in the second phase. Mirrored in hiz_cull.glsl.
+typedef struct {
+    u32 drawn_first;  // Visible last frame
+    u32 drawn_second; // Came into view, would have popped in without the second phase
+    u32 culled;
+} HiZStats;
+
+// From HIZ_STATS_SLOTS frames ago
+extern HiZStats hiz_stats;
+
+typedef struct {
+    GLuint pyramid; // GL_R32F with a full mip chain
+    s32 depth_width, depth_height; // Of the depth buffer it is built from
+    u32 level_count;
+
+    mat4x4 view_projection; // The pyramid was built with
+    bool valid; // False until the first build and after InvalidateHiZ
+
+    u32 build_program, cull_program;
+
+    GLuint stats_buffer;
+    u8 *stats_mapped;
+    size_t stats_stride;
+    GLsync stats_fences[HIZ_STATS_SLOTS];
+    u32 stats_slot;
+} HiZ;
+
+// After init_shader_bank, the programs have to be registered as "hiz_build" and "hiz_cull"
+void InitHiZ(HiZ *hiz);
+
+// The next first phase draws everything, e.g. when culling was off or the camera jumped
+void InvalidateHiZ(HiZ *hiz);
+
+// From the depth texture of a render target, whose contents were drawn with 'view_projection'
+void BuildHiZPyramid(HiZ *hiz, GLuint depth_texture, s32 width, s32 height, mat4x4 view_projection);
+
+// Sets the instance count of every command in 'buffer' at 'offset' to 1 or 0. The draw blocks
+// are read from DRAW_STORAGE_BINDING. The first phase does nothing while the pyramid is not valid.
+void CullIndirectCommands(HiZ *hiz, HiZPhase phase, GLuint buffer, size_t offset, u32 command_count);
+
+#endif
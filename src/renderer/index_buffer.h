@@ -9,6 +9,7 @@ typedef struct {
 } IndexBuffer;
 
 IndexBuffer GenIndexBuf(u32 *indices, u32 size);
+IndexBuffer GenIndexBuf16(u16 *indices, u32 size);
 
 void BindIndexBuf(IndexBuffer buf);
 void UnbindIndexBuf(void);
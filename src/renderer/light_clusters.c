@@ -0,0 +1,228 @@
+#include <assert.h>
+#include <math.h> // logf, expf, floorf, tanf, cosf, sinf
+#include <string.h> // memset
+
+#include "light_clusters.h"
+#include "..\platform.h"
+
+LightClusterStats light_cluster_stats;
+
+// Fewer lights are binned on the calling thread only, the work queue costs more than it saves
+#define LIGHT_CLUSTER_PARALLEL_MIN_LIGHTS 64
+
+void InitLightClusters(ArenaMemory *arena, LightClusters *clusters)
+{
+    memset(clusters, 0, sizeof(*clusters));
+
+    clusters->counts = (u32*) ArenaAlloc16(arena, LIGHT_CLUSTER_COUNT * sizeof(u32));
+    clusters->lists = (u16*) ArenaAlloc16(arena, LIGHT_CLUSTER_COUNT * LIGHT_CLUSTER_MAX_LIGHTS * sizeof(u16));
+    clusters->bounds = (ClusterLightBounds*) ArenaAlloc16(arena, MAX_LOCAL_LIGHTS * sizeof(ClusterLightBounds));
+}
+
+static u32 SliceOfDepth(LightClusters *clusters, f32 depth)
+{
+    if(depth <= clusters->near_depth) return 0;
+
+    f32 slice = floorf(logf(depth) * clusters->slice_scale + clusters->slice_bias);
+    if(slice >= LIGHT_CLUSTERS_Z - 1) return LIGHT_CLUSTERS_Z - 1;
+    return (slice < 0.0f) ? 0 : (u32)slice;
+}
+
+// Column or row of the tiles a ratio of x or y to the view depth falls into, unclamped
+static f32 TileOfRatio(f32 ratio, f32 tan_half, u32 tile_count)
+{
+    f32 tile = floorf((ratio / tan_half + 1.0f) * 0.5f * tile_count);
+    return fminf(fmaxf(tile, -1.0f), (f32)tile_count);
+}
+
+// Smallest and largest ratio of a coordinate to the depth over a box in view space, 'near_depth' > 0
+static void RatioRange(f32 min, f32 max, f32 near_depth, f32 far_depth, f32 *min_ratio, f32 *max_ratio)
+{
+    *min_ratio = min / ((min < 0.0f) ? near_depth : far_depth);
+    *max_ratio = max / ((max > 0.0f) ? near_depth : far_depth);
+}
+
+// Sphere around what a light reaches, a spot light's cone is tighter than its range
+static void LightBoundingSphere(LocalLight *light, vec3 *center, f32 *radius)
+{
+    if(light->type != LIGHT_SPOT || light->outer_angle >= RADIANS(90.0f))
+    {
+        *center = light->position;
+        *radius = light->range;
+    }
+    else if(light->outer_angle > RADIANS(45.0f))
+    {
+        // Around the disk at the end of the cone
+        *center = add_vec3(light->position, scale_vec3(light->direction, light->range * cosf(light->outer_angle)));
+        *radius = light->range * sinf(light->outer_angle);
+    }
+    else
+    {
+        // Through the apex and the rim of the disk
+        f32 distance = 0.5f * light->range / cosf(light->outer_angle);
+        *center = add_vec3(light->position, scale_vec3(light->direction, distance));
+        *radius = distance;
+    }
+}
+
+static void BinSlice(LightClusters *clusters, u32 slice)
+{
+    u32 *counts = &clusters->counts[slice * LIGHT_CLUSTERS_X * LIGHT_CLUSTERS_Y];
+    u16 *lists = &clusters->lists[slice * LIGHT_CLUSTERS_X * LIGHT_CLUSTERS_Y * LIGHT_CLUSTER_MAX_LIGHTS];
+    memset(counts, 0, LIGHT_CLUSTERS_X * LIGHT_CLUSTERS_Y * sizeof(u32));
+
+    f32 slice_near = (slice == 0) ? 0.0f : expf((slice - clusters->slice_bias) / clusters->slice_scale);
+    f32 slice_far = (slice == LIGHT_CLUSTERS_Z - 1) ? 1e30f : expf((slice + 1 - clusters->slice_bias) / clusters->slice_scale);
+
+    u32 dropped = 0;
+    for(u32 light_index = 0; light_index < clusters->light_count; light_index++)
+    {
+        ClusterLightBounds *bounds = &clusters->bounds[light_index];
+        if(slice < bounds->first_slice || slice > bounds->last_slice) continue;
+
+        // The box of the sphere, cut to the slice
+        f32 depth = -bounds->center.z;
+        f32 near_depth = fmaxf(fmaxf(depth - bounds->radius, slice_near), 1e-4f);
+        f32 far_depth = fmaxf(fminf(depth + bounds->radius, slice_far), near_depth);
+
+        f32 min_ratio, max_ratio;
+        RatioRange(bounds->center.x - bounds->radius, bounds->center.x + bounds->radius, near_depth, far_depth, &min_ratio, &max_ratio);
+        f32 first_x = TileOfRatio(min_ratio, clusters->tan_half_x, LIGHT_CLUSTERS_X);
+        f32 last_x = TileOfRatio(max_ratio, clusters->tan_half_x, LIGHT_CLUSTERS_X);
+        if(last_x < 0.0f || first_x >= LIGHT_CLUSTERS_X) continue;
+
+        RatioRange(bounds->center.y - bounds->radius, bounds->center.y + bounds->radius, near_depth, far_depth, &min_ratio, &max_ratio);
+        f32 first_y = TileOfRatio(min_ratio, clusters->tan_half_y, LIGHT_CLUSTERS_Y);
+        f32 last_y = TileOfRatio(max_ratio, clusters->tan_half_y, LIGHT_CLUSTERS_Y);
+        if(last_y < 0.0f || first_y >= LIGHT_CLUSTERS_Y) continue;
+
+        u32 x0 = (u32)fmaxf(first_x, 0.0f), x1 = (u32)fminf(last_x, LIGHT_CLUSTERS_X - 1);
+        u32 y0 = (u32)fmaxf(first_y, 0.0f), y1 = (u32)fminf(last_y, LIGHT_CLUSTERS_Y - 1);
+
+        for(u32 y = y0; y <= y1; y++)
+        {
+            for(u32 x = x0; x <= x1; x++)
+            {
+                u32 cluster = y * LIGHT_CLUSTERS_X + x;
+                if(counts[cluster] == LIGHT_CLUSTER_MAX_LIGHTS)
+                {
+                    dropped++;
+                    continue;
+                }
+
+                lists[cluster * LIGHT_CLUSTER_MAX_LIGHTS + counts[cluster]++] = (u16)light_index;
+            }
+        }
+    }
+
+    if(dropped) AtomicAdd(&clusters->dropped, dropped);
+}
+
+// Every worker takes slices until none are left
+static void BinSlices(WorkQueue *queue, void *data)
+{
+    LightClusters *clusters = (LightClusters*)data;
+
+    for(;;)
+    {
+        u32 slice = AtomicIncrement(&clusters->next_slice) - 1;
+        if(slice >= LIGHT_CLUSTERS_Z) break;
+
+        BinSlice(clusters, slice);
+    }
+}
+
+u32 BinLights(LightClusters *clusters, LocalLight *lights, u32 light_count, mat4x4 view,
+              f32 fov_y, f32 aspect, f32 near_depth, f32 far_depth)
+{
+    assert(light_count <= MAX_LOCAL_LIGHTS);
+    assert(near_depth > 0.0f && far_depth > near_depth);
+
+    u64 start = GetWallClock();
+
+    clusters->tan_half_y = tanf(0.5f * fov_y);
+    clusters->tan_half_x = clusters->tan_half_y * aspect;
+    clusters->near_depth = near_depth;
+    clusters->far_depth = far_depth;
+    clusters->slice_scale = LIGHT_CLUSTERS_Z / logf(far_depth / near_depth);
+    clusters->slice_bias = -logf(near_depth) * clusters->slice_scale;
+
+    // Bounds in view space and the slices they touch, lights behind the eye touch none
+    clusters->light_count = light_count;
+    for(u32 light_index = 0; light_index < light_count; light_index++)
+    {
+        ClusterLightBounds *bounds = &clusters->bounds[light_index];
+
+        vec3 center;
+        LightBoundingSphere(&lights[light_index], &center, &bounds->radius);
+
+        vec4 view_center = mat4x4_mult_vec4(view, create_vec4(center.x, center.y, center.z, 1.0f));
+        bounds->center = create_vec3(view_center.x, view_center.y, view_center.z);
+
+        f32 depth = -view_center.z;
+        if(depth + bounds->radius <= 0.0f)
+        {
+            bounds->first_slice = 1;
+            bounds->last_slice = 0;
+            continue;
+        }
+
+        bounds->first_slice = SliceOfDepth(clusters, depth - bounds->radius);
+        bounds->last_slice = SliceOfDepth(clusters, depth + bounds->radius);
+    }
+
+    clusters->next_slice = 0;
+    clusters->dropped = 0;
+
+    if(light_count < LIGHT_CLUSTER_PARALLEL_MIN_LIGHTS)
+    {
+        BinSlices(&work_queue, clusters);
+    }
+    else
+    {
+        u32 worker_count = work_queue.thread_count + 1;
+        if(worker_count > LIGHT_CLUSTERS_Z) worker_count = LIGHT_CLUSTERS_Z;
+
+        for(u32 worker_index = 0; worker_index < worker_count; worker_index++)
+            AddWorkEntry(&work_queue, BinSlices, clusters);
+        CompleteAllWork(&work_queue);
+    }
+
+    u32 index_count = 0;
+    for(u32 cluster = 0; cluster < LIGHT_CLUSTER_COUNT; cluster++) index_count += clusters->counts[cluster];
+
+    light_cluster_stats = (LightClusterStats){0};
+    light_cluster_stats.light_count = light_count;
+    light_cluster_stats.index_count = index_count;
+    light_cluster_stats.dropped = clusters->dropped;
+    light_cluster_stats.cpu_ms = (f32)(GetSecondsElapsed(start, GetWallClock()) * 1000.0);
+
+    return index_count;
+}
+
+void WriteLightClusters(LightClusters *clusters, ClusterBlock *blocks, u32 *indices)
+{
+    u64 start = GetWallClock();
+
+    u32 first_light = 0;
+    for(u32 cluster = 0; cluster < LIGHT_CLUSTER_COUNT; cluster++)
+    {
+        u32 count = clusters->counts[cluster];
+        u16 *list = &clusters->lists[cluster * LIGHT_CLUSTER_MAX_LIGHTS];
+
+        blocks[cluster].first_light = first_light;
+        blocks[cluster].light_count = count;
+
+        for(u32 list_index = 0; list_index < count; list_index++) indices[first_light + list_index] = list[list_index];
+        first_light += count;
+
+        if(count > light_cluster_stats.max_cluster_lights) light_cluster_stats.max_cluster_lights = count;
+    }
+
+    light_cluster_stats.cpu_ms += (f32)(GetSecondsElapsed(start, GetWallClock()) * 1000.0);
+}
+
+vec4 LightClusterScale(LightClusters *clusters, u32 width, u32 height)
+{
+    return create_vec4((f32)LIGHT_CLUSTERS_X / width, (f32)LIGHT_CLUSTERS_Y / height, clusters->slice_scale, clusters->slice_bias);
+}
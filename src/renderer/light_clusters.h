@@ -0,0 +1,84 @@
+#ifndef LIGHT_CLUSTERS_H
+#define LIGHT_CLUSTERS_H
+
+#include "lights.h"
+#include "uniform_blocks.h" // ClusterBlock
+#include "..\memory.h"
+#include "..\gfx_math.h"
+#include "..\defines.h"
+
+/*
+  Clustered forward shading. The view frustum is split into a grid of clusters, tiles of the
+  screen times slices of the view depth, and every frame the lights are binned into the clusters
+  their bounds touch. A fragment only loops over the lights of its cluster.
+
+  The slices are spaced exponentially between a near and a far depth, the first one starts at
+  the eye and the last one goes on forever. A light is tested against a slice with its bounding
+  sphere, and against the columns of tiles with the box of the sphere cut to the slice.
+
+  The slices are binned on the work queue, each into lists of a fixed size per cluster. The
+  lists are then packed one after the other into the index table the shader reads.
+*/
+
+#define LIGHT_CLUSTERS_X 16
+#define LIGHT_CLUSTERS_Y 9
+#define LIGHT_CLUSTERS_Z 24
+#define LIGHT_CLUSTER_COUNT (LIGHT_CLUSTERS_X * LIGHT_CLUSTERS_Y * LIGHT_CLUSTERS_Z)
+
+// Lights of one cluster, the rest are dropped and counted in the stats
+#define LIGHT_CLUSTER_MAX_LIGHTS 256
+
+// Light indices are stored as u16 while binning
+StaticAssert(MAX_LOCAL_LIGHTS <= 0x10000);
+
+typedef struct {
+    vec3 center; // View space, the eye looks down -z
+    f32 radius;
+    u32 first_slice, last_slice;
+} ClusterLightBounds;
+
+typedef struct {
+    // Per cluster, 'counts' of the lists of LIGHT_CLUSTER_MAX_LIGHTS entries in 'lists'
+    u32 *counts;
+    u16 *lists;
+
+    ClusterLightBounds *bounds; // Of the lights being binned
+    u32 light_count;
+
+    f32 tan_half_x, tan_half_y;
+    f32 near_depth, far_depth;
+    f32 slice_scale, slice_bias; // Slice of a view depth d is floor(log(d) * scale + bias)
+
+    u32 volatile next_slice;
+    u32 volatile dropped;
+} LightClusters;
+
+// Of the last frame
+typedef struct {
+    u32 light_count;
+    u32 index_count;        // Entries of the index table
+    u32 max_cluster_lights; // In the busiest cluster
+    u32 dropped;            // Over LIGHT_CLUSTER_MAX_LIGHTS
+    f32 cpu_ms;
+} LightClusterStats;
+
+extern LightClusterStats light_cluster_stats;
+
+// The lists come out of 'arena', about 1.8 MB
+void InitLightClusters(ArenaMemory *arena, LightClusters *clusters);
+
+// Bins the lights into the clusters of the frustum and returns the size of the index table.
+// 'near_depth' and 'far_depth' are where the slices start and end, they need not be the ones of
+// the projection.
+// @Note: Uses the work queue, so only the main thread may call this
+u32 BinLights(LightClusters *clusters, LocalLight *lights, u32 light_count, mat4x4 view,
+              f32 fov_y, f32 aspect, f32 near_depth, f32 far_depth);
+
+// Packs the lists of the last BinLights into the tables of the shader, 'indices' has room for the
+// count it returned
+void WriteLightClusters(LightClusters *clusters, ClusterBlock *blocks, u32 *indices);
+
+// Tiles per pixel in x and y, then the slice scale and bias, for the frame block
+vec4 LightClusterScale(LightClusters *clusters, u32 width, u32 height);
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef LIGHTS_H
+#define LIGHTS_H
+
+#include "..\gfx_math.h"
+#include "..\defines.h"
+
+// Besides dir_light, every one is uploaded as a LightBlock of uniform_blocks.h each frame
+#define MAX_LOCAL_LIGHTS 4096
+
+// Lights without a slot in the shadow atlas
+#define NO_SHADOW_SLOT 0xFFFFFFFF
+
+typedef enum {
+    LIGHT_POINT,
+    LIGHT_SPOT,
+} LightType;
+
+typedef struct {
+    LightType type;
+    vec3 position;
+    vec3 direction; // Of spot lights, normalized
+    vec3 color;     // Times the intensity
+    f32 range;      // Nothing is lit beyond it
+    f32 inner_angle, outer_angle; // Of spot lights, radians from the direction
+
+    u32 shadow_slot; // In the shadow atlas, NO_SHADOW_SLOT for lights without a shadow
+} LocalLight;
+
+#endif
@@ -0,0 +1,238 @@
+#include <string.h> // memset, memcpy
+#include <math.h> // sqrt
+
+#include "meshlet.h"
+
+#define POSITION(index) (*(vec3*)((u8*)positions + (size_t)(index) * position_stride))
+
+static void ComputeMeshletBounds(Meshlet *meshlet,
+                                 vec3 *positions, u32 position_stride,
+                                 u32 *indices)
+{
+    u32 *meshlet_indices = indices + meshlet->index_offset;
+    u32 triangle_count = meshlet->index_count / 3;
+
+    // Bounding sphere centered on the AABB of the meshlet
+    vec3 min = POSITION(meshlet_indices[0]);
+    vec3 max = min;
+
+    for(u32 index = 1; index < meshlet->index_count; index++)
+    {
+        vec3 p = POSITION(meshlet_indices[index]);
+
+        if(p.x < min.x) min.x = p.x;
+        if(p.y < min.y) min.y = p.y;
+        if(p.z < min.z) min.z = p.z;
+        if(p.x > max.x) max.x = p.x;
+        if(p.y > max.y) max.y = p.y;
+        if(p.z > max.z) max.z = p.z;
+    }
+
+    meshlet->center = scale_vec3(add_vec3(min, max), 0.5f);
+    meshlet->radius = 0.0f;
+
+    for(u32 index = 0; index < meshlet->index_count; index++)
+    {
+        f32 distance = length_vec3(sub_vec3(POSITION(meshlet_indices[index]), meshlet->center));
+        if(distance > meshlet->radius) meshlet->radius = distance;
+    }
+
+    // Normal cone, see "Optimizing the Graphics Pipeline with Compute" (Wihlidal) and meshoptimizer.
+    // A cutoff of 1 means the cone is degenerate and the meshlet is never backface culled.
+    meshlet->cone_apex = meshlet->center;
+    meshlet->cone_axis = create_vec3(0.0f, 0.0f, 0.0f);
+    meshlet->cone_cutoff = 1.0f;
+
+    vec3 normals[MESHLET_MAX_TRIANGLES];
+    vec3 axis = create_vec3(0.0f, 0.0f, 0.0f);
+
+    for(u32 triangle = 0; triangle < triangle_count; triangle++)
+    {
+        vec3 p0 = POSITION(meshlet_indices[triangle*3 + 0]);
+        vec3 p1 = POSITION(meshlet_indices[triangle*3 + 1]);
+        vec3 p2 = POSITION(meshlet_indices[triangle*3 + 2]);
+
+        vec3 n = cross_vec3(sub_vec3(p1, p0), sub_vec3(p2, p0));
+        f32 area = length_vec3(n);
+
+        // Degenerate triangles can't be seen from any side, leave them out of the cone
+        normals[triangle] = (area > 0.0f) ? scale_vec3(n, 1.0f / area) : create_vec3(0.0f, 0.0f, 0.0f);
+        axis = add_vec3(axis, normals[triangle]);
+    }
+
+    f32 axis_length = length_vec3(axis);
+    if(axis_length == 0.0f) return;
+
+    axis = scale_vec3(axis, 1.0f / axis_length);
+
+    f32 min_dp = 1.0f;
+    for(u32 triangle = 0; triangle < triangle_count; triangle++)
+    {
+        if(compare_vec3(normals[triangle], create_vec3(0.0f, 0.0f, 0.0f))) continue;
+
+        f32 dp = dot_vec3(normals[triangle], axis);
+        if(dp < min_dp) min_dp = dp;
+    }
+
+    // The normals span (close to) a hemisphere or more, there is no useful cone
+    if(min_dp <= 0.1f) return;
+
+    // Push the apex back along the axis until every triangle plane is in front of it
+    f32 max_t = 0.0f;
+    for(u32 triangle = 0; triangle < triangle_count; triangle++)
+    {
+        if(compare_vec3(normals[triangle], create_vec3(0.0f, 0.0f, 0.0f))) continue;
+
+        vec3 p0 = POSITION(meshlet_indices[triangle*3]);
+        f32 dc = dot_vec3(sub_vec3(meshlet->center, p0), normals[triangle]);
+        f32 dn = dot_vec3(axis, normals[triangle]);
+        f32 t = dc / dn;
+
+        if(t > max_t) max_t = t;
+    }
+
+    meshlet->cone_apex = sub_vec3(meshlet->center, scale_vec3(axis, max_t));
+    meshlet->cone_axis = axis;
+    meshlet->cone_cutoff = (f32)sqrt(1.0f - min_dp*min_dp);
+
+}
+
+/*
+  Greedy clustering: keep adding the unemitted triangle that is connected to the
+  current meshlet and introduces the fewest new vertices. When the meshlet is full
+  that triangle seeds the next one, so neighbouring meshlets stay spatially coherent.
+*/
+u32 BuildMeshlets(ArenaMemory *memory,
+                  ArenaMemory *scratch,
+                  vec3 *positions, u32 position_stride, u32 vertex_count,
+                  u32 *indices, u32 index_count,
+                  Meshlet **meshlets)
+{
+    u32 triangle_count = index_count / 3;
+
+    *meshlets = 0;
+    if(triangle_count == 0) return 0;
+
+    // Everything below is temporary
+    size_t scratch_mark = scratch->used;
+
+    // Vertex -> triangle adjacency, stored as offsets into one flat array
+    u32 *adjacency_offsets = (u32*) ArenaAlloc16(scratch, (vertex_count + 1) * sizeof(u32));
+    u32 *adjacency_fill =    (u32*) ArenaAlloc16(scratch, vertex_count * sizeof(u32));
+    u32 *adjacency =         (u32*) ArenaAlloc16(scratch, index_count * sizeof(u32));
+
+    memset(adjacency_offsets, 0, (vertex_count + 1) * sizeof(u32));
+
+    for(u32 index = 0; index < index_count; index++)
+        adjacency_offsets[indices[index] + 1]++;
+
+    for(u32 vertex = 0; vertex < vertex_count; vertex++)
+        adjacency_offsets[vertex + 1] += adjacency_offsets[vertex];
+
+    memcpy(adjacency_fill, adjacency_offsets, vertex_count * sizeof(u32));
+
+    for(u32 index = 0; index < index_count; index++)
+        adjacency[adjacency_fill[indices[index]]++] = index / 3;
+
+    // vertex_tag stores the last meshlet a vertex was added to
+    u32 *vertex_tag =    (u32*) ArenaAlloc16(scratch, vertex_count * sizeof(u32));
+    u8 *emitted =        (u8*)  ArenaAlloc16(scratch, triangle_count * sizeof(u8));
+    u32 *reordered =     (u32*) ArenaAlloc16(scratch, index_count * sizeof(u32));
+    Meshlet *clusters =  (Meshlet*) ArenaAlloc16(scratch, triangle_count * sizeof(Meshlet));
+
+    memset(vertex_tag, 0xFF, vertex_count * sizeof(u32));
+    memset(emitted, 0, triangle_count * sizeof(u8));
+
+    u32 meshlet_vertices[MESHLET_MAX_VERTICES];
+    Meshlet *current = 0;
+    u32 meshlet_count = 0;
+    u32 emitted_count = 0;
+    u32 scan = 0;
+
+    while(emitted_count < triangle_count)
+    {
+        u32 meshlet_id = meshlet_count - 1;
+        u32 best = ~0u;
+        u32 best_new = 4;
+
+        if(current)
+        {
+            for(u32 local = 0; local < current->vertex_count && best_new > 0; local++)
+            {
+                u32 vertex = meshlet_vertices[local];
+
+                for(u32 adj = adjacency_offsets[vertex]; adj < adjacency_offsets[vertex + 1]; adj++)
+                {
+                    u32 triangle = adjacency[adj];
+                    if(emitted[triangle]) continue;
+
+                    u32 new_vertices = (vertex_tag[indices[triangle*3 + 0]] != meshlet_id) +
+                                       (vertex_tag[indices[triangle*3 + 1]] != meshlet_id) +
+                                       (vertex_tag[indices[triangle*3 + 2]] != meshlet_id);
+
+                    if(new_vertices < best_new)
+                    {
+                        best = triangle;
+                        best_new = new_vertices;
+                        if(best_new == 0) break;
+                    }
+                }
+            }
+        }
+
+        if(best == ~0u)
+        {
+            // Nothing connected is left, continue with the next triangle in index order
+            while(emitted[scan]) scan++;
+
+            best = scan;
+            best_new = (current == 0) ? 3 :
+                (vertex_tag[indices[best*3 + 0]] != meshlet_id) +
+                (vertex_tag[indices[best*3 + 1]] != meshlet_id) +
+                (vertex_tag[indices[best*3 + 2]] != meshlet_id);
+        }
+
+        if(!current ||
+           current->vertex_count + best_new > MESHLET_MAX_VERTICES ||
+           current->index_count == MESHLET_MAX_TRIANGLES * 3)
+        {
+            current = &clusters[meshlet_count];
+            memset(current, 0, sizeof(Meshlet));
+            current->index_offset = emitted_count * 3;
+
+            meshlet_id = meshlet_count++;
+        }
+
+        for(u32 corner = 0; corner < 3; corner++)
+        {
+            u32 vertex = indices[best*3 + corner];
+
+            if(vertex_tag[vertex] != meshlet_id)
+            {
+                vertex_tag[vertex] = meshlet_id;
+                meshlet_vertices[current->vertex_count++] = vertex;
+            }
+
+            reordered[emitted_count*3 + corner] = vertex;
+        }
+
+        current->index_count += 3;
+        emitted[best] = 1;
+        emitted_count++;
+    }
+
+    memcpy(indices, reordered, index_count * sizeof(u32));
+
+    for(u32 meshlet_index = 0; meshlet_index < meshlet_count; meshlet_index++)
+    {
+        ComputeMeshletBounds(&clusters[meshlet_index], positions, position_stride, indices);
+    }
+
+    scratch->used = scratch_mark;
+
+    // The clusters are still intact since nothing has been allocated from scratch since
+    *meshlets = (Meshlet*) ArenaAlloc16(memory, meshlet_count * sizeof(Meshlet));
+    memcpy(*meshlets, clusters, meshlet_count * sizeof(Meshlet));
+
+    return meshlet_count;
+}
@@ -0,0 +1,39 @@
+#ifndef MESHLET_H
+#define MESHLET_H
+
+#include "..\memory.h"
+#include "..\gfx_math.h"
+#include "..\defines.h"
+
+// Limits are the ones commonly used for mesh shading hardware,
+// they keep clusters small enough that culling them is worthwhile.
+#define MESHLET_MAX_VERTICES 64
+#define MESHLET_MAX_TRIANGLES 124
+
+typedef struct {
+    // The triangles of a meshlet are stored contiguously in the index buffer
+    // of its mesh, so a meshlet can be drawn as a plain index range.
+    u32 index_offset;
+    u32 index_count;
+    u32 vertex_count; // Unique vertices referenced by the meshlet
+
+    // Bounding sphere (mesh space)
+    vec3 center;
+    f32 radius;
+
+    // Backface cone, the meshlet faces away from the eye when
+    // dot(normalize(cone_apex - eye), cone_axis) >= cone_cutoff
+    vec3 cone_apex;
+    vec3 cone_axis;
+    f32 cone_cutoff;
+} Meshlet;
+
+// Splits a triangle list into meshlets. 'indices' is reordered in place so
+// that every meshlet owns a contiguous range of it.
+u32 BuildMeshlets(ArenaMemory *memory,
+                  ArenaMemory *scratch,
+                  vec3 *positions, u32 position_stride, u32 vertex_count,
+                  u32 *indices, u32 index_count,
+                  Meshlet **meshlets);
+
+#endif
@@ -1,341 +1,1268 @@
 #include <stdbool.h>
 #include <string.h>
+#include <sys/stat.h> // stat
+#include <math.h> // fmaxf, log2f
 
 #include "renderer.h"
 #include "model.h"
 #include "vertex_buffer.h"
 #include "index_buffer.h"
-
-#include "assimp/types.h"
-#include "assimp/cimport.h"
-#include "assimp/scene.h"
-#include "assimp/material.h"
-#include "assimp/postprocess.h"
+#include "cooked.h"
+#include "texture_streaming.h"
+#include "gl_state.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb/stb_image.h"
 
-// 32-bit FNV
-#define FNV_OFFSET_BASIS 2166136261
-#define FNV_PRIME 16777619
+static TextureBank texture_bank;
+
+// Scratch for reloaded models, reset on every reload
+static ArenaMemory reload_memory;
+#define RELOAD_MEMORY_SIZE MB(256)
 
-u64 fnv_1a(u8 *data, size_t size)
+// Texels of array layers that have to be resampled, reset after every layer
+static ArenaMemory texture_memory;
+#define TEXTURE_MEMORY_SIZE MB(64)
+
+// 0 when the file does not exist
+static time_t FileModifiedTime(char *path)
 {
-	u64 hash = FNV_OFFSET_BASIS;
-	for(u8 index = 0; index < size; index++)
-	{
-		hash = (hash ^ data[index]) * FNV_PRIME;
-	}
-	
-	return hash;
+    struct stat file_stat;
+    if(stat(path, &file_stat) != 0) return 0;
+
+    return file_stat.st_mtime;
 }
 
-static u32 LoadTexture(u8 *path, s32 flipped)
+static void SetTextureParameters(GLuint texture)
 {
-    // Setup Texture
-    GLuint texture;
-    glGenTextures(1, &texture);
+    StateBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);	
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    StateBindTexture(GL_TEXTURE_2D, 0);
+}
+
+// Cooked textures come with their whole mip chain, already flipped by the cooker.
+// Only the mip tail is uploaded here, texture streaming brings in the finer levels.
+static bool UploadCookedTexture(TextureEntry *entry, char *cooked_path)
+{
+    CookedTexture cooked;
+    if(!OpenCookedTexture(cooked_path, &cooked)) return false;
+
+    StreamCookedTexture(entry->id, cooked_path, &cooked);
+
+    entry->width = cooked.header->width;
+    entry->height = cooked.header->height;
+    entry->mip_count = cooked.header->mip_count;
+
+    CloseCookedTexture(&cooked);
 
-    // Load our texture
-    s32 tex_width, tex_height, nr_channels;
-    u8 *tex_data = stbi_load(path, &tex_width, &tex_height, &nr_channels, 0);
+    printf("Loaded cooked texture: %s\n", cooked_path);
     
-    if(tex_data)
+    return true;
+}
+
+static bool UploadSourceTexture(TextureEntry *entry)
+{
+    stbi_set_flip_vertically_on_load(entry->flipped); // this image starts at top left
+    
+    // Always RGBA, like the cooked textures, so a reload can go either way
+    s32 width, height, nr_channels;
+    u8 *tex_data = stbi_load(entry->path, &width, &height, &nr_channels, 4);
+
+    if(!tex_data)
     {
-        GLenum format;
-        
-        if (nr_channels == 3)
-            format = GL_RGB;
-        else if (nr_channels == 4)
-            format = GL_RGBA;
-
-        // Upload to GPU
-        glBindTexture(GL_TEXTURE_2D, texture);        
-        glTexImage2D(GL_TEXTURE_2D, 0, format, tex_width, tex_height, 0, format, GL_UNSIGNED_BYTE, tex_data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-        
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);	
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        
-        glBindTexture(GL_TEXTURE_2D, 0);    
-        stbi_set_flip_vertically_on_load(flipped); // this image starts at top left            
-        stbi_image_free(tex_data);
-        
-        printf("Loaded texture: %s\n", path);
+        printf("Texture was not loaded: %s\n", entry->path);
+        return false;
     }
-    else printf("Texture was not loaded.\n");
+
+    // A full mip chain down to 1x1
+    s32 mip_count = 1;
+    for(s32 size = (width > height) ? width : height; size > 1; size /= 2) mip_count++;
+
+    // Streaming leaves only some of the levels specified, those have to be specified again
+    bool was_streamed = StopStreamingTexture(entry->id);
+    bool in_place = (!was_streamed && entry->width == width && entry->height == height && entry->mip_count == mip_count);
+
+    // Upload to GPU
+    StateBindTexture(GL_TEXTURE_2D, entry->id);
+
+    if(in_place)
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, tex_data);
+    else
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, tex_data);
     
-    return texture;
-}
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, mip_count - 1);
+    glGenerateMipmap(GL_TEXTURE_2D);
+    StateBindTexture(GL_TEXTURE_2D, 0);
+    
+    stbi_image_free(tex_data);
 
-static Mesh CreateMeshFromAssimp(ArenaMemory *scratch,
-                                 char *model_folder_path,
-                                 struct aiMesh *mesh,
-                                 const struct aiScene *scene)
-{
+    entry->width = width;
+    entry->height = height;
+    entry->mip_count = mip_count;
     
-    Mesh result = {0};
+    printf("Loaded texture (not cooked): %s\n", entry->path);
     
-    result.vertex_count = mesh->mNumVertices;
-    result.index_count = mesh->mNumFaces * 3; // @Important: A face could be connected by more than 3 vertices, but if we use aiProcess_Triangulate flag when loading with assimp, then we can always be sure that a face is always a triangle.
+    return true;
+}
+
+// The cooked texture is used unless the source was changed after it was cooked
+static bool PreferCookedTexture(TextureEntry *entry, char *cooked_path, size_t cooked_path_size)
+{
+    bool has_cooked_path = CookedPathFromSource(cooked_path, cooked_path_size, entry->path, COOKED_TEXTURE_EXTENSION);
+
+    entry->source_mod = FileModifiedTime(entry->path);
+    entry->cooked_mod = has_cooked_path ? FileModifiedTime(cooked_path) : 0;
 
+    return entry->cooked_mod && entry->cooked_mod >= entry->source_mod;
+}
+
+// Smallest square power of two the texture fits in
+static s32 TextureArraySize(s32 width, s32 height)
+{
+    s32 size = 1;
+    while(size < width || size < height) size *= 2;
 
-    //result.vertices = (Vertex*) ArenaAlloc16(&memory, result.vertex_count * sizeof(Vertex));
-    Vertex  *vertices = (Vertex*) ArenaAlloc16(scratch, result.vertex_count * sizeof(Vertex));
-    result.indices =    (u32*)    ALLOC_MEM(result.index_count * sizeof(u32));
+    return size;
+}
 
-    // Fill the vertex array of the mesh
-    for(u32 vertex_index = 0; vertex_index < result.vertex_count; vertex_index++)
+// Bilinear, texel centers are at half integers like on the GPU
+static void ResampleTexels(u8 *source, s32 source_width, s32 source_height,
+                          u8 *dest, s32 dest_width, s32 dest_height)
+{
+    for(s32 y = 0; y < dest_height; y++)
     {
-        Vertex vertex;
-        vec3 v;
+        f32 source_y = fmaxf((y + 0.5f) * source_height / dest_height - 0.5f, 0.0f);
+        s32 y0 = (s32)source_y;
+        s32 y1 = (y0 + 1 < source_height) ? y0 + 1 : y0;
+        f32 fy = source_y - y0;
         
-        v.x = mesh->mVertices[vertex_index].x;
-        v.y = mesh->mVertices[vertex_index].y;
-        v.z = mesh->mVertices[vertex_index].z;
-        vertex.position = v;
-
-        v.x = mesh->mNormals[vertex_index].x;
-        v.y = mesh->mNormals[vertex_index].y;
-        v.z = mesh->mNormals[vertex_index].z;
-        vertex.normal = v;
-        
-        if(mesh->mTextureCoords[0])
+        for(s32 x = 0; x < dest_width; x++)
         {
-            vertex.tex_coords.x = mesh->mTextureCoords[0][vertex_index].x;
-            vertex.tex_coords.y = mesh->mTextureCoords[0][vertex_index].y;                        
-        }
-        else
-            vertex.tex_coords = create_vec2(0.0f, 0.0f);
-        
-        vertices[vertex_index] = vertex;        
+            f32 source_x = fmaxf((x + 0.5f) * source_width / dest_width - 0.5f, 0.0f);
+            s32 x0 = (s32)source_x;
+            s32 x1 = (x0 + 1 < source_width) ? x0 + 1 : x0;
+            f32 fx = source_x - x0;
+
+            u8 *t00 = &source[(y0 * source_width + x0) * 4];
+            u8 *t10 = &source[(y0 * source_width + x1) * 4];
+            u8 *t01 = &source[(y1 * source_width + x0) * 4];
+            u8 *t11 = &source[(y1 * source_width + x1) * 4];
+            u8 *out = &dest[(y * dest_width + x) * 4];
 
+            for(s32 channel = 0; channel < 4; channel++)
+            {
+                f32 top = t00[channel] + (t10[channel] - t00[channel]) * fx;
+                f32 bottom = t01[channel] + (t11[channel] - t01[channel]) * fx;
+                out[channel] = (u8)(top + (bottom - top) * fy + 0.5f);
+            }
+        }
     }
+}
+
+// 2x2 box filter, 'dest' can be 'source'. An odd last row or column is dropped.
+static void HalveTexels(u8 *source, s32 *width, s32 *height, u8 *dest)
+{
+    s32 half_width = (*width > 1) ? *width / 2 : 1;
+    s32 half_height = (*height > 1) ? *height / 2 : 1;
+    s32 step_x = (*width > 1) ? 1 : 0;
+    s32 step_y = (*height > 1) ? *width : 0;
 
-    // Fill the index array of the mesh
-    u32 *indice = result.indices;
-    for(u32 indice_index = 0; indice_index < result.index_count; indice_index += 3)
+    for(s32 y = 0; y < half_height; y++)
     {
-        struct aiFace face = mesh->mFaces[indice_index / 3];
-        *indice++ = face.mIndices[0];
-        *indice++ = face.mIndices[1];
-        *indice++ = face.mIndices[2];                
+        for(s32 x = 0; x < half_width; x++)
+        {
+            u8 *t00 = &source[((y * 2) * *width + x * 2) * 4];
+            u8 *out = &dest[(y * half_width + x) * 4];
 
+            for(s32 channel = 0; channel < 4; channel++)
+            {
+                u32 sum = t00[channel] + t00[step_x * 4 + channel] + t00[step_y * 4 + channel] + t00[(step_x + step_y) * 4 + channel];
+                out[channel] = (u8)((sum + 2) / 4);
+            }
+        }
     }
 
-    // Find a texture and store it
-    if(mesh->mMaterialIndex >= 0)
+    *width = half_width;
+    *height = half_height;
+}
+
+// Fills the levels of the layer of the entry from 'first_level' up to 'end_level', which are in the
+// storage of the array. The cooked mips are used when they fit, otherwise only the first level is
+// made from the image. Returns true when the mips of the array have to be generated again.
+static bool UploadArrayLayer(TextureEntry *entry, s32 first_level, s32 end_level)
+{
+    TextureArray *array = &texture_bank.arrays[entry->array_index];
+    assert(first_level >= array->resident_level && first_level < end_level && end_level <= array->mip_count);
+
+    char cooked_path[512];
+    CookedTexture cooked;
+    bool from_cooked = PreferCookedTexture(entry, cooked_path, sizeof(cooked_path)) && OpenCookedTexture(cooked_path, &cooked);
+
+    u8 *texels;
+    s32 width, height;
+    if(from_cooked)
+    {
+        texels = cooked.mips[0];
+        width = cooked.header->width;
+        height = cooked.header->height;
+    }
+    else
     {
-        struct aiMaterial *mat = scene->mMaterials[mesh->mMaterialIndex];
+        stbi_set_flip_vertically_on_load(entry->flipped);
 
-        u32 diffuse_map_count = aiGetMaterialTextureCount(mat, aiTextureType_DIFFUSE);
-        u32 specular_map_count = aiGetMaterialTextureCount(mat, aiTextureType_SPECULAR);
-        u32 ambient_map_count = aiGetMaterialTextureCount(mat, aiTextureType_AMBIENT);
+        s32 nr_channels;
+        texels = stbi_load(entry->path, &width, &height, &nr_channels, 4);
+        if(!texels)
+        {
+            printf("Texture was not loaded: %s\n", entry->path);
+            return false;
+        }
+    }
 
-        //result.texture_count = diffuse_map_count + specular_map_count + ambient_map_count;
+    entry->width = width;
+    entry->height = height;
 
-        // @Note: There should be something to allocate, otherwise 'mat' should be null?
-        //result.textures = (Texture*)ArenaAlloc16(&memory, resuglt.texture_count * sizeof(Texture));
+    bool needs_mips = true;
+    s32 level_size = (array->size >> first_level) ? (array->size >> first_level) : 1;
+    s32 storage_level = first_level - array->resident_level;
+    StateBindTexture(GL_TEXTURE_2D_ARRAY, array->id);
 
-        // Load its different textures
-        // Let's start with diffuse maps and specular maps for now
+    if(from_cooked && width == array->size && height == array->size)
+    {
+        s32 mip_count = (cooked.header->mip_count < end_level) ? cooked.header->mip_count : end_level;
 
-#if 0
-        struct aiString diff_path, amb_path, spec_path;
-        u64 path_hash = 0;
-        
-        if(diffuse_map_count > 0 && aiGetMaterialTexture(mat, aiTextureType_DIFFUSE, 0, &diff_path,
-                                 0,0,0,0,0,0))
+        for(s32 mip = first_level; mip < mip_count; mip++)
         {
-            Texture tex = {0};
-            tex.type = TEX_DIFFUSE;
-            char texture_path[256];
-            
-            strcpy(texture_path, model_folder_path);
-            strcat(texture_path, diff_path.data);
-            u64 hash = fnv_1a(diff_path.data, diff_path.length);
-            
-            // Find out if hash already exists
-            
-            
-            tex.id = LoadTexture(texture_path, true);
-            
+            s32 mip_size = (array->size >> mip) ? (array->size >> mip) : 1;
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, mip - array->resident_level, 0, 0, entry->layer, mip_size, mip_size, 1,
+                            GL_RGBA, GL_UNSIGNED_BYTE, cooked.mips[mip]);
         }
 
-        if(ambient_map_count > 0 && aiGetMaterialTexture(mat, aiTextureType_AMBIENT, 0, &amb_path,
-                                 0,0,0,0,0,0))
+        needs_mips = (mip_count < end_level);
+    }
+    else if(width == level_size && height == level_size)
+    {
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, storage_level, 0, 0, entry->layer, level_size, level_size, 1,
+                        GL_RGBA, GL_UNSIGNED_BYTE, texels);
+    }
+    else
+    {
+        if(!texture_memory.buffer) InitArena(&texture_memory, ALLOC_MEM(TEXTURE_MEMORY_SIZE), TEXTURE_MEMORY_SIZE);
+        size_t memory_mark = texture_memory.used;
+
+        // Halved first while that does not go below the level, bilinear alone would skip texels
+        u8 *source = texels;
+        if(width >= 2 * level_size && height >= 2 * level_size)
         {
+            u8 *halved = (u8*) ArenaAlloc16(&texture_memory, (size_t)(width / 2) * (height / 2) * 4);
+            HalveTexels(source, &width, &height, halved);
+            source = halved;
             
+            while(width >= 2 * level_size && height >= 2 * level_size) HalveTexels(source, &width, &height, source);
         }
 
-        if(specular_map_count > 0 && aiGetMaterialTexture(mat, aiTextureType_SPECULAR, 0, &spec_path,
-                                 0,0,0,0,0,0))
-        {
-            
-        }                
-#endif
+        u8 *resampled = (u8*) ArenaAlloc16(&texture_memory, (size_t)level_size * level_size * 4);
+        ResampleTexels(source, width, height, resampled, level_size, level_size);
+
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, storage_level, 0, 0, entry->layer, level_size, level_size, 1,
+                        GL_RGBA, GL_UNSIGNED_BYTE, resampled);
+
+        texture_memory.used = memory_mark;
+    }
+
+    StateBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    if(from_cooked) CloseCookedTexture(&cooked);
+    else stbi_image_free(texels);
+
+    // A streamed level is one of many, only the whole layer is worth a line
+    if(end_level == array->mip_count)
+    {
+        printf("Loaded %stexture into layer %d of the %dx%d array: %s\n", from_cooked ? "cooked " : "", entry->layer,
+               array->size, array->size, from_cooked ? cooked_path : (char*)entry->path);
+    }
+
+    // The levels that are coarser than the streamed one are already there
+    return needs_mips && end_level == array->mip_count && first_level + 1 < end_level;
+}
+
+static void GenerateArrayMips(TextureArray *array)
+{
+    StateBindTexture(GL_TEXTURE_2D_ARRAY, array->id);
+    glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+    StateBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+static void UploadTexture(TextureEntry *entry)
+{
+    if(entry->array_index >= 0)
+    {
+        TextureArray *array = &texture_bank.arrays[entry->array_index];
+        if(UploadArrayLayer(entry, array->resident_level, array->mip_count)) GenerateArrayMips(array);
+        return;
+    }
+
+    char cooked_path[512];
+    bool prefer_cooked = PreferCookedTexture(entry, cooked_path, sizeof(cooked_path));
+
+    // @Note: A texture that was missing when the arrays were built has no layer to go into
+    if(!entry->id)
+    {
+        printf("%s has no layer in the texture arrays, it is loaded on the next start\n", entry->path);
+        return;
+    }
+
+    if(prefer_cooked && UploadCookedTexture(entry, cooked_path)) return;
+
+    UploadSourceTexture(entry);
+}
+
+static TextureEntry *FindTexture(u8 *path, u64 hash)
+{
+    for(u32 entry_index = 0; entry_index < texture_bank.count; entry_index++)
+    {
+        TextureEntry *entry = &texture_bank.entries[entry_index];
+        if(entry->hash == hash && !strcmp(entry->path, path)) return entry;
+    }
+
+    return 0;
+}
+
+// Without any storage yet
+static TextureEntry *AddTexture(u8 *path, u64 hash, s32 flipped)
+{
+    assert(texture_bank.count < MAX_TEXTURES);
+    
+    TextureEntry *entry = &texture_bank.entries[texture_bank.count++];
+    memset(entry, 0, sizeof(TextureEntry));
+    
+    strncpy(entry->path, path, sizeof(entry->path) - 1);
+    entry->hash = hash;
+    entry->flipped = flipped;
+    entry->array_index = entry->layer = -1;
+
+    return entry;
+}
+
+static TextureEntry *LoadTexture(u8 *path, s32 flipped)
+{
+    // Materials often share textures, only load each of them once
+    u64 hash = fnv_1a(path, strlen(path));
+    
+    TextureEntry *entry = FindTexture(path, hash);
+    if(entry) return entry;
+
+    entry = AddTexture(path, hash, flipped);
+    
+    // Setup Texture
+    glGenTextures(1, &entry->id);
+    
+    UploadTexture(entry);
+    SetTextureParameters(entry->id);
+    
+    return entry;
+}
+
+// Of the cooked texture when it is used, otherwise of the source image
+static bool ReadTextureSize(TextureEntry *entry, s32 *width, s32 *height)
+{
+    char cooked_path[512];
+    CookedTexture cooked;
+
+    if(PreferCookedTexture(entry, cooked_path, sizeof(cooked_path)) && OpenCookedTexture(cooked_path, &cooked))
+    {
+        *width = cooked.header->width;
+        *height = cooked.header->height;
+        CloseCookedTexture(&cooked);
         
-        if(diffuse_map_count > 0)
-        {
-            struct aiString str;
-            aiGetMaterialTexture(mat, aiTextureType_DIFFUSE, 0, &str,
-                                 0,0,0,0,0,0);
-            
-            DiffuseTexture texture;
-            char texture_path[256];
-            
-            strcpy(texture_path, model_folder_path);
-            strcat(texture_path, str.data);
-            
-            texture.id = LoadTexture(texture_path, true);
-            //texture.hash = fnv_1a(str.data, str.length); 
+        return true;
+    }
 
-            result.material.diffuse_map = texture;            
-        }
+    s32 nr_channels;
+    return stbi_info(entry->path, width, height, &nr_channels);
+}
+
+// Of every layer from 'level' down to the smallest one
+static size_t ArrayChainSize(TextureArray *array, s32 level)
+{
+    size_t result = 0;
+    for(; level < array->mip_count; level++)
+    {
+        size_t level_size = (array->size >> level) ? (array->size >> level) : 1;
+        result += level_size * level_size * 4;
+    }
+
+    return result * array->layer_count;
+}
+
+// Storage for 'layer_count' layers and the levels from 'resident_level' on
+static GLuint CreateArrayStorage(TextureArray *array, u32 layer_count)
+{
+    s32 size = (array->size >> array->resident_level) ? (array->size >> array->resident_level) : 1;
+
+    GLuint id;
+    glGenTextures(1, &id);
+    StateBindTexture(GL_TEXTURE_2D_ARRAY, id);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, array->mip_count - array->resident_level, GL_RGBA8, size, size, layer_count);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);	
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    StateBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    return id;
+}
+
+// Moves the layers to the new storage 'id', with the levels both of them have. The old storage
+// began at 'old_resident_level' and is deleted.
+static void ReplaceArrayStorage(TextureArray *array, GLuint id, s32 old_resident_level)
+{
+    s32 first_level = (old_resident_level > array->resident_level) ? old_resident_level : array->resident_level;
+    for(s32 level = first_level; level < array->mip_count; level++)
+    {
+        s32 level_size = (array->size >> level) ? (array->size >> level) : 1;
+        glCopyImageSubData(array->id, GL_TEXTURE_2D_ARRAY, level - old_resident_level, 0, 0, 0,
+                           id, GL_TEXTURE_2D_ARRAY, level - array->resident_level, 0, 0, 0,
+                           level_size, level_size, array->layer_count);
+    }
+
+    StateForgetTexture(array->id);
+    glDeleteTextures(1, &array->id);
+    array->id = id;
+}
+
+// Makes room for 'added_count' more layers of 'size' x 'size'. An array that already exists gets
+// new storage with its layers copied over, the old handle is deleted. A new one starts with only
+// its mip tail.
+static u32 ReserveArrayLayers(s32 size, u32 added_count, u32 *first_layer)
+{
+    u32 array_index = 0;
+    while(array_index < texture_bank.array_count && texture_bank.arrays[array_index].size != size) array_index++;
+
+    if(array_index == texture_bank.array_count)
+    {
+        assert(texture_bank.array_count < MAX_TEXTURE_ARRAYS);
+        
+        TextureArray *array = &texture_bank.arrays[texture_bank.array_count++];
+        memset(array, 0, sizeof(TextureArray));
+        array->size = size;
+        
+        array->mip_count = 1;
+        for(s32 mip_size = size; mip_size > 1; mip_size /= 2) array->mip_count++;
+
+        while((size >> array->tail_level) > TEXTURE_STREAMING_TAIL_SIZE) array->tail_level++;
+        array->resident_level = array->wanted_level = array->tail_level;
+    }
+
+    TextureArray *array = &texture_bank.arrays[array_index];
+    texture_streaming_stats.resident_bytes -= ArrayChainSize(array, array->resident_level);
+
+    GLuint id = CreateArrayStorage(array, array->layer_count + added_count);
+    if(array->layer_count) ReplaceArrayStorage(array, id, array->resident_level);
+    else array->id = id;
+
+    *first_layer = array->layer_count;
+    array->layer_count += added_count;
+
+    texture_streaming_stats.resident_bytes += ArrayChainSize(array, array->resident_level);
+    texture_streaming_stats.streamed_count += added_count;
+
+    return array_index;
+}
 
-        if(ambient_map_count > 0)
+// Puts the maps of the materials that are not loaded yet into the texture arrays, one array per
+// layer size. CreateMaterial then finds them in the bank.
+static void LoadArrayTextures(char *model_folder_path, MaterialData *materials, u32 material_count)
+{
+    TextureEntry *added[MAX_TEXTURES];
+    s32 added_size[MAX_TEXTURES];
+    u32 added_count = 0;
+    
+    for(u32 material_index = 0; material_index < material_count; material_index++)
+    {
+        MaterialData *material = &materials[material_index];
+        u8 *maps[3] = {material->diffuse_map, material->specular_map, material->ambient_map};
+
+        for(u32 map_index = 0; map_index < ArrayCount(maps); map_index++)
         {
-                
-            struct aiString str;
-            aiGetMaterialTexture(mat, aiTextureType_AMBIENT, 0, &str,
-                                 0,0,0,0,0,0);
-            
-            AmbientTexture texture;
-            char texture_path[256];
+            if(!maps[map_index][0]) continue;
             
+            char texture_path[512];
             strcpy(texture_path, model_folder_path);
-            strcat(texture_path, str.data);
+            strcat(texture_path, maps[map_index]);
+
+            u64 hash = fnv_1a(texture_path, strlen(texture_path));
+            if(FindTexture(texture_path, hash)) continue;
+
+            TextureEntry *entry = AddTexture(texture_path, hash, true);
             
-            texture.id = LoadTexture(texture_path, true);
-            result.material.ambient_map = texture;
+            s32 width, height;
+            if(!ReadTextureSize(entry, &width, &height))
+            {
+                printf("Texture was not loaded: %s\n", entry->path);
+                continue;
+            }
+
+            added[added_count] = entry;
+            added_size[added_count] = TextureArraySize(width, height);
+            added_count++;
         }
-        
+    }
+
+    // Layers for all the textures of one size at once, so every array is created or grown only once
+    for(u32 added_index = 0; added_index < added_count; added_index++)
+    {
+        if(added[added_index]->array_index >= 0) continue;
+
+        s32 size = added_size[added_index];
+        u32 same_size_count = 0;
+        for(u32 other_index = added_index; other_index < added_count; other_index++)
+            if(added_size[other_index] == size) same_size_count++;
 
-        if(specular_map_count > 0)
+        u32 layer;
+        u32 array_index = ReserveArrayLayers(size, same_size_count, &layer);
+
+        for(u32 other_index = added_index; other_index < added_count; other_index++)
         {
-                
-            struct aiString str;
-            aiGetMaterialTexture(mat, aiTextureType_SPECULAR, 0, &str,
-                                 0,0,0,0,0,0);
+            if(added_size[other_index] != size) continue;
 
-            SpecularTexture texture;
-            char texture_path[256];
-            
-            strcpy(texture_path, model_folder_path);
-            strcat(texture_path, str.data);
-                        
-            texture.id = LoadTexture(texture_path, true);
-            result.material.specular_map = texture;            
+            added[other_index]->array_index = array_index;
+            added[other_index]->layer = layer++;
         }
+    }
+
+    u32 arrays_without_mips = 0;
+    for(u32 added_index = 0; added_index < added_count; added_index++)
+    {
+        TextureArray *array = &texture_bank.arrays[added[added_index]->array_index];
+        if(UploadArrayLayer(added[added_index], array->resident_level, array->mip_count))
+            arrays_without_mips |= 1 << added[added_index]->array_index;
+    }
+
+    for(u32 array_index = 0; array_index < texture_bank.array_count; array_index++)
+    {
+        if(arrays_without_mips & (1 << array_index)) GenerateArrayMips(&texture_bank.arrays[array_index]);
+    }
+}
+
+u32 GetTextureArrays(u32 *ids)
+{
+    for(u32 array_index = 0; array_index < texture_bank.array_count; array_index++)
+        ids[array_index] = texture_bank.arrays[array_index].id;
+
+    return texture_bank.array_count;
+}
+
+void RequestArrayDetail(u32 array_index, f32 uv_per_pixel)
+{
+    if(array_index >= texture_bank.array_count) return;
+
+    TextureArray *array = &texture_bank.arrays[array_index];
+    if(array->requested_uv_per_pixel == 0.0f || uv_per_pixel < array->requested_uv_per_pixel)
+        array->requested_uv_per_pixel = uv_per_pixel;
+}
+
+static u64 array_frame_index;
+
+// One level finer for every layer, from the cooked files or the images. Returns the bytes uploaded.
+static size_t GrowArray(u32 array_index)
+{
+    TextureArray *array = &texture_bank.arrays[array_index];
+    assert(array->resident_level > 0);
+
+    s32 old_resident_level = array->resident_level;
+    texture_streaming_stats.resident_bytes -= ArrayChainSize(array, old_resident_level);
+
+    array->resident_level--;
+    ReplaceArrayStorage(array, CreateArrayStorage(array, array->layer_count), old_resident_level);
+
+    for(u32 entry_index = 0; entry_index < texture_bank.count; entry_index++)
+    {
+        TextureEntry *entry = &texture_bank.entries[entry_index];
+        if(entry->array_index == (s32)array_index) UploadArrayLayer(entry, array->resident_level, array->resident_level + 1);
+    }
+
+    texture_streaming_stats.resident_bytes += ArrayChainSize(array, array->resident_level);
+    texture_streaming_stats.levels_uploaded++;
+
+    size_t level_size = (size_t)(array->size >> array->resident_level);
+    return level_size * level_size * 4 * array->layer_count;
+}
+
+// The finest level goes, the others are copied to smaller storage
+static void ShrinkArray(TextureArray *array)
+{
+    assert(array->resident_level < array->tail_level);
+
+    s32 old_resident_level = array->resident_level;
+    texture_streaming_stats.resident_bytes -= ArrayChainSize(array, old_resident_level);
+
+    array->resident_level++;
+    ReplaceArrayStorage(array, CreateArrayStorage(array, array->layer_count), old_resident_level);
+
+    texture_streaming_stats.resident_bytes += ArrayChainSize(array, array->resident_level);
+    texture_streaming_stats.levels_evicted++;
+}
+
+// Like FindEvictionVictim in texture_streaming.c
+static TextureArray *FindArrayEvictionVictim(TextureArray *keep, bool forced)
+{
+    TextureArray *victim = 0;
+
+    for(u32 array_index = 0; array_index < texture_bank.array_count; array_index++)
+    {
+        TextureArray *array = &texture_bank.arrays[array_index];
+        if(array == keep || array->resident_level >= array->tail_level) continue;
+
+        if(!forced && array->last_used_frame == array_frame_index && array->resident_level >= array->wanted_level) continue;
 
-        struct aiColor4D v;
-        if(AI_SUCCESS == aiGetMaterialColor(mat, AI_MATKEY_COLOR_DIFFUSE, &v))
+        if(!victim ||
+           array->last_used_frame < victim->last_used_frame ||
+           (array->last_used_frame == victim->last_used_frame && array->resident_level < victim->resident_level))
         {
-            result.material.diffuse = create_vec3(v.r, v.g, v.b);
+            victim = array;
         }
+    }
+
+    return victim;
+}
+
+void UpdateArrayStreaming(void)
+{
+    array_frame_index++;
+
+    for(u32 array_index = 0; array_index < texture_bank.array_count; array_index++)
+    {
+        TextureArray *array = &texture_bank.arrays[array_index];
+        if(array->requested_uv_per_pixel == 0.0f) continue;
+
+        f32 level = floorf(log2f(array->size * array->requested_uv_per_pixel));
+
+        array->wanted_level = (level <= 0.0f) ? 0 : (level >= (f32)array->tail_level) ? array->tail_level : (s32)level;
+        array->last_used_frame = array_frame_index;
+        array->requested_uv_per_pixel = 0.0f;
+    }
+
+    while(texture_streaming_stats.resident_bytes > texture_streaming_stats.budget)
+    {
+        TextureArray *victim = FindArrayEvictionVictim(0, false);
+        if(!victim) victim = FindArrayEvictionVictim(0, true);
+        if(!victim) break;
 
-        if(AI_SUCCESS == aiGetMaterialColor(mat, AI_MATKEY_COLOR_SPECULAR, &v))
+        ShrinkArray(victim);
+    }
+
+    // A level of a large array can go over the limit on its own, it is still one per frame then
+    size_t uploaded = 0;
+    while(uploaded < TEXTURE_STREAMING_UPLOAD_LIMIT)
+    {
+        u32 next = texture_bank.array_count;
+        for(u32 array_index = 0; array_index < texture_bank.array_count; array_index++)
         {
-            result.material.specular = create_vec3(v.r, v.g, v.b);
+            TextureArray *array = &texture_bank.arrays[array_index];
+            if(array->last_used_frame != array_frame_index || array->resident_level <= array->wanted_level) continue;
+
+            if(next == texture_bank.array_count ||
+               array->resident_level - array->wanted_level > texture_bank.arrays[next].resident_level - texture_bank.arrays[next].wanted_level)
+            {
+                next = array_index;
+            }
         }
 
-        if(AI_SUCCESS == aiGetMaterialColor(mat, AI_MATKEY_COLOR_AMBIENT, &v))
+        if(next == texture_bank.array_count) break;
+
+        TextureArray *array = &texture_bank.arrays[next];
+        size_t level_size = (size_t)(array->size >> (array->resident_level - 1));
+        level_size *= level_size * 4 * array->layer_count;
+
+        bool fits = true;
+        while(texture_streaming_stats.resident_bytes + level_size > texture_streaming_stats.budget)
         {
-            result.material.ambient = create_vec3(v.r, v.g, v.b);
+            TextureArray *victim = FindArrayEvictionVictim(array, false);
+            if(!victim)
+            {
+                fits = false;
+                break;
+            }
+
+            ShrinkArray(victim);
         }
 
-        float s;
-        if(AI_SUCCESS == aiGetMaterialFloat(mat, AI_MATKEY_SHININESS, &s))
+        if(!fits) break;
+
+        uploaded += GrowArray(next);
+    }
+}
+
+void ReloadTextures(void)
+{
+    for(u32 entry_index = 0; entry_index < texture_bank.count; entry_index++)
+    {
+        TextureEntry *entry = &texture_bank.entries[entry_index];
+        
+        char cooked_path[512];
+        time_t source_mod = FileModifiedTime(entry->path);
+        time_t cooked_mod = CookedPathFromSource(cooked_path, sizeof(cooked_path), entry->path, COOKED_TEXTURE_EXTENSION) ?
+            FileModifiedTime(cooked_path) : 0;
+
+        if(source_mod > entry->source_mod || cooked_mod > entry->cooked_mod)
         {
-            result.material.shininess = s;
+            printf("Reloading texture %s\n", entry->path);
+            UploadTexture(entry);
         }
-        else
-            result.material.shininess = 32.0f;
-        
     }
+}
+
+// Fills the buffers of the mesh from its CPU copies, 'resized' re-specifies them instead of updating in place
+static void WriteMeshBuffers(ArenaMemory *scratch, Mesh *mesh, bool resized)
+{
+    size_t vertex_size = mesh->vertex_count * sizeof(PackedVertex);
+    
+    if(resized) glNamedBufferData(mesh->vbo, vertex_size, mesh->vertices, GL_STATIC_DRAW);
+    else glNamedBufferSubData(mesh->vbo, 0, vertex_size, mesh->vertices);
 
-    result.va = GenVertArr();
-    VertexBuffer vbo = GenVertBuf(vertices, result.vertex_count * sizeof(Vertex));
-    IndexBuffer ebo = GenIndexBuf(result.indices, result.index_count * sizeof(u32));
+    void *indices = mesh->indices;
+    size_t index_size = mesh->index_count * sizeof(u32);
+    size_t scratch_mark = scratch->used;
+    
+    // Small meshes can address all their vertices with 16-bit indices
+    if(mesh->vertex_count < 65536)
+    {
+        u16 *indices16 = (u16*) ArenaAlloc16(scratch, mesh->index_count * sizeof(u16));
+        for(u32 index = 0; index < mesh->index_count; index++)
+            indices16[index] = (u16)mesh->indices[index];
+
+        indices = indices16;
+        index_size = mesh->index_count * sizeof(u16);
+        mesh->index_type = GL_UNSIGNED_SHORT;
+    }
+    else
+    {
+        mesh->index_type = GL_UNSIGNED_INT;
+    }
+    
+    if(resized) glNamedBufferData(mesh->ebo, index_size, indices, GL_STATIC_DRAW);
+    else glNamedBufferSubData(mesh->ebo, 0, index_size, indices);
+
+    scratch->used = scratch_mark;
+}
+
+// Attributes of PackedVertex, with the buffers bound to the vertex array
+static void BindPackedVertexLayout(ArenaMemory *scratch, VertexArray *va, VertexBuffer vbo, IndexBuffer ebo)
+{
+    size_t scratch_mark = scratch->used;
 
     // The layout will have 3 attributes
     VertexLayout va_layout = {0};
     va_layout.attributes = (VertexAttribute*)ArenaAlloc16(scratch, 3 * sizeof(VertexAttribute));
     
-    VertLayoutPush(&va_layout, 3, GL_FLOAT, GL_FALSE); // Position
-    VertLayoutPush(&va_layout, 3, GL_FLOAT, GL_FALSE); // Normal
-    VertLayoutPush(&va_layout, 2, GL_FLOAT, GL_FALSE); // Texture
+    VertLayoutPush(&va_layout, 4, GL_UNSIGNED_SHORT, GL_TRUE); // Position
+    VertLayoutPush(&va_layout, 2, GL_SHORT, GL_TRUE); // Normal
+    VertLayoutPush(&va_layout, 2, GL_HALF_FLOAT, GL_FALSE); // Texture
+
+    assert(va_layout.stride == sizeof(PackedVertex));
 
-    BindVertArr(result.va);               
+    BindVertArr(*va);
     BindVertBuf(vbo);
     BindIndBuf(ebo);
-    VABindLayout(&result.va, va_layout);
+    VABindLayout(va, va_layout);
     
     UnbindVertArr();
     UnbindVertBuf();
     UnbindIndBuf();    
 
+    scratch->used = scratch_mark;
+}
+
+// Only the position of PackedVertex, for vertex arrays that read nothing else
+static void BindPositionLayout(ArenaMemory *scratch, VertexArray *va, VertexBuffer vbo, IndexBuffer ebo)
+{
+    size_t scratch_mark = scratch->used;
+
+    VertexLayout va_layout = {0};
+    va_layout.attributes = (VertexAttribute*)ArenaAlloc16(scratch, 1 * sizeof(VertexAttribute));
+    
+    VertLayoutPush(&va_layout, 4, GL_UNSIGNED_SHORT, GL_TRUE); // Position
+
+    assert(va_layout.stride == sizeof(((PackedVertex*)0)->position));
+
+    BindVertArr(*va);
+    BindVertBuf(vbo);
+    BindIndBuf(ebo);
+    VABindLayout(va, va_layout);
+    
+    UnbindVertArr();
+    UnbindVertBuf();
+    UnbindIndBuf();    
+
+    scratch->used = scratch_mark;
+}
+
+// Uploads the clustered and quantized data of the importer or the cooker
+static void UploadMesh(ArenaMemory *scratch,
+                       Mesh *mesh,
+                       MeshData *data)
+{
+    mesh->vertices = data->vertices;
+    mesh->indices = data->indices;
+    mesh->vertex_count = data->vertex_count;
+    mesh->index_count = data->index_count;
+    mesh->aabb_min = data->aabb_min;
+    mesh->aabb_max = data->aabb_max;
+    mesh->sphere_center = data->sphere_center;
+    mesh->sphere_radius = data->sphere_radius;
+    mesh->uv_density = data->uv_density;
+    mesh->meshlets = data->meshlets;
+    mesh->meshlet_count = data->meshlet_count;
+    
+    mesh->va = GenVertArr();
+    VertexBuffer vbo = GenVertBuf(0, 0);
+    IndexBuffer ebo = GenIndexBuf(0, 0);
+
+    mesh->vbo = vbo.renderer_id;
+    mesh->ebo = ebo.renderer_id;
+    
+    WriteMeshBuffers(scratch, mesh, true);
+    BindPackedVertexLayout(scratch, &mesh->va, vbo, ebo);
+}
+
+// The range of the mesh in the shared buffers, 'positions' has room for its position stream
+static void WriteSharedMesh(ArenaMemory *scratch, Model *model, Mesh *mesh, u8 *positions)
+{
+    size_t position_size = sizeof(((PackedVertex*)0)->position);
+
+    glNamedBufferSubData(model->shared_vbo, mesh->base_vertex * sizeof(PackedVertex),
+                         mesh->vertex_count * sizeof(PackedVertex), mesh->vertices);
+
+    if(model->shared_index_type == GL_UNSIGNED_SHORT)
+    {
+        size_t scratch_mark = scratch->used;
+        u16 *indices16 = (u16*) ArenaAlloc16(scratch, mesh->index_count * sizeof(u16));
+        for(u32 index = 0; index < mesh->index_count; index++)
+            indices16[index] = (u16)mesh->indices[index];
+
+        glNamedBufferSubData(model->shared_ebo, mesh->first_index * sizeof(u16),
+                             mesh->index_count * sizeof(u16), indices16);
+        scratch->used = scratch_mark;
+    }
+    else
+    {
+        glNamedBufferSubData(model->shared_ebo, mesh->first_index * sizeof(u32),
+                             mesh->index_count * sizeof(u32), mesh->indices);
+    }
+
+    for(u32 vertex = 0; vertex < mesh->vertex_count; vertex++)
+        memcpy(positions + vertex * position_size, mesh->vertices[vertex].position, position_size);
+
+    glNamedBufferSubData(model->position_vbo, mesh->base_vertex * position_size,
+                         mesh->vertex_count * position_size, positions);
+}
+
+// Every mesh one after the other in one vertex buffer and one index buffer, so the whole model
+// can be drawn with a single multi-draw indirect call. The indices stay relative to their mesh,
+// the draws add the base vertex, so they are 16-bit unless a single mesh has 65536 vertices or
+// more. One call has one index type, so that one mesh makes the whole buffer 32-bit. The positions
+// are also copied into a stream of their own, depth only passes fetch 8 bytes per vertex instead of 16.
+static void UploadSharedBuffers(ArenaMemory *scratch, Model *model)
+{
+    u32 vertex_count = 0, index_count = 0, max_vertex_count = 0;
+    for(u32 mesh_index = 0; mesh_index < model->mesh_count; mesh_index++)
+    {
+        Mesh *mesh = &model->meshes[mesh_index];
+        mesh->base_vertex = vertex_count;
+        mesh->first_index = index_count;
+
+        vertex_count += mesh->vertex_count;
+        index_count += mesh->index_count;
+        if(mesh->vertex_count > max_vertex_count) max_vertex_count = mesh->vertex_count;
+    }
+
+    if(!model->shared_va.renderer_id)
+    {
+        model->shared_va = GenVertArr();
+        VertexBuffer vbo = GenVertBuf(0, 0);
+        IndexBuffer ebo = GenIndexBuf(0, 0);
+
+        model->shared_vbo = vbo.renderer_id;
+        model->shared_ebo = ebo.renderer_id;
+
+        BindPackedVertexLayout(scratch, &model->shared_va, vbo, ebo);
+
+        model->position_va = GenVertArr();
+        VertexBuffer position_vbo = GenVertBuf(0, 0);
+        model->position_vbo = position_vbo.renderer_id;
+
+        BindPositionLayout(scratch, &model->position_va, position_vbo, ebo);
+    }
+
+    size_t position_size = sizeof(((PackedVertex*)0)->position);
+    glNamedBufferData(model->shared_vbo, vertex_count * sizeof(PackedVertex), 0, GL_STATIC_DRAW);
+    glNamedBufferData(model->position_vbo, vertex_count * position_size, 0, GL_STATIC_DRAW);
+
+    model->shared_index_type = (max_vertex_count < 65536) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    size_t index_size = (model->shared_index_type == GL_UNSIGNED_SHORT) ? sizeof(u16) : sizeof(u32);
+    glNamedBufferData(model->shared_ebo, index_count * index_size, 0, GL_STATIC_DRAW);
+
+    size_t scratch_mark = scratch->used;
+    u8 *positions = (u8*) ArenaAlloc16(scratch, max_vertex_count * position_size);
+
+    for(u32 mesh_index = 0; mesh_index < model->mesh_count; mesh_index++)
+        WriteSharedMesh(scratch, model, &model->meshes[mesh_index], positions);
+
+    scratch->used = scratch_mark;
+}
+
+// Only the ranges of the meshes flagged in 'changed' are written again. Their sizes have to be
+// the same as when the buffers were made, so every range and the index type stay what they were.
+static void UpdateSharedBuffers(ArenaMemory *scratch, Model *model, bool *changed)
+{
+    u32 max_vertex_count = 0;
+    for(u32 mesh_index = 0; mesh_index < model->mesh_count; mesh_index++)
+    {
+        if(changed[mesh_index] && model->meshes[mesh_index].vertex_count > max_vertex_count)
+            max_vertex_count = model->meshes[mesh_index].vertex_count;
+    }
+
+    size_t scratch_mark = scratch->used;
+    u8 *positions = (u8*) ArenaAlloc16(scratch, max_vertex_count * sizeof(((PackedVertex*)0)->position));
+
+    for(u32 mesh_index = 0; mesh_index < model->mesh_count; mesh_index++)
+    {
+        if(changed[mesh_index]) WriteSharedMesh(scratch, model, &model->meshes[mesh_index], positions);
+    }
+
+    scratch->used = scratch_mark;
+}
+
+static void DeleteMesh(Mesh *mesh)
+{
+    StateForgetVertexArray(mesh->va.renderer_id);
+    StateForgetBuffer(mesh->vbo);
+    StateForgetBuffer(mesh->ebo);
+
+    glDeleteVertexArrays(1, &mesh->va.renderer_id);
+    glDeleteBuffers(1, &mesh->vbo);
+    glDeleteBuffers(1, &mesh->ebo);
+}
+
+// The reload arena is reset every time, so the mesh copies what it keeps. Reuses the
+// existing array when the new data fits.
+// @Note: Grown arrays are not given back to the arena until the program restarts.
+static void *KeepArray(ArenaMemory *memory, void *existing, u32 existing_count, void *source, u32 count, size_t element_size)
+{
+    void *result = (existing && count <= existing_count) ? existing : ArenaAlloc16(memory, count * element_size);
+    memcpy(result, source, count * element_size);
+
     return result;
 }
 
-// We will process the nodes in a recursive manner
-static void ProcessAssimpNode(ArenaMemory *scratch,
-                              Model *model,
-                              struct aiNode *node,
-                              const struct aiScene *scene)
+// Updates the mesh in place when its data changed, returns true when it did
+static bool ReloadMesh(ArenaMemory *memory, ArenaMemory *scratch, Mesh *mesh, MeshData *data)
 {
-    static u32 mesh_index = 0;
+    bool same_size = (mesh->vertex_count == data->vertex_count && mesh->index_count == data->index_count);
     
-    struct aiNode *root_node = scene->mRootNode;
+    if(same_size &&
+       mesh->meshlet_count == data->meshlet_count &&
+       !memcmp(mesh->vertices, data->vertices, data->vertex_count * sizeof(PackedVertex)) &&
+       !memcmp(mesh->indices, data->indices, data->index_count * sizeof(u32)))
+    {
+        return false;
+    }
+
+    mesh->vertices = (PackedVertex*) KeepArray(memory, mesh->vertices, mesh->vertex_count, data->vertices, data->vertex_count, sizeof(PackedVertex));
+    mesh->indices = (u32*) KeepArray(memory, mesh->indices, mesh->index_count, data->indices, data->index_count, sizeof(u32));
+    mesh->meshlets = (Meshlet*) KeepArray(memory, mesh->meshlets, mesh->meshlet_count, data->meshlets, data->meshlet_count, sizeof(Meshlet));
+
+    // The index type can only change together with the vertex count
+    mesh->vertex_count = data->vertex_count;
+    mesh->index_count = data->index_count;
+    mesh->meshlet_count = data->meshlet_count;
+    mesh->aabb_min = data->aabb_min;
+    mesh->aabb_max = data->aabb_max;
+    mesh->sphere_center = data->sphere_center;
+    mesh->sphere_radius = data->sphere_radius;
+    mesh->uv_density = data->uv_density;
     
-    for(u32 node_mesh_index = 0; node_mesh_index < node->mNumMeshes; node_mesh_index++)
+    WriteMeshBuffers(scratch, mesh, !same_size);
+
+    return true;
+}
+
+static Material CreateMaterial(char *model_folder_path, MaterialData *data)
+{
+    Material result = {0};
+    char texture_path[512];
+
+    result.diffuse = data->diffuse;
+    result.specular = data->specular;
+    result.ambient = data->ambient;
+    result.shininess = data->shininess;
+    result.double_sided = data->double_sided != 0;
+    result.diffuse_map.layer = result.specular_map.layer = result.ambient_map.layer = -1;
+
+    if(data->diffuse_map[0])
     {
-        struct aiMesh *mesh = scene->mMeshes[node->mMeshes[node_mesh_index]];
-        model->meshes[model->mesh_count++] = CreateMeshFromAssimp(scratch, model->model_folder_path, mesh, scene);
+        strcpy(texture_path, model_folder_path);
+        strcat(texture_path, data->diffuse_map);
+        
+        TextureEntry *texture = LoadTexture(texture_path, true);
+        result.diffuse_map.id = texture->id;
+        result.diffuse_map.array = (texture->array_index >= 0) ? texture->array_index : 0;
+        result.diffuse_map.layer = texture->layer;
+        result.diffuse_map.hash = fnv_1a(data->diffuse_map, strlen(data->diffuse_map));
     }
 
-    // Process children nodes
-    for(u32 child_index = 0; child_index < node->mNumChildren; child_index++)
+    if(data->specular_map[0])
     {
+        strcpy(texture_path, model_folder_path);
+        strcat(texture_path, data->specular_map);
+        
+        TextureEntry *texture = LoadTexture(texture_path, true);
+        result.specular_map.id = texture->id;
+        result.specular_map.array = (texture->array_index >= 0) ? texture->array_index : 0;
+        result.specular_map.layer = texture->layer;
+        result.specular_map.hash = fnv_1a(data->specular_map, strlen(data->specular_map));
+    }
+
+    if(data->ambient_map[0])
+    {
+        strcpy(texture_path, model_folder_path);
+        strcat(texture_path, data->ambient_map);
+        
+        TextureEntry *texture = LoadTexture(texture_path, true);
+        result.ambient_map.id = texture->id;
+        result.ambient_map.array = (texture->array_index >= 0) ? texture->array_index : 0;
+        result.ambient_map.layer = texture->layer;
+        result.ambient_map.hash = fnv_1a(data->ambient_map, strlen(data->ambient_map));
+    }
+
+    return result;
+}
+
+static void WatchFile(Model *model, char *path)
+{
+    assert(model->watched_file_count < ArrayCount(model->watched_files));
+    
+    WatchedFile *file = &model->watched_files[model->watched_file_count++];
+    strcpy(file->path, path);
+    file->mod = FileModifiedTime(path);
+}
+
+// Reads the cooked model unless the source or one of its dependencies changed after it
+// was cooked, then the source is imported instead. Also decides which files are watched.
+static bool LoadModelData(ArenaMemory *memory, ArenaMemory *scratch, Model *model, ModelData *data)
+{
+    char source_path[512];
+    strcpy(source_path, model->model_folder_path);
+    strcat(source_path, model->model_name);
+
+    char cooked_path[512];
+    bool has_cooked_path = CookedPathFromSource(cooked_path, sizeof(cooked_path), source_path, COOKED_MODEL_EXTENSION);
+    
+    size_t memory_mark = memory->used;
+    bool loaded = false;
+    
+    if(has_cooked_path && ReadCookedModel(memory, cooked_path, data))
+    {
+        time_t cooked_mod = FileModifiedTime(cooked_path);
+        loaded = (FileModifiedTime(source_path) <= cooked_mod);
+        
+        for(u32 dependency_index = 0; loaded && dependency_index < data->dependency_count; dependency_index++)
+        {
+            char dependency_path[512];
+            strcpy(dependency_path, model->model_folder_path);
+            strcat(dependency_path, data->dependencies[dependency_index]);
+
+            if(FileModifiedTime(dependency_path) > cooked_mod) loaded = false;
+        }
+
+        if(loaded) printf("Loaded cooked model: %s\n", cooked_path);
+        else
+        {
+            printf("Cooked data of %s is out of date\n", source_path);
+            memory->used = memory_mark;
+        }
+    }
+
+    // Importing does all the clustering and quantization again, only meant for
+    // assets that have not been through cook.bat yet
+    if(!loaded)
+    {
+        printf("Importing %s at runtime\n", source_path);
+        loaded = ImportModel(memory, scratch, model->model_folder_path, model->model_name, data);
+    }
+
+    if(!loaded) return false;
+    
+    model->watched_file_count = 0;
+    WatchFile(model, source_path);
+    if(has_cooked_path) WatchFile(model, cooked_path);
 
-        ProcessAssimpNode(scratch, model, node->mChildren[child_index], scene);        
+    for(u32 dependency_index = 0; dependency_index < data->dependency_count; dependency_index++)
+    {
+        char dependency_path[512];
+        strcpy(dependency_path, model->model_folder_path);
+        strcat(dependency_path, data->dependencies[dependency_index]);
+        
+        WatchFile(model, dependency_path);
     }
 
+    return true;
 }
 
 // Relative to the asset folder
-Model LoadModelFromAssimp(ArenaMemory *mesh_memory, ArenaMemory *scratch, u8 *model_folder, u8 *model_name)
+Model LoadModel(ArenaMemory *mesh_memory, ArenaMemory *scratch, u8 *model_folder, u8 *model_name)
 {
     Model result = {0};
 
-    char model_path[512];
-    strcpy(model_path, "assets\\");
-    strcat(model_path, model_folder);        
-    strcat(model_path, "\\");
+    strcpy(result.model_folder_path, "assets\\");
+    strcat(result.model_folder_path, model_folder);        
+    strcat(result.model_folder_path, "\\");
+    strncpy(result.model_name, model_name, sizeof(result.model_name) - 1);
+    
+    ModelData data;
+    bool loaded = LoadModelData(mesh_memory, scratch, &result, &data);
+    assert(loaded);
+
+    size_t scratch_mark = scratch->used;
 
-    // Store the relative path to the model folder
-    strcpy(result.model_folder_path, model_path);
+#if MATERIAL_TEXTURE_ARRAYS
+    LoadArrayTextures(result.model_folder_path, data.materials, data.material_count);
+#endif
     
-    strcat(model_path, model_name);
+    // Materials are shared between meshes, so their textures are only loaded once
+    Material *materials = (Material*) ArenaAlloc16(scratch, data.material_count * sizeof(Material));
+    for(u32 material_index = 0; material_index < data.material_count; material_index++)
+    {
+        materials[material_index] = CreateMaterial(result.model_folder_path, &data.materials[material_index]);
+    }
+
+    result.mesh_count = data.mesh_count;
+    result.meshes = (Mesh*) ArenaAlloc16(mesh_memory, result.mesh_count * sizeof(Mesh));
+
+    for(u32 mesh_index = 0; mesh_index < data.mesh_count; mesh_index++)
+    {
+        Mesh *mesh = &result.meshes[mesh_index];
+        memset(mesh, 0, sizeof(Mesh));
+        
+        mesh->material = materials[data.meshes[mesh_index].material_index];
+        mesh->material_index = data.meshes[mesh_index].material_index;
+        UploadMesh(scratch, mesh, &data.meshes[mesh_index]);
+    }
+
+    UploadSharedBuffers(scratch, &result);
+
+    result.instances = data.instances;
+    result.instance_count = data.instance_count;
+
+    scratch->used = scratch_mark;
     
-    const struct aiScene *scene = aiImportFile(model_path, aiProcess_Triangulate);
+    return result;
+}
+
+bool ReloadModel(ArenaMemory *mesh_memory, ArenaMemory *scratch, Model *model)
+{
+    bool changed = false;
+    for(u32 file_index = 0; file_index < model->watched_file_count; file_index++)
+    {
+        WatchedFile *file = &model->watched_files[file_index];
+        if(FileModifiedTime(file->path) > file->mod) changed = true;
+    }
 
-    assert(scene);
-    assert(scene->mFlags | AI_SCENE_FLAGS_INCOMPLETE);
+    if(!changed) return false;
 
-    struct aiNode *root_node = scene->mRootNode;
+    printf("Reloading model %s%s\n", model->model_folder_path, model->model_name);
+
+    if(!reload_memory.buffer) InitArena(&reload_memory, ALLOC_MEM(RELOAD_MEMORY_SIZE), RELOAD_MEMORY_SIZE);
+    ResetArena(&reload_memory);
     
-    // Allocate enough meshes for our model
-    result.mesh_count = 0;
-    result.meshes = (Mesh*) ArenaAlloc16(mesh_memory, scene->mNumMeshes * sizeof(Mesh));
+    // On failure the old model stays as it is, it is tried again once the files change
+    ModelData data;
+    if(!LoadModelData(&reload_memory, scratch, model, &data))
+    {
+        printf("Reloading failed, keeping the old model\n");
+        return false;
+    }
     
-    // When loading a model, we will cache up to 64 hashes of the image path
-    TextureHashes tex_hashes = {0};
+    size_t scratch_mark = scratch->used;
+
+#if MATERIAL_TEXTURE_ARRAYS
+    LoadArrayTextures(model->model_folder_path, data.materials, data.material_count);
+#endif
     
-    // Begin by processing the root node
-    ProcessAssimpNode(scratch, &result, root_node, scene);
-           
-    return result;
+    Material *materials = (Material*) ArenaAlloc16(scratch, data.material_count * sizeof(Material));
+    for(u32 material_index = 0; material_index < data.material_count; material_index++)
+    {
+        materials[material_index] = CreateMaterial(model->model_folder_path, &data.materials[material_index]);
+    }
+
+    u32 reloaded_count = 0;
+
+    // The shared buffers are laid out again only when a mesh changed its size
+    bool *mesh_changed = 0;
+    bool mesh_resized = false;
+    
+    if(data.mesh_count == model->mesh_count)
+    {
+        mesh_changed = (bool*) ArenaAlloc16(scratch, data.mesh_count * sizeof(bool));
+
+        // Same structure, only the meshes that differ are uploaded again
+        for(u32 mesh_index = 0; mesh_index < data.mesh_count; mesh_index++)
+        {
+            Mesh *mesh = &model->meshes[mesh_index];
+            MeshData *mesh_data = &data.meshes[mesh_index];
+            bool same_size = (mesh->vertex_count == mesh_data->vertex_count && mesh->index_count == mesh_data->index_count);
+            
+            mesh->material = materials[mesh_data->material_index];
+            mesh->material_index = mesh_data->material_index;
+            mesh_changed[mesh_index] = ReloadMesh(mesh_memory, scratch, mesh, mesh_data);
+            if(!mesh_changed[mesh_index]) continue;
+
+            reloaded_count++;
+            if(!same_size) mesh_resized = true;
+        }
+    }
+    else
+    {
+        // Meshes were added or removed, there is nothing to match them up with
+        for(u32 mesh_index = 0; mesh_index < model->mesh_count; mesh_index++)
+            DeleteMesh(&model->meshes[mesh_index]);
+
+        model->mesh_count = data.mesh_count;
+        model->meshes = (Mesh*) ArenaAlloc16(mesh_memory, model->mesh_count * sizeof(Mesh));
+        
+        for(u32 mesh_index = 0; mesh_index < data.mesh_count; mesh_index++)
+        {
+            MeshData *mesh_data = &data.meshes[mesh_index];
+            Mesh *mesh = &model->meshes[mesh_index];
+            memset(mesh, 0, sizeof(Mesh));
+
+            mesh_data->vertices = (PackedVertex*) KeepArray(mesh_memory, 0, 0, mesh_data->vertices, mesh_data->vertex_count, sizeof(PackedVertex));
+            mesh_data->indices = (u32*) KeepArray(mesh_memory, 0, 0, mesh_data->indices, mesh_data->index_count, sizeof(u32));
+            mesh_data->meshlets = (Meshlet*) KeepArray(mesh_memory, 0, 0, mesh_data->meshlets, mesh_data->meshlet_count, sizeof(Meshlet));
+            
+            mesh->material = materials[mesh_data->material_index];
+            mesh->material_index = mesh_data->material_index;
+            UploadMesh(scratch, mesh, mesh_data);
+        }
+
+        reloaded_count = data.mesh_count;
+        mesh_resized = true;
+    }
+
+    if(mesh_resized) UploadSharedBuffers(scratch, model);
+    else if(reloaded_count) UpdateSharedBuffers(scratch, model, mesh_changed);
+    
+    model->instances = (MeshInstance*) KeepArray(mesh_memory, model->instances, model->instance_count,
+                                                 data.instances, data.instance_count, sizeof(MeshInstance));
+    model->instance_count = data.instance_count;
+    
+    scratch->used = scratch_mark;
+
+    printf("Reloaded %u of %u meshes\n", reloaded_count, model->mesh_count);
+    
+    return true;
 }
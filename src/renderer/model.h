@@ -2,32 +2,46 @@
 #define MODEL_H
 
 #include <stdbool.h>
+#include <time.h> // time_t
 
 #include "vertex_array.h"
+#include "meshlet.h"
+#include "model_import.h"
 #include "..\memory.h"
 #include "..\gfx_math.h"
 #include "..\defines.h"
 
-typedef struct {
-    vec3 position;
-    vec3 normal;
-    vec2 tex_coords;    
-} Vertex;
+// Group the textures of a model into GL_TEXTURE_2D_ARRAYs by size, so every texture of a
+// frame can be bound at once. Layers are square powers of two, other textures are resampled.
+// The arrays are streamed a level at a time for all their layers, see UpdateArrayStreaming.
+#ifndef MATERIAL_TEXTURE_ARRAYS
+#define MATERIAL_TEXTURE_ARRAYS 1
+#endif
 
-// Id: opengl texture handle
+// Texture units, one array is bound to each
+#define MAX_TEXTURE_ARRAYS 16
+
+// Id: opengl texture handle, 0 with MATERIAL_TEXTURE_ARRAYS
+// array, layer: where the texture is with MATERIAL_TEXTURE_ARRAYS, layer is -1 when there is none
 // hash: the hash of the relative path
 typedef struct {
     u32 id;
+    u32 array;
+    s32 layer;
     u64 hash;
 } DiffuseTexture;
 
 typedef struct {
     u32 id;
+    u32 array;
+    s32 layer;
     u64 hash;    
 } SpecularTexture;
 
 typedef struct {
     u32 id;
+    u32 array;
+    s32 layer;
     u64 hash;       
 } AmbientTexture;
 
@@ -39,34 +53,127 @@ typedef struct {
     AmbientTexture ambient_map;
     
     float shininess;
+    bool double_sided; // See MaterialData
 } Material;
 
 typedef struct {
-    //Vertex  *vertices; // We don't need to store vertices on the CPU side after we upload it to the GPU?
+    // CPU copies of what is on the GPU, a reload compares against them to find the meshes that changed
+    PackedVertex *vertices;
     u32 *indices;
     
     u32 vertex_count, index_count;
+    u32 index_type; // GL_UNSIGNED_SHORT for meshes below 65536 vertices, otherwise GL_UNSIGNED_INT
+
+    // Positions are quantized relative to the AABB, the shader needs it to decode them
+    vec3 aabb_min, aabb_max;
+
+    // See MeshData, mesh space like the AABB
+    vec3 sphere_center;
+    f32 sphere_radius;
+
+    f32 uv_density; // See MeshData
     
     Material material;
+    u32 material_index; // Meshes with the same index share the material
+
+    // Clusters of the index buffer, used for culling below mesh granularity
+    Meshlet *meshlets;
+    u32 meshlet_count;
 
     VertexArray va;
+    u32 vbo, ebo; // Kept so a reload can update them in place
+
+    // Where the mesh starts in the shared buffers of its model
+    u32 base_vertex, first_index;
 } Mesh;
 
-#define MAX_HASHES 64
+// Every texture loaded so far, shared between materials and polled for hot reloading
+#define MAX_TEXTURES 256
+typedef struct {
+    u8 path[512]; // The source image
+    u64 hash;     // Of the path
+    u32 id;       // OpenGL texture handle
+    s32 flipped;
+
+    // When the data on the GPU was read, 0 when the file did not exist
+    time_t source_mod, cooked_mod;
+
+    // Of the current storage, a reload with the same shape updates it in place
+    s32 width, height, mip_count;
+
+    // Index into TextureBank.arrays and the layer there, -1 when the texture has its own 'id'
+    s32 array_index, layer;
+} TextureEntry;
+
 typedef struct {
-    u64 hash[MAX_HASHES]; // Hash (key)
-    u32 index[MAX_HASHES]; // Index to texture (value)
+    u32 id; // GL_TEXTURE_2D_ARRAY, holds the levels from 'resident_level' on
+    s32 size; // Width and height of every layer at level 0
+    s32 mip_count;
+    u32 layer_count;
 
+    // Like StreamedTexture in texture_streaming.c, for every layer at once
+    s32 tail_level;     // This level and the smaller ones are always resident
+    s32 resident_level; // Finest level in the storage, its level 0
+    s32 wanted_level;   // From the last request
+    f32 requested_uv_per_pixel; // Finest request of this frame, 0 when there was none
+    u64 last_used_frame;
+} TextureArray;
+
+typedef struct {
+    TextureEntry entries[MAX_TEXTURES];
     u32 count;
-} TextureHashes;
+
+    TextureArray arrays[MAX_TEXTURE_ARRAYS];
+    u32 array_count;
+} TextureBank;
 
 typedef struct {
-    Mesh *meshes;
+    u8 path[512];
+    time_t mod;
+} WatchedFile;
+
+typedef struct {
+    Mesh *meshes; // Unique geometry
     u32 mesh_count;
+
+    MeshInstance *instances;
+    u32 instance_count;
+
+    // The meshes packed together, indices are relative to Mesh.base_vertex
+    VertexArray shared_va;
+    u32 shared_vbo, shared_ebo;
+    u32 shared_index_type; // GL_UNSIGNED_SHORT when every mesh is below 65536 vertices, otherwise GL_UNSIGNED_INT
+
+    // Only the positions of the shared vertices, with the same indices, for depth only passes
+    VertexArray position_va;
+    u32 position_vbo;
     
     u8 model_folder_path[512];
+    u8 model_name[256];
+
+    // Source, cooked file and dependencies, polled for hot reloading
+    WatchedFile watched_files[MODEL_MAX_DEPENDENCIES + 2];
+    u32 watched_file_count;
 } Model;
 
-Model LoadModelFromAssimp(ArenaMemory *memory, ArenaMemory *scratch, u8 *model_folder, u8 *model_name);
+// Loads the cooked model when there is one that is up to date, otherwise imports the source file
+Model LoadModel(ArenaMemory *memory, ArenaMemory *scratch, u8 *model_folder, u8 *model_name);
+
+// Hot reloading, polled like reload_shader_bank. Only the textures and meshes that
+// changed on disk are read and uploaded again, everything else stays untouched.
+void ReloadTextures(void);
+bool ReloadModel(ArenaMemory *memory, ArenaMemory *scratch, Model *model); // True when something changed
+
+// Handles of the texture arrays, the array index of a material map is its texture unit. Returns the count.
+// They change when the arrays are streamed, so they are fetched again every frame.
+u32 GetTextureArrays(u32 *ids);
+
+// Same as RequestTextureDetail, for every layer of the array
+void RequestArrayDetail(u32 array_index, f32 uv_per_pixel);
+
+// Once per frame after UpdateTextureStreaming, with the same budget and upload limit. A level is
+// uploaded for every layer of an array at once, the storage of the array is made again with
+// one level more or less and the levels it keeps are copied over.
+void UpdateArrayStreaming(void);
 
 #endif
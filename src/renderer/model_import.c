@@ -0,0 +1,519 @@
+#include <stdio.h> // printf
+#include <string.h>
+#include <math.h> // fabsf
+
+#include "model_import.h"
+#include "obj_loader.h"
+#include "..\platform.h"
+
+#include "assimp/types.h"
+#include "assimp/cimport.h"
+#include "assimp/scene.h"
+#include "assimp/material.h"
+#include "assimp/postprocess.h"
+
+// 32-bit FNV
+#define FNV_OFFSET_BASIS 2166136261
+#define FNV_PRIME 16777619
+
+u64 fnv_1a(u8 *data, size_t size)
+{
+	u64 hash = FNV_OFFSET_BASIS;
+	for(size_t index = 0; index < size; index++)
+	{
+		hash = (hash ^ data[index]) * FNV_PRIME;
+	}
+
+	return hash;
+}
+
+static u16 F32ToF16(f32 value)
+{
+    union { f32 f; u32 u; } bits;
+    bits.f = value;
+
+    u32 sign = (bits.u >> 16) & 0x8000;
+    u32 mantissa = bits.u & 0x007FFFFF;
+    s32 exponent = (s32)((bits.u >> 23) & 0xFF) - 127 + 15;
+
+    // Inf and NaN
+    if(((bits.u >> 23) & 0xFF) == 0xFF)
+        return (u16)(sign | 0x7C00 | (mantissa ? 0x200 : 0));
+
+    // Too large, clamp to inf
+    if(exponent >= 31)
+        return (u16)(sign | 0x7C00);
+
+    // Subnormal halfs, or zero when even those are too small
+    if(exponent <= 0)
+    {
+        if(exponent < -10) return (u16)sign;
+
+        mantissa |= 0x00800000;
+        u32 shift = 14 - exponent;
+        u32 half = mantissa >> shift;
+
+        // Round to nearest, ties to even
+        u32 rest = mantissa & ((1u << shift) - 1);
+        u32 halfway = 1u << (shift - 1);
+        if(rest > halfway || (rest == halfway && (half & 1))) half++;
+
+        return (u16)(sign | half);
+    }
+
+    // Round to nearest, ties to even. A carry into the exponent is still correct, up to inf.
+    u32 rounded = (((u32)exponent << 23) | mantissa) + 0xFFF + ((mantissa >> 13) & 1);
+
+    return (u16)(sign | (rounded >> 13));
+}
+
+// Maps the unit sphere onto the [-1, 1] square
+static void OctahedralEncode(vec3 n, s16 *out)
+{
+    f32 l1_norm = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+    if(l1_norm == 0.0f)
+    {
+        out[0] = out[1] = 0;
+        return;
+    }
+
+    f32 u = n.x / l1_norm;
+    f32 v = n.y / l1_norm;
+
+    // Fold the lower hemisphere over the diagonals
+    if(n.z < 0.0f)
+    {
+        f32 folded_u = (1.0f - fabsf(v)) * (u >= 0.0f ? 1.0f : -1.0f);
+        f32 folded_v = (1.0f - fabsf(u)) * (v >= 0.0f ? 1.0f : -1.0f);
+        u = folded_u;
+        v = folded_v;
+    }
+
+    out[0] = (s16)lroundf(fmaxf(-1.0f, fminf(1.0f, u)) * 32767.0f);
+    out[1] = (s16)lroundf(fmaxf(-1.0f, fminf(1.0f, v)) * 32767.0f);
+}
+
+static u16 QuantizeUnorm16(f32 value, f32 min, f32 extent)
+{
+    if(extent <= 0.0f) return 0;
+
+    f32 t = (value - min) / extent;
+    t = fmaxf(0.0f, fminf(1.0f, t));
+
+    return (u16)lroundf(t * 65535.0f);
+}
+
+static void PackVertices(Vertex *vertices, PackedVertex *packed, u32 vertex_count,
+                         vec3 aabb_min, vec3 aabb_max)
+{
+    vec3 extent = sub_vec3(aabb_max, aabb_min);
+
+    for(u32 vertex_index = 0; vertex_index < vertex_count; vertex_index++)
+    {
+        Vertex *vertex = &vertices[vertex_index];
+        PackedVertex *out = &packed[vertex_index];
+
+        out->position[0] = QuantizeUnorm16(vertex->position.x, aabb_min.x, extent.x);
+        out->position[1] = QuantizeUnorm16(vertex->position.y, aabb_min.y, extent.y);
+        out->position[2] = QuantizeUnorm16(vertex->position.z, aabb_min.z, extent.z);
+        out->position[3] = 0;
+
+        OctahedralEncode(vertex->normal, out->normal);
+
+        out->tex_coords[0] = F32ToF16(vertex->tex_coords.x);
+        out->tex_coords[1] = F32ToF16(vertex->tex_coords.y);
+    }
+}
+
+// Shared by all import backends: clusters and quantizes a mesh whose indices
+// and counts have been filled in
+static void BuildMeshData(ArenaMemory *memory,
+                          ArenaMemory *scratch,
+                          MeshData *mesh,
+                          Vertex *vertices)
+{
+    // Reorders the indices so every meshlet is a contiguous range
+    mesh->meshlet_count = BuildMeshlets(memory, scratch,
+                                        &vertices[0].position, sizeof(Vertex), mesh->vertex_count,
+                                        mesh->indices, mesh->index_count,
+                                        &mesh->meshlets);
+
+    // Quantize the vertices relative to the bounds of the mesh
+    mesh->aabb_min = mesh->aabb_max = vertices[0].position;
+    for(u32 vertex_index = 1; vertex_index < mesh->vertex_count; vertex_index++)
+    {
+        vec3 p = vertices[vertex_index].position;
+
+        mesh->aabb_min = create_vec3(fminf(mesh->aabb_min.x, p.x), fminf(mesh->aabb_min.y, p.y), fminf(mesh->aabb_min.z, p.z));
+        mesh->aabb_max = create_vec3(fmaxf(mesh->aabb_max.x, p.x), fmaxf(mesh->aabb_max.y, p.y), fmaxf(mesh->aabb_max.z, p.z));
+    }
+
+    mesh->sphere_center = scale_vec3(add_vec3(mesh->aabb_min, mesh->aabb_max), 0.5f);
+    f32 radius_squared = 0.0f;
+    for(u32 vertex_index = 0; vertex_index < mesh->vertex_count; vertex_index++)
+    {
+        vec3 offset = sub_vec3(vertices[vertex_index].position, mesh->sphere_center);
+        radius_squared = fmaxf(radius_squared, dot_vec3(offset, offset));
+    }
+    mesh->sphere_radius = sqrtf(radius_squared);
+
+    // Square root of the ratio between the total texture space and mesh space areas
+    f64 surface_area = 0.0, uv_area = 0.0;
+    for(u32 index = 0; index + 2 < mesh->index_count; index += 3)
+    {
+        Vertex *a = &vertices[mesh->indices[index + 0]];
+        Vertex *b = &vertices[mesh->indices[index + 1]];
+        Vertex *c = &vertices[mesh->indices[index + 2]];
+
+        surface_area += 0.5 * length_vec3(cross_vec3(sub_vec3(b->position, a->position), sub_vec3(c->position, a->position)));
+        uv_area += 0.5 * fabs((b->tex_coords.x - a->tex_coords.x) * (c->tex_coords.y - a->tex_coords.y) -
+                              (c->tex_coords.x - a->tex_coords.x) * (b->tex_coords.y - a->tex_coords.y));
+    }
+    mesh->uv_density = (surface_area > 0.0) ? (f32)sqrt(uv_area / surface_area) : 0.0f;
+
+    mesh->vertices = (PackedVertex*) ArenaAlloc16(memory, mesh->vertex_count * sizeof(PackedVertex));
+    PackVertices(vertices, mesh->vertices, mesh->vertex_count, mesh->aabb_min, mesh->aabb_max);
+}
+
+//----------------------
+// ASSIMP
+//----------------------
+static void ImportAssimpMesh(ArenaMemory *memory,
+                             ArenaMemory *scratch,
+                             struct aiMesh *mesh,
+                             MeshData *result)
+{
+    memset(result, 0, sizeof(MeshData));
+
+    result->vertex_count = mesh->mNumVertices;
+    result->index_count = mesh->mNumFaces * 3; // @Important: A face could be connected by more than 3 vertices, but if we use aiProcess_Triangulate flag when loading with assimp, then we can always be sure that a face is always a triangle.
+    result->material_index = mesh->mMaterialIndex;
+
+    Vertex  *vertices = (Vertex*) ArenaAlloc16(scratch, result->vertex_count * sizeof(Vertex));
+    result->indices =   (u32*)    ArenaAlloc16(memory, result->index_count * sizeof(u32));
+
+    // Fill the vertex array of the mesh
+    for(u32 vertex_index = 0; vertex_index < result->vertex_count; vertex_index++)
+    {
+        Vertex vertex;
+        vec3 v;
+
+        v.x = mesh->mVertices[vertex_index].x;
+        v.y = mesh->mVertices[vertex_index].y;
+        v.z = mesh->mVertices[vertex_index].z;
+        vertex.position = v;
+
+        v.x = mesh->mNormals[vertex_index].x;
+        v.y = mesh->mNormals[vertex_index].y;
+        v.z = mesh->mNormals[vertex_index].z;
+        vertex.normal = v;
+
+        if(mesh->mTextureCoords[0])
+        {
+            vertex.tex_coords.x = mesh->mTextureCoords[0][vertex_index].x;
+            vertex.tex_coords.y = mesh->mTextureCoords[0][vertex_index].y;
+        }
+        else
+            vertex.tex_coords = create_vec2(0.0f, 0.0f);
+
+        vertices[vertex_index] = vertex;
+
+    }
+
+    // Fill the index array of the mesh
+    u32 *indice = result->indices;
+    for(u32 indice_index = 0; indice_index < result->index_count; indice_index += 3)
+    {
+        struct aiFace face = mesh->mFaces[indice_index / 3];
+        *indice++ = face.mIndices[0];
+        *indice++ = face.mIndices[1];
+        *indice++ = face.mIndices[2];
+
+    }
+
+    BuildMeshData(memory, scratch, result, vertices);
+}
+
+static void ImportAssimpMaterial(struct aiMaterial *mat, MaterialData *result)
+{
+    memset(result, 0, sizeof(MaterialData));
+
+    struct aiString str;
+
+    // Let's start with diffuse, specular and ambient maps for now
+    if(aiGetMaterialTextureCount(mat, aiTextureType_DIFFUSE) > 0 &&
+       aiGetMaterialTexture(mat, aiTextureType_DIFFUSE, 0, &str, 0,0,0,0,0,0) == AI_SUCCESS)
+    {
+        strncpy(result->diffuse_map, str.data, MATERIAL_MAX_PATH - 1);
+    }
+
+    if(aiGetMaterialTextureCount(mat, aiTextureType_SPECULAR) > 0 &&
+       aiGetMaterialTexture(mat, aiTextureType_SPECULAR, 0, &str, 0,0,0,0,0,0) == AI_SUCCESS)
+    {
+        strncpy(result->specular_map, str.data, MATERIAL_MAX_PATH - 1);
+    }
+
+    if(aiGetMaterialTextureCount(mat, aiTextureType_AMBIENT) > 0 &&
+       aiGetMaterialTexture(mat, aiTextureType_AMBIENT, 0, &str, 0,0,0,0,0,0) == AI_SUCCESS)
+    {
+        strncpy(result->ambient_map, str.data, MATERIAL_MAX_PATH - 1);
+    }
+
+    struct aiColor4D v;
+    if(AI_SUCCESS == aiGetMaterialColor(mat, AI_MATKEY_COLOR_DIFFUSE, &v))
+    {
+        result->diffuse = create_vec3(v.r, v.g, v.b);
+    }
+
+    if(AI_SUCCESS == aiGetMaterialColor(mat, AI_MATKEY_COLOR_SPECULAR, &v))
+    {
+        result->specular = create_vec3(v.r, v.g, v.b);
+    }
+
+    if(AI_SUCCESS == aiGetMaterialColor(mat, AI_MATKEY_COLOR_AMBIENT, &v))
+    {
+        result->ambient = create_vec3(v.r, v.g, v.b);
+    }
+
+    float s;
+    if(AI_SUCCESS == aiGetMaterialFloat(mat, AI_MATKEY_SHININESS, &s))
+    {
+        result->shininess = s;
+    }
+    else
+        result->shininess = 32.0f;
+
+    // Like the .obj path, alpha maps are taken as cut out single sheets
+    s32 two_sided = 0;
+    if((AI_SUCCESS == aiGetMaterialIntegerArray(mat, AI_MATKEY_TWOSIDED, &two_sided, 0) && two_sided) ||
+       aiGetMaterialTextureCount(mat, aiTextureType_OPACITY) > 0)
+    {
+        result->double_sided = 1;
+    }
+}
+
+static u32 CountAssimpInstances(struct aiNode *node)
+{
+    u32 result = node->mNumMeshes;
+
+    for(u32 child_index = 0; child_index < node->mNumChildren; child_index++)
+        result += CountAssimpInstances(node->mChildren[child_index]);
+
+    return result;
+}
+
+// Assimp matrices are row-major, ours are column-major
+static mat4x4 Mat4FromAssimp(struct aiMatrix4x4 m)
+{
+    mat4x4 result;
+
+    result.matrix[0]  = m.a1; result.matrix[4]  = m.a2; result.matrix[8]  = m.a3; result.matrix[12] = m.a4;
+    result.matrix[1]  = m.b1; result.matrix[5]  = m.b2; result.matrix[9]  = m.b3; result.matrix[13] = m.b4;
+    result.matrix[2]  = m.c1; result.matrix[6]  = m.c2; result.matrix[10] = m.c3; result.matrix[14] = m.c4;
+    result.matrix[3]  = m.d1; result.matrix[7]  = m.d2; result.matrix[11] = m.d3; result.matrix[15] = m.d4;
+
+    return result;
+}
+
+// We will process the nodes in a recursive manner, flattening the
+// hierarchy into one world transform per mesh reference
+static void ProcessAssimpNode(ModelData *model,
+                              struct aiNode *node,
+                              mat4x4 parent_transform)
+{
+    mat4x4 transform = mult_mat4x4(parent_transform, Mat4FromAssimp(node->mTransformation));
+    mat4x4 inverse_transform = inverse_mat4x4(transform);
+
+    // Mirroring transforms flip the winding of every triangle
+    f32 *m = transform.matrix;
+    f32 determinant = m[0] * (m[5]*m[10] - m[9]*m[6])
+                    - m[4] * (m[1]*m[10] - m[9]*m[2])
+                    + m[8] * (m[1]*m[6]  - m[5]*m[2]);
+
+    for(u32 node_mesh_index = 0; node_mesh_index < node->mNumMeshes; node_mesh_index++)
+    {
+        MeshInstance *instance = &model->instances[model->instance_count++];
+
+        instance->mesh_index = node->mMeshes[node_mesh_index];
+        instance->transform = transform;
+        instance->inverse_transform = inverse_transform;
+        instance->flip_winding = (determinant < 0.0f);
+    }
+
+    // Process children nodes
+    for(u32 child_index = 0; child_index < node->mNumChildren; child_index++)
+    {
+        ProcessAssimpNode(model, node->mChildren[child_index], transform);
+    }
+
+}
+
+static bool ImportModelFromAssimp(ArenaMemory *memory, ArenaMemory *scratch, char *model_folder_path, char *model_name, ModelData *result)
+{
+    char model_path[512];
+    strcpy(model_path, model_folder_path);
+    strcat(model_path, model_name);
+
+    const struct aiScene *scene = aiImportFile(model_path, aiProcess_Triangulate);
+
+    if(!scene || (scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE))
+    {
+        printf("Assimp could not import %s: %s\n", model_path, aiGetErrorString());
+        if(scene) aiReleaseImport(scene);
+        return false;
+    }
+
+    struct aiNode *root_node = scene->mRootNode;
+
+    // Every unique mesh is created once, no matter how many nodes reference it
+    result->mesh_count = scene->mNumMeshes;
+    result->meshes = (MeshData*) ArenaAlloc16(memory, result->mesh_count * sizeof(MeshData));
+
+    for(u32 mesh_index = 0; mesh_index < result->mesh_count; mesh_index++)
+    {
+        size_t scratch_mark = scratch->used;
+        ImportAssimpMesh(memory, scratch, scene->mMeshes[mesh_index], &result->meshes[mesh_index]);
+        scratch->used = scratch_mark;
+    }
+
+    result->material_count = scene->mNumMaterials;
+    result->materials = (MaterialData*) ArenaAlloc16(memory, result->material_count * sizeof(MaterialData));
+
+    for(u32 material_index = 0; material_index < result->material_count; material_index++)
+    {
+        ImportAssimpMaterial(scene->mMaterials[material_index], &result->materials[material_index]);
+    }
+
+    // The node hierarchy only decides where the meshes are placed
+    result->instance_count = 0;
+    result->instances = (MeshInstance*) ArenaAlloc16(memory, CountAssimpInstances(root_node) * sizeof(MeshInstance));
+
+    ProcessAssimpNode(result, root_node, create_diag_mat4x4(1.0f));
+
+    aiReleaseImport(scene);
+
+    return true;
+}
+
+//----------------------
+// OBJ
+//----------------------
+static void ImportObjMaterial(ObjMaterial *obj_material, MaterialData *result)
+{
+    memset(result, 0, sizeof(MaterialData));
+
+    result->diffuse = obj_material->diffuse;
+    result->specular = obj_material->specular;
+    result->ambient = obj_material->ambient;
+    result->shininess = obj_material->shininess;
+    result->double_sided = obj_material->double_sided;
+
+    strcpy(result->diffuse_map, obj_material->diffuse_map);
+    strcpy(result->specular_map, obj_material->specular_map);
+    strcpy(result->ambient_map, obj_material->ambient_map);
+}
+
+static bool ImportModelFromObj(ArenaMemory *memory, ArenaMemory *scratch, char *model_folder_path, char *model_name, ModelData *result)
+{
+    size_t scratch_mark = scratch->used;
+
+    ObjScene scene;
+    if(!ParseObj(memory, scratch, model_folder_path, model_name, &scene))
+    {
+        scratch->used = scratch_mark;
+        return false;
+    }
+
+    if(scene.material_library[0])
+    {
+        strcpy(result->dependencies[result->dependency_count++], scene.material_library);
+    }
+
+    // The last material is used by faces that had no usemtl
+    result->material_count = scene.material_count + 1;
+    result->materials = (MaterialData*) ArenaAlloc16(memory, result->material_count * sizeof(MaterialData));
+
+    for(u32 material_index = 0; material_index < scene.material_count; material_index++)
+    {
+        ImportObjMaterial(&scene.materials[material_index], &result->materials[material_index]);
+    }
+
+    MaterialData *default_material = &result->materials[scene.material_count];
+    memset(default_material, 0, sizeof(MaterialData));
+    default_material->diffuse = create_vec3(0.6f, 0.6f, 0.6f);
+    default_material->shininess = 32.0f;
+
+    result->mesh_count = scene.mesh_count;
+    result->meshes = (MeshData*) ArenaAlloc16(memory, result->mesh_count * sizeof(MeshData));
+
+    // OBJ has no hierarchy, every mesh is placed once as it is
+    result->instance_count = scene.mesh_count;
+    result->instances = (MeshInstance*) ArenaAlloc16(memory, result->instance_count * sizeof(MeshInstance));
+
+    for(u32 mesh_index = 0; mesh_index < scene.mesh_count; mesh_index++)
+    {
+        ObjMesh *obj_mesh = &scene.meshes[mesh_index];
+        MeshData *mesh = &result->meshes[mesh_index];
+
+        memset(mesh, 0, sizeof(MeshData));
+        mesh->vertex_count = obj_mesh->vertex_count;
+        mesh->index_count = obj_mesh->index_count;
+        mesh->indices = obj_mesh->indices;
+        mesh->material_index = (obj_mesh->material_index != OBJ_NO_MATERIAL) ? obj_mesh->material_index : scene.material_count;
+
+        BuildMeshData(memory, scratch, mesh, obj_mesh->vertices);
+
+        MeshInstance *instance = &result->instances[mesh_index];
+        instance->transform = create_diag_mat4x4(1.0f);
+        instance->inverse_transform = create_diag_mat4x4(1.0f);
+        instance->mesh_index = mesh_index;
+        instance->flip_winding = 0;
+    }
+
+    scratch->used = scratch_mark;
+
+    return true;
+}
+
+#if BENCHMARK_OBJ_IMPORT
+// Quantization and meshlets are left out
+void BenchmarkObjBackends(ArenaMemory *scratch, char *model_folder_path, char *model_name)
+{
+    char model_path[512];
+    strcpy(model_path, model_folder_path);
+    strcat(model_path, model_name);
+
+    u64 start = GetWallClock();
+    const struct aiScene *scene = aiImportFile(model_path, aiProcess_Triangulate);
+    f64 assimp_ms = GetSecondsElapsed(start, GetWallClock()) * 1000.0;
+    aiReleaseImport(scene);
+
+    size_t scratch_mark = scratch->used;
+    ObjScene obj_scene;
+
+    start = GetWallClock();
+    ParseObj(scratch, scratch, model_folder_path, model_name, &obj_scene);
+    f64 native_ms = GetSecondsElapsed(start, GetWallClock()) * 1000.0;
+
+    scratch->used = scratch_mark;
+
+    printf("OBJ import of %s: assimp %.2f ms, native %.2f ms (%u threads)\n", model_path, assimp_ms, native_ms,
+           work_queue.thread_count + 1);
+}
+#endif
+
+// Picks the import backend from the file extension
+bool ImportModel(ArenaMemory *memory, ArenaMemory *scratch, char *model_folder_path, char *model_name, ModelData *model)
+{
+    memset(model, 0, sizeof(ModelData));
+
+    size_t name_length = strlen(model_name);
+    bool is_obj = name_length > 4 && !strcmp(model_name + name_length - 4, ".obj");
+
+    if(NATIVE_OBJ_LOADER && is_obj)
+    {
+        return ImportModelFromObj(memory, scratch, model_folder_path, model_name, model);
+    }
+
+    return ImportModelFromAssimp(memory, scratch, model_folder_path, model_name, model);
+}
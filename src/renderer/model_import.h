@@ -0,0 +1,113 @@
+#ifndef MODEL_IMPORT_H
+#define MODEL_IMPORT_H
+
+#include <stdbool.h>
+
+#include "meshlet.h"
+#include "..\memory.h"
+#include "..\gfx_math.h"
+#include "..\defines.h"
+
+/*
+  CPU side of model loading. Nothing in here touches OpenGL, so it is shared
+  between the renderer and the offline cooker (src\cook).
+*/
+
+typedef struct {
+    vec3 position;
+    vec3 normal;
+    vec2 tex_coords;
+} Vertex;
+
+// Compact layout of Vertex as it is stored on the GPU, 16 bytes instead of 32
+typedef struct {
+    u16 position[4];   // unorm16 relative to the AABB of the mesh, w is padding
+    s16 normal[2];     // Octahedral encoded, snorm16
+    u16 tex_coords[2]; // Half floats
+} PackedVertex;
+
+// A placement of a mesh in the world, one per node that references it
+typedef struct {
+    mat4x4 transform; // Mesh space -> world space
+    mat4x4 inverse_transform;
+
+    u32 mesh_index;
+    u32 flip_winding; // The transform mirrors, front faces are clockwise
+} MeshInstance;
+
+#define MATERIAL_MAX_PATH 256
+
+// Texture paths are relative to the model folder, empty when the map is missing
+typedef struct {
+    vec3 diffuse, specular, ambient;
+    f32 shininess;
+
+    // Seen from both sides, e.g. alpha tested leaves on single quads. Back faces are not culled.
+    u32 double_sided;
+
+    u8 diffuse_map[MATERIAL_MAX_PATH];
+    u8 specular_map[MATERIAL_MAX_PATH];
+    u8 ambient_map[MATERIAL_MAX_PATH];
+} MaterialData;
+
+// A mesh that is ready to be uploaded: clustered, quantized and bounded
+typedef struct {
+    PackedVertex *vertices;
+    u32 *indices; // Reordered so every meshlet is a contiguous range
+    u32 vertex_count, index_count;
+
+    vec3 aabb_min, aabb_max; // Dequantizes the positions
+
+    // Around the center of the AABB, tighter than half its diagonal. Culling tests it first.
+    vec3 sphere_center;
+    f32 sphere_radius;
+
+    // Texture coordinate units per mesh space unit, averaged over the surface.
+    // Texture streaming uses it to tell how many texels end up on a pixel.
+    f32 uv_density;
+
+    Meshlet *meshlets;
+    u32 meshlet_count;
+
+    u32 material_index;
+} MeshData;
+
+#define MODEL_MAX_DEPENDENCIES 8
+
+typedef struct {
+    MeshData *meshes;
+    u32 mesh_count;
+
+    MaterialData *materials;
+    u32 material_count;
+
+    MeshInstance *instances;
+    u32 instance_count;
+
+    // Other source files the import read (e.g. the .mtl), relative to the model folder.
+    // The cooker tracks them as inputs and the renderer watches them for hot reloading.
+    u8 dependencies[MODEL_MAX_DEPENDENCIES][MATERIAL_MAX_PATH];
+    u32 dependency_count;
+} ModelData;
+
+// Use the native parser for .obj files instead of assimp
+#ifndef NATIVE_OBJ_LOADER
+#define NATIVE_OBJ_LOADER 1
+#endif
+
+// Time the import of the .obj model with both backends once at startup
+#ifndef BENCHMARK_OBJ_IMPORT
+#define BENCHMARK_OBJ_IMPORT 0
+#endif
+
+u64 fnv_1a(u8 *data, size_t size);
+
+// 'model_folder_path' ends with a separator. The result lives in 'memory', 'scratch' is only used temporarily.
+bool ImportModel(ArenaMemory *memory, ArenaMemory *scratch, char *model_folder_path, char *model_name, ModelData *model);
+
+#if BENCHMARK_OBJ_IMPORT
+// Compares the import step of assimp and the native parser and prints both times
+void BenchmarkObjBackends(ArenaMemory *scratch, char *model_folder_path, char *model_name);
+#endif
+
+#endif
@@ -0,0 +1,862 @@
+#include <stdio.h> // printf
+#include <string.h> // memchr, memcpy, memset, strcpy
+#include <math.h> // pow
+
+#include "obj_loader.h"
+#include "..\platform.h"
+
+/*
+  Native Wavefront OBJ/MTL parser.
+
+  The file is memory mapped and split into chunks at line boundaries. Parsing is done in two
+  parallel passes over the chunks: the first one only counts what every chunk contains, which
+  lets us allocate exact arrays and hand every chunk its write offsets, the second one parses
+  straight into the shared arrays. Negative (relative) indices can be resolved in the second
+  pass since every chunk knows how many elements came before it.
+
+  Faces are then split into meshes at every 'g', 'o' and 'usemtl', and each mesh gets its
+  vertices deduplicated in parallel.
+*/
+
+#define OBJ_MIN_CHUNK_SIZE KB(256)
+#define OBJ_MAX_CHUNKS 64
+
+typedef struct {
+    s32 position, tex_coord, normal; // 0-based, -1 when absent
+} ObjCorner;
+
+typedef enum {
+    OBJ_EVENT_GROUP,
+    OBJ_EVENT_MATERIAL,
+} ObjEventType;
+
+typedef struct {
+    u32 type;
+    u32 triangle_offset; // Global index of the first triangle after the event
+    u8 *name;
+    u32 name_length;
+} ObjEvent;
+
+typedef struct {
+    u8 *begin, *end;
+
+    // Counting pass
+    u32 position_count, tex_coord_count, normal_count, triangle_count, event_count;
+    u8 *mtllib;
+    u32 mtllib_length;
+
+    // Parsing pass, the global arrays and where this chunk starts in them
+    u32 position_base, tex_coord_base, normal_base, triangle_base, event_base;
+
+    vec3 *positions;
+    vec2 *tex_coords;
+    vec3 *normals;
+    ObjCorner *corners;
+    ObjEvent *events;
+} ObjChunk;
+
+typedef struct {
+    ObjScene *scene;
+    u32 volatile next_mesh;
+
+    u32 *triangle_offsets; // First triangle of every mesh
+
+    ObjCorner *corners;
+    vec3 *positions;
+    vec2 *tex_coords;
+    vec3 *normals;
+    u32 position_count, tex_coord_count, normal_count;
+
+    // Per-mesh temporaries, sized for the largest mesh and one set per job
+    ObjCorner **vertex_keys;
+    u32 **hash_tables;
+    u32 hash_table_size;
+} ObjMeshJobs;
+
+typedef struct {
+    ObjMeshJobs *shared;
+    u32 job_index;
+} ObjMeshJob;
+
+//----------------------
+// TOKENIZING
+//----------------------
+static inline bool IsSpace(u8 c)
+{
+    return c == ' ' || c == '\t';
+}
+
+static inline u8 *SkipSpaces(u8 *at, u8 *end)
+{
+    while(at < end && IsSpace(*at)) at++;
+    return at;
+}
+
+// Returns the end of the line, excluding "\r\n" or "\n"
+static inline u8 *FindLineEnd(u8 *at, u8 *end, u8 **next_line)
+{
+    u8 *newline = (u8*)memchr(at, '\n', end - at);
+    u8 *line_end = newline ? newline : end;
+
+    *next_line = newline ? newline + 1 : end;
+    if(line_end > at && line_end[-1] == '\r') line_end--;
+
+    return line_end;
+}
+
+static inline bool IsKeyword(u8 *at, u8 *end, char *keyword, u32 length)
+{
+    return (u32)(end - at) > length && !memcmp(at, keyword, length) && IsSpace(at[length]);
+}
+
+static f64 powers_of_ten[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+// Exact for the number of digits OBJ exporters write, avoids strtod and its locale
+static u8 *ParseFloat(u8 *at, u8 *end, f32 *out)
+{
+    at = SkipSpaces(at, end);
+
+    f64 sign = 1.0;
+    if(at < end && (*at == '-' || *at == '+'))
+    {
+        if(*at == '-') sign = -1.0;
+        at++;
+    }
+
+    u64 mantissa = 0;
+    s32 exponent = 0;
+
+    while(at < end && *at >= '0' && *at <= '9')
+    {
+        if(mantissa < 100000000000000000ull) mantissa = mantissa * 10 + (*at - '0');
+        else exponent++;
+        at++;
+    }
+
+    if(at < end && *at == '.')
+    {
+        at++;
+        while(at < end && *at >= '0' && *at <= '9')
+        {
+            if(mantissa < 100000000000000000ull)
+            {
+                mantissa = mantissa * 10 + (*at - '0');
+                exponent--;
+            }
+            at++;
+        }
+    }
+
+    if(at < end && (*at == 'e' || *at == 'E'))
+    {
+        at++;
+        s32 exponent_sign = 1;
+        if(at < end && (*at == '-' || *at == '+'))
+        {
+            if(*at == '-') exponent_sign = -1;
+            at++;
+        }
+
+        s32 value = 0;
+        while(at < end && *at >= '0' && *at <= '9')
+        {
+            if(value < 10000) value = value * 10 + (*at - '0');
+            at++;
+        }
+        exponent += exponent_sign * value;
+    }
+
+    f64 result = (f64)mantissa;
+    if(exponent < 0)
+    {
+        result = (exponent >= -22) ? result / powers_of_ten[-exponent] : result * pow(10.0, exponent);
+    }
+    else if(exponent > 0)
+    {
+        result = (exponent <= 22) ? result * powers_of_ten[exponent] : result * pow(10.0, exponent);
+    }
+
+    *out = (f32)(sign * result);
+    return at;
+}
+
+static u8 *ParseInt(u8 *at, u8 *end, s32 *out)
+{
+    s32 sign = 1;
+    if(at < end && (*at == '-' || *at == '+'))
+    {
+        if(*at == '-') sign = -1;
+        at++;
+    }
+
+    s32 value = 0;
+    while(at < end && *at >= '0' && *at <= '9')
+    {
+        value = value * 10 + (*at - '0');
+        at++;
+    }
+
+    *out = sign * value;
+    return at;
+}
+
+// 1-based, or negative relative to the elements parsed so far, into 0-based
+static inline s32 ResolveIndex(s32 index, u32 count_so_far)
+{
+    if(index > 0) return index - 1;
+    if(index < 0) return (s32)count_so_far + index;
+    return -1;
+}
+
+static void CopyName(u8 *dest, u32 dest_size, u8 *src, u32 length)
+{
+    if(length >= dest_size) length = dest_size - 1;
+    memcpy(dest, src, length);
+    dest[length] = '\0';
+}
+
+// Rest of the line without surrounding whitespace
+static u32 TrimmedRest(u8 *at, u8 *line_end, u8 **begin)
+{
+    at = SkipSpaces(at, line_end);
+    while(line_end > at && IsSpace(line_end[-1])) line_end--;
+
+    *begin = at;
+    return (u32)(line_end - at);
+}
+
+//----------------------
+// CHUNK PASSES
+//----------------------
+static void CountObjChunk(WorkQueue *queue, void *data)
+{
+    ObjChunk *chunk = (ObjChunk*)data;
+    u8 *end = chunk->end;
+    u8 *next_line;
+
+    for(u8 *line = chunk->begin; line < end; line = next_line)
+    {
+        u8 *line_end = FindLineEnd(line, end, &next_line);
+        u8 *at = SkipSpaces(line, line_end);
+
+        if(at == line_end) continue;
+
+        switch(*at)
+        {
+            case 'v':
+            {
+                if(IsKeyword(at, line_end, "v", 1)) chunk->position_count++;
+                else if(IsKeyword(at, line_end, "vt", 2)) chunk->tex_coord_count++;
+                else if(IsKeyword(at, line_end, "vn", 2)) chunk->normal_count++;
+                break;
+            }
+            case 'f':
+            {
+                if(!IsKeyword(at, line_end, "f", 1)) break;
+
+                u32 corner_count = 0;
+                at++;
+                for(;;)
+                {
+                    at = SkipSpaces(at, line_end);
+                    if(at == line_end) break;
+
+                    corner_count++;
+                    while(at < line_end && !IsSpace(*at)) at++;
+                }
+
+                if(corner_count >= 3) chunk->triangle_count += corner_count - 2;
+                break;
+            }
+            case 'g':
+            case 'o':
+            {
+                if(IsKeyword(at, line_end, "g", 1) || IsKeyword(at, line_end, "o", 1)) chunk->event_count++;
+                break;
+            }
+            case 'u':
+            {
+                if(IsKeyword(at, line_end, "usemtl", 6)) chunk->event_count++;
+                break;
+            }
+            case 'm':
+            {
+                if(!chunk->mtllib && IsKeyword(at, line_end, "mtllib", 6))
+                    chunk->mtllib_length = TrimmedRest(at + 6, line_end, &chunk->mtllib);
+                break;
+            }
+            default: break;
+        }
+    }
+}
+
+static u8 *ParseCorner(u8 *at, u8 *end, ObjChunk *chunk,
+                       u32 positions_so_far, u32 tex_coords_so_far, u32 normals_so_far,
+                       ObjCorner *corner)
+{
+    s32 index;
+
+    at = ParseInt(at, end, &index);
+    corner->position = ResolveIndex(index, positions_so_far);
+    corner->tex_coord = -1;
+    corner->normal = -1;
+
+    if(at < end && *at == '/')
+    {
+        at++;
+        if(at < end && *at != '/' && !IsSpace(*at))
+        {
+            at = ParseInt(at, end, &index);
+            corner->tex_coord = ResolveIndex(index, tex_coords_so_far);
+        }
+
+        if(at < end && *at == '/')
+        {
+            at++;
+            at = ParseInt(at, end, &index);
+            corner->normal = ResolveIndex(index, normals_so_far);
+        }
+    }
+
+    // Skip whatever else is in the token
+    while(at < end && !IsSpace(*at)) at++;
+
+    return at;
+}
+
+static void ParseObjChunk(WorkQueue *queue, void *data)
+{
+    ObjChunk *chunk = (ObjChunk*)data;
+    u8 *end = chunk->end;
+    u8 *next_line;
+
+    u32 position_count = 0, tex_coord_count = 0, normal_count = 0;
+    u32 triangle_count = 0, event_count = 0;
+
+    for(u8 *line = chunk->begin; line < end; line = next_line)
+    {
+        u8 *line_end = FindLineEnd(line, end, &next_line);
+        u8 *at = SkipSpaces(line, line_end);
+
+        if(at == line_end) continue;
+
+        switch(*at)
+        {
+            case 'v':
+            {
+                if(IsKeyword(at, line_end, "v", 1))
+                {
+                    vec3 *p = &chunk->positions[chunk->position_base + position_count++];
+                    at = ParseFloat(at + 1, line_end, &p->x);
+                    at = ParseFloat(at, line_end, &p->y);
+                    at = ParseFloat(at, line_end, &p->z);
+                }
+                else if(IsKeyword(at, line_end, "vt", 2))
+                {
+                    vec2 *t = &chunk->tex_coords[chunk->tex_coord_base + tex_coord_count++];
+                    at = ParseFloat(at + 2, line_end, &t->x);
+                    at = ParseFloat(at, line_end, &t->y);
+                }
+                else if(IsKeyword(at, line_end, "vn", 2))
+                {
+                    vec3 *n = &chunk->normals[chunk->normal_base + normal_count++];
+                    at = ParseFloat(at + 2, line_end, &n->x);
+                    at = ParseFloat(at, line_end, &n->y);
+                    at = ParseFloat(at, line_end, &n->z);
+                }
+                break;
+            }
+            case 'f':
+            {
+                if(!IsKeyword(at, line_end, "f", 1)) break;
+
+                u32 positions_so_far = chunk->position_base + position_count;
+                u32 tex_coords_so_far = chunk->tex_coord_base + tex_coord_count;
+                u32 normals_so_far = chunk->normal_base + normal_count;
+
+                // Triangulate as a fan around the first corner
+                ObjCorner first, previous, current;
+                u32 corner_count = 0;
+
+                at++;
+                for(;;)
+                {
+                    at = SkipSpaces(at, line_end);
+                    if(at == line_end) break;
+
+                    at = ParseCorner(at, line_end, chunk, positions_so_far, tex_coords_so_far, normals_so_far, &current);
+
+                    if(corner_count >= 2)
+                    {
+                        ObjCorner *triangle = &chunk->corners[(chunk->triangle_base + triangle_count++) * 3];
+                        triangle[0] = first;
+                        triangle[1] = previous;
+                        triangle[2] = current;
+                    }
+                    else if(corner_count == 0)
+                    {
+                        first = current;
+                    }
+
+                    previous = current;
+                    corner_count++;
+                }
+                break;
+            }
+            case 'g':
+            case 'o':
+            case 'u':
+            {
+                u32 type;
+                u32 keyword_length;
+
+                if(IsKeyword(at, line_end, "g", 1) || IsKeyword(at, line_end, "o", 1))
+                {
+                    type = OBJ_EVENT_GROUP;
+                    keyword_length = 1;
+                }
+                else if(IsKeyword(at, line_end, "usemtl", 6))
+                {
+                    type = OBJ_EVENT_MATERIAL;
+                    keyword_length = 6;
+                }
+                else break;
+
+                ObjEvent *event = &chunk->events[chunk->event_base + event_count++];
+                event->type = type;
+                event->triangle_offset = chunk->triangle_base + triangle_count;
+                event->name_length = TrimmedRest(at + keyword_length, line_end, &event->name);
+                break;
+            }
+            default: break;
+        }
+    }
+}
+
+//----------------------
+// MESHES
+//----------------------
+static inline u32 HashCorner(ObjCorner corner)
+{
+    return ((u32)corner.position * 73856093u) ^ ((u32)corner.tex_coord * 19349663u) ^ ((u32)corner.normal * 83492791u);
+}
+
+static void BuildObjMesh(ObjMeshJobs *shared, u32 job_index, u32 mesh_index)
+{
+    ObjMesh *mesh = &shared->scene->meshes[mesh_index];
+    u32 first_triangle = shared->triangle_offsets[mesh_index];
+    u32 triangle_count = mesh->index_count / 3;
+
+    ObjCorner *vertex_keys = shared->vertex_keys[job_index];
+    u32 *hash_table = shared->hash_tables[job_index];
+    u32 hash_mask = shared->hash_table_size - 1;
+
+    // 0 marks an empty slot, otherwise vertex index + 1
+    memset(hash_table, 0, shared->hash_table_size * sizeof(u32));
+    mesh->vertex_count = 0;
+
+    for(u32 triangle = 0; triangle < triangle_count; triangle++)
+    {
+        ObjCorner *corners = &shared->corners[(first_triangle + triangle) * 3];
+        u32 *triangle_indices = &mesh->indices[triangle * 3];
+
+        for(u32 corner_index = 0; corner_index < 3; corner_index++)
+        {
+            ObjCorner corner = corners[corner_index];
+
+            // Out of range references are treated as missing
+            if(corner.position < 0 || (u32)corner.position >= shared->position_count) corner.position = 0;
+            if(corner.tex_coord >= (s32)shared->tex_coord_count) corner.tex_coord = -1;
+            if(corner.normal >= (s32)shared->normal_count) corner.normal = -1;
+
+            u32 slot = HashCorner(corner) & hash_mask;
+            u32 vertex_index;
+
+            for(;;)
+            {
+                if(!hash_table[slot])
+                {
+                    vertex_index = mesh->vertex_count++;
+                    hash_table[slot] = vertex_index + 1;
+                    vertex_keys[vertex_index] = corner;
+
+                    Vertex *vertex = &mesh->vertices[vertex_index];
+                    vertex->position = shared->positions[corner.position];
+                    vertex->tex_coords = (corner.tex_coord >= 0) ? shared->tex_coords[corner.tex_coord] : create_vec2(0.0f, 0.0f);
+                    vertex->normal = (corner.normal >= 0) ? shared->normals[corner.normal] : create_vec3(0.0f, 0.0f, 0.0f);
+                    break;
+                }
+
+                ObjCorner key = vertex_keys[hash_table[slot] - 1];
+                if(key.position == corner.position && key.tex_coord == corner.tex_coord && key.normal == corner.normal)
+                {
+                    vertex_index = hash_table[slot] - 1;
+                    break;
+                }
+
+                slot = (slot + 1) & hash_mask;
+            }
+
+            triangle_indices[corner_index] = vertex_index;
+        }
+
+        // Vertices without a normal get the area weighted normals of their faces
+        if(corners[0].normal < 0 || corners[1].normal < 0 || corners[2].normal < 0)
+        {
+            Vertex *v0 = &mesh->vertices[triangle_indices[0]];
+            Vertex *v1 = &mesh->vertices[triangle_indices[1]];
+            Vertex *v2 = &mesh->vertices[triangle_indices[2]];
+            vec3 face_normal = cross_vec3(sub_vec3(v1->position, v0->position), sub_vec3(v2->position, v0->position));
+
+            for(u32 corner_index = 0; corner_index < 3; corner_index++)
+            {
+                u32 vertex_index = triangle_indices[corner_index];
+                if(vertex_keys[vertex_index].normal < 0)
+                    mesh->vertices[vertex_index].normal = add_vec3(mesh->vertices[vertex_index].normal, face_normal);
+            }
+        }
+    }
+
+    for(u32 vertex_index = 0; vertex_index < mesh->vertex_count; vertex_index++)
+    {
+        if(vertex_keys[vertex_index].normal >= 0) continue;
+
+        vec3 n = mesh->vertices[vertex_index].normal;
+        if(length_vec3(n) > 0.0f) mesh->vertices[vertex_index].normal = normalize_vec3(n);
+    }
+}
+
+static void BuildObjMeshes(WorkQueue *queue, void *data)
+{
+    ObjMeshJob *job = (ObjMeshJob*)data;
+    ObjMeshJobs *shared = job->shared;
+
+    for(;;)
+    {
+        u32 mesh_index = AtomicIncrement(&shared->next_mesh) - 1;
+        if(mesh_index >= shared->scene->mesh_count) break;
+
+        BuildObjMesh(shared, job->job_index, mesh_index);
+    }
+}
+
+//----------------------
+// MTL
+//----------------------
+static void ParseMtl(ArenaMemory *memory, char *path, ObjScene *scene)
+{
+    MappedFile file;
+
+    scene->materials = 0;
+    scene->material_count = 0;
+
+    if(!MapFileReadOnly(path, &file)) return;
+
+    u8 *end = file.data + file.size;
+    u8 *next_line;
+
+    u32 material_count = 0;
+    for(u8 *line = file.data; line < end; line = next_line)
+    {
+        u8 *line_end = FindLineEnd(line, end, &next_line);
+        u8 *at = SkipSpaces(line, line_end);
+        if(IsKeyword(at, line_end, "newmtl", 6)) material_count++;
+    }
+
+    if(!material_count)
+    {
+        UnmapFile(&file);
+        return;
+    }
+
+    scene->materials = (ObjMaterial*) ArenaAlloc16(memory, material_count * sizeof(ObjMaterial));
+    ObjMaterial *material = 0;
+
+    for(u8 *line = file.data; line < end; line = next_line)
+    {
+        u8 *line_end = FindLineEnd(line, end, &next_line);
+        u8 *at = SkipSpaces(line, line_end);
+        u8 *name;
+
+        if(IsKeyword(at, line_end, "newmtl", 6))
+        {
+            material = &scene->materials[scene->material_count++];
+            memset(material, 0, sizeof(ObjMaterial));
+
+            // Same defaults as assimp
+            material->diffuse = create_vec3(0.6f, 0.6f, 0.6f);
+            material->shininess = 32.0f;
+
+            u32 length = TrimmedRest(at + 6, line_end, &name);
+            material->name_hash = fnv_1a(name, length);
+            CopyName(material->name, OBJ_MAX_PATH, name, length);
+            continue;
+        }
+
+        if(!material) continue;
+
+        if(IsKeyword(at, line_end, "Kd", 2))
+        {
+            at = ParseFloat(at + 2, line_end, &material->diffuse.x);
+            at = ParseFloat(at, line_end, &material->diffuse.y);
+            at = ParseFloat(at, line_end, &material->diffuse.z);
+        }
+        else if(IsKeyword(at, line_end, "Ks", 2))
+        {
+            at = ParseFloat(at + 2, line_end, &material->specular.x);
+            at = ParseFloat(at, line_end, &material->specular.y);
+            at = ParseFloat(at, line_end, &material->specular.z);
+        }
+        else if(IsKeyword(at, line_end, "Ka", 2))
+        {
+            at = ParseFloat(at + 2, line_end, &material->ambient.x);
+            at = ParseFloat(at, line_end, &material->ambient.y);
+            at = ParseFloat(at, line_end, &material->ambient.z);
+        }
+        else if(IsKeyword(at, line_end, "Ns", 2))
+        {
+            ParseFloat(at + 2, line_end, &material->shininess);
+        }
+        else if(IsKeyword(at, line_end, "map_Kd", 6))
+        {
+            u32 length = TrimmedRest(at + 6, line_end, &name);
+            CopyName(material->diffuse_map, OBJ_MAX_PATH, name, length);
+        }
+        else if(IsKeyword(at, line_end, "map_Ks", 6))
+        {
+            u32 length = TrimmedRest(at + 6, line_end, &name);
+            CopyName(material->specular_map, OBJ_MAX_PATH, name, length);
+        }
+        else if(IsKeyword(at, line_end, "map_Ka", 6))
+        {
+            u32 length = TrimmedRest(at + 6, line_end, &name);
+            CopyName(material->ambient_map, OBJ_MAX_PATH, name, length);
+        }
+        else if(IsKeyword(at, line_end, "map_d", 5))
+        {
+            // Cut out by its alpha, the surface is a single sheet
+            material->double_sided = true;
+        }
+        else if(IsKeyword(at, line_end, "d", 1))
+        {
+            f32 dissolve = 1.0f;
+            ParseFloat(at + 1, line_end, &dissolve);
+            if(dissolve < 1.0f) material->double_sided = true;
+        }
+    }
+
+    UnmapFile(&file);
+}
+
+static u32 FindObjMaterial(ObjScene *scene, u8 *name, u32 length)
+{
+    u64 hash = fnv_1a(name, length);
+
+    for(u32 material_index = 0; material_index < scene->material_count; material_index++)
+    {
+        ObjMaterial *material = &scene->materials[material_index];
+
+        // Different names can share a hash
+        if(material->name_hash == hash && strlen(material->name) == length && !memcmp(material->name, name, length))
+            return material_index;
+    }
+
+    return OBJ_NO_MATERIAL;
+}
+
+//----------------------
+// OBJ
+//----------------------
+bool ParseObj(ArenaMemory *memory, ArenaMemory *scratch,
+              char *folder_path, char *file_name,
+              ObjScene *scene)
+{
+    u64 start = GetWallClock();
+
+    char path[512];
+    strcpy(path, folder_path);
+    strcat(path, file_name);
+
+    memset(scene, 0, sizeof(ObjScene));
+
+    MappedFile file;
+    if(!MapFileReadOnly(path, &file)) return false;
+
+    // Split into chunks that end on a line boundary
+    u32 chunk_count = (u32)(file.size / OBJ_MIN_CHUNK_SIZE) + 1;
+    u32 max_chunks = 4 * (work_queue.thread_count + 1);
+    if(max_chunks > OBJ_MAX_CHUNKS) max_chunks = OBJ_MAX_CHUNKS;
+    if(chunk_count > max_chunks) chunk_count = max_chunks;
+
+    ObjChunk *chunks = (ObjChunk*) ArenaAlloc16(scratch, chunk_count * sizeof(ObjChunk));
+    memset(chunks, 0, chunk_count * sizeof(ObjChunk));
+
+    u8 *end = file.data + file.size;
+    u8 *chunk_begin = file.data;
+    u32 used_chunks = 0;
+
+    for(u32 chunk_index = 0; chunk_index < chunk_count && chunk_begin < end; chunk_index++)
+    {
+        u8 *chunk_end = (chunk_index == chunk_count - 1) ? end : file.data + (file.size / chunk_count) * (chunk_index + 1);
+        if(chunk_end < chunk_begin) chunk_end = chunk_begin;
+
+        u8 *newline = (u8*)memchr(chunk_end, '\n', end - chunk_end);
+        chunk_end = newline ? newline + 1 : end;
+
+        chunks[used_chunks].begin = chunk_begin;
+        chunks[used_chunks].end = chunk_end;
+        used_chunks++;
+
+        chunk_begin = chunk_end;
+    }
+    chunk_count = used_chunks;
+
+    // Pass 1: count
+    for(u32 chunk_index = 0; chunk_index < chunk_count; chunk_index++)
+        AddWorkEntry(&work_queue, CountObjChunk, &chunks[chunk_index]);
+    CompleteAllWork(&work_queue);
+
+    u32 position_count = 0, tex_coord_count = 0, normal_count = 0, triangle_count = 0, event_count = 0;
+    u8 *mtllib = 0;
+    u32 mtllib_length = 0;
+
+    for(u32 chunk_index = 0; chunk_index < chunk_count; chunk_index++)
+    {
+        ObjChunk *chunk = &chunks[chunk_index];
+
+        chunk->position_base = position_count;
+        chunk->tex_coord_base = tex_coord_count;
+        chunk->normal_base = normal_count;
+        chunk->triangle_base = triangle_count;
+        chunk->event_base = event_count;
+
+        position_count += chunk->position_count;
+        tex_coord_count += chunk->tex_coord_count;
+        normal_count += chunk->normal_count;
+        triangle_count += chunk->triangle_count;
+        event_count += chunk->event_count;
+
+        if(!mtllib && chunk->mtllib)
+        {
+            mtllib = chunk->mtllib;
+            mtllib_length = chunk->mtllib_length;
+        }
+    }
+
+    vec3 *positions =     (vec3*)      ArenaAlloc16(scratch, (position_count + 1) * sizeof(vec3));
+    vec2 *tex_coords =    (vec2*)      ArenaAlloc16(scratch, (tex_coord_count + 1) * sizeof(vec2));
+    vec3 *normals =       (vec3*)      ArenaAlloc16(scratch, (normal_count + 1) * sizeof(vec3));
+    ObjCorner *corners =  (ObjCorner*) ArenaAlloc16(scratch, (triangle_count * 3 + 1) * sizeof(ObjCorner));
+    ObjEvent *events =    (ObjEvent*)  ArenaAlloc16(scratch, (event_count + 1) * sizeof(ObjEvent));
+
+    // Pass 2: parse into the shared arrays
+    for(u32 chunk_index = 0; chunk_index < chunk_count; chunk_index++)
+    {
+        ObjChunk *chunk = &chunks[chunk_index];
+        chunk->positions = positions;
+        chunk->tex_coords = tex_coords;
+        chunk->normals = normals;
+        chunk->corners = corners;
+        chunk->events = events;
+
+        AddWorkEntry(&work_queue, ParseObjChunk, chunk);
+    }
+    CompleteAllWork(&work_queue);
+
+    if(mtllib)
+    {
+        char mtl_path[512];
+        strcpy(mtl_path, folder_path);
+
+        CopyName(scene->material_library, sizeof(scene->material_library), mtllib, mtllib_length);
+        strcat(mtl_path, scene->material_library);
+
+        ParseMtl(scratch, mtl_path, scene);
+    }
+
+    // A new mesh starts at every group, object and material change
+    u32 *triangle_offsets = (u32*)     ArenaAlloc16(scratch, (event_count + 1) * sizeof(u32));
+    scene->meshes =         (ObjMesh*) ArenaAlloc16(scratch, (event_count + 1) * sizeof(ObjMesh));
+
+    u32 material_index = OBJ_NO_MATERIAL;
+    u32 run_start = 0;
+    u32 max_mesh_triangles = 0;
+
+    for(u32 event_index = 0; event_index <= event_count; event_index++)
+    {
+        u32 run_end = (event_index < event_count) ? events[event_index].triangle_offset : triangle_count;
+
+        if(run_end > run_start)
+        {
+            ObjMesh *mesh = &scene->meshes[scene->mesh_count];
+            triangle_offsets[scene->mesh_count] = run_start;
+            scene->mesh_count++;
+
+            mesh->index_count = (run_end - run_start) * 3;
+            mesh->material_index = material_index;
+
+            if(run_end - run_start > max_mesh_triangles) max_mesh_triangles = run_end - run_start;
+        }
+
+        run_start = run_end;
+
+        if(event_index < event_count && events[event_index].type == OBJ_EVENT_MATERIAL)
+            material_index = FindObjMaterial(scene, events[event_index].name, events[event_index].name_length);
+    }
+
+    for(u32 mesh_index = 0; mesh_index < scene->mesh_count; mesh_index++)
+    {
+        ObjMesh *mesh = &scene->meshes[mesh_index];
+
+        // Worst case every corner is a unique vertex
+        mesh->vertices = (Vertex*) ArenaAlloc16(scratch, mesh->index_count * sizeof(Vertex));
+        mesh->indices = (u32*) ArenaAlloc16(memory, mesh->index_count * sizeof(u32));
+    }
+
+    // Deduplicate the vertices of every mesh
+    if(scene->mesh_count)
+    {
+        ObjMeshJobs shared = {0};
+        shared.scene = scene;
+        shared.triangle_offsets = triangle_offsets;
+        shared.corners = corners;
+        shared.positions = positions;
+        shared.tex_coords = tex_coords;
+        shared.normals = normals;
+        shared.position_count = position_count;
+        shared.tex_coord_count = tex_coord_count;
+        shared.normal_count = normal_count;
+
+        shared.hash_table_size = 1;
+        while(shared.hash_table_size < max_mesh_triangles * 3 * 2) shared.hash_table_size <<= 1;
+
+        u32 job_count = work_queue.thread_count + 1;
+        if(job_count > scene->mesh_count) job_count = scene->mesh_count;
+
+        ObjMeshJob *jobs =    (ObjMeshJob*)  ArenaAlloc16(scratch, job_count * sizeof(ObjMeshJob));
+        shared.vertex_keys =  (ObjCorner**)  ArenaAlloc16(scratch, job_count * sizeof(ObjCorner*));
+        shared.hash_tables =  (u32**)        ArenaAlloc16(scratch, job_count * sizeof(u32*));
+
+        for(u32 job_index = 0; job_index < job_count; job_index++)
+        {
+            shared.vertex_keys[job_index] = (ObjCorner*) ArenaAlloc16(scratch, max_mesh_triangles * 3 * sizeof(ObjCorner));
+            shared.hash_tables[job_index] = (u32*)       ArenaAlloc16(scratch, shared.hash_table_size * sizeof(u32));
+
+            jobs[job_index].shared = &shared;
+            jobs[job_index].job_index = job_index;
+
+            AddWorkEntry(&work_queue, BuildObjMeshes, &jobs[job_index]);
+        }
+        CompleteAllWork(&work_queue);
+    }
+
+    UnmapFile(&file);
+
+    printf("Parsed %s: %u meshes, %u triangles, %u chunks in %.2f ms\n", path, scene->mesh_count, triangle_count,
+           chunk_count, GetSecondsElapsed(start, GetWallClock()) * 1000.0);
+
+    return true;
+}
@@ -0,0 +1,52 @@
+#ifndef OBJ_LOADER_H
+#define OBJ_LOADER_H
+
+#include <stdbool.h>
+
+#include "model_import.h"
+#include "..\memory.h"
+#include "..\gfx_math.h"
+#include "..\defines.h"
+
+#define OBJ_MAX_PATH 256
+#define OBJ_NO_MATERIAL (~0u)
+
+typedef struct {
+    u64 name_hash;
+    u8 name[OBJ_MAX_PATH]; // Of the newmtl, usemtl looks it up by the hash first
+
+    vec3 diffuse, specular, ambient;
+    f32 shininess;
+    bool double_sided; // It has an alpha map or is not fully opaque
+
+    // Relative to the folder of the .obj, empty when the map is missing
+    u8 diffuse_map[OBJ_MAX_PATH];
+    u8 specular_map[OBJ_MAX_PATH];
+    u8 ambient_map[OBJ_MAX_PATH];
+} ObjMaterial;
+
+typedef struct {
+    Vertex *vertices;
+    u32 *indices;
+    u32 vertex_count, index_count;
+
+    u32 material_index; // OBJ_NO_MATERIAL when the faces had no usemtl
+} ObjMesh;
+
+typedef struct {
+    ObjMesh *meshes;
+    u32 mesh_count;
+
+    ObjMaterial *materials;
+    u32 material_count;
+
+    u8 material_library[OBJ_MAX_PATH]; // The mtllib, relative to the folder of the .obj, empty when there is none
+} ObjScene;
+
+// Vertices are deduplicated and faces triangulated. Indices end up in 'memory',
+// everything else (including the vertices, which are meant to be packed) in 'scratch'.
+bool ParseObj(ArenaMemory *memory, ArenaMemory *scratch,
+              char *folder_path, char *file_name,
+              ObjScene *scene);
+
+#endif
@@ -0,0 +1,512 @@
+#include <assert.h>
+#include <stdio.h> // printf
+#include <float.h> // FLT_MAX
+#include <math.h> // floorf, ceilf
+#include <immintrin.h>
+
+#include "occlusion.h"
+#include "..\platform.h"
+
+// Occluder triangles are handed out to the threads in batches of this many for setup
+#define OCCLUSION_SETUP_BATCH_SIZE 1024
+
+OcclusionStats occlusion_stats;
+
+static vec4 TransformPoint(mat4x4 transform, vec3 p)
+{
+    f32 *m = transform.matrix;
+    return create_vec4(m[0]*p.x + m[4]*p.y + m[8]*p.z + m[12],
+                       m[1]*p.x + m[5]*p.y + m[9]*p.z + m[13],
+                       m[2]*p.x + m[6]*p.y + m[10]*p.z + m[14],
+                       m[3]*p.x + m[7]*p.y + m[11]*p.z + m[15]);
+}
+
+void BuildOcclusionBuffer(ArenaMemory *memory, ArenaMemory *scratch, Model *model, OcclusionBuffer *buffer)
+{
+    u64 start = GetWallClock();
+    size_t scratch_mark = scratch->used;
+
+    if(!buffer->levels[0])
+    {
+        for(u32 level = 0; level < OCCLUSION_LEVEL_COUNT; level++)
+        {
+            buffer->level_widths[level] = (OCCLUSION_WIDTH >> level) ? (OCCLUSION_WIDTH >> level) : 1;
+            buffer->level_heights[level] = (OCCLUSION_HEIGHT >> level) ? (OCCLUSION_HEIGHT >> level) : 1;
+            buffer->levels[level] = (f32*) ArenaAlloc16(memory, buffer->level_widths[level] * buffer->level_heights[level] * sizeof(f32));
+        }
+    }
+
+    // Mesh space surface area, every instance is ranked by it times its scale squared
+    f32 *mesh_areas = (f32*) ArenaAlloc16(scratch, model->mesh_count * sizeof(f32));
+    for(u32 mesh_index = 0; mesh_index < model->mesh_count; mesh_index++)
+    {
+        Mesh *mesh = &model->meshes[mesh_index];
+        vec3 extent = sub_vec3(mesh->aabb_max, mesh->aabb_min);
+        f32 area = 0.0f;
+
+        for(u32 index = 0; index + 2 < mesh->index_count; index += 3)
+        {
+            vec3 p[3];
+            for(u32 corner = 0; corner < 3; corner++)
+            {
+                u16 *q = mesh->vertices[mesh->indices[index + corner]].position;
+                p[corner] = create_vec3(extent.x * (q[0] / 65535.0f), extent.y * (q[1] / 65535.0f), extent.z * (q[2] / 65535.0f));
+            }
+
+            area += 0.5f * length_vec3(cross_vec3(sub_vec3(p[1], p[0]), sub_vec3(p[2], p[0])));
+        }
+
+        mesh_areas[mesh_index] = area;
+    }
+
+    // Insertion sort by area, largest first. Only runs when the model changes.
+    u32 *candidates = (u32*) ArenaAlloc16(scratch, model->instance_count * sizeof(u32));
+    f32 *candidate_areas = (f32*) ArenaAlloc16(scratch, model->instance_count * sizeof(f32));
+    u32 candidate_count = 0;
+
+    for(u32 instance_index = 0; instance_index < model->instance_count; instance_index++)
+    {
+        MeshInstance *instance = &model->instances[instance_index];
+        Mesh *mesh = &model->meshes[instance->mesh_index];
+
+        u32 triangle_count = mesh->index_count / 3;
+        if(!triangle_count || triangle_count > OCCLUDER_MAX_TRIANGLES) continue;
+
+        f32 *m = instance->transform.matrix;
+        f32 scale = fmaxf(fmaxf(length_vec3(create_vec3(m[0], m[1], m[2])),
+                                length_vec3(create_vec3(m[4], m[5], m[6]))),
+                          length_vec3(create_vec3(m[8], m[9], m[10])));
+        f32 area = mesh_areas[instance->mesh_index] * scale * scale;
+
+        u32 slot = candidate_count++;
+        while(slot && candidate_areas[slot - 1] < area)
+        {
+            candidates[slot] = candidates[slot - 1];
+            candidate_areas[slot] = candidate_areas[slot - 1];
+            slot--;
+        }
+        candidates[slot] = instance_index;
+        candidate_areas[slot] = area;
+    }
+
+    // As many of the largest as fit into the budget, smaller ones can still fill the rest
+    u32 occluder_triangle_count = 0, occluder_count = 0;
+    for(u32 candidate = 0; candidate < candidate_count; candidate++)
+    {
+        Mesh *mesh = &model->meshes[model->instances[candidates[candidate]].mesh_index];
+        if(occluder_triangle_count + mesh->index_count / 3 > OCCLUSION_MAX_TRIANGLES) continue;
+
+        occluder_triangle_count += mesh->index_count / 3;
+        candidates[occluder_count++] = candidates[candidate];
+    }
+
+    // Clipping against the near plane turns a triangle into two at most, they go into fixed slots
+    if(occluder_triangle_count > buffer->occluder_triangle_capacity)
+    {
+        buffer->occluder_triangle_capacity = occluder_triangle_count;
+        buffer->bin_capacity = 2 * occluder_triangle_count;
+
+        buffer->occluder_vertices = (vec3*) ArenaAlloc16(memory, occluder_triangle_count * 3 * sizeof(vec3));
+        buffer->triangles = (OcclusionTriangle*) ArenaAlloc16(memory, buffer->bin_capacity * sizeof(OcclusionTriangle));
+        buffer->bins = (u32*) ArenaAlloc16(memory, OCCLUSION_TILE_COUNT * buffer->bin_capacity * sizeof(u32));
+    }
+
+    buffer->occluder_triangle_count = occluder_triangle_count;
+    buffer->occluder_count = occluder_count;
+
+    u32 vertex_count = 0;
+    for(u32 occluder = 0; occluder < occluder_count; occluder++)
+    {
+        MeshInstance *instance = &model->instances[candidates[occluder]];
+        Mesh *mesh = &model->meshes[instance->mesh_index];
+        vec3 extent = sub_vec3(mesh->aabb_max, mesh->aabb_min);
+
+        // Same decoding as the vertex shader
+        for(u32 index = 0; index < (mesh->index_count / 3) * 3; index++)
+        {
+            u16 *q = mesh->vertices[mesh->indices[index]].position;
+            vec3 p = create_vec3(mesh->aabb_min.x + extent.x * (q[0] / 65535.0f),
+                                 mesh->aabb_min.y + extent.y * (q[1] / 65535.0f),
+                                 mesh->aabb_min.z + extent.z * (q[2] / 65535.0f));
+
+            vec4 world = TransformPoint(instance->transform, p);
+            buffer->occluder_vertices[vertex_count++] = create_vec3(world.x, world.y, world.z);
+        }
+    }
+
+    buffer->triangle_count = 2 * occluder_triangle_count;
+
+    scratch->used = scratch_mark;
+
+    printf("Picked %u occluders with %u triangles out of %u instances in %.2f ms\n",
+           occluder_count, occluder_triangle_count, model->instance_count, GetSecondsElapsed(start, GetWallClock()) * 1000.0);
+}
+
+//----------------------
+// SETUP
+//----------------------
+
+// Empty triangles have no pixels in their bounds
+static void EmptyTriangle(OcclusionTriangle *triangle)
+{
+    triangle->min_x = triangle->min_y = 0;
+    triangle->max_x = triangle->max_y = -1;
+}
+
+// 'v' are screen space x and y in pixels and NDC z
+static void SetupScreenTriangle(vec3 v[3], OcclusionTriangle *triangle)
+{
+    f32 area = (v[1].x - v[0].x) * (v[2].y - v[0].y) - (v[2].x - v[0].x) * (v[1].y - v[0].y);
+    if(fabsf(area) < 1e-8f)
+    {
+        EmptyTriangle(triangle);
+        return;
+    }
+
+    // Pixel centers are at +0.5
+    f32 min_x = fminf(fminf(v[0].x, v[1].x), v[2].x), max_x = fmaxf(fmaxf(v[0].x, v[1].x), v[2].x);
+    f32 min_y = fminf(fminf(v[0].y, v[1].y), v[2].y), max_y = fmaxf(fmaxf(v[0].y, v[1].y), v[2].y);
+
+    // Clamped in float first, points behind the camera were clipped but the rest can still be far off screen
+    triangle->min_x = (s32)ceilf(fmaxf(min_x - 0.5f, 0.0f));
+    triangle->min_y = (s32)ceilf(fmaxf(min_y - 0.5f, 0.0f));
+    triangle->max_x = (s32)floorf(fminf(max_x - 0.5f, OCCLUSION_WIDTH - 1.0f));
+    triangle->max_y = (s32)floorf(fminf(max_y - 0.5f, OCCLUSION_HEIGHT - 1.0f));
+
+    if(triangle->min_x > triangle->max_x || triangle->min_y > triangle->max_y)
+    {
+        EmptyTriangle(triangle);
+        return;
+    }
+
+    // Relative to the first pixel center, the products stay small even for huge triangles
+    f32 origin_x = triangle->min_x + 0.5f;
+    f32 origin_y = triangle->min_y + 0.5f;
+    f32 sign = (area > 0.0f) ? 1.0f : -1.0f;
+
+    for(u32 edge = 0; edge < 3; edge++)
+    {
+        vec3 a = v[edge];
+        vec3 b = v[(edge + 1) % 3];
+
+        triangle->edge[edge] = sign * ((b.x - a.x) * (origin_y - a.y) - (b.y - a.y) * (origin_x - a.x));
+        triangle->edge_dx[edge] = -sign * (b.y - a.y);
+        triangle->edge_dy[edge] = sign * (b.x - a.x);
+    }
+
+    triangle->depth_dx = ((v[1].z - v[0].z) * (v[2].y - v[0].y) - (v[2].z - v[0].z) * (v[1].y - v[0].y)) / area;
+    triangle->depth_dy = ((v[1].x - v[0].x) * (v[2].z - v[0].z) - (v[2].x - v[0].x) * (v[1].z - v[0].z)) / area;
+    triangle->depth = v[0].z + triangle->depth_dx * (origin_x - v[0].x) + triangle->depth_dy * (origin_y - v[0].y);
+}
+
+// Clips against the near plane (z >= -w) and writes one or two screen triangles, both empty when nothing is left
+static void SetupTriangle(vec4 clip[3], OcclusionTriangle *triangles)
+{
+    vec4 polygon[4];
+    u32 polygon_count = 0;
+
+    for(u32 corner = 0; corner < 3; corner++)
+    {
+        vec4 a = clip[corner];
+        vec4 b = clip[(corner + 1) % 3];
+        f32 distance_a = a.z + a.w;
+        f32 distance_b = b.z + b.w;
+
+        if(distance_a >= 0.0f) polygon[polygon_count++] = a;
+        if((distance_a >= 0.0f) != (distance_b >= 0.0f))
+        {
+            f32 t = distance_a / (distance_a - distance_b);
+            polygon[polygon_count++] = add_vec4(a, scale_vec4(sub_vec4(b, a), t));
+        }
+    }
+
+    EmptyTriangle(&triangles[0]);
+    EmptyTriangle(&triangles[1]);
+    if(polygon_count < 3) return;
+
+    vec3 screen[4];
+    for(u32 corner = 0; corner < polygon_count; corner++)
+    {
+        vec4 p = polygon[corner];
+
+        // On the near plane w is the near distance, never 0
+        f32 inv_w = 1.0f / p.w;
+        screen[corner] = create_vec3((p.x * inv_w * 0.5f + 0.5f) * OCCLUSION_WIDTH,
+                                     (p.y * inv_w * 0.5f + 0.5f) * OCCLUSION_HEIGHT,
+                                     p.z * inv_w);
+    }
+
+    vec3 first[3] = {screen[0], screen[1], screen[2]};
+    SetupScreenTriangle(first, &triangles[0]);
+
+    if(polygon_count == 4)
+    {
+        vec3 second[3] = {screen[0], screen[2], screen[3]};
+        SetupScreenTriangle(second, &triangles[1]);
+    }
+}
+
+typedef struct {
+    OcclusionBuffer *buffer;
+
+    u32 volatile next_batch;
+    u32 batch_count;
+    u32 volatile triangles_rasterized;
+} SetupJob;
+
+static void SetupBatches(WorkQueue *queue, void *data)
+{
+    SetupJob *job = (SetupJob*)data;
+    OcclusionBuffer *buffer = job->buffer;
+    u32 triangles_rasterized = 0;
+
+    for(;;)
+    {
+        u32 batch = AtomicIncrement(&job->next_batch) - 1;
+        if(batch >= job->batch_count) break;
+
+        u32 first = batch * OCCLUSION_SETUP_BATCH_SIZE;
+        u32 end = first + OCCLUSION_SETUP_BATCH_SIZE;
+        if(end > buffer->occluder_triangle_count) end = buffer->occluder_triangle_count;
+
+        for(u32 triangle = first; triangle < end; triangle++)
+        {
+            vec4 clip[3];
+            for(u32 corner = 0; corner < 3; corner++)
+                clip[corner] = TransformPoint(buffer->view_projection, buffer->occluder_vertices[triangle*3 + corner]);
+
+            OcclusionTriangle *result = &buffer->triangles[triangle * 2];
+            SetupTriangle(clip, result);
+
+            triangles_rasterized += (result[0].min_x <= result[0].max_x) + (result[1].min_x <= result[1].max_x);
+        }
+    }
+
+    AtomicAdd(&job->triangles_rasterized, triangles_rasterized);
+}
+
+//----------------------
+// RASTERIZATION
+//----------------------
+typedef struct {
+    OcclusionBuffer *buffer;
+    u32 volatile next_tile;
+} RasterJob;
+
+static void RasterizeTile(OcclusionBuffer *buffer, u32 tile)
+{
+    s32 tile_min_x = (tile % OCCLUSION_TILES_X) * OCCLUSION_TILE_WIDTH;
+    s32 tile_min_y = (tile / OCCLUSION_TILES_X) * OCCLUSION_TILE_HEIGHT;
+    s32 tile_max_x = tile_min_x + OCCLUSION_TILE_WIDTH - 1;
+    s32 tile_max_y = tile_min_y + OCCLUSION_TILE_HEIGHT - 1;
+
+    f32 *depth_buffer = buffer->levels[0];
+    u32 *bin = &buffer->bins[tile * buffer->bin_capacity];
+
+    for(u32 bin_index = 0; bin_index < buffer->bin_counts[tile]; bin_index++)
+    {
+        OcclusionTriangle *triangle = &buffer->triangles[bin[bin_index]];
+
+        s32 min_x = (triangle->min_x > tile_min_x) ? triangle->min_x : tile_min_x;
+        s32 max_x = (triangle->max_x < tile_max_x) ? triangle->max_x : tile_max_x;
+        s32 min_y = (triangle->min_y > tile_min_y) ? triangle->min_y : tile_min_y;
+        s32 max_y = (triangle->max_y < tile_max_y) ? triangle->max_y : tile_max_y;
+
+#if OCCLUSION_AVX
+        // Whole steps of 8, the pixels outside the bounds are outside the triangle too
+        min_x &= ~7;
+
+        __m256 lane_offsets = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+        __m256 edge_dx[3];
+        for(u32 edge = 0; edge < 3; edge++) edge_dx[edge] = _mm256_set1_ps(triangle->edge_dx[edge]);
+        __m256 depth_dx = _mm256_set1_ps(triangle->depth_dx);
+
+        for(s32 y = min_y; y <= max_y; y++)
+        {
+            f32 dy = (f32)(y - triangle->min_y);
+            f32 *row = &depth_buffer[y * OCCLUSION_WIDTH];
+
+            for(s32 x = min_x; x <= max_x; x += 8)
+            {
+                __m256 dx = _mm256_add_ps(_mm256_set1_ps((f32)(x - triangle->min_x)), lane_offsets);
+
+                __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+                for(u32 edge = 0; edge < 3; edge++)
+                {
+                    __m256 value = _mm256_add_ps(_mm256_set1_ps(triangle->edge[edge] + triangle->edge_dy[edge] * dy),
+                                                 _mm256_mul_ps(edge_dx[edge], dx));
+                    inside = _mm256_and_ps(inside, _mm256_cmp_ps(value, _mm256_setzero_ps(), _CMP_GE_OQ));
+                }
+
+                if(_mm256_testz_ps(inside, inside)) continue;
+
+                __m256 depth = _mm256_add_ps(_mm256_set1_ps(triangle->depth + triangle->depth_dy * dy),
+                                             _mm256_mul_ps(depth_dx, dx));
+                __m256 previous = _mm256_loadu_ps(&row[x]);
+                _mm256_storeu_ps(&row[x], _mm256_blendv_ps(previous, _mm256_min_ps(previous, depth), inside));
+            }
+        }
+#else
+        for(s32 y = min_y; y <= max_y; y++)
+        {
+            f32 dy = (f32)(y - triangle->min_y);
+            f32 *row = &depth_buffer[y * OCCLUSION_WIDTH];
+
+            for(s32 x = min_x; x <= max_x; x++)
+            {
+                f32 dx = (f32)(x - triangle->min_x);
+
+                if(triangle->edge[0] + triangle->edge_dx[0] * dx + triangle->edge_dy[0] * dy < 0.0f) continue;
+                if(triangle->edge[1] + triangle->edge_dx[1] * dx + triangle->edge_dy[1] * dy < 0.0f) continue;
+                if(triangle->edge[2] + triangle->edge_dx[2] * dx + triangle->edge_dy[2] * dy < 0.0f) continue;
+
+                f32 depth = triangle->depth + triangle->depth_dx * dx + triangle->depth_dy * dy;
+                if(depth < row[x]) row[x] = depth;
+            }
+        }
+#endif
+    }
+}
+
+static void RasterizeTiles(WorkQueue *queue, void *data)
+{
+    RasterJob *job = (RasterJob*)data;
+
+    for(;;)
+    {
+        u32 tile = AtomicIncrement(&job->next_tile) - 1;
+        if(tile >= OCCLUSION_TILE_COUNT) break;
+
+        RasterizeTile(job->buffer, tile);
+    }
+}
+
+void RasterizeOccluders(OcclusionBuffer *buffer, mat4x4 view_projection)
+{
+    u64 start = GetWallClock();
+    u32 worker_count = work_queue.thread_count + 1;
+
+    occlusion_stats = (OcclusionStats){0};
+    occlusion_stats.occluder_count = buffer->occluder_count;
+
+    buffer->view_projection = view_projection;
+
+    f32 *depth_buffer = buffer->levels[0];
+    for(u32 pixel = 0; pixel < OCCLUSION_WIDTH * OCCLUSION_HEIGHT; pixel++) depth_buffer[pixel] = 1.0f;
+
+    if(buffer->occluder_triangle_count)
+    {
+        SetupJob setup = {0};
+        setup.buffer = buffer;
+        setup.batch_count = (buffer->occluder_triangle_count + OCCLUSION_SETUP_BATCH_SIZE - 1) / OCCLUSION_SETUP_BATCH_SIZE;
+
+        for(u32 worker_index = 0; worker_index < worker_count && worker_index < setup.batch_count; worker_index++)
+            AddWorkEntry(&work_queue, SetupBatches, &setup);
+        CompleteAllWork(&work_queue);
+
+        occlusion_stats.triangles_rasterized = setup.triangles_rasterized;
+
+        // In triangle order, every tile sees its triangles the same way each frame
+        for(u32 tile = 0; tile < OCCLUSION_TILE_COUNT; tile++) buffer->bin_counts[tile] = 0;
+
+        for(u32 triangle_index = 0; triangle_index < buffer->triangle_count; triangle_index++)
+        {
+            OcclusionTriangle *triangle = &buffer->triangles[triangle_index];
+            if(triangle->min_x > triangle->max_x) continue;
+
+            for(s32 tile_y = triangle->min_y / OCCLUSION_TILE_HEIGHT; tile_y <= triangle->max_y / OCCLUSION_TILE_HEIGHT; tile_y++)
+            {
+                for(s32 tile_x = triangle->min_x / OCCLUSION_TILE_WIDTH; tile_x <= triangle->max_x / OCCLUSION_TILE_WIDTH; tile_x++)
+                {
+                    u32 tile = tile_y * OCCLUSION_TILES_X + tile_x;
+                    assert(buffer->bin_counts[tile] < buffer->bin_capacity);
+                    buffer->bins[tile * buffer->bin_capacity + buffer->bin_counts[tile]++] = triangle_index;
+                }
+            }
+        }
+
+        RasterJob raster = {0};
+        raster.buffer = buffer;
+
+        for(u32 worker_index = 0; worker_index < worker_count && worker_index < OCCLUSION_TILE_COUNT; worker_index++)
+            AddWorkEntry(&work_queue, RasterizeTiles, &raster);
+        CompleteAllWork(&work_queue);
+    }
+
+    for(u32 level = 1; level < OCCLUSION_LEVEL_COUNT; level++)
+    {
+        f32 *source = buffer->levels[level - 1];
+        f32 *dest = buffer->levels[level];
+        u32 source_width = buffer->level_widths[level - 1];
+        u32 source_height = buffer->level_heights[level - 1];
+
+        for(u32 y = 0; y < buffer->level_heights[level]; y++)
+        {
+            // A side that is 1 already is not halved any further
+            u32 y0 = (2*y < source_height) ? 2*y : source_height - 1;
+            u32 y1 = (2*y + 1 < source_height) ? 2*y + 1 : source_height - 1;
+
+            for(u32 x = 0; x < buffer->level_widths[level]; x++)
+            {
+                u32 x0 = (2*x < source_width) ? 2*x : source_width - 1;
+                u32 x1 = (2*x + 1 < source_width) ? 2*x + 1 : source_width - 1;
+
+                dest[y * buffer->level_widths[level] + x] = fmaxf(fmaxf(source[y0 * source_width + x0], source[y0 * source_width + x1]),
+                                                                  fmaxf(source[y1 * source_width + x0], source[y1 * source_width + x1]));
+            }
+        }
+    }
+
+    occlusion_stats.raster_ms = (f32)(GetSecondsElapsed(start, GetWallClock()) * 1000.0);
+}
+
+//----------------------
+// TESTS
+//----------------------
+bool AABBOccluded(OcclusionBuffer *buffer, vec3 min, vec3 max)
+{
+    occlusion_stats.instances_tested++;
+
+    f32 min_x = FLT_MAX, min_y = FLT_MAX, max_x = -FLT_MAX, max_y = -FLT_MAX;
+    f32 min_depth = FLT_MAX;
+
+    for(u32 corner = 0; corner < 8; corner++)
+    {
+        vec3 p = create_vec3((corner & 1) ? max.x : min.x, (corner & 2) ? max.y : min.y, (corner & 4) ? max.z : min.z);
+        vec4 clip = TransformPoint(buffer->view_projection, p);
+
+        // In front of the near plane, the projection of the box can not be trusted
+        if(clip.z < -clip.w) return false;
+
+        f32 inv_w = 1.0f / clip.w;
+        f32 x = (clip.x * inv_w * 0.5f + 0.5f) * OCCLUSION_WIDTH;
+        f32 y = (clip.y * inv_w * 0.5f + 0.5f) * OCCLUSION_HEIGHT;
+
+        min_x = fminf(min_x, x); max_x = fmaxf(max_x, x);
+        min_y = fminf(min_y, y); max_y = fmaxf(max_y, y);
+        min_depth = fminf(min_depth, clip.z * inv_w);
+    }
+
+    // Every pixel the box touches, not only the ones whose center it covers
+    s32 x0 = (s32)fmaxf(floorf(min_x), 0.0f), x1 = (s32)fminf(floorf(max_x), OCCLUSION_WIDTH - 1.0f);
+    s32 y0 = (s32)fmaxf(floorf(min_y), 0.0f), y1 = (s32)fminf(floorf(max_y), OCCLUSION_HEIGHT - 1.0f);
+    if(x0 > x1 || y0 > y1) return false;
+
+    // The finest level where the box touches 2x2 texels at most
+    u32 level = 0;
+    while(level + 1 < OCCLUSION_LEVEL_COUNT && ((x1 >> level) - (x0 >> level) > 1 || (y1 >> level) - (y0 >> level) > 1))
+        level++;
+
+    f32 *texels = buffer->levels[level];
+    u32 width = buffer->level_widths[level];
+    f32 max_depth = -FLT_MAX;
+
+    for(s32 y = y0 >> level; y <= (y1 >> level); y++)
+        for(s32 x = x0 >> level; x <= (x1 >> level); x++)
+            max_depth = fmaxf(max_depth, texels[y * width + x]);
+
+    bool occluded = min_depth > max_depth;
+    occlusion_stats.instances_occluded += occluded;
+
+    return occluded;
+}
@@ -0,0 +1,105 @@
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#include <stdbool.h>
+
+#include "model.h"
+#include "..\memory.h"
+#include "..\gfx_math.h"
+#include "..\defines.h"
+
+/*
+  Software occlusion culling. A few large occluders are rasterized into a small depth
+  buffer on the CPU, then the bounds of what passed frustum culling are tested against a
+  max-depth pyramid of it before anything is submitted.
+
+  The buffer is split into tiles. The occluder triangles are set up and clipped against the
+  near plane in parallel batches, binned into the tiles they overlap, then every tile is
+  rasterized by one thread at a time, 8 pixels per step with AVX. Tiles never share pixels,
+  so the threads need no synchronization besides taking the next tile.
+
+  Depth is NDC z, -1 at the near plane and 1 at the far one, so larger is further away.
+  Pixels are covered when their center is inside a triangle, like on the GPU.
+*/
+
+// Rows of 8 pixels are rasterized with AVX, otherwise pixel by pixel
+#ifndef OCCLUSION_AVX
+#define OCCLUSION_AVX 1
+#endif
+
+#define OCCLUSION_WIDTH 256
+#define OCCLUSION_HEIGHT 128
+
+// Multiples of 8 so a tile row is made of whole AVX steps
+#define OCCLUSION_TILE_WIDTH 32
+#define OCCLUSION_TILE_HEIGHT 32
+#define OCCLUSION_TILES_X (OCCLUSION_WIDTH / OCCLUSION_TILE_WIDTH)
+#define OCCLUSION_TILES_Y (OCCLUSION_HEIGHT / OCCLUSION_TILE_HEIGHT)
+#define OCCLUSION_TILE_COUNT (OCCLUSION_TILES_X * OCCLUSION_TILES_Y)
+
+// Levels of the max-depth pyramid, down to 1x1 for the larger side
+#define OCCLUSION_LEVEL_COUNT 9
+
+// Of all occluders together. Instances are picked by their surface area until it is used up.
+#define OCCLUSION_MAX_TRIANGLES 32768
+
+// Denser meshes cost too much for the area they cover
+#define OCCLUDER_MAX_TRIANGLES 8192
+
+// Screen space triangle, ready to be rasterized
+typedef struct {
+    // Edge functions and depth at the center of pixel (min_x, min_y), and how they change
+    // per pixel in x and y. Every edge function is >= 0 inside the triangle.
+    f32 edge[3], edge_dx[3], edge_dy[3];
+    f32 depth, depth_dx, depth_dy;
+
+    s32 min_x, min_y, max_x, max_y; // Pixels whose center can be covered, inclusive and inside the buffer
+} OcclusionTriangle;
+
+typedef struct {
+    vec3 *occluder_vertices; // World space, three per triangle
+    u32 occluder_triangle_count;
+    u32 occluder_count;
+
+    // Occluder triangles the arrays have room for, they are only reallocated when a rebuild needs more
+    u32 occluder_triangle_capacity;
+
+    // Filled every frame. Clipping against the near plane can turn a triangle into two.
+    OcclusionTriangle *triangles;
+    u32 triangle_count;
+    u32 *bins; // OCCLUSION_TILE_COUNT lists of indices into 'triangles'
+    u32 bin_counts[OCCLUSION_TILE_COUNT];
+    u32 bin_capacity; // Per tile, the room in 'triangles'
+
+    mat4x4 view_projection;
+
+    // Level 0 is the depth buffer, every texel of the next level is the maximum of 2x2 of the previous one
+    f32 *levels[OCCLUSION_LEVEL_COUNT];
+    u32 level_widths[OCCLUSION_LEVEL_COUNT], level_heights[OCCLUSION_LEVEL_COUNT];
+} OcclusionBuffer;
+
+// Counters of the last frame
+typedef struct {
+    u32 occluder_count;
+    u32 triangles_rasterized; // After clipping, without the ones that cover no pixel center
+    f32 raster_ms;
+
+    u32 instances_tested;
+    u32 instances_occluded;
+} OcclusionStats;
+
+extern OcclusionStats occlusion_stats;
+
+// Picks the occluders among the instances of the model and keeps their triangles in world space.
+// Call again when the model changes, the arrays of the last build are reused when they are large enough.
+void BuildOcclusionBuffer(ArenaMemory *memory, ArenaMemory *scratch, Model *model, OcclusionBuffer *buffer);
+
+// Clears the buffer and rasterizes the occluders seen with 'view_projection', then builds the pyramid.
+// @Note: Uses the work queue, so only the main thread may call this
+void RasterizeOccluders(OcclusionBuffer *buffer, mat4x4 view_projection);
+
+// True when the world space box is completely behind the occluders. Boxes that reach
+// in front of the near plane are always visible.
+bool AABBOccluded(OcclusionBuffer *buffer, vec3 min, vec3 max);
+
+#endif
@@ -0,0 +1,681 @@
+#include <stdio.h> // printf
+#include <string.h> // memset
+#include <float.h> // FLT_MAX
+#include <math.h> // fabsf, tanf
+
+#include "raycast.h"
+#include "..\platform.h"
+
+#if RAYCAST_AVX2
+#include <immintrin.h>
+#endif
+
+// Keeps 1 / direction finite, axis aligned rays would otherwise produce inf * 0 = NaN in the slab test
+#define RAYCAST_MIN_DIRECTION 1e-12f
+
+static f32 SafeInverse(f32 x)
+{
+    if(fabsf(x) < RAYCAST_MIN_DIRECTION) x = (x < 0.0f) ? -RAYCAST_MIN_DIRECTION : RAYCAST_MIN_DIRECTION;
+    return 1.0f / x;
+}
+
+static vec3 TransformPoint(mat4x4 transform, vec3 p)
+{
+    f32 *m = transform.matrix;
+    return create_vec3(m[0]*p.x + m[4]*p.y + m[8]*p.z  + m[12],
+                       m[1]*p.x + m[5]*p.y + m[9]*p.z  + m[13],
+                       m[2]*p.x + m[6]*p.y + m[10]*p.z + m[14]);
+}
+
+static vec3 TransformDirection(mat4x4 transform, vec3 d)
+{
+    f32 *m = transform.matrix;
+    return create_vec3(m[0]*d.x + m[4]*d.y + m[8]*d.z,
+                       m[1]*d.x + m[5]*d.y + m[9]*d.z,
+                       m[2]*d.x + m[6]*d.y + m[10]*d.z);
+}
+
+void BuildRaycastScene(ArenaMemory *memory, ArenaMemory *scratch, Model *model, BVH *instance_bvh, RaycastScene *scene)
+{
+    u64 start = GetWallClock();
+    u32 triangle_count = 0;
+
+    scene->model = model;
+    scene->instance_bvh = instance_bvh;
+    scene->meshes = (RaycastMesh*) ArenaAlloc16(memory, model->mesh_count * sizeof(RaycastMesh));
+
+    for(u32 mesh_index = 0; mesh_index < model->mesh_count; mesh_index++)
+    {
+        Mesh *mesh = &model->meshes[mesh_index];
+        RaycastMesh *raycast_mesh = &scene->meshes[mesh_index];
+        memset(raycast_mesh, 0, sizeof(RaycastMesh)); // A fresh BVH, there is no earlier build to reuse
+
+        size_t scratch_mark = scratch->used;
+
+        // Same decoding as the vertex shader
+        vec3 extent = sub_vec3(mesh->aabb_max, mesh->aabb_min);
+        vec3 *positions = (vec3*) ArenaAlloc16(scratch, mesh->vertex_count * sizeof(vec3));
+
+        for(u32 vertex_index = 0; vertex_index < mesh->vertex_count; vertex_index++)
+        {
+            u16 *q = mesh->vertices[vertex_index].position;
+            positions[vertex_index] = create_vec3(mesh->aabb_min.x + extent.x * (q[0] / 65535.0f),
+                                                  mesh->aabb_min.y + extent.y * (q[1] / 65535.0f),
+                                                  mesh->aabb_min.z + extent.z * (q[2] / 65535.0f));
+        }
+
+        BuildTriangleBVH(memory, scratch, positions, sizeof(vec3), mesh->indices, mesh->index_count, &raycast_mesh->bvh);
+
+        // Stored in the order the leaves reference them, traversal never goes through primitive_indices
+        u32 mesh_triangle_count = raycast_mesh->bvh.primitive_count;
+        raycast_mesh->triangles = (RaycastTriangle*) ArenaAlloc16(memory, mesh_triangle_count * sizeof(RaycastTriangle));
+
+        for(u32 index = 0; index < mesh_triangle_count; index++)
+        {
+            u32 triangle = raycast_mesh->bvh.primitive_indices[index];
+            vec3 p0 = positions[mesh->indices[triangle*3 + 0]];
+            vec3 p1 = positions[mesh->indices[triangle*3 + 1]];
+            vec3 p2 = positions[mesh->indices[triangle*3 + 2]];
+
+            RaycastTriangle *result = &raycast_mesh->triangles[index];
+            result->v0 = p0;
+            result->edge1 = sub_vec3(p1, p0);
+            result->edge2 = sub_vec3(p2, p0);
+            result->triangle_index = triangle;
+        }
+
+        triangle_count += mesh_triangle_count;
+        scratch->used = scratch_mark;
+    }
+
+    printf("Built raycast BVHs: %u meshes, %u triangles in %.2f ms\n",
+           model->mesh_count, triangle_count, GetSecondsElapsed(start, GetWallClock()) * 1000.0);
+}
+
+//----------------------
+// SINGLE RAYS
+//----------------------
+
+// Slab test, returns the entry distance or FLT_MAX on a miss
+static f32 IntersectBounds(vec3 min, vec3 max, vec3 origin, vec3 inv_direction, f32 t_max)
+{
+    f32 tx0 = (min.x - origin.x) * inv_direction.x, tx1 = (max.x - origin.x) * inv_direction.x;
+    f32 ty0 = (min.y - origin.y) * inv_direction.y, ty1 = (max.y - origin.y) * inv_direction.y;
+    f32 tz0 = (min.z - origin.z) * inv_direction.z, tz1 = (max.z - origin.z) * inv_direction.z;
+
+    f32 t_enter = (tx0 < tx1) ? tx0 : tx1;
+    f32 t_exit = (tx0 < tx1) ? tx1 : tx0;
+
+    f32 t = (ty0 < ty1) ? ty0 : ty1;
+    if(t > t_enter) t_enter = t;
+    t = (ty0 < ty1) ? ty1 : ty0;
+    if(t < t_exit) t_exit = t;
+
+    t = (tz0 < tz1) ? tz0 : tz1;
+    if(t > t_enter) t_enter = t;
+    t = (tz0 < tz1) ? tz1 : tz0;
+    if(t < t_exit) t_exit = t;
+
+    if(t_enter < 0.0f) t_enter = 0.0f;
+    if(t_exit > t_max) t_exit = t_max;
+
+    return (t_enter <= t_exit) ? t_enter : FLT_MAX;
+}
+
+// Möller-Trumbore, on a hit 't' is lowered and true returned.
+// Written out instead of using gfx_math, it is the innermost loop of every query.
+static bool IntersectTriangle(RaycastTriangle *triangle, vec3 origin, vec3 direction, f32 *t, f32 *u, f32 *v)
+{
+    vec3 e1 = triangle->edge1, e2 = triangle->edge2;
+
+    // p = cross(direction, edge2)
+    f32 px = direction.y*e2.z - direction.z*e2.y;
+    f32 py = direction.z*e2.x - direction.x*e2.z;
+    f32 pz = direction.x*e2.y - direction.y*e2.x;
+
+    f32 det = e1.x*px + e1.y*py + e1.z*pz;
+    if(det == 0.0f) return false;
+
+    f32 inv_det = 1.0f / det;
+    f32 ox = origin.x - triangle->v0.x, oy = origin.y - triangle->v0.y, oz = origin.z - triangle->v0.z;
+
+    f32 hit_u = (ox*px + oy*py + oz*pz) * inv_det;
+    if(hit_u < 0.0f || hit_u > 1.0f) return false;
+
+    // q = cross(to_origin, edge1)
+    f32 qx = oy*e1.z - oz*e1.y;
+    f32 qy = oz*e1.x - ox*e1.z;
+    f32 qz = ox*e1.y - oy*e1.x;
+
+    f32 hit_v = (direction.x*qx + direction.y*qy + direction.z*qz) * inv_det;
+    if(hit_v < 0.0f || hit_u + hit_v > 1.0f) return false;
+
+    f32 hit_t = (e2.x*qx + e2.y*qy + e2.z*qz) * inv_det;
+    if(hit_t <= 0.0f || hit_t >= *t) return false;
+
+    *t = hit_t;
+    *u = hit_u;
+    *v = hit_v;
+
+    return true;
+}
+
+// Nearest child first, so the closest hit shrinks 't_max' early and prunes the far one
+static bool CastRayMesh(RaycastMesh *mesh, vec3 origin, vec3 direction, RaycastMode mode,
+                        f32 *t_max, RayHit *hit)
+{
+    BVH *bvh = &mesh->bvh;
+    if(!bvh->node_count) return false;
+
+    vec3 inv_direction = create_vec3(SafeInverse(direction.x), SafeInverse(direction.y), SafeInverse(direction.z));
+    bool found = false;
+
+    // Entry distances are kept with the nodes, a hit found in between may make visiting them pointless
+    u32 stack[BVH_MAX_DEPTH];
+    f32 stack_t[BVH_MAX_DEPTH];
+    u32 stack_count = 0;
+
+    stack_t[stack_count] = IntersectBounds(bvh->nodes[0].min, bvh->nodes[0].max, origin, inv_direction, *t_max);
+    stack[stack_count++] = 0;
+
+    while(stack_count)
+    {
+        stack_count--;
+        if(stack_t[stack_count] > *t_max) continue;
+
+        BVHNode *node = &bvh->nodes[stack[stack_count]];
+
+        if(node->primitive_count)
+        {
+            for(u32 index = node->left_first; index < node->left_first + node->primitive_count; index++)
+            {
+                RaycastTriangle *triangle = &mesh->triangles[index];
+                if(!IntersectTriangle(triangle, origin, direction, t_max, &hit->u, &hit->v)) continue;
+
+                hit->triangle_index = triangle->triangle_index;
+                found = true;
+
+                if(mode == RAYCAST_ANY_HIT) return true;
+            }
+
+            continue;
+        }
+
+        u32 near_index = node->left_first, far_index = node->left_first + 1;
+        f32 t_near = IntersectBounds(bvh->nodes[near_index].min, bvh->nodes[near_index].max, origin, inv_direction, *t_max);
+        f32 t_far = IntersectBounds(bvh->nodes[far_index].min, bvh->nodes[far_index].max, origin, inv_direction, *t_max);
+
+        if(t_far < t_near)
+        {
+            f32 t = t_near; t_near = t_far; t_far = t;
+            u32 index = near_index; near_index = far_index; far_index = index;
+        }
+
+        if(t_far != FLT_MAX)
+        {
+            stack_t[stack_count] = t_far;
+            stack[stack_count++] = far_index;
+        }
+        if(t_near != FLT_MAX)
+        {
+            stack_t[stack_count] = t_near;
+            stack[stack_count++] = near_index;
+        }
+    }
+
+    return found;
+}
+
+bool CastRay(RaycastScene *scene, Ray *ray, RaycastMode mode, RayHit *hit)
+{
+    memset(hit, 0, sizeof(RayHit));
+
+    BVH *bvh = scene->instance_bvh;
+    if(!bvh->node_count || ray->t_max <= 0.0f) return false;
+
+    vec3 inv_direction = create_vec3(SafeInverse(ray->direction.x), SafeInverse(ray->direction.y), SafeInverse(ray->direction.z));
+    f32 t_max = ray->t_max;
+
+    u32 stack[BVH_MAX_DEPTH];
+    u32 stack_count = 0;
+    stack[stack_count++] = 0;
+
+    while(stack_count)
+    {
+        BVHNode *node = &bvh->nodes[stack[--stack_count]];
+
+        // Tested when popped, an earlier hit may have moved t_max in front of it since it was pushed
+        if(IntersectBounds(node->min, node->max, ray->origin, inv_direction, t_max) == FLT_MAX) continue;
+
+        if(!node->primitive_count)
+        {
+            stack[stack_count++] = node->left_first + 1;
+            stack[stack_count++] = node->left_first;
+            continue;
+        }
+
+        for(u32 index = node->left_first; index < node->left_first + node->primitive_count; index++)
+        {
+            u32 instance_index = bvh->primitive_indices[index];
+            MeshInstance *instance = &scene->model->instances[instance_index];
+
+            // Affine, so t means the same in mesh space
+            vec3 origin = TransformPoint(instance->inverse_transform, ray->origin);
+            vec3 direction = TransformDirection(instance->inverse_transform, ray->direction);
+
+            if(!CastRayMesh(&scene->meshes[instance->mesh_index], origin, direction, mode, &t_max, hit)) continue;
+
+            hit->hit = true;
+            hit->t = t_max;
+            hit->instance_index = instance_index;
+            hit->mesh_index = instance->mesh_index;
+
+            if(mode == RAYCAST_ANY_HIT) return true;
+        }
+    }
+
+    return hit->hit;
+}
+
+//----------------------
+// PACKETS
+//----------------------
+#if RAYCAST_AVX2
+
+// Structure of arrays, one lane per ray
+typedef struct {
+    __m256 origin[3];
+    __m256 direction[3];
+    __m256 inv_direction[3];
+} RayPacket;
+
+typedef struct {
+    // Rays only look for hits closer than this. Any hit mode sets it to -1 once a ray hit
+    // something, which fails every later test and takes the lane out of the packet.
+    __m256 t_max;
+
+    __m256 t, u, v;
+    __m256i triangle_index;
+    __m256i instance_index;
+    __m256 hit; // All bits set in the lanes that hit
+} PacketHits;
+
+static f32 HorizontalMin(__m256 x)
+{
+    __m128 m = _mm_min_ps(_mm256_castps256_ps128(x), _mm256_extractf128_ps(x, 1));
+    m = _mm_min_ps(m, _mm_movehl_ps(m, m));
+    m = _mm_min_ss(m, _mm_shuffle_ps(m, m, 1));
+    return _mm_cvtss_f32(m);
+}
+
+// Slab test of all lanes, returns the entry distance in the lanes that hit and FLT_MAX in the others
+static __m256 IntersectBoundsPacket(RayPacket *packet, __m256 t_max, vec3 min, vec3 max)
+{
+    __m256 tx0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(min.x), packet->origin[0]), packet->inv_direction[0]);
+    __m256 tx1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(max.x), packet->origin[0]), packet->inv_direction[0]);
+    __m256 ty0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(min.y), packet->origin[1]), packet->inv_direction[1]);
+    __m256 ty1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(max.y), packet->origin[1]), packet->inv_direction[1]);
+    __m256 tz0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(min.z), packet->origin[2]), packet->inv_direction[2]);
+    __m256 tz1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(max.z), packet->origin[2]), packet->inv_direction[2]);
+
+    __m256 t_enter = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(tx0, tx1), _mm256_min_ps(ty0, ty1)),
+                                   _mm256_max_ps(_mm256_min_ps(tz0, tz1), _mm256_setzero_ps()));
+    __m256 t_exit = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(tx0, tx1), _mm256_max_ps(ty0, ty1)),
+                                  _mm256_min_ps(_mm256_max_ps(tz0, tz1), t_max));
+
+    __m256 mask = _mm256_cmp_ps(t_enter, t_exit, _CMP_LE_OQ);
+    return _mm256_blendv_ps(_mm256_set1_ps(FLT_MAX), t_enter, mask);
+}
+
+// Möller-Trumbore of one triangle against all lanes
+static void IntersectTrianglePacket(RayPacket *packet, RaycastTriangle *triangle, __m256i instance_index, PacketHits *hits)
+{
+    __m256 e1x = _mm256_set1_ps(triangle->edge1.x), e1y = _mm256_set1_ps(triangle->edge1.y), e1z = _mm256_set1_ps(triangle->edge1.z);
+    __m256 e2x = _mm256_set1_ps(triangle->edge2.x), e2y = _mm256_set1_ps(triangle->edge2.y), e2z = _mm256_set1_ps(triangle->edge2.z);
+    __m256 *d = packet->direction;
+
+    // p = cross(direction, edge2)
+    __m256 px = _mm256_sub_ps(_mm256_mul_ps(d[1], e2z), _mm256_mul_ps(d[2], e2y));
+    __m256 py = _mm256_sub_ps(_mm256_mul_ps(d[2], e2x), _mm256_mul_ps(d[0], e2z));
+    __m256 pz = _mm256_sub_ps(_mm256_mul_ps(d[0], e2y), _mm256_mul_ps(d[1], e2x));
+
+    __m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)), _mm256_mul_ps(e1z, pz));
+    __m256 inv_det = _mm256_div_ps(_mm256_set1_ps(1.0f), det);
+
+    __m256 ox = _mm256_sub_ps(packet->origin[0], _mm256_set1_ps(triangle->v0.x));
+    __m256 oy = _mm256_sub_ps(packet->origin[1], _mm256_set1_ps(triangle->v0.y));
+    __m256 oz = _mm256_sub_ps(packet->origin[2], _mm256_set1_ps(triangle->v0.z));
+
+    __m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ox, px), _mm256_mul_ps(oy, py)), _mm256_mul_ps(oz, pz)), inv_det);
+
+    // q = cross(to_origin, edge1)
+    __m256 qx = _mm256_sub_ps(_mm256_mul_ps(oy, e1z), _mm256_mul_ps(oz, e1y));
+    __m256 qy = _mm256_sub_ps(_mm256_mul_ps(oz, e1x), _mm256_mul_ps(ox, e1z));
+    __m256 qz = _mm256_sub_ps(_mm256_mul_ps(ox, e1y), _mm256_mul_ps(oy, e1x));
+
+    __m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(d[0], qx), _mm256_mul_ps(d[1], qy)), _mm256_mul_ps(d[2], qz)), inv_det);
+    __m256 t = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)), inv_det);
+
+    // Ordered compares are false for the NaNs and infinities of det == 0
+    __m256 zero = _mm256_setzero_ps();
+    __m256 mask = _mm256_cmp_ps(u, zero, _CMP_GE_OQ);
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(v, zero, _CMP_GE_OQ));
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(_mm256_add_ps(u, v), _mm256_set1_ps(1.0f), _CMP_LE_OQ));
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(t, zero, _CMP_GT_OQ));
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(t, hits->t_max, _CMP_LT_OQ));
+
+    if(!_mm256_movemask_ps(mask)) return;
+
+    hits->t = _mm256_blendv_ps(hits->t, t, mask);
+    hits->u = _mm256_blendv_ps(hits->u, u, mask);
+    hits->v = _mm256_blendv_ps(hits->v, v, mask);
+    hits->hit = _mm256_or_ps(hits->hit, mask);
+
+    __m256i int_mask = _mm256_castps_si256(mask);
+    hits->triangle_index = _mm256_blendv_epi8(hits->triangle_index, _mm256_set1_epi32(triangle->triangle_index), int_mask);
+    hits->instance_index = _mm256_blendv_epi8(hits->instance_index, instance_index, int_mask);
+
+    hits->t_max = _mm256_blendv_ps(hits->t_max, t, mask);
+}
+
+// Lanes that are still looking for hits
+static s32 ActiveLanes(PacketHits *hits)
+{
+    return _mm256_movemask_ps(_mm256_cmp_ps(hits->t_max, _mm256_setzero_ps(), _CMP_GT_OQ));
+}
+
+static void CastPacketMesh(RaycastMesh *mesh, RayPacket *packet, RaycastMode mode, u32 instance_index, PacketHits *hits)
+{
+    BVH *bvh = &mesh->bvh;
+    if(!bvh->node_count) return;
+
+    __m256i instance_lanes = _mm256_set1_epi32(instance_index);
+
+    u32 stack[BVH_MAX_DEPTH];
+    u32 stack_count = 0;
+    stack[stack_count++] = 0;
+
+    while(stack_count)
+    {
+        BVHNode *node = &bvh->nodes[stack[--stack_count]];
+
+        __m256 t_enter = IntersectBoundsPacket(packet, hits->t_max, node->min, node->max);
+        if(_mm256_movemask_ps(_mm256_cmp_ps(t_enter, _mm256_set1_ps(FLT_MAX), _CMP_LT_OQ)) == 0) continue;
+
+        if(!node->primitive_count)
+        {
+            // Visit first the child the packet reaches first
+            BVHNode *left = &bvh->nodes[node->left_first];
+            BVHNode *right = left + 1;
+
+            f32 t_left = HorizontalMin(IntersectBoundsPacket(packet, hits->t_max, left->min, left->max));
+            f32 t_right = HorizontalMin(IntersectBoundsPacket(packet, hits->t_max, right->min, right->max));
+
+            if(t_left <= t_right)
+            {
+                if(t_right != FLT_MAX) stack[stack_count++] = node->left_first + 1;
+                if(t_left != FLT_MAX) stack[stack_count++] = node->left_first;
+            }
+            else
+            {
+                if(t_left != FLT_MAX) stack[stack_count++] = node->left_first;
+                stack[stack_count++] = node->left_first + 1;
+            }
+
+            continue;
+        }
+
+        for(u32 index = node->left_first; index < node->left_first + node->primitive_count; index++)
+        {
+            IntersectTrianglePacket(packet, &mesh->triangles[index], instance_lanes, hits);
+        }
+
+        if(mode == RAYCAST_ANY_HIT)
+        {
+            hits->t_max = _mm256_blendv_ps(hits->t_max, _mm256_set1_ps(-1.0f), hits->hit);
+            if(!ActiveLanes(hits)) return;
+        }
+    }
+}
+
+void CastRayPacket(RaycastScene *scene, Ray *rays, RaycastMode mode, RayHit *hits)
+{
+    f32 lanes[10][RAY_PACKET_SIZE];
+
+    for(u32 ray_index = 0; ray_index < RAY_PACKET_SIZE; ray_index++)
+    {
+        Ray *ray = &rays[ray_index];
+        lanes[0][ray_index] = ray->origin.x;
+        lanes[1][ray_index] = ray->origin.y;
+        lanes[2][ray_index] = ray->origin.z;
+        lanes[3][ray_index] = ray->direction.x;
+        lanes[4][ray_index] = ray->direction.y;
+        lanes[5][ray_index] = ray->direction.z;
+        lanes[6][ray_index] = (ray->t_max > 0.0f) ? ray->t_max : -1.0f;
+    }
+
+    RayPacket world;
+    for(u32 axis = 0; axis < 3; axis++)
+    {
+        world.origin[axis] = _mm256_loadu_ps(lanes[axis]);
+        world.direction[axis] = _mm256_loadu_ps(lanes[3 + axis]);
+    }
+
+    PacketHits packet_hits;
+    packet_hits.t_max = _mm256_loadu_ps(lanes[6]);
+    packet_hits.t = packet_hits.u = packet_hits.v = packet_hits.hit = _mm256_setzero_ps();
+    packet_hits.triangle_index = packet_hits.instance_index = _mm256_setzero_si256();
+
+    BVH *bvh = scene->instance_bvh;
+
+    u32 stack[BVH_MAX_DEPTH];
+    u32 stack_count = 0;
+    if(bvh->node_count && ActiveLanes(&packet_hits)) stack[stack_count++] = 0;
+
+    for(u32 axis = 0; axis < 3; axis++)
+    {
+        for(u32 ray_index = 0; ray_index < RAY_PACKET_SIZE; ray_index++)
+            lanes[7 + axis][ray_index] = SafeInverse(lanes[3 + axis][ray_index]);
+
+        world.inv_direction[axis] = _mm256_loadu_ps(lanes[7 + axis]);
+    }
+
+    while(stack_count)
+    {
+        BVHNode *node = &bvh->nodes[stack[--stack_count]];
+
+        __m256 t_enter = IntersectBoundsPacket(&world, packet_hits.t_max, node->min, node->max);
+        if(_mm256_movemask_ps(_mm256_cmp_ps(t_enter, _mm256_set1_ps(FLT_MAX), _CMP_LT_OQ)) == 0) continue;
+
+        if(!node->primitive_count)
+        {
+            stack[stack_count++] = node->left_first + 1;
+            stack[stack_count++] = node->left_first;
+            continue;
+        }
+
+        for(u32 index = node->left_first; index < node->left_first + node->primitive_count; index++)
+        {
+            u32 instance_index = bvh->primitive_indices[index];
+            MeshInstance *instance = &scene->model->instances[instance_index];
+            f32 *m = instance->inverse_transform.matrix;
+
+            // Into mesh space, t keeps its meaning
+            RayPacket local;
+            for(u32 row = 0; row < 3; row++)
+            {
+                __m256 r0 = _mm256_set1_ps(m[row]), r1 = _mm256_set1_ps(m[4 + row]), r2 = _mm256_set1_ps(m[8 + row]);
+
+                local.origin[row] = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(r0, world.origin[0]), _mm256_mul_ps(r1, world.origin[1])),
+                                                  _mm256_add_ps(_mm256_mul_ps(r2, world.origin[2]), _mm256_set1_ps(m[12 + row])));
+                local.direction[row] = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(r0, world.direction[0]), _mm256_mul_ps(r1, world.direction[1])),
+                                                     _mm256_mul_ps(r2, world.direction[2]));
+            }
+
+            for(u32 axis = 0; axis < 3; axis++)
+            {
+                _mm256_storeu_ps(lanes[axis], local.direction[axis]);
+                for(u32 ray_index = 0; ray_index < RAY_PACKET_SIZE; ray_index++)
+                    lanes[axis][ray_index] = SafeInverse(lanes[axis][ray_index]);
+
+                local.inv_direction[axis] = _mm256_loadu_ps(lanes[axis]);
+            }
+
+            CastPacketMesh(&scene->meshes[instance->mesh_index], &local, mode, instance_index, &packet_hits);
+
+            if(mode == RAYCAST_ANY_HIT && !ActiveLanes(&packet_hits))
+            {
+                stack_count = 0;
+                break;
+            }
+        }
+    }
+
+    f32 t[RAY_PACKET_SIZE], u[RAY_PACKET_SIZE], v[RAY_PACKET_SIZE];
+    u32 triangle_index[RAY_PACKET_SIZE], instance_index[RAY_PACKET_SIZE];
+
+    _mm256_storeu_ps(t, packet_hits.t);
+    _mm256_storeu_ps(u, packet_hits.u);
+    _mm256_storeu_ps(v, packet_hits.v);
+    _mm256_storeu_si256((__m256i*)triangle_index, packet_hits.triangle_index);
+    _mm256_storeu_si256((__m256i*)instance_index, packet_hits.instance_index);
+    s32 hit_mask = _mm256_movemask_ps(packet_hits.hit);
+
+    // Back to SSE code without the AVX transition penalty
+    _mm256_zeroupper();
+
+    for(u32 ray_index = 0; ray_index < RAY_PACKET_SIZE; ray_index++)
+    {
+        RayHit *hit = &hits[ray_index];
+        memset(hit, 0, sizeof(RayHit));
+
+        if(!(hit_mask & (1 << ray_index))) continue;
+
+        hit->hit = true;
+        hit->t = t[ray_index];
+        hit->u = u[ray_index];
+        hit->v = v[ray_index];
+        hit->triangle_index = triangle_index[ray_index];
+        hit->instance_index = instance_index[ray_index];
+        hit->mesh_index = scene->model->instances[hit->instance_index].mesh_index;
+    }
+}
+
+#else
+
+void CastRayPacket(RaycastScene *scene, Ray *rays, RaycastMode mode, RayHit *hits)
+{
+    for(u32 ray_index = 0; ray_index < RAY_PACKET_SIZE; ray_index++)
+        CastRay(scene, &rays[ray_index], mode, &hits[ray_index]);
+}
+
+#endif
+
+//----------------------
+// BENCHMARK
+//----------------------
+#if PERF
+
+// Tiles of 4x2 pixels, so a packet holds neighbouring rays
+#define BENCHMARK_TILE_WIDTH 4
+#define BENCHMARK_TILE_HEIGHT 2
+
+typedef struct {
+    RaycastScene *scene;
+    RaycastMode mode;
+    bool packets;
+
+    vec3 origin, forward, right, up; // right and up are scaled to the half extent of the image plane
+    u32 width, height;
+
+    u32 tile_count;
+    u32 volatile next_tile;
+    u32 volatile hit_count;
+} RaycastBenchmark;
+
+static void BenchmarkTiles(WorkQueue *queue, void *data)
+{
+    RaycastBenchmark *benchmark = (RaycastBenchmark*)data;
+    u32 tiles_per_row = benchmark->width / BENCHMARK_TILE_WIDTH;
+    u32 hit_count = 0;
+
+    for(;;)
+    {
+        u32 tile = AtomicIncrement(&benchmark->next_tile) - 1;
+        if(tile >= benchmark->tile_count) break;
+
+        u32 tile_x = (tile % tiles_per_row) * BENCHMARK_TILE_WIDTH;
+        u32 tile_y = (tile / tiles_per_row) * BENCHMARK_TILE_HEIGHT;
+
+        Ray rays[RAY_PACKET_SIZE];
+        RayHit hits[RAY_PACKET_SIZE];
+
+        for(u32 ray_index = 0; ray_index < RAY_PACKET_SIZE; ray_index++)
+        {
+            f32 x = ((tile_x + ray_index % BENCHMARK_TILE_WIDTH) + 0.5f) / benchmark->width * 2.0f - 1.0f;
+            f32 y = ((tile_y + ray_index / BENCHMARK_TILE_WIDTH) + 0.5f) / benchmark->height * 2.0f - 1.0f;
+
+            rays[ray_index].origin = benchmark->origin;
+            rays[ray_index].direction = add_vec3(benchmark->forward, add_vec3(scale_vec3(benchmark->right, x), scale_vec3(benchmark->up, y)));
+            rays[ray_index].t_max = FLT_MAX;
+        }
+
+        if(benchmark->packets)
+        {
+            CastRayPacket(benchmark->scene, rays, benchmark->mode, hits);
+        }
+        else
+        {
+            for(u32 ray_index = 0; ray_index < RAY_PACKET_SIZE; ray_index++)
+                CastRay(benchmark->scene, &rays[ray_index], benchmark->mode, &hits[ray_index]);
+        }
+
+        for(u32 ray_index = 0; ray_index < RAY_PACKET_SIZE; ray_index++)
+            hit_count += hits[ray_index].hit;
+    }
+
+    AtomicAdd(&benchmark->hit_count, hit_count);
+}
+
+void BenchmarkRaycasts(RaycastScene *scene, Camera *camera, u32 width, u32 height)
+{
+    RaycastBenchmark benchmark = {0};
+    benchmark.scene = scene;
+    benchmark.width = width - width % BENCHMARK_TILE_WIDTH;
+    benchmark.height = height - height % BENCHMARK_TILE_HEIGHT;
+    benchmark.tile_count = (benchmark.width / BENCHMARK_TILE_WIDTH) * (benchmark.height / BENCHMARK_TILE_HEIGHT);
+
+    f32 half_height = tanf(RADIANS(camera->fov) * 0.5f);
+    f32 half_width = half_height * (f32)benchmark.width / (f32)benchmark.height;
+
+    benchmark.origin = camera->position;
+    benchmark.forward = normalize_vec3(camera->direction);
+    benchmark.right = scale_vec3(normalize_vec3(cross_vec3(benchmark.forward, camera->world_up)), half_width);
+    benchmark.up = scale_vec3(normalize_vec3(cross_vec3(benchmark.right, benchmark.forward)), half_height);
+
+    u32 ray_count = benchmark.tile_count * RAY_PACKET_SIZE;
+    u32 worker_count = work_queue.thread_count + 1;
+
+    for(u32 run = 0; run < 4; run++)
+    {
+        benchmark.mode = (run & 1) ? RAYCAST_ANY_HIT : RAYCAST_CLOSEST_HIT;
+        benchmark.packets = (run >= 2);
+        benchmark.next_tile = 0;
+        benchmark.hit_count = 0;
+
+        u64 start = GetWallClock();
+
+        for(u32 worker_index = 0; worker_index < worker_count; worker_index++)
+            AddWorkEntry(&work_queue, BenchmarkTiles, &benchmark);
+        CompleteAllWork(&work_queue);
+
+        f64 seconds = GetSecondsElapsed(start, GetWallClock());
+
+        printf("Raycasts %s, %s: %u rays in %.2f ms, %.2f Mrays/s, %u hits (%u threads)\n",
+               benchmark.packets ? "packets of 8" : "single rays",
+               (benchmark.mode == RAYCAST_ANY_HIT) ? "any hit" : "closest hit",
+               ray_count, seconds * 1000.0, ray_count / seconds / 1000000.0, benchmark.hit_count, worker_count);
+    }
+}
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef RAYCAST_H
+#define RAYCAST_H
+
+#include <stdbool.h>
+
+#include "bvh.h"
+#include "model.h"
+#include "camera.h"
+#include "..\memory.h"
+#include "..\gfx_math.h"
+#include "..\defines.h"
+
+/*
+  CPU ray casts against a Model, for picking, line of sight and camera collision.
+
+  Two levels: the BVH over the world space bounds of the instances (the one the renderer
+  culls with), then a triangle BVH per mesh. Rays are moved into mesh space for the second
+  level, so instances share the triangle BVH of their mesh. Triangles are double sided.
+*/
+
+// Packets are traversed with AVX2, otherwise their rays are cast one by one
+#ifndef RAYCAST_AVX2
+#define RAYCAST_AVX2 1
+#endif
+
+#define RAY_PACKET_SIZE 8
+
+typedef struct {
+    vec3 origin;
+    vec3 direction; // Does not have to be normalized, t is measured in multiples of it
+    f32 t_max;      // Hits further away are ignored, a ray with t_max <= 0 is skipped
+} Ray;
+
+typedef struct {
+    bool hit;
+    f32 t;
+
+    u32 instance_index;
+    u32 mesh_index;
+    u32 triangle_index; // Its indices start at 3 * triangle_index in the index buffer of the mesh
+
+    // Barycentric weights of the second and third vertex of the triangle
+    f32 u, v;
+} RayHit;
+
+typedef enum {
+    RAYCAST_CLOSEST_HIT,
+    RAYCAST_ANY_HIT, // Stops at the first hit found, enough for line of sight
+} RaycastMode;
+
+// Mesh space triangle, prepared for Möller-Trumbore
+typedef struct {
+    vec3 v0, edge1, edge2;
+    u32 triangle_index;
+} RaycastTriangle;
+
+typedef struct {
+    BVH bvh;
+    RaycastTriangle *triangles; // In leaf order, the ranges of the leaves index this directly
+} RaycastMesh;
+
+typedef struct {
+    Model *model;
+    BVH *instance_bvh; // Over the world space bounds of model->instances
+    RaycastMesh *meshes; // One per mesh of the model
+} RaycastScene;
+
+// Builds the triangle BVHs into 'memory', 'instance_bvh' is referenced and has to outlive the scene.
+// Nothing of an earlier scene is reused, give it an arena that is reset before every build.
+void BuildRaycastScene(ArenaMemory *memory, ArenaMemory *scratch, Model *model, BVH *instance_bvh, RaycastScene *scene);
+
+bool CastRay(RaycastScene *scene, Ray *ray, RaycastMode mode, RayHit *hit);
+
+// RAY_PACKET_SIZE rays at once, fastest when they are coherent like the rays through neighbouring pixels
+void CastRayPacket(RaycastScene *scene, Ray *rays, RaycastMode mode, RayHit *hits);
+
+#if PERF
+// Primary rays through every pixel of a 'width' x 'height' view, cast on all threads
+void BenchmarkRaycasts(RaycastScene *scene, Camera *camera, u32 width, u32 height);
+#endif
+
+#endif
@@ -0,0 +1,113 @@
+#include <assert.h>
+#include <string.h> // memcpy
+
+#include "render_queue.h"
+
+void InitRenderQueue(RenderQueue *queue, ArenaMemory *memory, u32 capacity)
+{
+    if(capacity <= queue->capacity) return;
+
+    queue->packets = (RenderPacket*) ArenaAlloc16(memory, capacity * sizeof(RenderPacket));
+    queue->entries = (RenderSortEntry*) ArenaAlloc16(memory, capacity * sizeof(RenderSortEntry));
+    queue->sort_buffer = (RenderSortEntry*) ArenaAlloc16(memory, capacity * sizeof(RenderSortEntry));
+    queue->capacity = capacity;
+    queue->count = 0;
+}
+
+void ResetRenderQueue(RenderQueue *queue)
+{
+    queue->count = 0;
+}
+
+void SetFaceCullMode(FaceCullMode mode)
+{
+    if(mode == FACE_CULL_NONE)
+    {
+        glDisable(GL_CULL_FACE);
+        return;
+    }
+
+    glEnable(GL_CULL_FACE);
+    glFrontFace(mode == FACE_CULL_BACK_CW ? GL_CW : GL_CCW);
+}
+
+RenderPacket *PushRenderPacket(RenderQueue *queue, u64 sort_key)
+{
+    assert(queue->count < queue->capacity);
+
+    u32 packet_index = queue->count++;
+    queue->entries[packet_index].key = sort_key;
+    queue->entries[packet_index].packet_index = packet_index;
+
+    return &queue->packets[packet_index];
+}
+
+void SortRenderQueue(RenderQueue *queue)
+{
+    RenderSortEntry *source = queue->entries;
+    RenderSortEntry *dest = queue->sort_buffer;
+    u32 count = queue->count;
+
+    // All histograms in one read of the keys
+    u32 histograms[8][256] = {0};
+    for(u32 index = 0; index < count; index++)
+    {
+        u64 key = source[index].key;
+        for(u32 byte = 0; byte < 8; byte++) histograms[byte][(key >> (byte * 8)) & 0xFF]++;
+    }
+
+    for(u32 byte = 0; byte < 8; byte++)
+    {
+        u32 *histogram = histograms[byte];
+
+        // Every key has the same byte here, this pass would not move anything
+        if(count == 0 || histogram[(source[0].key >> (byte * 8)) & 0xFF] == count) continue;
+
+        u32 offset = 0;
+        for(u32 bucket = 0; bucket < 256; bucket++)
+        {
+            u32 bucket_count = histogram[bucket];
+            histogram[bucket] = offset;
+            offset += bucket_count;
+        }
+
+        for(u32 index = 0; index < count; index++)
+        {
+            u32 bucket = (source[index].key >> (byte * 8)) & 0xFF;
+            dest[histogram[bucket]++] = source[index];
+        }
+
+        RenderSortEntry *swap = source;
+        source = dest;
+        dest = swap;
+    }
+
+    // An odd number of passes leaves the result in the other buffer
+    if(source != queue->entries)
+    {
+        queue->sort_buffer = queue->entries;
+        queue->entries = source;
+    }
+}
+
+u64 MakeSortKey(RenderPass pass, u32 program_index, u32 material_index, u32 vertex_array, f32 view_depth)
+{
+    assert(pass < (1 << SORT_KEY_PASS_BITS));
+    assert(program_index < (1 << SORT_KEY_PROGRAM_BITS));
+    assert(material_index < (1 << SORT_KEY_MATERIAL_BITS));
+    assert(vertex_array < (1 << SORT_KEY_VERTEX_ARRAY_BITS));
+    assert(view_depth >= 0.0f);
+
+    // The bits of a positive float grow with its value, the top ones are enough to order by
+    u32 depth_bits;
+    memcpy(&depth_bits, &view_depth, sizeof(depth_bits));
+    u64 depth = depth_bits >> (32 - SORT_KEY_DEPTH_BITS);
+
+    u64 key = pass;
+    key = (key << SORT_KEY_PROGRAM_BITS) | program_index;
+    key = (key << SORT_KEY_MATERIAL_BITS) | material_index;
+    key = (key << SORT_KEY_VERTEX_ARRAY_BITS) | vertex_array;
+    key = (key << SORT_KEY_DEPTH_BITS) | depth;
+
+    return key;
+}
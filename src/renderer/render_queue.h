@@ -0,0 +1,92 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include "glad/glad.h"
+#include "..\memory.h"
+#include "..\defines.h"
+
+/*
+  Draws are recorded as packets first, then sorted by a 64-bit key and submitted in that
+  order. The key puts the most expensive state changes in the highest bits, so packets
+  that share a program, material and vertex array end up next to each other and the
+  submission only changes what differs from the previous packet:
+
+    63      60 59       52 51        40 39            24 23          0
+    |  pass   | program   | material   | vertex array   | depth      |
+
+  Within the same state, packets are drawn front to back for early-z rejection.
+*/
+
+typedef enum {
+    RENDER_PASS_OPAQUE,
+
+    RENDER_PASS_COUNT
+} RenderPass;
+
+#define SORT_KEY_PASS_BITS 4
+#define SORT_KEY_PROGRAM_BITS 8
+#define SORT_KEY_MATERIAL_BITS 12
+#define SORT_KEY_VERTEX_ARRAY_BITS 16
+#define SORT_KEY_DEPTH_BITS 24
+
+typedef struct {
+    u32 program_index; // In the shader bank
+    u32 material_index;
+    u32 mesh_index;
+    u32 instance_index;
+
+    // Index ranges of the visible meshlets, the whole mesh is drawn when there are none
+    GLsizei *draw_counts;
+    void **draw_offsets;
+    u32 draw_count;
+} RenderPacket;
+
+typedef struct {
+    u64 key;
+    u32 packet_index;
+} RenderSortEntry;
+
+// What glMultiDrawElementsIndirect reads from GL_DRAW_INDIRECT_BUFFER, per draw
+typedef struct {
+    u32 count;
+    u32 instance_count;
+    u32 first_index;
+    s32 base_vertex;
+    u32 base_instance;
+} DrawElementsIndirectCommand;
+
+typedef struct {
+    RenderPacket *packets;
+    RenderSortEntry *entries; // Sorted by SortRenderQueue
+    RenderSortEntry *sort_buffer;
+    u32 count, capacity;
+} RenderQueue;
+
+// Allocated once, grown by calling it again with a larger capacity
+void InitRenderQueue(RenderQueue *queue, ArenaMemory *memory, u32 capacity);
+
+// Empties the queue for the next frame
+void ResetRenderQueue(RenderQueue *queue);
+
+// Which faces of a draw are culled. Front faces are counterclockwise unless the transform of the
+// instance mirrors, the faces of double sided materials are all drawn.
+typedef enum {
+    FACE_CULL_BACK_CCW,
+    FACE_CULL_BACK_CW,
+    FACE_CULL_NONE,
+
+    FACE_CULL_MODE_COUNT
+} FaceCullMode;
+
+// glFrontFace and GL_CULL_FACE for the mode
+void SetFaceCullMode(FaceCullMode mode);
+
+RenderPacket *PushRenderPacket(RenderQueue *queue, u64 sort_key);
+
+// LSD radix sort of the entries, 8 bits per pass. Passes where every key has the same byte are skipped.
+void SortRenderQueue(RenderQueue *queue);
+
+// 'view_depth' must not be negative, larger is further away
+u64 MakeSortKey(RenderPass pass, u32 program_index, u32 material_index, u32 vertex_array, f32 view_depth);
+
+#endif
@@ -0,0 +1,57 @@
+#include <stdio.h> // printf
+
+#include "render_target.h"
+#include "gl_state.h"
+
+bool ResizeRenderTarget(RenderTarget *target, s32 width, s32 height)
+{
+    if(width <= 0 || height <= 0) return false;
+    if(target->framebuffer && target->width == width && target->height == height) return false;
+
+    if(!target->framebuffer) glCreateFramebuffers(1, &target->framebuffer);
+
+    if(target->color)
+    {
+        StateForgetTexture(target->color);
+        StateForgetTexture(target->depth);
+        glDeleteTextures(1, &target->color);
+        glDeleteTextures(1, &target->depth);
+    }
+
+    glCreateTextures(GL_TEXTURE_2D, 1, &target->color);
+    glTextureStorage2D(target->color, 1, GL_RGBA8, width, height);
+
+    // Read with texelFetch only
+    glCreateTextures(GL_TEXTURE_2D, 1, &target->depth);
+    glTextureStorage2D(target->depth, 1, GL_DEPTH_COMPONENT32F, width, height);
+    glTextureParameteri(target->depth, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTextureParameteri(target->depth, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    glNamedFramebufferTexture(target->framebuffer, GL_COLOR_ATTACHMENT0, target->color, 0);
+    glNamedFramebufferTexture(target->framebuffer, GL_DEPTH_ATTACHMENT, target->depth, 0);
+
+    GLenum status = glCheckNamedFramebufferStatus(target->framebuffer, GL_FRAMEBUFFER);
+    if(status != GL_FRAMEBUFFER_COMPLETE) printf("Render target of %dx%d is incomplete: 0x%x\n", width, height, status);
+
+    target->width = width;
+    target->height = height;
+
+    return true;
+}
+
+void BindRenderTarget(RenderTarget *target)
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, target->framebuffer);
+    glViewport(0, 0, target->width, target->height);
+}
+
+void PresentRenderTarget(RenderTarget *target, s32 window_width, s32 window_height)
+{
+    glBlitNamedFramebuffer(target->framebuffer, 0,
+                           0, 0, target->width, target->height,
+                           0, 0, window_width, window_height,
+                           GL_COLOR_BUFFER_BIT, GL_NEAREST);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, window_width, window_height);
+}
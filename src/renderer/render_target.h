@@ -0,0 +1,28 @@
+#ifndef RENDER_TARGET_H
+#define RENDER_TARGET_H
+
+#include <stdbool.h>
+
+#include "glad/glad.h"
+#include "..\defines.h"
+
+// Framebuffer whose depth can be sampled afterwards, the one of the window can not be.
+// The frame is drawn into it and copied to the window at the end.
+typedef struct {
+    GLuint framebuffer;
+    GLuint color; // GL_RGBA8
+    GLuint depth; // GL_DEPTH_COMPONENT32F
+    s32 width, height;
+} RenderTarget;
+
+// Creates the textures again when the size changed, true when it did. A size of 0 (a
+// minimized window) keeps the old ones.
+bool ResizeRenderTarget(RenderTarget *target, s32 width, s32 height);
+
+// Binds the framebuffer and sets the viewport to cover it
+void BindRenderTarget(RenderTarget *target);
+
+// Copies the color to the window and binds the window framebuffer
+void PresentRenderTarget(RenderTarget *target, s32 window_width, s32 window_height);
+
+#endif
@@ -1,3 +1,7 @@
+#include <assert.h>
+#include <float.h> // FLT_MAX
+#include <math.h> // tanf
+
 #include "renderer.h"
 #include "camera.h"
 #include "vertex_array.h"
@@ -5,10 +9,28 @@
 #include "index_buffer.h"
 #include "shader_bank.h"
 #include "model.h"
+#include "culling.h"
+#include "occlusion.h"
+#include "hiz.h"
+#include "gpu_culling.h"
+#include "gpu_query.h"
+#include "shadows.h"
+#include "shadow_atlas.h"
+#include "lights.h"
+#include "light_clusters.h"
+#include "gbuffer.h"
+#include "render_target.h"
+#include "bvh.h"
+#include "raycast.h"
+#include "texture_streaming.h"
+#include "render_queue.h"
+#include "gl_state.h"
+#include "uniform_blocks.h"
 
 #include "cube.h"
 
 #include "..\win64_main.h"
+#include "..\platform.h"
 #include "..\defines.h"
 #include "..\gfx_math.h"
 
@@ -20,8 +42,92 @@ static vec3 light_dir;
 static Model test_model;
 
 static ArenaMemory region1;
+static ArenaMemory mesh_memory;
 static ArenaMemory scratch_memory;
+static ArenaMemory raycast_memory; // Only the raycast scene, it is built again from scratch on every reload
+
+// Index ranges of the visible meshlets of every packet in the render queue
+static GLsizei *meshlet_draw_counts;
+static void **meshlet_draw_offsets;
+static u32 meshlet_draw_capacity;
+
+static RenderQueue render_queue;
+
+// Frame and draw data and the indirect commands, written from the sorted queue every frame.
+// The draw blocks are indexed by the position of the packet in the queue.
+#define FRAME_STREAM_SIZE MB(4)
+static StreamBuffer frame_stream;
+
+// Instances of test_model by their world space bounds
+static BVH scene_bvh;
+static vec3 *instance_bounds_min, *instance_bounds_max;
+static CullBounds instance_cull_bounds; // The same AABBs plus world space spheres, for the flat cull
+static u8 *instance_visible;
+static u32 *visible_instances;
+static u32 visible_instance_capacity;
+
+// CPU ray casts against test_model, over scene_bvh
+static RaycastScene raycast_scene;
+
+static OcclusionBuffer occlusion_buffer;
+
+// The scene is drawn here, so its depth can be read back for the pyramid
+static RenderTarget scene_target;
+static HiZ hiz;
+
+// With deferred shading the scene is drawn into it instead and lit into scene_target
+static GBuffer gbuffer;
+static bool deferred_frame;
+
+static GPUCulling gpu_culling;
+
+// Cascades of dir_light, drawn from the position stream with the depth program
+static ShadowMaps shadow_maps;
+static u8 *shadow_caster_visible; // Per instance, for the cascade being culled
+static u32 *local_light_casters;  // Instances in reach of the light whose atlas faces are being drawn
+
+// Point and spot lights, the ones with a slot cast shadows from the atlas
+static LocalLight local_lights[MAX_LOCAL_LIGHTS];
+static vec3 local_light_homes[MAX_LOCAL_LIGHTS]; // Where they move around
+static u32 local_light_count;
+static ShadowAtlas shadow_atlas;
+static LightClusters light_clusters;
+
+// Small point lights without shadows all over the scene, key L cycles through the counts
+static const u32 light_field_counts[] = {0, 256, 1024, 4000};
+static s32 placed_light_field = -1;
+
+#define CAMERA_NEAR 0.1f
+#define CAMERA_FAR 5000.0f
 
+// Everything drawn into scene_target, and the samples that pass the depth test in the shading
+// passes. The GPU runs the fragment shader for those only, it tests depth early.
+static GPUQuery scene_time_query, shaded_samples_query;
+
+// The path each frame of scene_time_query was drawn with, and the last time of each path
+static bool scene_query_deferred[GPU_QUERY_FRAMES];
+static f32 forward_gpu_ms, deferred_gpu_ms;
+
+// Looked up once in render_init, the submission does no string work
+static u32 default_program;
+static u32 depth_program;
+static u32 gbuffer_program, deferred_program;
+static u32 scene_program; // The scene is drawn with this frame, default_program or gbuffer_program
+static struct {
+    UniformHandle draw_index; // Into the draw table, negative for indirect draws
+    UniformHandle shadow_map;
+    UniformHandle shadow_atlas;
+
+#if MATERIAL_TEXTURE_ARRAYS
+    UniformHandle texture_arrays[MAX_TEXTURE_ARRAYS];
+#else
+    UniformHandle diffuse_map, specular_map, ambient_map;
+#endif
+} uniforms;
+
+static vec3 light_amb, light_diff, light_spec;
+
+RenderStats render_stats;
 Camera global_cam;
 extern AppState app_state;
 extern ShaderBank shaders;
@@ -85,12 +191,399 @@ static u32 quad_indices[] = {
     0, 1, 3,
 };
 
+// The triangle BVHs of the last build are dropped with their arena
+static void build_raycast_scene(void)
+{
+    ResetArena(&raycast_memory);
+    BuildRaycastScene(&raycast_memory, &scratch_memory, &test_model, &scene_bvh, &raycast_scene);
+}
+
+// Enough room for the visible ranges of every instance and one packet per instance
+static void reserve_meshlet_draws(Model *model)
+{
+    u32 total_meshlet_count = 0;
+    for(u32 instance_index = 0; instance_index < model->instance_count; instance_index++)
+        total_meshlet_count += model->meshes[model->instances[instance_index].mesh_index].meshlet_count;
+
+    InitRenderQueue(&render_queue, &mesh_memory, model->instance_count);
+
+    if(total_meshlet_count <= meshlet_draw_capacity) return;
+
+    meshlet_draw_counts = (GLsizei*) ArenaAlloc16(&mesh_memory, total_meshlet_count * sizeof(GLsizei));
+    meshlet_draw_offsets = (void**) ArenaAlloc16(&mesh_memory, total_meshlet_count * sizeof(void*));
+    meshlet_draw_capacity = total_meshlet_count;
+}
+
+// One entry per material index of the meshes, for the material table the shaders index
+static void upload_materials(Model *model)
+{
+    u32 material_count = 0;
+    for(u32 mesh_index = 0; mesh_index < model->mesh_count; mesh_index++)
+    {
+        if(model->meshes[mesh_index].material_index >= material_count)
+            material_count = model->meshes[mesh_index].material_index + 1;
+    }
+
+    // Temporary
+    size_t scratch_used = scratch_memory.used;
+    MaterialBlock *blocks = (MaterialBlock*) ArenaAlloc16(&scratch_memory, material_count * sizeof(MaterialBlock));
+
+    for(u32 mesh_index = 0; mesh_index < model->mesh_count; mesh_index++)
+    {
+        Material *mat = &model->meshes[mesh_index].material;
+        MaterialBlock *block = &blocks[model->meshes[mesh_index].material_index];
+
+        block->diffuse = create_vec4(mat->diffuse.x, mat->diffuse.y, mat->diffuse.z, 0.0f);
+        block->specular = create_vec4(mat->specular.x, mat->specular.y, mat->specular.z, 0.0f);
+        block->ambient = create_vec4(mat->ambient.x, mat->ambient.y, mat->ambient.z, 0.0f);
+
+        block->diffuse_map[0] = mat->diffuse_map.array;
+        block->diffuse_map[1] = mat->diffuse_map.layer;
+        block->specular_map[0] = mat->specular_map.array;
+        block->specular_map[1] = mat->specular_map.layer;
+        block->ambient_map[0] = mat->ambient_map.array;
+        block->ambient_map[1] = mat->ambient_map.layer;
+
+        block->shininess = mat->shininess;
+        block->padding = 0.0f;
+    }
+
+    UploadMaterialBlocks(blocks, material_count);
+    scratch_memory.used = scratch_used;
+}
+
+// Rebuilt when instances were added or removed. 'refit' keeps the tree of the same instances and
+// only moves its bounds, for reloads that changed transforms or meshes.
+static void build_scene_bvh(Model *model, bool refit)
+{
+    u64 start = GetWallClock();
+
+    if(model->instance_count > visible_instance_capacity)
+    {
+        instance_bounds_min = (vec3*) ArenaAlloc16(&mesh_memory, model->instance_count * sizeof(vec3));
+        instance_bounds_max = (vec3*) ArenaAlloc16(&mesh_memory, model->instance_count * sizeof(vec3));
+        visible_instances = (u32*) ArenaAlloc16(&mesh_memory, model->instance_count * sizeof(u32));
+        instance_visible = (u8*) ArenaAlloc16(&mesh_memory, model->instance_count * sizeof(u8));
+        shadow_caster_visible = (u8*) ArenaAlloc16(&mesh_memory, model->instance_count * sizeof(u8));
+        local_light_casters = (u32*) ArenaAlloc16(&mesh_memory, model->instance_count * sizeof(u32));
+
+        instance_cull_bounds.center_x = (f32*) ArenaAlloc16(&mesh_memory, model->instance_count * sizeof(f32));
+        instance_cull_bounds.center_y = (f32*) ArenaAlloc16(&mesh_memory, model->instance_count * sizeof(f32));
+        instance_cull_bounds.center_z = (f32*) ArenaAlloc16(&mesh_memory, model->instance_count * sizeof(f32));
+        instance_cull_bounds.radius = (f32*) ArenaAlloc16(&mesh_memory, model->instance_count * sizeof(f32));
+        visible_instance_capacity = model->instance_count;
+    }
+
+    instance_cull_bounds.aabb_min = instance_bounds_min;
+    instance_cull_bounds.aabb_max = instance_bounds_max;
+    instance_cull_bounds.count = model->instance_count;
+
+    for(u32 instance_index = 0; instance_index < model->instance_count; instance_index++)
+    {
+        MeshInstance *instance = &model->instances[instance_index];
+        Mesh *mesh = &model->meshes[instance->mesh_index];
+
+        TransformBounds(instance->transform, mesh->aabb_min, mesh->aabb_max,
+                        &instance_bounds_min[instance_index], &instance_bounds_max[instance_index]);
+
+        // The largest scale of the transform keeps the sphere around the mesh
+        f32 *m = instance->transform.matrix;
+        f32 scale = fmaxf(fmaxf(length_vec3(create_vec3(m[0], m[1], m[2])),
+                                length_vec3(create_vec3(m[4], m[5], m[6]))),
+                          length_vec3(create_vec3(m[8], m[9], m[10])));
+
+        vec4 center = mat4x4_mult_vec4(instance->transform, create_vec4(mesh->sphere_center.x, mesh->sphere_center.y, mesh->sphere_center.z, 1.0f));
+        instance_cull_bounds.center_x[instance_index] = center.x;
+        instance_cull_bounds.center_y[instance_index] = center.y;
+        instance_cull_bounds.center_z[instance_index] = center.z;
+        instance_cull_bounds.radius[instance_index] = mesh->sphere_radius * scale;
+    }
+
+    refit = refit && scene_bvh.node_count && scene_bvh.primitive_count == model->instance_count;
+    if(refit) RefitBVH(&scene_bvh, instance_bounds_min, instance_bounds_max);
+    else BuildBVH(&mesh_memory, &scratch_memory, instance_bounds_min, instance_bounds_max, model->instance_count, &scene_bvh);
+
+    printf("%s scene BVH: %u instances, %u nodes in %.2f ms\n", refit ? "Refit" : "Built",
+           model->instance_count, scene_bvh.node_count, GetSecondsElapsed(start, GetWallClock()) * 1000.0);
+}
+
+// Mirrored instances wind their front faces the other way, double sided materials have none
+static FaceCullMode instance_face_cull(MeshInstance *instance, Mesh *mesh)
+{
+    if(mesh->material.double_sided) return FACE_CULL_NONE;
+    return instance->flip_winding ? FACE_CULL_BACK_CW : FACE_CULL_BACK_CCW;
+}
+
+// The GPU culling and the shadow casters read every instance from static buffers.
+// After build_scene_bvh, the bounds are its world space AABBs.
+static void upload_instance_buffers(Model *model)
+{
+    size_t scratch_used = scratch_memory.used;
+    GPUCullInstance *instances = (GPUCullInstance*) ArenaAlloc16(&scratch_memory, model->instance_count * sizeof(GPUCullInstance));
+    DrawBlock *draws = (DrawBlock*) ArenaAlloc16(&scratch_memory, model->instance_count * sizeof(DrawBlock));
+
+    for(u32 instance_index = 0; instance_index < model->instance_count; instance_index++)
+    {
+        MeshInstance *instance = &model->instances[instance_index];
+        Mesh *mesh = &model->meshes[instance->mesh_index];
+
+        GPUCullInstance *cull = &instances[instance_index];
+        cull->world_min = instance_bounds_min[instance_index];
+        cull->index_count = mesh->index_count;
+        cull->world_max = instance_bounds_max[instance_index];
+        cull->first_index = mesh->first_index;
+        cull->base_vertex = mesh->base_vertex;
+        cull->face_cull = instance_face_cull(instance, mesh);
+        cull->padding[0] = cull->padding[1] = 0;
+
+        DrawBlock *draw = &draws[instance_index];
+        draw->model = instance->transform;
+        draw->position_min = mesh->aabb_min;
+        draw->material_index = mesh->material_index;
+        draw->position_extent = sub_vec3(mesh->aabb_max, mesh->aabb_min);
+        draw->padding = 0;
+    }
+
+    UploadGPUCullInstances(&gpu_culling, instances, draws, model->instance_count);
+
+    vec3 scene_min = create_vec3(0.0f, 0.0f, 0.0f), scene_max = scene_min;
+    if(scene_bvh.node_count)
+    {
+        scene_min = scene_bvh.nodes[0].min;
+        scene_max = scene_bvh.nodes[0].max;
+    }
+    UploadShadowCasters(&shadow_maps, draws, model->instance_count, scene_min, scene_max);
+    ShadowCastersChanged(&shadow_atlas, scene_min, scene_max);
+
+    scratch_memory.used = scratch_used;
+}
+
+// From the point to the closest point of the world space bounds, 0 inside them
+static f32 instance_distance_to(u32 instance_index, vec3 point)
+{
+    vec3 min = instance_bounds_min[instance_index];
+    vec3 max = instance_bounds_max[instance_index];
+
+    vec3 offset = create_vec3(fmaxf(fmaxf(min.x - point.x, point.x - max.x), 0.0f),
+                              fmaxf(fmaxf(min.y - point.y, point.y - max.y), 0.0f),
+                              fmaxf(fmaxf(min.z - point.z, point.z - max.z), 0.0f));
+
+    return length_vec3(offset);
+}
+
+static f32 instance_distance(u32 instance_index)
+{
+    return instance_distance_to(instance_index, global_cam.position);
+}
+
+// Texture coordinate units one pixel covers at the point of the instance closest to the camera,
+// 0 when the mesh has no texture coordinates
+static f32 texture_detail(u32 instance_index, f32 world_per_pixel_at_unit_distance)
+{
+    MeshInstance *instance = &test_model.instances[instance_index];
+    Mesh *mesh = &test_model.meshes[instance->mesh_index];
+    if(mesh->uv_density <= 0.0f) return 0.0f;
+
+    // Inside the bounds the closest surface could be right at the near plane
+    f32 distance = fmaxf(instance_distance(instance_index), 0.1f);
+
+    // Largest scale of the transform, mesh units to world units
+    f32 *m = instance->transform.matrix;
+    f32 scale = fmaxf(fmaxf(length_vec3(create_vec3(m[0], m[1], m[2])),
+                            length_vec3(create_vec3(m[4], m[5], m[6]))),
+                      length_vec3(create_vec3(m[8], m[9], m[10])));
+    if(scale <= 0.0f) return 0.0f;
+
+    return mesh->uv_density * distance * world_per_pixel_at_unit_distance / scale;
+}
+
+// Size of a pixel at distance 1
+static f32 world_per_pixel_at_unit_distance(void)
+{
+    return 2.0f * tanf(RADIANS(global_cam.fov) * 0.5f) / (f32)app_state.window_height;
+}
+
+// The texture streaming requests for the maps of the instance
+static void request_texture_detail(u32 instance_index, f32 world_per_pixel)
+{
+    f32 uv_per_pixel = texture_detail(instance_index, world_per_pixel);
+    if(uv_per_pixel <= 0.0f) return;
+
+    Material *mat = &test_model.meshes[test_model.instances[instance_index].mesh_index].material;
+#if MATERIAL_TEXTURE_ARRAYS
+    if(mat->diffuse_map.layer >= 0) RequestArrayDetail(mat->diffuse_map.array, uv_per_pixel);
+    if(mat->specular_map.layer >= 0) RequestArrayDetail(mat->specular_map.array, uv_per_pixel);
+    if(mat->ambient_map.layer >= 0) RequestArrayDetail(mat->ambient_map.array, uv_per_pixel);
+#else
+    RequestTextureDetail(mat->diffuse_map.id, uv_per_pixel);
+    RequestTextureDetail(mat->specular_map.id, uv_per_pixel);
+    RequestTextureDetail(mat->ambient_map.id, uv_per_pixel);
+#endif
+}
+
+// Walks the scene BVH and collects the instances whose bounds touch the frustum
+static u32 cull_instances_bvh(Frustum *frustum)
+{
+    u32 visible_count = 0;
+    if(!scene_bvh.node_count) return 0;
+
+    u32 stack[BVH_MAX_DEPTH];
+    u32 stack_count = 0;
+    stack[stack_count++] = 0;
+
+    while(stack_count)
+    {
+        BVHNode *node = &scene_bvh.nodes[stack[--stack_count]];
+        render_stats.bvh_nodes_tested++;
+
+        if(!AABBInFrustum(frustum, node->min, node->max)) continue;
+
+        if(node->primitive_count)
+        {
+            // The leaf bounds cover up to BVH_MAX_LEAF_SIZE instances, the ones of the instances are tighter
+            for(u32 index = node->left_first; index < node->left_first + node->primitive_count; index++)
+            {
+                u32 instance_index = scene_bvh.primitive_indices[index];
+                render_stats.instances_tested++;
+
+                if(AABBInFrustum(frustum, instance_bounds_min[instance_index], instance_bounds_max[instance_index]))
+                    visible_instances[visible_count++] = instance_index;
+            }
+        }
+        else
+        {
+            stack[stack_count++] = node->left_first + 1;
+            stack[stack_count++] = node->left_first;
+        }
+    }
+
+    return visible_count;
+}
+
+// Tests every instance, spread over the work queue in SoA batches. Cheaper than the BVH walk
+// as long as a good part of the scene is visible, it never chases pointers.
+static u32 cull_instances_flat(Frustum *frustum)
+{
+    render_stats.instances_tested = instance_cull_bounds.count;
+    CullBoundsParallel(frustum, &instance_cull_bounds, instance_visible);
+
+    // In instance order, the same every frame for the same view
+    u32 visible_count = 0;
+    for(u32 instance_index = 0; instance_index < instance_cull_bounds.count; instance_index++)
+    {
+        if(instance_visible[instance_index]) visible_instances[visible_count++] = instance_index;
+    }
+
+    return visible_count;
+}
+
+// xorshift32, the same lights every run
+static f32 random_unit(u32 *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return (f32)(*state >> 8) / (f32)(1 << 24);
+}
+
+// A few point lights along the middle of the scene and spot lights looking down on it, all
+// with shadows, then the light field. After build_scene_bvh, they are placed in its bounds.
+static void place_local_lights(void)
+{
+    placed_light_field = app_state.light_field;
+    if(!scene_bvh.node_count) return;
+
+    vec3 min = scene_bvh.nodes[0].min, max = scene_bvh.nodes[0].max;
+    vec3 extent = sub_vec3(max, min);
+    vec3 center = scale_vec3(add_vec3(min, max), 0.5f);
+    f32 size = fmaxf(extent.x, fmaxf(extent.y, extent.z));
+
+    local_light_count = 0;
+
+    f32 point_offsets[] = {-0.3f, -0.1f, 0.1f, 0.3f};
+    vec3 point_colors[] = {{{2.0f, 1.4f, 0.8f}}, {{0.8f, 1.2f, 2.0f}}, {{2.0f, 1.4f, 0.8f}}, {{1.2f, 2.0f, 0.8f}}};
+    for(u32 point_index = 0; point_index < ArrayCount(point_offsets); point_index++)
+    {
+        LocalLight *light = &local_lights[local_light_count++];
+        light->type = LIGHT_POINT;
+        light->position = create_vec3(center.x + point_offsets[point_index] * extent.x, min.y + 0.15f * extent.y, center.z);
+        light->direction = create_vec3(0.0f, -1.0f, 0.0f);
+        light->color = point_colors[point_index];
+        light->range = 0.15f * size;
+    }
+
+    f32 spot_offsets[] = {-0.25f, 0.25f};
+    for(u32 spot_index = 0; spot_index < ArrayCount(spot_offsets); spot_index++)
+    {
+        LocalLight *light = &local_lights[local_light_count++];
+        light->type = LIGHT_SPOT;
+        light->position = create_vec3(center.x + spot_offsets[spot_index] * extent.x, min.y + 0.6f * extent.y, center.z);
+        light->direction = normalize_vec3(create_vec3(-spot_offsets[spot_index], -1.0f, 0.0f));
+        light->color = create_vec3(3.0f, 3.0f, 2.6f);
+        light->range = 0.4f * size;
+        light->inner_angle = RADIANS(20.0f);
+        light->outer_angle = RADIANS(30.0f);
+    }
+
+    for(u32 light_index = 0; light_index < local_light_count; light_index++)
+        local_lights[light_index].shadow_slot = (light_index < SHADOW_ATLAS_MAX_LIGHTS) ? light_index : NO_SHADOW_SLOT;
+
+    // Over the lower half of the scene, a little inside of its walls
+    u32 random_state = 0x9E3779B9;
+    u32 field_count = light_field_counts[app_state.light_field % ArrayCount(light_field_counts)];
+    if(field_count > MAX_LOCAL_LIGHTS - local_light_count) field_count = MAX_LOCAL_LIGHTS - local_light_count;
+
+    for(u32 field_index = 0; field_index < field_count; field_index++)
+    {
+        LocalLight *light = &local_lights[local_light_count++];
+        light->type = LIGHT_POINT;
+        light->position = create_vec3(min.x + (0.05f + 0.9f * random_unit(&random_state)) * extent.x,
+                                      min.y + 0.5f * random_unit(&random_state) * extent.y,
+                                      min.z + (0.05f + 0.9f * random_unit(&random_state)) * extent.z);
+        light->direction = create_vec3(0.0f, -1.0f, 0.0f);
+        light->color = create_vec3(0.2f + random_unit(&random_state), 0.2f + random_unit(&random_state), 0.2f + random_unit(&random_state));
+        light->range = 0.025f * size;
+        light->shadow_slot = NO_SHADOW_SLOT;
+    }
+
+    for(u32 light_index = 0; light_index < local_light_count; light_index++)
+        local_light_homes[light_index] = local_lights[light_index].position;
+
+    printf("Local lights: %u, %u of them in the light field\n", local_light_count, field_count);
+}
+
+// The first point light circles around where it was placed, its shadow is drawn again as it moves.
+// The light field bobs up and down.
+static void move_local_lights(f32 time)
+{
+    if(app_state.light_field != placed_light_field) place_local_lights();
+    if(!local_light_count) return;
+
+    vec3 home = local_light_homes[0];
+    f32 radius = 0.2f * local_lights[0].range;
+    local_lights[0].position = create_vec3(home.x + radius * cosf(0.5f * time), home.y, home.z + radius * sinf(0.5f * time));
+
+    for(u32 light_index = 0; light_index < local_light_count; light_index++)
+    {
+        LocalLight *light = &local_lights[light_index];
+        if(light->shadow_slot != NO_SHADOW_SLOT) continue;
+
+        home = local_light_homes[light_index];
+        f32 phase = (f32)(light_index % 64) * 0.1f;
+        light->position.y = home.y + 0.5f * light->range * sinf((1.0f + phase) * time + phase * 7.0f);
+    }
+}
+
 void render_init()
 {
     gladLoadGLLoader((GLADloadproc) glfwGetProcAddress);	    
     glViewport(0,0, app_state.window_width, app_state.window_height);
     glEnable(GL_DEPTH_TEST);
 
+    // Back faces are culled, double sided materials turn it off for their own draws. Meshlet cone
+    // culling skips their meshes for the same reason.
+    SetFaceCullMode(FACE_CULL_BACK_CCW);
+
     // glEnable(GL_BLEND);
     // glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
@@ -109,17 +602,51 @@ void render_init()
     
     // Compile shaders
     register_shader("..\\src\\shaders\\default.glsl", "default");
+    register_shader_variant("..\\src\\shaders\\default.glsl", "gbuffer", "#define GBUFFER_PASS\n");
+    register_shader_variant("..\\src\\shaders\\default.glsl", "deferred", "#define DEFERRED_LIGHTING\n");
     register_shader("..\\src\\shaders\\ui.glsl", "ui");    
     register_shader("..\\src\\shaders\\cube.glsl", "cube");
     register_shader("..\\src\\shaders\\light.glsl", "light");
+    register_vertex_shader("..\\src\\shaders\\depth.glsl", "depth");
+    register_compute_shader("..\\src\\shaders\\hiz_build.glsl", "hiz_build");
+    register_compute_shader("..\\src\\shaders\\hiz_cull.glsl", "hiz_cull");
+    register_compute_shader("..\\src\\shaders\\gpu_cull.glsl", "gpu_cull");
+    set_shader_common("..\\src\\shaders\\common.glsl");
+    
+    // The shaders see the same options as the C code
+    static char shader_defines[1024];
+    snprintf(shader_defines, sizeof(shader_defines),
+             "#define MATERIAL_TEXTURE_ARRAYS %d\n#define MAX_TEXTURE_ARRAYS %d\n"
+             "#define FRAME_UNIFORM_BINDING %d\n#define MATERIAL_STORAGE_BINDING %d\n#define DRAW_STORAGE_BINDING %d\n"
+             "#define HIZ_COMMAND_BINDING %d\n#define HIZ_STATS_BINDING %d\n"
+             "#define GPU_CULL_INSTANCE_BINDING %d\n#define GPU_CULL_PENDING_BINDING %d\n"
+             "#define GPU_CULL_COMMAND_BINDING %d\n#define GPU_CULL_COUNTER_BINDING %d\n#define GPU_CULL_LISTS %d\n"
+             "#define SHADOW_CASCADE_COUNT %d\n#define LIGHT_STORAGE_BINDING %d\n#define SHADOW_FACE_STORAGE_BINDING %d\n"
+             "#define CLUSTER_STORAGE_BINDING %d\n#define CLUSTER_LIGHT_STORAGE_BINDING %d\n"
+             "#define LIGHT_CLUSTERS_X %d\n#define LIGHT_CLUSTERS_Y %d\n#define LIGHT_CLUSTERS_Z %d\n",
+             MATERIAL_TEXTURE_ARRAYS, MAX_TEXTURE_ARRAYS, FRAME_UNIFORM_BINDING, MATERIAL_STORAGE_BINDING, DRAW_STORAGE_BINDING,
+             HIZ_COMMAND_BINDING, HIZ_STATS_BINDING,
+             GPU_CULL_INSTANCE_BINDING, GPU_CULL_PENDING_BINDING, GPU_CULL_COMMAND_BINDING, GPU_CULL_COUNTER_BINDING, GPU_CULL_LISTS,
+             SHADOW_CASCADE_COUNT, LIGHT_STORAGE_BINDING, SHADOW_FACE_STORAGE_BINDING,
+             CLUSTER_STORAGE_BINDING, CLUSTER_LIGHT_STORAGE_BINDING, LIGHT_CLUSTERS_X, LIGHT_CLUSTERS_Y, LIGHT_CLUSTERS_Z);
+    set_shader_defines(shader_defines);
     
     if(!init_shader_bank())
     {
         printf("Failed init of shader bank!\n");
         exit(0);
     }
+
+    InitUniformBlocks();
+    InitStreamBuffer(&frame_stream, FRAME_STREAM_SIZE);
+    InitHiZ(&hiz);
+    InitGPUCulling(&gpu_culling);
+    InitShadowMaps(&shadow_maps);
+    InitShadowAtlas(&shadow_atlas);
+    InitGBuffer(&gbuffer);
+    InitGPUQuery(&scene_time_query, GL_TIME_ELAPSED);
+    InitGPUQuery(&shaded_samples_query, GL_SAMPLES_PASSED);
     
-    ArenaMemory mesh_memory;
     {
         size_t region_size = MB(10);
         InitArena(&region1, ALLOC_MEM(region_size), region_size);
@@ -129,30 +656,48 @@ void render_init()
         
         region_size = MB(256);
         InitArena(&scratch_memory, ALLOC_MEM(region_size), region_size);        
+
+        region_size = MB(256);
+        InitArena(&raycast_memory, ALLOC_MEM(region_size), region_size);
     }
 
+    InitLightClusters(&region1, &light_clusters);
+
+    SetTextureStreamingBudget(TEXTURE_STREAMING_BUDGET);
+
     use_program(0);
-    test_model = LoadModelFromAssimp(&mesh_memory, &scratch_memory, "sponza", "sponza.obj");
+    test_model = LoadModel(&mesh_memory, &scratch_memory, "sponza", "sponza.obj");
+#if BENCHMARK_OBJ_IMPORT
+    BenchmarkObjBackends(&scratch_memory, test_model.model_folder_path, test_model.model_name);
+#endif
+    upload_materials(&test_model);
+
+    reserve_meshlet_draws(&test_model);
+    build_scene_bvh(&test_model, false);
+    upload_instance_buffers(&test_model);
+    build_raycast_scene();
+    BuildOcclusionBuffer(&mesh_memory, &scratch_memory, &test_model, &occlusion_buffer);
+    place_local_lights();
 
 #if 0
     
     // UI  
     glGenVertexArrays(1, &ui_VAO);
-    glBindVertexArray(ui_VAO);
+    StateBindVertexArray(ui_VAO);
 
     glGenBuffers(1, &ui_VBO);
-    glBindBuffer(GL_ARRAY_BUFFER, ui_VBO);
+    StateBindBuffer(GL_ARRAY_BUFFER, ui_VBO);
     glBufferData(GL_ARRAY_BUFFER, sizeof(quad_vert), quad_vert, GL_STATIC_DRAW);
 
     glGenBuffers(1, &ui_EBO);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ui_EBO);
+    StateBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ui_EBO);
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(quad_indices), quad_indices, GL_STATIC_DRAW);
 
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
     glEnableVertexAttribArray(0);
-    glBindVertexArray(0);    
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);      
+    StateBindVertexArray(0);    
+    StateBindBuffer(GL_ARRAY_BUFFER, 0);
+    StateBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);      
 
 #endif
     
@@ -160,19 +705,32 @@ void render_init()
     light_color = create_vec3(1.0f, 1.0f, 1.0f);
     light_dir = normalize_vec3(create_vec3(0.3f, -1.0f, 0.));
     
-    vec3 light_amb = create_vec3(0.1f, 0.1f, 0.1f);
-    vec3 light_diff = create_vec3(0.5f, 0.5f, 0.5f);
-    vec3 light_spec = create_vec3(0.5f, 0.5f, 0.5f);
+    light_amb = create_vec3(0.1f, 0.1f, 0.1f);
+    light_diff = create_vec3(0.5f, 0.5f, 0.5f);
+    light_spec = create_vec3(0.5f, 0.5f, 0.5f);
 
-    use_program_name("default");
-    
-    set_int("diffuse_map", 0);
-    set_int("specular_map", 1);
-    set_int("ambient_map", 2);
+    default_program = query_program_index("default");
+    depth_program = query_program_index("depth");
+    gbuffer_program = query_program_index("gbuffer");
+    deferred_program = query_program_index("deferred");
+    scene_program = default_program;
+
+    uniforms.draw_index = query_uniform("draw_index");
+    uniforms.shadow_map = query_uniform("shadow_map");
+    uniforms.shadow_atlas = query_uniform("shadow_atlas");
     
-    set_vec3f("dir_light.ambient", light_amb);
-    set_vec3f("dir_light.diffuse", light_diff);
-    set_vec3f("dir_light.specular", light_spec);
+#if MATERIAL_TEXTURE_ARRAYS
+    for(u32 unit = 0; unit < MAX_TEXTURE_ARRAYS; unit++)
+    {
+        char sampler_name[32];
+        snprintf(sampler_name, sizeof(sampler_name), "texture_arrays[%u]", unit);
+        uniforms.texture_arrays[unit] = query_uniform(sampler_name);
+    }
+#else
+    uniforms.diffuse_map = query_uniform("diffuse_map");
+    uniforms.specular_map = query_uniform("specular_map");
+    uniforms.ambient_map = query_uniform("ambient_map");
+#endif
     
     vec3 cam_pos, cam_dir, cam_up;
     
@@ -182,20 +740,743 @@ void render_init()
         
     create_camera(&global_cam, cam_pos, cam_dir, cam_up, app_state.fov, 1000.0f);
 
+#if PERF
+    BenchmarkRaycasts(&raycast_scene, &global_cam, app_state.window_width, app_state.window_height);
+#endif
+
 }
 
-void render(float dt)
+void reload_assets()
+{
+    ReloadTextures();
+
+    if(ReloadModel(&mesh_memory, &scratch_memory, &test_model))
+    {
+        upload_materials(&test_model);
+        reserve_meshlet_draws(&test_model);
+
+        // The instances are in the same order when their number did not change
+        build_scene_bvh(&test_model, true);
+        upload_instance_buffers(&test_model);
+        build_raycast_scene();
+        BuildOcclusionBuffer(&mesh_memory, &scratch_memory, &test_model, &occlusion_buffer);
+        place_local_lights();
+    }
+}
+
+#if DEBUG
+void check_reload_memory()
 {
+    size_t used = 0;
+    for(u32 pass = 0; pass < 3; pass++)
+    {
+        // Looks like every file changed, so the whole model goes through the reload path
+        for(u32 file_index = 0; file_index < test_model.watched_file_count; file_index++)
+            test_model.watched_files[file_index].mod = 0;
+
+        reload_assets();
+        build_scene_bvh(&test_model, false); // The full build is what runs when the instance count changes
+
+        if(pass && mesh_memory.used != used)
+            printf("Reload %u took %llu more bytes of mesh memory\n", pass, (unsigned long long)(mesh_memory.used - used));
+        assert(!pass || mesh_memory.used == used);
+        used = mesh_memory.used;
+    }
+
+    printf("Reloads keep mesh memory at %llu bytes\n", (unsigned long long)used);
+}
+#endif
+
+void pick_at_crosshair()
+{
+    Ray ray;
+    ray.origin = global_cam.position;
+    ray.direction = global_cam.direction;
+    ray.t_max = FLT_MAX;
+
+    RayHit hit;
+    if(CastRay(&raycast_scene, &ray, RAYCAST_CLOSEST_HIT, &hit))
+    {
+        printf("Picked instance %u: mesh %u, triangle %u at distance %.2f\n",
+               hit.instance_index, hit.mesh_index, hit.triangle_index, hit.t * length_vec3(ray.direction));
+    }
+    else printf("Picked nothing\n");
+}
+
+// Program and the state every draw with it shares
+static void bind_program(u32 program_index)
+{
+    use_program_index(program_index);
+
+    // Constant, but a reloaded program starts over from the defaults. The state cache drops them otherwise.
+#if MATERIAL_TEXTURE_ARRAYS
+    for(u32 unit = 0; unit < MAX_TEXTURE_ARRAYS; unit++) set_int_handle(uniforms.texture_arrays[unit], unit);
+
+    // Every texture of the frame at once, the materials pick their array and layer
+    u32 texture_arrays[MAX_TEXTURE_ARRAYS];
+    u32 texture_array_count = GetTextureArrays(texture_arrays);
+    StateBindTextures(0, texture_array_count, texture_arrays);
+#else
+    set_int_handle(uniforms.diffuse_map, 0);
+    set_int_handle(uniforms.specular_map, 1);
+    set_int_handle(uniforms.ambient_map, 2);
+#endif
+
+    set_int_handle(uniforms.shadow_map, SHADOW_TEXTURE_UNIT);
+    StateBindTextures(SHADOW_TEXTURE_UNIT, 1, &shadow_maps.depth_array);
+    set_int_handle(uniforms.shadow_atlas, SHADOW_ATLAS_TEXTURE_UNIT);
+    StateBindTextures(SHADOW_ATLAS_TEXTURE_UNIT, 1, &shadow_atlas.depth);
+
+    render_stats.program_changes++;
+}
+
+typedef enum {
+    SCENE_PASS_SHADE,       // Depth tested with GL_LESS, without a pre-pass
+    SCENE_PASS_DEPTH,       // The pre-pass, no color writes and no fragment shader
+    SCENE_PASS_SHADE_EQUAL, // After the pre-pass, only the closest fragment of a pixel is shaded
+} ScenePass;
+
+static void set_scene_pass_state(ScenePass pass)
+{
+    GLboolean color_writes = (pass != SCENE_PASS_DEPTH);
+    glColorMask(color_writes, color_writes, color_writes, color_writes);
+
+    // The pre-pass already wrote the depth that the shading pass tests against
+    glDepthFunc((pass == SCENE_PASS_SHADE_EQUAL) ? GL_EQUAL : GL_LESS);
+    glDepthMask(pass != SCENE_PASS_SHADE_EQUAL);
+}
+
+// The queue from the position stream of the model, the ranges of a packet are converted to
+// the shared indices. Every packet has the same program and vertex array.
+static void submit_packets_depth(void)
+{
+    u32 shared_index_type = test_model.shared_index_type;
+    size_t shared_index_size = (shared_index_type == GL_UNSIGNED_SHORT) ? sizeof(u16) : sizeof(u32);
+
+    use_program_index(depth_program);
+    render_stats.program_changes++;
+
+    BindVertArr(test_model.position_va);
+    render_stats.vertex_array_changes++;
+
+    FaceCullMode bound_face_cull = FACE_CULL_MODE_COUNT;
+    for(u32 entry_index = 0; entry_index < render_queue.count; entry_index++)
+    {
+        RenderPacket *packet = &render_queue.packets[render_queue.entries[entry_index].packet_index];
+        MeshInstance *instance = &test_model.instances[packet->instance_index];
+        Mesh *mesh = &test_model.meshes[packet->mesh_index];
+
+        set_int_handle(uniforms.draw_index, entry_index);
+
+        FaceCullMode face_cull = instance_face_cull(instance, mesh);
+        if(face_cull != bound_face_cull)
+        {
+            SetFaceCullMode(face_cull);
+            bound_face_cull = face_cull;
+        }
+
+        size_t index_size = (mesh->index_type == GL_UNSIGNED_SHORT) ? sizeof(u16) : sizeof(u32);
+        u32 range_count = packet->draw_count ? packet->draw_count : 1;
+        for(u32 range = 0; range < range_count; range++)
+        {
+            u32 first_index = mesh->first_index;
+            u32 count = mesh->index_count;
+            if(packet->draw_count)
+            {
+                first_index += (u32)((size_t)packet->draw_offsets[range] / index_size);
+                count = packet->draw_counts[range];
+            }
+
+            glDrawElementsBaseVertex(GL_TRIANGLES, count, shared_index_type, (void*)(first_index * shared_index_size), mesh->base_vertex);
+            render_stats.draw_calls++;
+        }
+    }
+
+    SetFaceCullMode(FACE_CULL_BACK_CCW);
+}
+
+// A draw call per packet with the vertex array of its mesh. Only the state that differs from the previous packet is set.
+static void submit_packets(void)
+{
+    u32 bound_program = UINT32_MAX, bound_material = UINT32_MAX, bound_mesh = UINT32_MAX;
+    FaceCullMode bound_face_cull = FACE_CULL_MODE_COUNT;
     
-    glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    for(u32 entry_index = 0; entry_index < render_queue.count; entry_index++)
+    {
+        RenderPacket *packet = &render_queue.packets[render_queue.entries[entry_index].packet_index];
+        MeshInstance *instance = &test_model.instances[packet->instance_index];
+        Mesh *mesh = &test_model.meshes[packet->mesh_index];
+
+        if(packet->program_index != bound_program)
+        {
+            bind_program(packet->program_index);
+
+            bound_program = packet->program_index;
+            bound_material = bound_mesh = UINT32_MAX;
+        }
+
+        if(packet->material_index != bound_material)
+        {
+#if !MATERIAL_TEXTURE_ARRAYS
+            Material *mat = &mesh->material;
+
+            StateActiveTexture(0);
+            StateBindTexture(GL_TEXTURE_2D, mat->diffuse_map.id);
+
+            StateActiveTexture(1);
+            StateBindTexture(GL_TEXTURE_2D, mat->specular_map.id);
+
+            StateActiveTexture(2);
+            StateBindTexture(GL_TEXTURE_2D, mat->ambient_map.id);
+#endif
+
+            bound_material = packet->material_index;
+            render_stats.material_changes++;
+        }
+
+        if(packet->mesh_index != bound_mesh)
+        {
+            BindVertArr(mesh->va);
+
+            bound_mesh = packet->mesh_index;
+            render_stats.vertex_array_changes++;
+        }
+        
+        set_int_handle(uniforms.draw_index, entry_index);
+
+        FaceCullMode face_cull = instance_face_cull(instance, mesh);
+        if(face_cull != bound_face_cull)
+        {
+            SetFaceCullMode(face_cull);
+            bound_face_cull = face_cull;
+        }
+        
+        if(packet->draw_count)
+            glMultiDrawElements(GL_TRIANGLES, packet->draw_counts, mesh->index_type, (const void* const*)packet->draw_offsets, packet->draw_count);
+        else
+            glDrawElements(GL_TRIANGLES, mesh->index_count, mesh->index_type, 0);
+
+        render_stats.draw_calls++;
+    }
+
+    SetFaceCullMode(FACE_CULL_BACK_CCW);
+}
+
+typedef struct {
+    u32 program_index;
+    FaceCullMode face_cull;
+    u32 first_command, command_count;
+} IndirectBatch;
+
+typedef struct {
+    StreamAllocation commands;
+    u32 command_count;
+
+    IndirectBatch batches[FACE_CULL_MODE_COUNT * MAX_SHADER_PROGRAMS];
+    u32 batch_count;
+} IndirectSubmission;
+
+// The commands of the whole queue from the shared buffers of the model, batched per program and
+// face cull mode, a single glMultiDrawElementsIndirect can change neither. Every meshlet range is a command
+// and the draws find their draw block through the base instance. False when there is nothing to draw.
+static bool build_indirect(IndirectSubmission *submission)
+{
+    submission->batch_count = 0;
+    submission->command_count = 0;
+
+    // Meshes without visible ranges are drawn whole
+    u32 command_capacity = 0;
+    for(u32 packet_index = 0; packet_index < render_queue.count; packet_index++)
+    {
+        u32 draw_count = render_queue.packets[packet_index].draw_count;
+        command_capacity += draw_count ? draw_count : 1;
+    }
+
+    if(!command_capacity) return false;
+
+    submission->commands = StreamAlloc(&frame_stream, command_capacity * sizeof(DrawElementsIndirectCommand));
+    DrawElementsIndirectCommand *draw_commands = (DrawElementsIndirectCommand*) submission->commands.memory;
+    u32 command_count = 0;
+
+    for(u32 run_start = 0; run_start < render_queue.count;)
+    {
+        // The queue is sorted by program first
+        u32 program_index = render_queue.packets[render_queue.entries[run_start].packet_index].program_index;
+        u32 run_end = run_start + 1;
+        while(run_end < render_queue.count &&
+              render_queue.packets[render_queue.entries[run_end].packet_index].program_index == program_index)
+        {
+            run_end++;
+        }
+
+        for(u32 face_cull = 0; face_cull < FACE_CULL_MODE_COUNT; face_cull++)
+        {
+            IndirectBatch batch = {program_index, (FaceCullMode) face_cull, command_count, 0};
+
+            for(u32 entry_index = run_start; entry_index < run_end; entry_index++)
+            {
+                RenderPacket *packet = &render_queue.packets[render_queue.entries[entry_index].packet_index];
+                Mesh *mesh = &test_model.meshes[packet->mesh_index];
+                if(instance_face_cull(&test_model.instances[packet->instance_index], mesh) != batch.face_cull) continue;
+
+                size_t index_size = (mesh->index_type == GL_UNSIGNED_SHORT) ? sizeof(u16) : sizeof(u32);
+                u32 range_count = packet->draw_count ? packet->draw_count : 1;
+
+                assert(command_count + range_count <= command_capacity);
+                for(u32 range = 0; range < range_count; range++)
+                {
+                    DrawElementsIndirectCommand *command = &draw_commands[command_count++];
+                    command->instance_count = 1;
+                    command->base_vertex = mesh->base_vertex;
+                    command->base_instance = entry_index;
+
+                    // The ranges are byte offsets into the index buffer of the mesh, which can be 16-bit
+                    if(packet->draw_count)
+                    {
+                        command->count = packet->draw_counts[range];
+                        command->first_index = mesh->first_index + (u32)((size_t)packet->draw_offsets[range] / index_size);
+                    }
+                    else
+                    {
+                        command->count = mesh->index_count;
+                        command->first_index = mesh->first_index;
+                    }
+                }
+            }
+
+            batch.command_count = command_count - batch.first_command;
+            if(batch.command_count)
+            {
+                assert(submission->batch_count < ArrayCount(submission->batches));
+                submission->batches[submission->batch_count++] = batch;
+            }
+        }
+
+        run_start = run_end;
+    }
+
+    submission->command_count = command_count;
+    return true;
+}
+
+// Commands whose instance count was set to 0 draw nothing, but are still a part of the call.
+// The depth pass draws every batch with the depth program from the position stream.
+static void draw_indirect(IndirectSubmission *submission, ScenePass pass)
+{
+    StateBindBuffer(GL_DRAW_INDIRECT_BUFFER, submission->commands.buffer);
+
+    BindVertArr((pass == SCENE_PASS_DEPTH) ? test_model.position_va : test_model.shared_va);
+    render_stats.vertex_array_changes++;
+
+    u32 bound_program = UINT32_MAX;
+    for(u32 batch_index = 0; batch_index < submission->batch_count; batch_index++)
+    {
+        IndirectBatch *batch = &submission->batches[batch_index];
+        u32 program_index = (pass == SCENE_PASS_DEPTH) ? depth_program : batch->program_index;
+        if(program_index != bound_program)
+        {
+            if(pass == SCENE_PASS_DEPTH)
+            {
+                use_program_index(program_index);
+                render_stats.program_changes++;
+            }
+            else bind_program(program_index);
+            set_int_handle(uniforms.draw_index, -1);
+
+            bound_program = program_index;
+        }
+
+        SetFaceCullMode(batch->face_cull);
+        glMultiDrawElementsIndirect(GL_TRIANGLES, test_model.shared_index_type,
+                                    (void*)(submission->commands.offset + batch->first_command * sizeof(DrawElementsIndirectCommand)),
+                                    batch->command_count, 0);
+        render_stats.draw_calls++;
+    }
+
+    SetFaceCullMode(FACE_CULL_BACK_CCW);
+}
+
+// Depth first when the pre-pass is on, then shaded
+static void draw_indirect_passes(IndirectSubmission *submission)
+{
+    if(app_state.depth_prepass)
+    {
+        set_scene_pass_state(SCENE_PASS_DEPTH);
+        draw_indirect(submission, SCENE_PASS_DEPTH);
+        set_scene_pass_state(SCENE_PASS_SHADE_EQUAL);
+    }
+
+    BeginGPUQuery(&shaded_samples_query);
+    draw_indirect(submission, SCENE_PASS_SHADE);
+    EndGPUQuery(&shaded_samples_query);
+
+    set_scene_pass_state(SCENE_PASS_SHADE);
+}
+
+// With hierarchical-Z culling the queue is drawn twice, see hiz.h. The commands are culled in place
+// between the draws, the second draw only has the ones the first one missed.
+static void submit_indirect(mat4x4 view_projection)
+{
+    IndirectSubmission submission;
+    if(!build_indirect(&submission)) return;
+
+    if(!app_state.hiz_culling)
+    {
+        // It would be from a frame long ago once culling is back on
+        InvalidateHiZ(&hiz);
+        draw_indirect_passes(&submission);
+        return;
+    }
+
+    GLuint buffer = submission.commands.buffer;
+    size_t offset = submission.commands.offset;
+
+    CullIndirectCommands(&hiz, HIZ_PHASE_FIRST, buffer, offset, submission.command_count);
+    draw_indirect_passes(&submission);
+
+    BuildHiZPyramid(&hiz, scene_target.depth, scene_target.width, scene_target.height, view_projection);
+
+    CullIndirectCommands(&hiz, HIZ_PHASE_SECOND, buffer, offset, submission.command_count);
+    draw_indirect_passes(&submission);
+}
+
+// Like draw_indirect_passes
+static void draw_gpu_culled_passes(GPUCullPhase phase)
+{
+    if(app_state.depth_prepass)
+    {
+        set_scene_pass_state(SCENE_PASS_DEPTH);
+
+        BindVertArr(test_model.position_va);
+        render_stats.vertex_array_changes++;
+        use_program_index(depth_program);
+        render_stats.program_changes++;
+        set_int_handle(uniforms.draw_index, -1);
+        render_stats.draw_calls += DrawCulledInstances(&gpu_culling, phase, test_model.shared_index_type);
+
+        set_scene_pass_state(SCENE_PASS_SHADE_EQUAL);
+    }
+
+    BindVertArr(test_model.shared_va);
+    render_stats.vertex_array_changes++;
+    bind_program(scene_program);
+    set_int_handle(uniforms.draw_index, -1);
+
+    BeginGPUQuery(&shaded_samples_query);
+    render_stats.draw_calls += DrawCulledInstances(&gpu_culling, phase, test_model.shared_index_type);
+    EndGPUQuery(&shaded_samples_query);
+
+    set_scene_pass_state(SCENE_PASS_SHADE);
+}
+
+// Every instance is culled and drawn on the GPU, in two phases like submit_indirect when the
+// pyramid is there
+static void submit_gpu_culled(mat4x4 view_projection)
+{
+    Frustum frustum = ExtractFrustumPlanes(view_projection);
+    HiZ *culling_hiz = app_state.hiz_culling ? &hiz : 0;
+    if(!culling_hiz) InvalidateHiZ(&hiz);
+
+    CullInstancesGPU(&gpu_culling, GPU_CULL_PHASE_FIRST, &frustum, culling_hiz);
+    draw_gpu_culled_passes(GPU_CULL_PHASE_FIRST);
+
+    if(!culling_hiz) return;
+
+    BuildHiZPyramid(&hiz, scene_target.depth, scene_target.width, scene_target.height, view_projection);
+    CullInstancesGPU(&gpu_culling, GPU_CULL_PHASE_SECOND, &frustum, culling_hiz);
+    draw_gpu_culled_passes(GPU_CULL_PHASE_SECOND);
+}
+
+// The cascades that are not cached are drawn from the position stream, every one with the
+// casters whose bounds touch its box. Before the scene, it samples all of them.
+static void render_shadows(mat4x4 view, f32 aspect)
+{
+    u32 draw_mask = UpdateShadowCascades(&shadow_maps, view, RADIANS(global_cam.fov), aspect, CAMERA_NEAR, CAMERA_FAR, light_dir);
+    if(!draw_mask) return;
+
+    // Every cascade draws from the draw blocks of all instances, the commands pick theirs
+    StateBindBufferBase(GL_SHADER_STORAGE_BUFFER, DRAW_STORAGE_BINDING, shadow_maps.caster_draws);
+    BindVertArr(test_model.position_va);
+    use_program_index(depth_program);
+    set_int_handle(uniforms.draw_index, -1);
+
+    for(u32 cascade_index = 0; cascade_index < SHADOW_CASCADE_COUNT; cascade_index++)
+    {
+        ShadowCascadeStats *stats = &shadow_stats.cascades[cascade_index];
+        stats->casters = 0;
+        stats->cpu_ms = 0.0f;
+        if(!(draw_mask & (1 << cascade_index))) continue;
+
+        u64 cull_start = GetWallClock();
+        ShadowCascade *cascade = &shadow_maps.cascades[cascade_index];
+
+        // The box of the cascade reaches back to the light, so nothing in front of the slice is lost
+        Frustum frustum = ExtractFrustumPlanes(cascade->view_projection);
+        CullBoundsParallel(&frustum, &instance_cull_bounds, shadow_caster_visible);
+
+        // Casters too small to cover a texel would cost a draw for nothing, the far cascades have large texels
+        f32 min_caster_radius = SHADOW_MIN_CASTER_TEXELS * cascade->texel_size;
+
+        u32 command_count = 0;
+        StreamAllocation commands = {0};
+        if(test_model.instance_count)
+        {
+            commands = StreamAlloc(&frame_stream, test_model.instance_count * sizeof(DrawElementsIndirectCommand));
+            DrawElementsIndirectCommand *draw_commands = (DrawElementsIndirectCommand*) commands.memory;
+
+            for(u32 instance_index = 0; instance_index < test_model.instance_count; instance_index++)
+            {
+                if(!shadow_caster_visible[instance_index]) continue;
+                if(instance_cull_bounds.radius[instance_index] < min_caster_radius) continue;
+
+                Mesh *mesh = &test_model.meshes[test_model.instances[instance_index].mesh_index];
+                DrawElementsIndirectCommand *command = &draw_commands[command_count++];
+                command->count = mesh->index_count;
+                command->instance_count = 1;
+                command->first_index = mesh->first_index;
+                command->base_vertex = mesh->base_vertex;
+                command->base_instance = instance_index;
+            }
+        }
+
+        // Only the view and projection are read by the depth program
+        FrameBlock *frame = PushFrameBlock(&frame_stream);
+        frame->view = cascade->view;
+        frame->projection = cascade->projection;
+
+        stats->casters = command_count;
+        stats->cpu_ms = (f32)(GetSecondsElapsed(cull_start, GetWallClock()) * 1000.0);
+
+        BeginShadowCascade(&shadow_maps, cascade_index);
+        if(command_count)
+        {
+            StateBindBuffer(GL_DRAW_INDIRECT_BUFFER, commands.buffer);
+            glMultiDrawElementsIndirect(GL_TRIANGLES, test_model.shared_index_type, (void*)commands.offset, command_count, 0);
+        }
+        EndShadowCascade(&shadow_maps, cascade_index);
+    }
+}
+
+// Tiles of the atlas for the local lights in view, then the faces the schedule picked. The casters
+// of a light are the instances within its range, every face draws the ones in its frustum.
+static void render_local_shadows(mat4x4 view_projection)
+{
+    u64 start = GetWallClock();
+
+    Frustum view_frustum = ExtractFrustumPlanes(view_projection);
+    f32 pixels_per_unit = 0.5f * (f32)app_state.window_height / tanf(0.5f * RADIANS(global_cam.fov));
+
+    ShadowAtlasDraw draws[SHADOW_ATLAS_FACE_COUNT];
+    u32 draw_count = ScheduleShadowAtlas(&shadow_atlas, local_lights, local_light_count, &view_frustum,
+                                         global_cam.position, pixels_per_unit, draws);
+
+    if(draw_count && test_model.instance_count)
+    {
+        u32 *casters = local_light_casters;
+        u32 caster_count = 0, casters_slot = NO_SHADOW_SLOT;
+
+        StateBindBufferBase(GL_SHADER_STORAGE_BUFFER, DRAW_STORAGE_BINDING, shadow_maps.caster_draws);
+        BindVertArr(test_model.position_va);
+        use_program_index(depth_program);
+        set_int_handle(uniforms.draw_index, -1);
+
+        BeginShadowAtlas(&shadow_atlas);
+        for(u32 draw_index = 0; draw_index < draw_count; draw_index++)
+        {
+            ShadowAtlasSlot *slot = &shadow_atlas.slots[draws[draw_index].slot];
+
+            // The faces of a light are next to each other
+            if(draws[draw_index].slot != casters_slot)
+            {
+                caster_count = 0;
+                for(u32 instance_index = 0; instance_index < test_model.instance_count; instance_index++)
+                {
+                    if(instance_distance_to(instance_index, slot->position) <= slot->range) casters[caster_count++] = instance_index;
+                }
+                casters_slot = draws[draw_index].slot;
+            }
+
+            mat4x4 face_view_projection = slot->face_view_projection[draws[draw_index].face];
+            Frustum face_frustum = ExtractFrustumPlanes(face_view_projection);
+
+            u32 command_count = 0;
+            StreamAllocation commands = {0};
+            if(caster_count)
+            {
+                commands = StreamAlloc(&frame_stream, caster_count * sizeof(DrawElementsIndirectCommand));
+                DrawElementsIndirectCommand *draw_commands = (DrawElementsIndirectCommand*) commands.memory;
+
+                for(u32 caster_index = 0; caster_index < caster_count; caster_index++)
+                {
+                    u32 instance_index = casters[caster_index];
+                    if(!AABBInFrustum(&face_frustum, instance_bounds_min[instance_index], instance_bounds_max[instance_index])) continue;
+
+                    Mesh *mesh = &test_model.meshes[test_model.instances[instance_index].mesh_index];
+                    DrawElementsIndirectCommand *command = &draw_commands[command_count++];
+                    command->count = mesh->index_count;
+                    command->instance_count = 1;
+                    command->first_index = mesh->first_index;
+                    command->base_vertex = mesh->base_vertex;
+                    command->base_instance = instance_index;
+                }
+            }
+
+            // The depth program reads the view and projection only
+            FrameBlock *frame = PushFrameBlock(&frame_stream);
+            frame->view = create_diag_mat4x4(1.0f);
+            frame->projection = face_view_projection;
+
+            BeginShadowAtlasFace(&shadow_atlas, draws[draw_index].slot, draws[draw_index].face);
+            if(command_count)
+            {
+                StateBindBuffer(GL_DRAW_INDIRECT_BUFFER, commands.buffer);
+                glMultiDrawElementsIndirect(GL_TRIANGLES, test_model.shared_index_type, (void*)commands.offset, command_count, 0);
+            }
+
+            shadow_atlas_stats.casters_drawn += command_count;
+        }
+        EndShadowAtlas(&shadow_atlas);
+    }
+
+    shadow_atlas_stats.cpu_ms = (f32)(GetSecondsElapsed(start, GetWallClock()) * 1000.0);
+}
+
+// The light tables of default.glsl. A light has a shadow once its faces were drawn into the atlas.
+static void push_light_blocks(void)
+{
+    LightBlock *blocks = PushLightBlocks(&frame_stream, local_light_count);
+    for(u32 light_index = 0; light_index < local_light_count; light_index++)
+    {
+        LocalLight *light = &local_lights[light_index];
+        LightBlock *block = &blocks[light_index];
+
+        block->position = light->position;
+        block->range = light->range;
+        block->color = light->color;
+        block->direction = light->direction;
+        block->cos_outer = (light->type == LIGHT_SPOT) ? cosf(light->outer_angle) : -1.0f;
+        block->cos_inner = (light->type == LIGHT_SPOT) ? cosf(light->inner_angle) : -1.0f;
+        block->type = light->type;
+        block->padding[0] = block->padding[1] = 0.0f;
+
+        block->shadow_face = -1;
+        if(app_state.local_shadows && light->shadow_slot != NO_SHADOW_SLOT)
+        {
+            ShadowAtlasSlot *slot = &shadow_atlas.slots[light->shadow_slot];
+            if(slot->tile_size && slot->drawn) block->shadow_face = light->shadow_slot * 6;
+        }
+    }
+
+    ShadowFaceBlock *faces = PushShadowFaceBlocks(&frame_stream, SHADOW_ATLAS_FACE_COUNT);
+    for(u32 slot_index = 0; slot_index < SHADOW_ATLAS_MAX_LIGHTS; slot_index++)
+    {
+        for(u32 face = 0; face < 6; face++) faces[slot_index * 6 + face] = shadow_atlas.slots[slot_index].faces[face];
+    }
+}
+
+// Bins the lights into the clusters of the view and uploads the tables, returns the cluster
+// scale of the frame block. The slices end at the far side of the scene.
+static vec4 push_light_clusters(mat4x4 view)
+{
+    f32 far_depth = CAMERA_FAR;
+    if(scene_bvh.node_count) far_depth = fminf(length_vec3(sub_vec3(scene_bvh.nodes[0].max, scene_bvh.nodes[0].min)), CAMERA_FAR);
+    f32 near_depth = fmaxf(far_depth / 512.0f, CAMERA_NEAR);
+
+    f32 aspect = (f32)app_state.window_width / (f32)app_state.window_height;
+    u32 index_count = BinLights(&light_clusters, local_lights, local_light_count, view, RADIANS(global_cam.fov), aspect,
+                                near_depth, far_depth);
+
+    ClusterBlock *clusters = PushClusterBlocks(&frame_stream, LIGHT_CLUSTER_COUNT);
+    u32 *indices = PushClusterLightIndices(&frame_stream, index_count);
+    WriteLightClusters(&light_clusters, clusters, indices);
+
+    return LightClusterScale(&light_clusters, app_state.window_width, app_state.window_height);
+}
+
+// Shared by every program and draw
+static void push_frame_block(mat4x4 view, mat4x4 projection)
+{
+    FrameBlock *frame = PushFrameBlock(&frame_stream);
+    frame->view = view;
+    frame->projection = projection;
+    frame->world_from_clip = inverse_mat4x4(mult_mat4x4(projection, view));
+    frame->view_pos = create_vec4(global_cam.position.x, global_cam.position.y, global_cam.position.z, 1.0f);
+    frame->dir_light.direction = create_vec4(light_dir.x, light_dir.y, light_dir.z, 0.0f);
+    frame->dir_light.diffuse = create_vec4(light_diff.x, light_diff.y, light_diff.z, 0.0f);
+    frame->dir_light.specular = create_vec4(light_spec.x, light_spec.y, light_spec.z, 0.0f);
+    frame->dir_light.ambient = create_vec4(light_amb.x, light_amb.y, light_amb.z, 0.0f);
+
+    f32 cascade_far[SHADOW_CASCADE_COUNT], cascade_texel_size[SHADOW_CASCADE_COUNT];
+    for(u32 cascade_index = 0; cascade_index < SHADOW_CASCADE_COUNT; cascade_index++)
+    {
+        ShadowCascade *cascade = &shadow_maps.cascades[cascade_index];
+        frame->shadow_from_world[cascade_index] = cascade->texture_from_world;
+        cascade_far[cascade_index] = cascade->far_depth;
+        cascade_texel_size[cascade_index] = cascade->texel_size;
+    }
+
+    frame->cascade_far = create_vec4(cascade_far[0], cascade_far[1], cascade_far[2], cascade_far[3]);
+    frame->cascade_texel_size = create_vec4(cascade_texel_size[0], cascade_texel_size[1], cascade_texel_size[2], cascade_texel_size[3]);
+    frame->shadows_enabled = app_state.shadows;
+
+    push_light_blocks();
+    frame->cluster_scale = push_light_clusters(view);
+}
+
+// Every pixel of the scene the G-buffer has a surface for is lit into its color
+static void light_gbuffer(void)
+{
+    bind_program(deferred_program);
+    LightGBuffer(&gbuffer);
+}
+
+static void end_frame(f64 submit_start)
+{
+    if(deferred_frame) light_gbuffer();
+
+    EndGPUQuery(&scene_time_query);
+
+    // From a few frames ago, see gpu_query.h
+    render_stats.fragments_shaded = shaded_samples_query.result;
+    render_stats.scene_gpu_ms = GPUQueryMilliseconds(&scene_time_query);
+
+    // The result is of the frame the slot was last used for, which may have had the other path
+    u32 query_slot = scene_time_query.slot;
+    if(scene_time_query.result)
+    {
+        if(scene_query_deferred[query_slot]) deferred_gpu_ms = render_stats.scene_gpu_ms;
+        else forward_gpu_ms = render_stats.scene_gpu_ms;
+    }
+    scene_query_deferred[query_slot] = deferred_frame;
+
+    render_stats.forward_gpu_ms = forward_gpu_ms;
+    render_stats.deferred_gpu_ms = deferred_gpu_ms;
+
+    PresentRenderTarget(&scene_target, app_state.window_width, app_state.window_height);
+
+    EndStreamFrame(&frame_stream);
+
+    render_stats.submit_ms = (f32)((glfwGetTime() - submit_start) * 1000.0);
+
+    // The requests of this frame decide which mip levels are resident for the next ones
+    UpdateTextureStreaming();
+#if MATERIAL_TEXTURE_ARRAYS
+    UpdateArrayStreaming();
+#endif
+}
+
+void render(float dt)
+{
+    ResetGLStateCounters();
+    BeginStreamFrame(&frame_stream);
 
     /* Model-view-projection */
     mat4x4 model, view, projection;
     vec3 rotation_axis, trans_vec;
 
     // Calculate perspective projection matrix
-    projection = perspective(RADIANS(global_cam.fov), (float)app_state.window_width/(float)app_state.window_height, 0.1f, 5000.0f);
+    f32 aspect = (float)app_state.window_width/(float)app_state.window_height;
+    projection = perspective(RADIANS(global_cam.fov), aspect, CAMERA_NEAR, CAMERA_FAR);
     
 #if 0
     /* Translate scene forward */         
@@ -205,48 +1486,208 @@ void render(float dt)
 
     view = get_camera_view_matrix(&global_cam);
 
-    use_program_name("default");
-    model = create_diag_mat4x4(1.0f);
-    model = scale_mat4x4(model, 1.0f, 1.0f, 1.0f);
+    float time = glfwGetTime();    
+    move_local_lights(time);
+
+    // Into their own framebuffers, outside of the scene timer
+    if(app_state.shadows) render_shadows(view, aspect);
+    if(app_state.local_shadows) render_local_shadows(mult_mat4x4(projection, view));
+
+    ResizeRenderTarget(&scene_target, app_state.window_width, app_state.window_height);
+    BindRenderTarget(&scene_target);
     
-    set_mat4f("model", model.matrix);
-    set_mat4f("view", view.matrix);
-    set_mat4f("projection", projection.matrix);
+    glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    set_vec3f("view_pos", global_cam.position);
-    set_vec3f("dir_light.direction", light_dir);
+    // The G-buffer shares the depth of scene_target, what is not drawn keeps the clear color
+    deferred_frame = app_state.deferred;
+    scene_program = deferred_frame ? gbuffer_program : default_program;
+    if(deferred_frame)
+    {
+        ResizeGBuffer(&gbuffer, &scene_target);
+        BindGBuffer(&gbuffer);
+    }
 
-    float time = glfwGetTime();    
+    AdvanceGPUQuery(&scene_time_query);
+    AdvanceGPUQuery(&shaded_samples_query);
+    BeginGPUQuery(&scene_time_query);
 
-    // Iterate through every mesh of a model
-    // Bind every mesh and its material and draw it
-    // Obviously this is not a good way to draw a 3D model!
+    mat4x4 view_projection = mult_mat4x4(projection, view);
+    render_stats = (RenderStats){0};
 
-    //glBindTexture(GL_TEXTURE_2D, 0);
-    for(u32 mesh_index = 0; mesh_index < test_model.mesh_count; mesh_index++)
+    // The CPU never looks at the instances, see gpu_culling.h
+    if(MATERIAL_TEXTURE_ARRAYS && app_state.gpu_culling)
     {
-        Mesh mesh = test_model.meshes[mesh_index];
-        Material mat = mesh.material;
+        // Which instances are visible is not known here, every one asks for its textures
+        f32 world_per_pixel = world_per_pixel_at_unit_distance();
+        for(u32 instance_index = 0; instance_index < test_model.instance_count; instance_index++)
+            request_texture_detail(instance_index, world_per_pixel);
 
-        glActiveTexture(GL_TEXTURE0);                
-        glBindTexture(GL_TEXTURE_2D, mat.diffuse_map.id);            
+        f64 submit_start = glfwGetTime();
 
-        glActiveTexture(GL_TEXTURE1);                
-        glBindTexture(GL_TEXTURE_2D, mat.specular_map.id);
+        push_frame_block(view, projection);
+        submit_gpu_culled(view_projection);
 
-        glActiveTexture(GL_TEXTURE2);                
-        glBindTexture(GL_TEXTURE_2D, mat.ambient_map.id);
-        
-        set_vec3f("material.ambient", mat.ambient);
-        set_vec3f("material.diffuse", mat.diffuse);
-        set_vec3f("material.specular", mat.specular);
-        set_float("material.shininess", mat.shininess);                
-        
-        BindVertArr(mesh.va);
+        end_frame(submit_start);
+        return;
+    }
+
+    // Only the instances in the frustum are recorded into the render queue, which is then
+    // sorted by state and submitted
+
+    u32 instance_count = test_model.instance_count;
+    if(app_state.cluster_culling)
+    {
+        u64 cull_start = GetWallClock();
+
+        Frustum world_frustum = ExtractFrustumPlanes(view_projection);
+        instance_count = app_state.bvh_culling ? cull_instances_bvh(&world_frustum) : cull_instances_flat(&world_frustum);
+        render_stats.instances_culled = test_model.instance_count - instance_count;
+
+        render_stats.instance_cull_ms = (f32)(GetSecondsElapsed(cull_start, GetWallClock()) * 1000.0);
+    }
+    else
+    {
+        for(u32 instance_index = 0; instance_index < instance_count; instance_index++)
+            visible_instances[instance_index] = instance_index;
+    }
+
+    // What survived is tested against the largest occluders, rasterized on the CPU
+    if(app_state.occlusion_culling)
+    {
+        RasterizeOccluders(&occlusion_buffer, view_projection);
+
+        u32 unoccluded_count = 0;
+        for(u32 visible_index = 0; visible_index < instance_count; visible_index++)
+        {
+            u32 instance_index = visible_instances[visible_index];
+            if(!AABBOccluded(&occlusion_buffer, instance_bounds_min[instance_index], instance_bounds_max[instance_index]))
+                visible_instances[unoccluded_count++] = instance_index;
+        }
+
+        instance_count = unoccluded_count;
+    }
+
+    render_stats.instances_visible = instance_count;
+
+    // For the texture streaming requests
+    f32 world_per_pixel = world_per_pixel_at_unit_distance();
+
+    ResetRenderQueue(&render_queue);
+    u32 meshlet_draw_used = 0;
+    
+    for(u32 visible_index = 0; visible_index < instance_count; visible_index++)
+    {
+        u32 instance_index = visible_instances[visible_index];
+        MeshInstance *instance = &test_model.instances[instance_index];
+        Mesh *mesh = &test_model.meshes[instance->mesh_index];
+
+        // This packet's ranges start after the ones of the previous packets
+        GLsizei *draw_counts = &meshlet_draw_counts[meshlet_draw_used];
+        void **draw_offsets = &meshlet_draw_offsets[meshlet_draw_used];
         
-        glDrawElements(GL_TRIANGLES, mesh.index_count, GL_UNSIGNED_INT, 0);
+        size_t index_size = (mesh->index_type == GL_UNSIGNED_SHORT) ? sizeof(u16) : sizeof(u32);
+        u32 draw_count = 0;
+        if(app_state.cluster_culling && mesh->meshlet_count)
+        {
+            // Meshlet bounds are in mesh space, so bring the frustum and the eye there instead
+            model = instance->transform;
+            Frustum frustum = ExtractFrustumPlanes(mult_mat4x4(view_projection, model));
+            
+            vec4 eye = mat4x4_mult_vec4(instance->inverse_transform, create_vec4(global_cam.position.x, global_cam.position.y, global_cam.position.z, 1.0f));
+            vec3 mesh_eye = create_vec3(eye.x, eye.y, eye.z);
+            
+            for(u32 meshlet_index = 0; meshlet_index < mesh->meshlet_count; meshlet_index++)
+            {
+                Meshlet *meshlet = &mesh->meshlets[meshlet_index];
+                render_stats.meshlets_tested++;
+
+                if(!SphereInFrustum(&frustum, meshlet->center, meshlet->radius)) continue;
+                if(!mesh->material.double_sided &&
+                   ConeBackfacing(meshlet->cone_apex, meshlet->cone_axis, meshlet->cone_cutoff, mesh_eye)) continue;
+
+                render_stats.meshlets_visible++;
+
+                // Merge with the previous range when they are adjacent in the index buffer
+                size_t offset = meshlet->index_offset * index_size;
+                if(draw_count &&
+                   (size_t)draw_offsets[draw_count - 1] + draw_counts[draw_count - 1] * index_size == offset)
+                {
+                    draw_counts[draw_count - 1] += meshlet->index_count;
+                }
+                else
+                {
+                    draw_counts[draw_count] = meshlet->index_count;
+                    draw_offsets[draw_count] = (void*)offset;
+                    draw_count++;
+                }
+            }
+
+            // The whole mesh was culled
+            if(!draw_count) continue;
+        }
+
+        meshlet_draw_used += draw_count;
+
+        request_texture_detail(instance_index, world_per_pixel);
+
+        // Every mesh has its own vertex array, so the mesh index stands in for it
+        u64 sort_key = MakeSortKey(RENDER_PASS_OPAQUE, scene_program, mesh->material_index, instance->mesh_index,
+                                   instance_distance(instance_index));
+
+        RenderPacket *packet = PushRenderPacket(&render_queue, sort_key);
+        packet->program_index = scene_program;
+        packet->material_index = mesh->material_index;
+        packet->mesh_index = instance->mesh_index;
+        packet->instance_index = instance_index;
+        packet->draw_counts = draw_counts;
+        packet->draw_offsets = draw_offsets;
+        packet->draw_count = draw_count;
+    }
+
+    SortRenderQueue(&render_queue);
+
+    f64 submit_start = glfwGetTime();
+    render_stats.draw_calls = 0;
+
+    push_frame_block(view, projection);
+
+    DrawBlock *draw_blocks = PushDrawBlocks(&frame_stream, render_queue.count);
+
+    for(u32 entry_index = 0; entry_index < render_queue.count; entry_index++)
+    {
+        RenderPacket *packet = &render_queue.packets[render_queue.entries[entry_index].packet_index];
+        MeshInstance *instance = &test_model.instances[packet->instance_index];
+        Mesh *mesh = &test_model.meshes[packet->mesh_index];
+
+        DrawBlock *draw = &draw_blocks[entry_index];
+        draw->model = instance->transform;
+        draw->position_min = mesh->aabb_min;
+        draw->material_index = packet->material_index;
+        draw->position_extent = sub_vec3(mesh->aabb_max, mesh->aabb_min);
+        draw->padding = 0;
     }
 
+    // Materials can only be picked in the shader when their textures are in the arrays
+    if(MATERIAL_TEXTURE_ARRAYS && app_state.indirect_draws) submit_indirect(view_projection);
+    else
+    {
+        if(app_state.depth_prepass)
+        {
+            set_scene_pass_state(SCENE_PASS_DEPTH);
+            submit_packets_depth();
+            set_scene_pass_state(SCENE_PASS_SHADE_EQUAL);
+        }
+
+        BeginGPUQuery(&shaded_samples_query);
+        submit_packets();
+        EndGPUQuery(&shaded_samples_query);
+
+        set_scene_pass_state(SCENE_PASS_SHADE);
+    }
+
+    end_frame(submit_start);
+
 #if 0        
     // UI
     {        
@@ -276,7 +1717,7 @@ void render(float dt)
         set_vec3f("color", 0.0f, 255.0f, 0.0f);
         set_float("scale", 0.5f);
         
-        glBindVertexArray(ui_VAO);
+        StateBindVertexArray(ui_VAO);
         glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
     }
 #endif
@@ -2,8 +2,54 @@
 #define RENDERER_H
 
 #include "glad/glad.h"
+#include "..\defines.h"
+
+// Counters of the last rendered frame
+typedef struct {
+    u32 meshlets_tested;
+    u32 meshlets_visible;
+
+    u32 bvh_nodes_tested;
+    u32 instances_tested; // Every instance for the flat cull, the ones in the leaves reached for the BVH walk
+    u32 instances_visible;
+    u32 instances_culled;
+    f32 instance_cull_ms;
+
+    // State changes while submitting the render queue
+    u32 program_changes;
+    u32 material_changes;
+    u32 vertex_array_changes;
+
+    // CPU time from the sorted queue to the last draw call
+    u32 draw_calls;
+    f32 submit_ms;
+
+    // Of the scene, read back a few frames late. Without the depth pre-pass every fragment that
+    // passes the depth test at the time is shaded, with it one per covered pixel.
+    u64 fragments_shaded;
+    f32 scene_gpu_ms;
+
+    // scene_gpu_ms of the last frame measured with each path, to compare them while switching.
+    // With deferred shading the fragments shaded are the ones written into the G-buffer.
+    f32 forward_gpu_ms;
+    f32 deferred_gpu_ms;
+} RenderStats;
+
+extern RenderStats render_stats;
 
 void render_init();
 void render(float dt);
 
+// Picks up textures and models that changed on disk
+void reload_assets();
+
+#if DEBUG
+// Reloads the unchanged model a few times, every reload after the first has to
+// fit into the storage of the one before instead of taking more mesh memory
+void check_reload_memory();
+#endif
+
+// Casts a ray from the camera and prints what it hits
+void pick_at_crosshair();
+
 #endif
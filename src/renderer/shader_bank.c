@@ -1,14 +1,26 @@
+#include <assert.h>
 #include <sys/stat.h> // stat
 #include <string.h> // memset, strlen, strcmp
 
 #include "shader_bank.h"
+#include "gl_state.h"
 #include "..\memory.h"
 
 static const u8 *version_define = "#version 460 core\n";
 static const u8 *vertex_define = "#define VERTEX_SHADER\n";
 static const u8 *fragment_define = "#define FRAGMENT_SHADER\n";
+static const u8 *compute_define = "#define COMPUTE_SHADER\n";
 
-#define SHADER_BUFFER_SIZE (8*1024)
+// Set by the renderer so the shaders see the same options as the C code
+static const u8 *option_defines = "";
+
+// Placed in front of every shader, for the declarations they share
+static const u8 *common_path;
+static u8 *common_src;
+static s32 common_size;
+static time_t common_mod;
+
+#define SHADER_BUFFER_SIZE (16*1024)
 #define SHADER_LOG_SIZE (1*1024)
 // #define DEBUG_PRINT_SOURCE
 
@@ -33,17 +45,248 @@ void register_shader(char* path, char* name)
 {
     shaders.paths[shaders.programs_count][0] = path;
     shaders.paths[shaders.programs_count][1] = name;
+    shaders.stages[shaders.programs_count] = SHADER_STAGES_VERTEX_FRAGMENT;
+    shaders.defines[shaders.programs_count] = "";
 
     shaders.programs_count++;
 }
 
+void register_compute_shader(char* path, char* name)
+{
+    register_shader(path, name);
+    shaders.stages[shaders.programs_count - 1] = SHADER_STAGES_COMPUTE;
+}
+
+void register_vertex_shader(char* path, char* name)
+{
+    register_shader(path, name);
+    shaders.stages[shaders.programs_count - 1] = SHADER_STAGES_VERTEX;
+}
+
+void register_shader_variant(char* path, char* name, char* defines)
+{
+    register_shader(path, name);
+    shaders.defines[shaders.programs_count - 1] = defines;
+}
+
+void set_shader_defines(u8 *defines)
+{
+    option_defines = defines;
+}
+
+void set_shader_common(u8 *path)
+{
+    common_path = path;
+}
+
+// True when the common source changed since it was last read
+static bool reload_common_source()
+{
+    struct stat fstat;
+    if(!common_path || stat(common_path, &fstat) || fstat.st_mtime <= common_mod) return false;
+
+    FILE *fp = fopen(common_path, "rb");
+    if(!fp)
+    {
+        printf("Could not open shader file: %s\n", common_path);
+        return false;
+    }
+
+    s32 file_size = FILE_size(fp);
+    if(file_size < 0 || file_size >= SHADER_BUFFER_SIZE)
+    {
+        printf("Could not load the common shader source %s, it is too big or unreadable\n", common_path);
+        fclose(fp);
+        return false;
+    }
+
+    common_size = fread((void*)common_src, sizeof(unsigned char), file_size, fp);
+    common_src[common_size] = '\0';
+    fclose(fp);
+
+    common_mod = fstat.st_mtime;
+    printf("Loading shader %s\n", common_path);
+
+    return true;
+}
+
+/* Names of the uniform handles, in the order they were queried */
+static u8 uniform_handle_names[MAX_UNIFORM_HANDLES][MAX_UNIFORM_NAME];
+static u32 uniform_handle_hashes[MAX_UNIFORM_HANDLES];
+static u32 uniform_handle_count;
+
+// FNV-1a
+static u32 hash_uniform_name(u8 *name)
+{
+    u32 hash = 2166136261u;
+    for(; *name; name++) hash = (hash ^ *name) * 16777619u;
+
+    return hash;
+}
+
+static GLint find_uniform(ProgramUniforms *uniforms, u8 *name, u32 hash)
+{
+    for(u32 probe = hash & (PROGRAM_UNIFORM_TABLE_SIZE - 1);
+        uniforms->table[probe].used;
+        probe = (probe + 1) & (PROGRAM_UNIFORM_TABLE_SIZE - 1))
+    {
+        ProgramUniform *uniform = &uniforms->table[probe];
+        if(uniform->hash == hash && !strcmp(uniforms->names + uniform->name_offset, name)) return uniform->location;
+    }
+
+    return -1;
+}
+
+static void add_uniform(ProgramUniforms *uniforms, u8 *name, GLint location, u8 *program_name)
+{
+    u32 length = strlen(name) + 1;
+    if(uniforms->names_used + length > PROGRAM_UNIFORM_NAMES_SIZE)
+    {
+        printf("Too many uniform names in shader program %s, %s is left out\n", program_name, name);
+        return;
+    }
+
+    u32 hash = hash_uniform_name(name);
+    u32 probe = hash & (PROGRAM_UNIFORM_TABLE_SIZE - 1);
+    u32 probes = 0;
+    while(uniforms->table[probe].used)
+    {
+        // Keep the table at most half full so misses stay short
+        if(++probes == PROGRAM_UNIFORM_TABLE_SIZE / 2)
+        {
+            printf("Too many uniforms in shader program %s, %s is left out\n", program_name, name);
+            return;
+        }
+        probe = (probe + 1) & (PROGRAM_UNIFORM_TABLE_SIZE - 1);
+    }
+
+    ProgramUniform *uniform = &uniforms->table[probe];
+    uniform->hash = hash;
+    uniform->location = location;
+    uniform->name_offset = uniforms->names_used;
+    uniform->used = true;
+
+    memcpy(uniforms->names + uniforms->names_used, name, length);
+    uniforms->names_used += length;
+}
+
+// Fills the uniform table of the program at 'index' from what the linker kept, then resolves every handle against it
+static void reflect_uniforms(u32 index)
+{
+    GLuint program = shaders.programs[index];
+    ProgramUniforms *uniforms = &shaders.uniforms[index];
+    memset(uniforms->table, 0, sizeof(uniforms->table));
+    uniforms->names_used = 0;
+
+    s32 uniform_count = 0;
+    glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &uniform_count);
+
+    for(s32 uniform_index = 0; uniform_index < uniform_count; uniform_index++)
+    {
+        u8 name[MAX_UNIFORM_NAME];
+        GLsizei length;
+        GLint size;
+        GLenum type;
+        glGetActiveUniform(program, uniform_index, sizeof(name), &length, &size, &type, name);
+
+        if(length >= MAX_UNIFORM_NAME - 1)
+        {
+            printf("Uniform name %s... in shader program %s is too long\n", name, shaders.paths[index][1]);
+            continue;
+        }
+
+        // Members of uniform blocks have no location
+        GLint location = glGetUniformLocation(program, name);
+        if(location < 0) continue;
+
+        add_uniform(uniforms, name, location, shaders.paths[index][1]);
+
+        // Arrays are reported once as "name[0]", every element gets its own entry and the bare name is the first one
+        if(size > 1 && length > 3 && !strcmp(name + length - 3, "[0]"))
+        {
+            name[length - 3] = '\0';
+            add_uniform(uniforms, name, location, shaders.paths[index][1]);
+
+            for(s32 element = 1; element < size; element++)
+            {
+                u8 element_name[MAX_UNIFORM_NAME];
+                snprintf(element_name, sizeof(element_name), "%s[%d]", name, element);
+                add_uniform(uniforms, element_name, glGetUniformLocation(program, element_name), shaders.paths[index][1]);
+            }
+        }
+    }
+
+    for(u32 handle = 0; handle < uniform_handle_count; handle++)
+        uniforms->handle_locations[handle] = find_uniform(uniforms, uniform_handle_names[handle], uniform_handle_hashes[handle]);
+}
+
+UniformHandle query_uniform(u8 *name)
+{
+    u32 hash = hash_uniform_name(name);
+    for(u32 handle = 0; handle < uniform_handle_count; handle++)
+    {
+        if(uniform_handle_hashes[handle] == hash && !strcmp(uniform_handle_names[handle], name)) return handle;
+    }
+
+    assert(uniform_handle_count < MAX_UNIFORM_HANDLES);
+    assert(strlen(name) < MAX_UNIFORM_NAME);
+
+    UniformHandle handle = uniform_handle_count++;
+    strcpy(uniform_handle_names[handle], name);
+    uniform_handle_hashes[handle] = hash;
+
+    // Programs that are not linked yet resolve it when they are
+    for(u32 index = 0; shaders.programs && index < shaders.programs_count; index++)
+    {
+        shaders.uniforms[index].handle_locations[handle] =
+            shaders.programs[index] ? find_uniform(&shaders.uniforms[index], name, hash) : -1;
+    }
+
+    return handle;
+}
+
+// Compiles one stage of the source in shader_src, 0 when it failed
+static GLuint compile_stage(GLenum type, const u8 *stage_define, char *stage_name, u8 *shader_path, s32 file_size,
+                            const u8 *program_defines)
+{
+    const u8 *const src[6] = { version_define, option_defines, program_defines, stage_define, common_src, shader_src };
+    const int length[6] = { strlen(version_define), strlen(option_defines), strlen(program_defines), strlen(stage_define),
+                            common_size, file_size };
+
+    GLuint shader_id = glCreateShader(type);
+    glShaderSource(shader_id, 6, src, length);
+    glCompileShader(shader_id);
+
+    s32 compiled = 0;
+    glGetShaderiv(shader_id, GL_COMPILE_STATUS, &compiled);
+    if(!compiled)
+    {
+        u8 shader_log[SHADER_LOG_SIZE];
+        glGetShaderInfoLog(shader_id, SHADER_LOG_SIZE, 0, shader_log);
+        printf("%s shader %s failed! Reason: %s\n", stage_name, shader_path, shader_log);
+
+#if DEBUG_PRINT_SOURCE
+        printf("This is the code it tried to compile:\n%s\n", src[5]);
+#endif
+
+        glDeleteShader(shader_id);
+        return 0;
+    }
+
+    return shader_id;
+}
+
 bool init_shader_bank()
 {
     InitArena(&mem_reg, ALLOC_MEM(10*KB(64)), 10*KB(64));
 
     shader_src = (u8*)       ArenaAlloc16(&mem_reg, SHADER_BUFFER_SIZE * sizeof(unsigned char));
+    common_src = (u8*)       ArenaAlloc16(&mem_reg, SHADER_BUFFER_SIZE * sizeof(unsigned char));
+    common_src[0] = '\0';
     shaders.mod = (time_t*)             ArenaAlloc16(&mem_reg, shaders.programs_count * sizeof(time_t));
     shaders.programs = (GLuint*)  ArenaAlloc16(&mem_reg, shaders.programs_count * sizeof(unsigned int));
+    shaders.uniforms = (ProgramUniforms*) ArenaAlloc16(&mem_reg, shaders.programs_count * sizeof(ProgramUniforms));
+    memset(shaders.programs, 0, shaders.programs_count * sizeof(unsigned int));
     shaders.active_program_index = 0;
     
     // Populate shader bank
@@ -55,6 +298,9 @@ bool reload_shader_bank()
 {
     bool status = true;
 
+    // Every program includes it, so all of them are rebuilt when it changes
+    bool common_changed = reload_common_source();
+
     for(u8 idx = 0;
         idx < shaders.programs_count;
         idx++)
@@ -78,7 +324,7 @@ bool reload_shader_bank()
             
         // save last modification
         stat(shader_path, &fstat);
-        if(fstat.st_mtime > shaders.mod[idx])
+        if(fstat.st_mtime > shaders.mod[idx] || common_changed)
         {
             shaders.mod[idx] = fstat.st_mtime;
             shader_changed = true;
@@ -114,68 +360,42 @@ bool reload_shader_bank()
         
         shader_src[file_size] = '\0'; //fread does not append null-terminator
 
-        // vertex_src and fragment_src copies shader_src, which is unneccesary copying
+        // Every stage copies shader_src, which is unneccesary copying
         // TODO: Carve out the source code for the different shaders out of shader_src
         // This can yield to more readable error printing when printing source code to
         // the console.
-        const u8 *const vertex_src[3] = { version_define, vertex_define, shader_src };
-        const int v_length[3] = { strlen(version_define), strlen(vertex_define), file_size };
-        
-        const u8 *const fragment_src[3] = { version_define, fragment_define, shader_src };
-        const int f_length[3] = { strlen(version_define), strlen(fragment_define), file_size };
-        
-        u8 shader_log[SHADER_LOG_SIZE];
-                
-        /* Compile vertex shader */
-        GLuint vertex_id = glCreateShader(GL_VERTEX_SHADER);
-        
-        glShaderSource(vertex_id, 3, vertex_src, v_length);
-        glCompileShader(vertex_id);
+        GLuint stages[2];
+        u32 stage_count = 0;
+        bool compiled = true;
 
-        s32 vertex_compiled = 0;
-        glGetShaderiv(vertex_id, GL_COMPILE_STATUS, &vertex_compiled);        
-        if(!vertex_compiled)
+        if(shaders.stages[idx] == SHADER_STAGES_COMPUTE)
         {
-            glGetShaderInfoLog(vertex_id, SHADER_LOG_SIZE, 0, shader_log);          
-            printf("Vertex shader %s failed! Reason: %s\n", shader_path, shader_log);
-            
-#if DEBUG_PRINT_SOURCE
-            printf("This is the code it tried to compile:\n%s\n", vertex_src[2]);
-#endif
-            
-        }        
-         
-        /* Compile fragment shader */
-        GLuint fragment_id = glCreateShader(GL_FRAGMENT_SHADER);        
-        
-        glShaderSource(fragment_id, 3, fragment_src, f_length);
-        glCompileShader(fragment_id);
-        
-        s32 fragment_compiled = 0;
-        glGetShaderiv(fragment_id, GL_COMPILE_STATUS, &fragment_compiled);
-        if(!fragment_compiled)
+            stages[stage_count] = compile_stage(GL_COMPUTE_SHADER, compute_define, "Compute", shader_path, file_size, shaders.defines[idx]);
+            compiled = compiled && stages[stage_count++];
+        }
+        else
         {
-            glGetShaderInfoLog(fragment_id, SHADER_LOG_SIZE, 0, shader_log);            
-            printf("Fragment shader %s failed! Reason: %s\n", shader_path, shader_log);
-            
-#if DEBUG_PRINT_SOURCE            
-            printf("This is the code it tried to compile:\n%s\n", fragment_src[2]);
-#endif
-            
+            stages[stage_count] = compile_stage(GL_VERTEX_SHADER, vertex_define, "Vertex", shader_path, file_size, shaders.defines[idx]);
+            compiled = compiled && stages[stage_count++];
+
+            if(shaders.stages[idx] == SHADER_STAGES_VERTEX_FRAGMENT)
+            {
+                stages[stage_count] = compile_stage(GL_FRAGMENT_SHADER, fragment_define, "Fragment", shader_path, file_size, shaders.defines[idx]);
+                compiled = compiled && stages[stage_count++];
+            }
         }
 
         /* If one of them failed, don't even try to link them together */
-        if(!vertex_compiled || !fragment_compiled)
-        {            
-            glDeleteShader(vertex_id);
-            glDeleteShader(fragment_id);
+        if(!compiled)
+        {
+            for(u32 stage = 0; stage < stage_count; stage++) glDeleteShader(stages[stage]);
             status = false;
             continue;
         }
                 
+        u8 shader_log[SHADER_LOG_SIZE];
         GLuint shader_program = glCreateProgram();
-        glAttachShader(shader_program, vertex_id);
-        glAttachShader(shader_program, fragment_id);
+        for(u32 stage = 0; stage < stage_count; stage++) glAttachShader(shader_program, stages[stage]);
         glLinkProgram(shader_program);
                 
         s32 program_linked;
@@ -184,6 +404,7 @@ bool reload_shader_bank()
         if(program_linked)
         {
             shaders.programs[idx] = shader_program;
+            reflect_uniforms(idx);
             printf("Compiled and linked shader program: %s\n\n", shaders.paths[idx][1]);
         }
         else
@@ -192,8 +413,7 @@ bool reload_shader_bank()
             printf("Linking failed for %s! Reason: %s\n\n", shader_path, shader_log);
         }
 
-        glDeleteShader(vertex_id);
-        glDeleteShader(fragment_id);
+        for(u32 stage = 0; stage < stage_count; stage++) glDeleteShader(stages[stage]);
      
     }
 	
@@ -208,7 +428,7 @@ void use_program_name(u8 *program_name)
         if(!strcmp(shaders.paths[index][1], program_name))
         {
             shaders.active_program_index = index;
-            glUseProgram(shaders.programs[index]);
+            StateUseProgram(shaders.programs[index]);
             break;
         }
     }
@@ -223,7 +443,7 @@ void use_program(GLuint program)
         if(program == shaders.programs[index])
         {
             shaders.active_program_index = index;
-            glUseProgram(program);
+            StateUseProgram(program);
             break;
         }
 
@@ -231,6 +451,14 @@ void use_program(GLuint program)
     
 }
 
+void use_program_index(u32 index)
+{
+    assert(index < shaders.programs_count);
+
+    shaders.active_program_index = index;
+    StateUseProgram(shaders.programs[index]);
+}
+
 void query_program(GLuint *program, u8 *program_name)
 {
 
@@ -247,42 +475,158 @@ void query_program(GLuint *program, u8 *program_name)
     
 }
 
+u32 query_program_index(u8 *program_name)
+{
+    /* Naive */
+    for(u32 index = 0; index < shaders.programs_count; index++)
+    {
+        if(!strcmp(shaders.paths[index][1], program_name)) return index;
+    }
+
+    assert(!"Unknown shader program");
+    return 0;
+}
+
 void get_active_program(GLuint *program)
 {
     *program = shaders.programs[shaders.active_program_index];
 }
 
+// True when the location exists and the value differs from the last one set there
+static bool uniform_changed(GLint location, void *value, u32 size)
+{
+    return location >= 0 && StateUniformChanged(shaders.programs[shaders.active_program_index], location, value, size);
+}
+
+static GLint name_location(u8 *name)
+{
+    return find_uniform(&shaders.uniforms[shaders.active_program_index], name, hash_uniform_name(name));
+}
+
+static GLint handle_location(UniformHandle uniform)
+{
+    assert(uniform < uniform_handle_count);
+    return shaders.uniforms[shaders.active_program_index].handle_locations[uniform];
+}
+
+static void put_float(GLint location, f32 val)
+{
+    if(uniform_changed(location, &val, sizeof(val))) glUniform1f(location, val);
+}
+
+static void put_int(GLint location, int val)
+{
+    if(uniform_changed(location, &val, sizeof(val))) glUniform1i(location, val);
+}
+
+static void put_ivec2(GLint location, s32 x, s32 y)
+{
+    s32 value[2] = {x, y};
+    if(uniform_changed(location, value, sizeof(value))) glUniform2i(location, x, y);
+}
+
+static void put_vec4f(GLint location, vec4 v)
+{
+    if(uniform_changed(location, &v, sizeof(v))) glUniform4f(location, v.x, v.y, v.z, v.w);
+}
+
+static void put_vec3f(GLint location, vec3 v)
+{
+    if(uniform_changed(location, &v, sizeof(v))) glUniform3f(location, v.x, v.y, v.z);
+}
+
+static void put_vec2f(GLint location, vec2 v)
+{
+    if(uniform_changed(location, &v, sizeof(v))) glUniform2f(location, v.x, v.y);
+}
+
+static void put_mat4f(GLint location, float *val)
+{
+    if(uniform_changed(location, val, 16 * sizeof(f32))) glUniformMatrix4fv(location, 1, GL_FALSE, val);
+}
+
+static void put_mat3f(GLint location, float *val)
+{
+    if(uniform_changed(location, val, 9 * sizeof(f32))) glUniformMatrix3fv(location, 1, GL_FALSE, val);
+}
+
 void set_float(u8 *name, float val)
 {
-    glUniform1f(glGetUniformLocation(shaders.programs[shaders.active_program_index], name), val);
+    put_float(name_location(name), val);
 }
 
 void set_int(u8 *name, int val)
 {
-    glUniform1i(glGetUniformLocation(shaders.programs[shaders.active_program_index], name), val);    
+    put_int(name_location(name), val);
+}
+
+void set_ivec2(u8 *name, s32 x, s32 y)
+{
+    put_ivec2(name_location(name), x, y);
 }
 
 void set_vec4f(u8 *name, vec4 v)
 {
-    glUniform4f(glGetUniformLocation(shaders.programs[shaders.active_program_index], name), v.x, v.y, v.z, v.w);    
+    put_vec4f(name_location(name), v);
 }
 
 void set_vec3f(u8 *name, vec3 v)
 {
-    glUniform3f(glGetUniformLocation(shaders.programs[shaders.active_program_index], name), v.x, v.y, v.z);        
+    put_vec3f(name_location(name), v);
 }
 
 void set_vec2f(u8 *name, vec2 v)
 {
-    glUniform2f(glGetUniformLocation(shaders.programs[shaders.active_program_index], name), v.x, v.y);        
+    put_vec2f(name_location(name), v);
 }
 
 void set_mat4f(u8 *name, float* val)
 {
-    glUniformMatrix4fv(glGetUniformLocation(shaders.programs[shaders.active_program_index], name), 1, GL_FALSE, val);
+    put_mat4f(name_location(name), val);
 }
 
 void set_mat3f(u8 *name, float* val)
 {
-    glUniformMatrix3fv(glGetUniformLocation(shaders.programs[shaders.active_program_index], name), 1, GL_FALSE, val);
+    put_mat3f(name_location(name), val);
+}
+
+void set_float_handle(UniformHandle uniform, f32 val)
+{
+    put_float(handle_location(uniform), val);
+}
+
+void set_int_handle(UniformHandle uniform, int val)
+{
+    put_int(handle_location(uniform), val);
+}
+
+void set_ivec2_handle(UniformHandle uniform, s32 x, s32 y)
+{
+    put_ivec2(handle_location(uniform), x, y);
+}
+
+void set_vec4f_handle(UniformHandle uniform, vec4 v)
+{
+    put_vec4f(handle_location(uniform), v);
 }
+
+void set_vec3f_handle(UniformHandle uniform, vec3 v)
+{
+    put_vec3f(handle_location(uniform), v);
+}
+
+void set_vec2f_handle(UniformHandle uniform, vec2 v)
+{
+    put_vec2f(handle_location(uniform), v);
+}
+
+void set_mat4f_handle(UniformHandle uniform, float* val)
+{
+    put_mat4f(handle_location(uniform), val);
+}
+
+void set_mat3f_handle(UniformHandle uniform, float* val)
+{
+    put_mat3f(handle_location(uniform), val);
+}
+
@@ -10,10 +10,46 @@
 
 #define MAX_SHADER_PROGRAMS 64
 
+#define MAX_UNIFORM_HANDLES 256
+#define PROGRAM_UNIFORM_TABLE_SIZE 256 // Power of two, at least twice the active uniforms of a program
+#define PROGRAM_UNIFORM_NAMES_SIZE 4096
+#define MAX_UNIFORM_NAME 64
+
+typedef enum {
+    SHADER_STAGES_VERTEX_FRAGMENT,
+    SHADER_STAGES_VERTEX,  // Depth only passes, no fragment shader runs at all
+    SHADER_STAGES_COMPUTE,
+} ShaderStages;
+
+// Index of a uniform name, valid for every program and across reloads
+typedef u32 UniformHandle;
+
+typedef struct {
+    u32 hash; // Of the name
+    GLint location;
+    u16 name_offset; // Into ProgramUniforms.names
+    bool used;
+} ProgramUniform;
+
+// Built from GL_ACTIVE_UNIFORMS every time the program links
+typedef struct {
+    ProgramUniform table[PROGRAM_UNIFORM_TABLE_SIZE]; // Open addressing on the name hash
+    u8 names[PROGRAM_UNIFORM_NAMES_SIZE];
+    u32 names_used;
+
+    GLint handle_locations[MAX_UNIFORM_HANDLES]; // -1 when the program does not have the uniform
+} ProgramUniforms;
+
 typedef struct {
     
     /* Pointer to a 2D array where every row consists of a shader program (a path and its name) */
     u8* paths[MAX_SHADER_PROGRAMS][2];
+
+    /* The sections of the source that are compiled and linked */
+    ShaderStages stages[MAX_SHADER_PROGRAMS];
+
+    /* Placed after the option defines, so one file can be built into several programs */
+    u8* defines[MAX_SHADER_PROGRAMS];
     
     /* Timestamp on last modification of the shader file */
     time_t *mod;
@@ -22,23 +58,45 @@ typedef struct {
     GLuint *programs;
     u32 programs_count;
 
+    ProgramUniforms *uniforms; // One per program
+
     u32 active_program_index;
     
 } ShaderBank;
 
 static int FILE_size(FILE* fp);
 void register_shader(char* path, char* name);
+void register_compute_shader(char* path, char* name); // The source only has a COMPUTE_SHADER section
+void register_vertex_shader(char* path, char* name);  // Only the VERTEX_SHADER section is used
+
+// Like register_shader, the source sees 'defines' too, e.g. "#define VARIANT\n"
+void register_shader_variant(char* path, char* name, char* defines);
+
+// Source lines placed after #version in every shader, e.g. "#define OPTION 1\n". Call before init_shader_bank.
+void set_shader_defines(u8 *defines);
+
+// Source shared by every shader, placed after the defines. Reloaded like the shaders, a change rebuilds all programs.
+void set_shader_common(u8 *path);
+
 bool init_shader_bank();
 bool reload_shader_bank();
 
 void use_program_name(u8 *program_name);
 void use_program(GLuint program);
+void use_program_index(u32 index); // No lookup, for the per frame path
 
 void query_program(GLuint *program, u8 *program_name);
+u32 query_program_index(u8 *program_name); // Into ShaderBank.programs
 void get_active_program(GLuint *program);
-    
+
+// Resolved against every program now and again whenever one is relinked. Look them up
+// once, the setters taking a handle do no string work.
+UniformHandle query_uniform(u8 *name);
+
+// By name, hashed into the table of the active program
 void set_float(u8 *name, f32 value);
 void set_int(u8 *name, int value);
+void set_ivec2(u8 *name, s32 x, s32 y);
 
 void set_vec4f(u8 *name, vec4 v);
 void set_vec3f(u8 *name, vec3 v);
@@ -47,4 +105,16 @@ void set_vec2f(u8 *name, vec2 v);
 void set_mat4f(u8 *name, float* value);
 void set_mat3f(u8 *name, float* value);
 
+// By handle
+void set_float_handle(UniformHandle uniform, f32 value);
+void set_int_handle(UniformHandle uniform, int value);
+void set_ivec2_handle(UniformHandle uniform, s32 x, s32 y);
+
+void set_vec4f_handle(UniformHandle uniform, vec4 v);
+void set_vec3f_handle(UniformHandle uniform, vec3 v);
+void set_vec2f_handle(UniformHandle uniform, vec2 v);
+
+void set_mat4f_handle(UniformHandle uniform, float* value);
+void set_mat3f_handle(UniformHandle uniform, float* value);
+
 #endif
@@ -0,0 +1,393 @@
+#include <assert.h>
+#include <math.h> // sqrtf, tanf
+#include <stdio.h> // printf
+#include <string.h> // memset
+
+#include "shadow_atlas.h"
+#include "gl_state.h"
+
+ShadowAtlasStats shadow_atlas_stats;
+
+typedef enum {
+    ATLAS_NODE_FREE,
+    ATLAS_NODE_SPLIT, // Some of the four children are used
+    ATLAS_NODE_USED,
+} AtlasNodeState;
+
+// Like the cascades of shadows.c
+#define SHADOW_ATLAS_BIAS_SLOPE 2.0f
+#define SHADOW_ATLAS_BIAS_UNITS 4.0f
+
+// Cube faces in the order the shader picks them by the major axis: +x, -x, +y, -y, +z, -z
+static const vec3 face_axes[6] = {{{1, 0, 0}}, {{-1, 0, 0}}, {{0, 1, 0}}, {{0, -1, 0}}, {{0, 0, 1}}, {{0, 0, -1}}};
+static const vec3 face_ups[6] = {{{0, 1, 0}}, {{0, 1, 0}}, {{0, 0, 1}}, {{0, 0, 1}}, {{0, 1, 0}}, {{0, 1, 0}}};
+
+void InitShadowAtlas(ShadowAtlas *atlas)
+{
+    memset(atlas, 0, sizeof(*atlas));
+
+    glCreateTextures(GL_TEXTURE_2D, 1, &atlas->depth);
+    glTextureStorage2D(atlas->depth, 1, GL_DEPTH_COMPONENT32F, SHADOW_ATLAS_SIZE, SHADOW_ATLAS_SIZE);
+    glTextureParameteri(atlas->depth, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTextureParameteri(atlas->depth, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTextureParameteri(atlas->depth, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTextureParameteri(atlas->depth, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTextureParameteri(atlas->depth, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glTextureParameteri(atlas->depth, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+
+    glCreateFramebuffers(1, &atlas->framebuffer);
+    glNamedFramebufferDrawBuffer(atlas->framebuffer, GL_NONE);
+    glNamedFramebufferReadBuffer(atlas->framebuffer, GL_NONE);
+    glNamedFramebufferTexture(atlas->framebuffer, GL_DEPTH_ATTACHMENT, atlas->depth, 0);
+
+    GLenum status = glCheckNamedFramebufferStatus(atlas->framebuffer, GL_FRAMEBUFFER);
+    if(status != GL_FRAMEBUFFER_COMPLETE) printf("Shadow atlas framebuffer is incomplete: 0x%x\n", status);
+
+    InitGPUQuery(&atlas->time_query, GL_TIME_ELAPSED);
+}
+
+// Levels are stored one after the other, every one row by row
+static u32 NodeIndex(u32 level, u32 x, u32 y)
+{
+    return ((1 << (2 * level)) - 1) / 3 + y * (1 << level) + x;
+}
+
+static u32 NodeLevel(u32 node)
+{
+    u32 level = 0;
+    while(NodeIndex(level + 1, 0, 0) <= node) level++;
+    return level;
+}
+
+static u32 LevelTileSize(u32 level)
+{
+    return SHADOW_ATLAS_SIZE >> level;
+}
+
+// Depth first, so the used tiles stay packed into as few subtrees as they can
+static bool AllocNode(ShadowAtlas *atlas, u32 level, u32 x, u32 y, u32 target_level, u32 *allocated)
+{
+    u32 node = NodeIndex(level, x, y);
+    if(atlas->nodes[node] == ATLAS_NODE_USED) return false;
+
+    if(level == target_level)
+    {
+        if(atlas->nodes[node] != ATLAS_NODE_FREE) return false;
+
+        atlas->nodes[node] = ATLAS_NODE_USED;
+        *allocated = node;
+        return true;
+    }
+
+    // The children of a free node are free as well
+    if(atlas->nodes[node] == ATLAS_NODE_FREE) atlas->nodes[node] = ATLAS_NODE_SPLIT;
+
+    for(u32 child = 0; child < 4; child++)
+    {
+        if(AllocNode(atlas, level + 1, 2 * x + (child & 1), 2 * y + (child >> 1), target_level, allocated)) return true;
+    }
+
+    return false;
+}
+
+static void FreeNode(ShadowAtlas *atlas, u32 node)
+{
+    assert(atlas->nodes[node] == ATLAS_NODE_USED);
+    atlas->nodes[node] = ATLAS_NODE_FREE;
+
+    u32 level = NodeLevel(node);
+    u32 index = node - NodeIndex(level, 0, 0);
+    u32 x = index % (1 << level), y = index / (1 << level);
+
+    // Merge while all four siblings are free
+    while(level > 0)
+    {
+        u32 parent_x = x / 2, parent_y = y / 2;
+
+        bool siblings_free = true;
+        for(u32 child = 0; child < 4; child++)
+        {
+            if(atlas->nodes[NodeIndex(level, 2 * parent_x + (child & 1), 2 * parent_y + (child >> 1))] != ATLAS_NODE_FREE)
+                siblings_free = false;
+        }
+        if(!siblings_free) break;
+
+        level--;
+        x = parent_x;
+        y = parent_y;
+        atlas->nodes[NodeIndex(level, x, y)] = ATLAS_NODE_FREE;
+    }
+}
+
+static void FreeSlotTiles(ShadowAtlas *atlas, ShadowAtlasSlot *slot)
+{
+    for(u32 face = 0; face < slot->face_count && slot->tile_size; face++) FreeNode(atlas, slot->tile_nodes[face]);
+
+    slot->tile_size = 0;
+    slot->drawn = false;
+}
+
+// All faces of the light at the largest size up to 'tile_size' that still fits
+static bool AllocSlotTiles(ShadowAtlas *atlas, ShadowAtlasSlot *slot, u32 tile_size)
+{
+    for(; tile_size >= SHADOW_ATLAS_MIN_TILE; tile_size /= 2)
+    {
+        u32 level = 0;
+        while(LevelTileSize(level) > tile_size) level++;
+
+        u32 face_index = 0;
+        for(; face_index < slot->face_count; face_index++)
+        {
+            if(!AllocNode(atlas, 0, 0, 0, level, &slot->tile_nodes[face_index])) break;
+        }
+
+        if(face_index == slot->face_count)
+        {
+            slot->tile_size = tile_size;
+            slot->drawn = false;
+            return true;
+        }
+
+        // Some faces fit, give them back and try smaller ones
+        while(face_index--) FreeNode(atlas, slot->tile_nodes[face_index]);
+    }
+
+    return false;
+}
+
+// Power of two for the screen radius, within the tile limits
+static u32 WantedTileSize(f32 coverage)
+{
+    u32 tile_size = SHADOW_ATLAS_MIN_TILE;
+    while(tile_size < SHADOW_ATLAS_MAX_TILE && (f32)tile_size < coverage * SHADOW_ATLAS_TEXELS_PER_PIXEL) tile_size *= 2;
+    return tile_size;
+}
+
+static bool LightMoved(ShadowAtlasSlot *slot, LocalLight *light)
+{
+    return slot->type != light->type || !compare_vec3(slot->position, light->position) ||
+           slot->range != light->range ||
+           (light->type == LIGHT_SPOT && (!compare_vec3(slot->direction, light->direction) || slot->outer_angle != light->outer_angle));
+}
+
+// The view of every face from the current state of the light, and where it lands in the atlas
+static void PlaceFaces(ShadowAtlasSlot *slot, LocalLight *light)
+{
+    slot->type = light->type;
+    slot->position = light->position;
+    slot->direction = light->direction;
+    slot->range = light->range;
+    slot->outer_angle = light->outer_angle;
+
+    f32 near_plane = fmaxf(0.01f * light->range, 0.05f);
+    f32 fov = (light->type == LIGHT_POINT) ? RADIANS(90.0f) : fminf(2.0f * light->outer_angle + RADIANS(2.0f), RADIANS(170.0f));
+    mat4x4 projection = perspective(fov, 1.0f, near_plane, light->range);
+
+    for(u32 face = 0; face < slot->face_count; face++)
+    {
+        vec3 axis = (light->type == LIGHT_POINT) ? face_axes[face] : light->direction;
+        vec3 up = (light->type == LIGHT_POINT) ? face_ups[face] :
+                  ((fabsf(axis.y) > 0.99f) ? create_vec3(1.0f, 0.0f, 0.0f) : create_vec3(0.0f, 1.0f, 0.0f));
+
+        mat4x4 view = look_at(light->position, add_vec3(light->position, axis), up);
+        slot->face_view_projection[face] = mult_mat4x4(projection, view);
+
+        u32 node = slot->tile_nodes[face];
+        u32 level = NodeLevel(node);
+        u32 index = node - NodeIndex(level, 0, 0);
+        f32 tile_size = (f32)LevelTileSize(level) / SHADOW_ATLAS_SIZE;
+
+        ShadowFaceBlock *block = &slot->faces[face];
+        block->tile_min = create_vec2((index % (1 << level)) * tile_size, (index / (1 << level)) * tile_size);
+        block->tile_size = tile_size;
+        block->texel_slope = 2.0f * tanf(0.5f * fov) / LevelTileSize(level);
+
+        // NDC to [0, 1], then into the tile
+        mat4x4 to_tile = create_diag_mat4x4(1.0f);
+        to_tile.matrix[0] = to_tile.matrix[5] = 0.5f * tile_size;
+        to_tile.matrix[10] = 0.5f;
+        to_tile.matrix[12] = block->tile_min.x + 0.5f * tile_size;
+        to_tile.matrix[13] = block->tile_min.y + 0.5f * tile_size;
+        to_tile.matrix[14] = 0.5f;
+        block->texture_from_world = mult_mat4x4(to_tile, slot->face_view_projection[face]);
+    }
+}
+
+u32 ScheduleShadowAtlas(ShadowAtlas *atlas, LocalLight *lights, u32 light_count, Frustum *view_frustum,
+                        vec3 eye, f32 pixels_per_unit, ShadowAtlasDraw *draws)
+{
+    AdvanceGPUQuery(&atlas->time_query);
+    shadow_atlas_stats = (ShadowAtlasStats){0};
+    shadow_atlas_stats.gpu_ms = GPUQueryMilliseconds(&atlas->time_query);
+
+    // Slots of the lights in view, largest on screen first
+    u32 order[SHADOW_ATLAS_MAX_LIGHTS];
+    u32 light_of_slot[SHADOW_ATLAS_MAX_LIGHTS];
+    u32 order_count = 0;
+
+    for(u32 light_index = 0; light_index < light_count; light_index++)
+    {
+        LocalLight *light = &lights[light_index];
+        if(light->shadow_slot == NO_SHADOW_SLOT) continue;
+        assert(light->shadow_slot < SHADOW_ATLAS_MAX_LIGHTS);
+
+        ShadowAtlasSlot *slot = &atlas->slots[light->shadow_slot];
+        light_of_slot[light->shadow_slot] = light_index;
+
+        u32 face_count = (light->type == LIGHT_POINT) ? 6 : 1;
+        if(face_count != slot->face_count) FreeSlotTiles(atlas, slot);
+        slot->face_count = face_count;
+
+        slot->visible = SphereInFrustum(view_frustum, light->position, light->range);
+        if(!slot->visible)
+        {
+            FreeSlotTiles(atlas, slot);
+            continue;
+        }
+
+        // Inside of its bounds the light can cover the whole screen
+        f32 distance = length_vec3(sub_vec3(light->position, eye));
+        slot->coverage = (distance > light->range) ? light->range * pixels_per_unit / sqrtf(distance * distance - light->range * light->range) : 1e30f;
+
+        u32 insert = order_count++;
+        while(insert && atlas->slots[order[insert - 1]].coverage < slot->coverage)
+        {
+            order[insert] = order[insert - 1];
+            insert--;
+        }
+        order[insert] = light->shadow_slot;
+    }
+
+    // Larger tiles right away, smaller ones only once they are a quarter of the size, so lights
+    // at the edge of a size do not get a new tile every other frame
+    for(u32 order_index = 0; order_index < order_count; order_index++)
+    {
+        ShadowAtlasSlot *slot = &atlas->slots[order[order_index]];
+        u32 wanted_size = WantedTileSize(slot->coverage);
+
+        if(slot->tile_size && (wanted_size > slot->tile_size || 4 * wanted_size <= slot->tile_size)) FreeSlotTiles(atlas, slot);
+        if(!slot->tile_size && !AllocSlotTiles(atlas, slot, wanted_size)) continue;
+
+        shadow_atlas_stats.shadowed_lights++;
+        shadow_atlas_stats.atlas_used += slot->face_count * (f32)(slot->tile_size * slot->tile_size) / (SHADOW_ATLAS_SIZE * SHADOW_ATLAS_SIZE);
+    }
+
+    // What has to be drawn, by the screen size and the frames it waited for it
+    u32 waiting[SHADOW_ATLAS_MAX_LIGHTS];
+    u32 waiting_count = 0;
+    for(u32 order_index = 0; order_index < order_count; order_index++)
+    {
+        u32 slot_index = order[order_index];
+        ShadowAtlasSlot *slot = &atlas->slots[slot_index];
+        if(!slot->tile_size) continue;
+
+        if(slot->drawn && !slot->casters_changed && !LightMoved(slot, &lights[light_of_slot[slot_index]]))
+        {
+            slot->waiting_frames = 0;
+            continue;
+        }
+
+        slot->waiting_frames++;
+        waiting[waiting_count++] = slot_index;
+    }
+
+    u32 draw_count = 0;
+    while(waiting_count)
+    {
+        // Lights without any shadow yet come first
+        u32 best = 0;
+        f32 best_priority = -1.0f;
+        for(u32 waiting_index = 0; waiting_index < waiting_count; waiting_index++)
+        {
+            ShadowAtlasSlot *slot = &atlas->slots[waiting[waiting_index]];
+            f32 priority = fminf(slot->coverage, (f32)SHADOW_ATLAS_SIZE) * slot->waiting_frames * (slot->drawn ? 1.0f : 4.0f);
+            if(priority > best_priority)
+            {
+                best = waiting_index;
+                best_priority = priority;
+            }
+        }
+
+        u32 slot_index = waiting[best];
+        ShadowAtlasSlot *slot = &atlas->slots[slot_index];
+        if(draw_count && draw_count + slot->face_count > SHADOW_ATLAS_FACE_BUDGET) break;
+
+        PlaceFaces(slot, &lights[light_of_slot[slot_index]]);
+        slot->drawn = true;
+        slot->casters_changed = false;
+        slot->waiting_frames = 0;
+
+        for(u32 face = 0; face < slot->face_count; face++)
+        {
+            draws[draw_count].slot = slot_index;
+            draws[draw_count].face = face;
+            draw_count++;
+        }
+
+        waiting[best] = waiting[--waiting_count];
+    }
+
+    shadow_atlas_stats.lights_waiting = waiting_count;
+    shadow_atlas_stats.faces_drawn = draw_count;
+    return draw_count;
+}
+
+void ShadowCastersChanged(ShadowAtlas *atlas, vec3 min, vec3 max)
+{
+    for(u32 slot_index = 0; slot_index < SHADOW_ATLAS_MAX_LIGHTS; slot_index++)
+    {
+        ShadowAtlasSlot *slot = &atlas->slots[slot_index];
+        if(!slot->drawn) continue;
+
+        // Distance from the light to the box
+        vec3 p = slot->position;
+        vec3 offset = create_vec3(fmaxf(fmaxf(min.x - p.x, p.x - max.x), 0.0f),
+                                  fmaxf(fmaxf(min.y - p.y, p.y - max.y), 0.0f),
+                                  fmaxf(fmaxf(min.z - p.z, p.z - max.z), 0.0f));
+
+        if(length_vec3(offset) <= slot->range) slot->casters_changed = true;
+    }
+}
+
+void BeginShadowAtlas(ShadowAtlas *atlas)
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, atlas->framebuffer);
+    BeginGPUQuery(&atlas->time_query);
+
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glDepthMask(GL_TRUE);
+    glDepthFunc(GL_LESS);
+
+    glDisable(GL_CULL_FACE);
+    glEnable(GL_POLYGON_OFFSET_FILL);
+    glPolygonOffset(SHADOW_ATLAS_BIAS_SLOPE, SHADOW_ATLAS_BIAS_UNITS);
+
+    // The clear of a tile must not touch its neighbours
+    glEnable(GL_SCISSOR_TEST);
+}
+
+void BeginShadowAtlasFace(ShadowAtlas *atlas, u32 slot_index, u32 face)
+{
+    ShadowAtlasSlot *slot = &atlas->slots[slot_index];
+    assert(slot->tile_size && face < slot->face_count);
+
+    u32 node = slot->tile_nodes[face];
+    u32 level = NodeLevel(node);
+    u32 index = node - NodeIndex(level, 0, 0);
+    s32 size = LevelTileSize(level);
+    s32 x = (index % (1 << level)) * size, y = (index / (1 << level)) * size;
+
+    glViewport(x, y, size, size);
+    glScissor(x, y, size, size);
+    glClear(GL_DEPTH_BUFFER_BIT);
+}
+
+void EndShadowAtlas(ShadowAtlas *atlas)
+{
+    EndGPUQuery(&atlas->time_query);
+
+    glDisable(GL_SCISSOR_TEST);
+    glDisable(GL_POLYGON_OFFSET_FILL);
+    glEnable(GL_CULL_FACE);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
@@ -0,0 +1,120 @@
+#ifndef SHADOW_ATLAS_H
+#define SHADOW_ATLAS_H
+
+#include <stdbool.h>
+
+#include "glad/glad.h"
+#include "lights.h"
+#include "culling.h"
+#include "gpu_query.h"
+#include "shadows.h" // SHADOW_TEXTURE_UNIT
+#include "uniform_blocks.h" // ShadowFaceBlock
+#include "..\gfx_math.h"
+#include "..\defines.h"
+
+/*
+  Shadows of the point and spot lights, all in one depth texture of a fixed size. A point light
+  takes six square tiles, one per cube face, a spot light one.
+
+  Tiles are handed out by a quadtree buddy allocator: every node is free, split into four or
+  used, and freeing the last used child of a node merges it back. A light gets a tile for the
+  radius its bounds cover on screen, larger lights are served first and take a smaller tile when
+  the atlas is full. Lights out of view give their tiles back.
+
+  The contents of a tile are kept until the light moves, its caster changes or it gets another
+  tile. Of those, only SHADOW_ATLAS_FACE_BUDGET faces are drawn per frame, picked by the screen
+  size of the light and how long it has been waiting. Until a face is drawn again the shader keeps
+  using the matrices it was drawn with, so a moving light drags its old shadow for a few frames
+  instead of losing it.
+*/
+
+#define SHADOW_ATLAS_SIZE 4096
+#define SHADOW_ATLAS_MIN_TILE 128
+#define SHADOW_ATLAS_MAX_TILE 1024
+
+// Quadtree levels from the whole atlas down to SHADOW_ATLAS_MIN_TILE, and their nodes
+#define SHADOW_ATLAS_LEVELS 6
+#define SHADOW_ATLAS_NODE_COUNT (((1 << (2 * SHADOW_ATLAS_LEVELS)) - 1) / 3)
+
+// Lights with a shadow at once, and the faces of the table the shader reads
+#define SHADOW_ATLAS_MAX_LIGHTS 32
+#define SHADOW_ATLAS_FACE_COUNT (6 * SHADOW_ATLAS_MAX_LIGHTS)
+
+// Faces drawn per frame. A point light is always drawn whole, the first light of a frame can go over.
+#define SHADOW_ATLAS_FACE_BUDGET 12
+
+// Tile pixels per pixel of the radius a light covers on screen
+#define SHADOW_ATLAS_TEXELS_PER_PIXEL 1.0f
+
+// After the cascades
+#define SHADOW_ATLAS_TEXTURE_UNIT (SHADOW_TEXTURE_UNIT + 1)
+
+typedef struct {
+    bool visible;    // Bounds touch the view, otherwise it has no tiles
+    f32 coverage;    // Radius on screen in pixels
+    u32 tile_size;   // 0 without tiles
+    u32 tile_nodes[6];
+    u32 face_count;
+
+    // What the faces were last drawn with, the shader uses it until they are drawn again
+    bool drawn;
+    LightType type;
+    vec3 position, direction;
+    f32 range, outer_angle;
+    mat4x4 face_view_projection[6];
+    ShadowFaceBlock faces[6];
+
+    bool casters_changed;
+    u32 waiting_frames; // Since it needed to be drawn
+} ShadowAtlasSlot;
+
+// A face to draw this frame
+typedef struct {
+    u32 slot;
+    u32 face;
+} ShadowAtlasDraw;
+
+typedef struct {
+    GLuint depth; // GL_DEPTH_COMPONENT32F, compared when sampled
+    GLuint framebuffer;
+
+    u8 nodes[SHADOW_ATLAS_NODE_COUNT]; // AtlasNodeState
+    ShadowAtlasSlot slots[SHADOW_ATLAS_MAX_LIGHTS];
+
+    GPUQuery time_query;
+} ShadowAtlas;
+
+// Of the last frame
+typedef struct {
+    u32 shadowed_lights;  // With a tile
+    u32 lights_waiting;   // Need to be drawn, over the budget
+    u32 faces_drawn;
+    u32 casters_drawn;
+    f32 atlas_used;       // Part of the texels in tiles
+    f32 cpu_ms;
+    f32 gpu_ms;           // Of GPU_QUERY_FRAMES - 1 frames ago
+} ShadowAtlasStats;
+
+extern ShadowAtlasStats shadow_atlas_stats;
+
+void InitShadowAtlas(ShadowAtlas *atlas);
+
+// Tiles for the lights with a slot that are in view, and the faces to draw this frame, at most
+// SHADOW_ATLAS_FACE_COUNT. The faces count as drawn afterwards. 'pixels_per_unit' is the screen
+// size of a unit at distance 1.
+u32 ScheduleShadowAtlas(ShadowAtlas *atlas, LocalLight *lights, u32 light_count, Frustum *view_frustum,
+                        vec3 eye, f32 pixels_per_unit, ShadowAtlasDraw *draws);
+
+// The lights whose drawn bounds touch the box are drawn again, e.g. when something in it moved
+void ShadowCastersChanged(ShadowAtlas *atlas, vec3 min, vec3 max);
+
+// Binds the atlas and sets the state of depth only passes without face culling
+void BeginShadowAtlas(ShadowAtlas *atlas);
+
+// Viewport and scissor on the tile of the face, cleared
+void BeginShadowAtlasFace(ShadowAtlas *atlas, u32 slot, u32 face);
+
+// Puts back the state the scene is drawn with, the framebuffer is left to the caller
+void EndShadowAtlas(ShadowAtlas *atlas);
+
+#endif
@@ -0,0 +1,223 @@
+#include <assert.h>
+#include <math.h> // floorf, sqrtf, powf
+#include <stdio.h> // printf
+#include <string.h> // memset
+
+#include "shadows.h"
+#include "gl_state.h"
+
+ShadowStats shadow_stats;
+
+// Against acne on surfaces facing the light, scaled by the slope of the depth
+#define SHADOW_DEPTH_BIAS_SLOPE 2.0f
+#define SHADOW_DEPTH_BIAS_UNITS 4.0f
+
+void InitShadowMaps(ShadowMaps *shadows)
+{
+    memset(shadows, 0, sizeof(*shadows));
+
+    // Linear filtering of a compared texture gives 2x2 percentage closer filtering per tap
+    glCreateTextures(GL_TEXTURE_2D_ARRAY, 1, &shadows->depth_array);
+    glTextureStorage3D(shadows->depth_array, 1, GL_DEPTH_COMPONENT32F, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, SHADOW_CASCADE_COUNT);
+    glTextureParameteri(shadows->depth_array, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTextureParameteri(shadows->depth_array, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTextureParameteri(shadows->depth_array, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTextureParameteri(shadows->depth_array, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTextureParameteri(shadows->depth_array, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glTextureParameteri(shadows->depth_array, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+
+    glCreateFramebuffers(1, &shadows->framebuffer);
+    glNamedFramebufferDrawBuffer(shadows->framebuffer, GL_NONE);
+    glNamedFramebufferReadBuffer(shadows->framebuffer, GL_NONE);
+
+    glNamedFramebufferTextureLayer(shadows->framebuffer, GL_DEPTH_ATTACHMENT, shadows->depth_array, 0, 0);
+    GLenum status = glCheckNamedFramebufferStatus(shadows->framebuffer, GL_FRAMEBUFFER);
+    if(status != GL_FRAMEBUFFER_COMPLETE) printf("Shadow map framebuffer is incomplete: 0x%x\n", status);
+
+    glCreateBuffers(1, &shadows->caster_draws);
+
+    for(u32 cascade_index = 0; cascade_index < SHADOW_CASCADE_COUNT; cascade_index++)
+        InitGPUQuery(&shadows->cascade_queries[cascade_index], GL_TIME_ELAPSED);
+}
+
+void UploadShadowCasters(ShadowMaps *shadows, DrawBlock *draws, u32 count, vec3 scene_min, vec3 scene_max)
+{
+    shadows->caster_count = count;
+    shadows->scene_min = scene_min;
+    shadows->scene_max = scene_max;
+
+    for(u32 cascade_index = 0; cascade_index < SHADOW_CASCADE_COUNT; cascade_index++)
+        shadows->cascades[cascade_index].valid = false;
+
+    if(!count) return;
+
+    // Only changes when models load or reload, a new store is fine
+    if(count > shadows->caster_capacity)
+    {
+        glNamedBufferData(shadows->caster_draws, count * sizeof(DrawBlock), draws, GL_STATIC_DRAW);
+        shadows->caster_capacity = count;
+    }
+    else glNamedBufferSubData(shadows->caster_draws, 0, count * sizeof(DrawBlock), draws);
+}
+
+// Smallest sphere around the slice of a symmetric frustum between the view depths 'near_depth'
+// and 'far_depth'. 'corner_slope' is the distance of a corner from the view axis per unit of depth.
+static void SliceBoundingSphere(f32 near_depth, f32 far_depth, f32 corner_slope, f32 *center_depth, f32 *radius)
+{
+    f32 slope_squared = corner_slope * corner_slope;
+
+    // Where the near and far corners are equally far away, the far plane if that is beyond it
+    f32 depth = 0.5f * (near_depth + far_depth) * (1.0f + slope_squared);
+    if(depth > far_depth) depth = far_depth;
+
+    f32 near_distance = sqrtf((depth - near_depth) * (depth - near_depth) + near_depth * near_depth * slope_squared);
+    f32 far_distance = sqrtf((far_depth - depth) * (far_depth - depth) + far_depth * far_depth * slope_squared);
+
+    *center_depth = depth;
+    *radius = fmaxf(near_distance, far_distance);
+}
+
+// The square and depth range of the cascade in the light view, the square snapped to whole texels
+static void PlaceCascade(ShadowMaps *shadows, ShadowCascade *cascade, vec2 center, f32 half_extent, f32 light_near, f32 light_far)
+{
+    cascade->half_extent = half_extent;
+    cascade->texel_size = 2.0f * half_extent / SHADOW_MAP_SIZE;
+
+    cascade->center.x = floorf(center.x / cascade->texel_size) * cascade->texel_size;
+    cascade->center.y = floorf(center.y / cascade->texel_size) * cascade->texel_size;
+
+    cascade->view = shadows->light_view;
+    cascade->projection = ortho(cascade->center.x - half_extent, cascade->center.x + half_extent,
+                                cascade->center.y - half_extent, cascade->center.y + half_extent,
+                                light_near, light_far);
+    cascade->view_projection = mult_mat4x4(cascade->projection, cascade->view);
+
+    // From NDC to [0, 1]
+    mat4x4 bias = create_diag_mat4x4(0.5f);
+    bias.matrix[12] = bias.matrix[13] = bias.matrix[14] = 0.5f;
+    bias.matrix[15] = 1.0f;
+    cascade->texture_from_world = mult_mat4x4(bias, cascade->view_projection);
+}
+
+u32 UpdateShadowCascades(ShadowMaps *shadows, mat4x4 camera_view, f32 fov_y, f32 aspect, f32 near_plane, f32 far_plane,
+                         vec3 light_direction)
+{
+    for(u32 cascade_index = 0; cascade_index < SHADOW_CASCADE_COUNT; cascade_index++)
+    {
+        AdvanceGPUQuery(&shadows->cascade_queries[cascade_index]);
+        shadow_stats.cascades[cascade_index].gpu_ms = GPUQueryMilliseconds(&shadows->cascade_queries[cascade_index]);
+    }
+
+    // Everything was drawn from another direction
+    if(!compare_vec3(light_direction, shadows->light_direction))
+    {
+        shadows->light_direction = light_direction;
+
+        vec3 up = (fabsf(light_direction.y) > 0.99f) ? create_vec3(1.0f, 0.0f, 0.0f) : create_vec3(0.0f, 1.0f, 0.0f);
+        shadows->light_view = look_at(create_vec3(0.0f, 0.0f, 0.0f), light_direction, up);
+
+        for(u32 cascade_index = 0; cascade_index < SHADOW_CASCADE_COUNT; cascade_index++)
+            shadows->cascades[cascade_index].valid = false;
+    }
+
+    // Depth range of the scene in the light view, it looks down -z
+    f32 light_min_z = 1e30f, light_max_z = -1e30f;
+    for(u32 corner = 0; corner < 8; corner++)
+    {
+        vec4 p = create_vec4((corner & 1) ? shadows->scene_max.x : shadows->scene_min.x,
+                             (corner & 2) ? shadows->scene_max.y : shadows->scene_min.y,
+                             (corner & 4) ? shadows->scene_max.z : shadows->scene_min.z, 1.0f);
+        vec4 light_p = mat4x4_mult_vec4(shadows->light_view, p);
+        light_min_z = fminf(light_min_z, light_p.z);
+        light_max_z = fmaxf(light_max_z, light_p.z);
+    }
+
+    f32 depth_padding = fmaxf(0.01f * (light_max_z - light_min_z), 0.1f);
+    f32 light_near = -light_max_z - depth_padding;
+    f32 light_far = -light_min_z + depth_padding;
+
+    // Nothing beyond the scene needs a shadow. Depends on the scene only, so the cascades
+    // keep their size while the camera moves.
+    f32 shadow_distance = fminf(length_vec3(sub_vec3(shadows->scene_max, shadows->scene_min)), far_plane);
+    shadow_distance = fmaxf(shadow_distance, 2.0f * near_plane);
+
+    f32 tan_y = tanf(0.5f * fov_y);
+    f32 corner_slope = tan_y * sqrtf(1.0f + aspect * aspect);
+    mat4x4 camera_world = inverse_mat4x4(camera_view);
+
+    u32 draw_mask = 0;
+    f32 near_depth = near_plane;
+    for(u32 cascade_index = 0; cascade_index < SHADOW_CASCADE_COUNT; cascade_index++)
+    {
+        ShadowCascade *cascade = &shadows->cascades[cascade_index];
+
+        f32 t = (f32)(cascade_index + 1) / SHADOW_CASCADE_COUNT;
+        f32 log_split = near_plane * powf(shadow_distance / near_plane, t);
+        f32 uniform_split = near_plane + (shadow_distance - near_plane) * t;
+        f32 far_depth = uniform_split + (log_split - uniform_split) * SHADOW_SPLIT_LAMBDA;
+
+        cascade->near_depth = near_depth;
+        cascade->far_depth = far_depth;
+        near_depth = far_depth;
+
+        f32 center_depth;
+        SliceBoundingSphere(cascade->near_depth, cascade->far_depth, corner_slope, &center_depth, &cascade->radius);
+
+        vec4 world_center = mat4x4_mult_vec4(camera_world, create_vec4(0.0f, 0.0f, -center_depth, 1.0f));
+        vec4 light_center = mat4x4_mult_vec4(shadows->light_view, world_center);
+        vec2 center = create_vec2(light_center.x, light_center.y);
+
+        bool cached = (cascade_index >= SHADOW_FIRST_CACHED_CASCADE);
+        f32 half_extent = cascade->radius * (cached ? SHADOW_CACHE_MARGIN : 1.0f);
+
+        // A cached one is kept while its square has the same size and still holds the whole sphere
+        if(cached && cascade->valid && cascade->half_extent == half_extent &&
+           fabsf(center.x - cascade->center.x) + cascade->radius <= half_extent &&
+           fabsf(center.y - cascade->center.y) + cascade->radius <= half_extent)
+        {
+            shadow_stats.cascades[cascade_index].drawn = false;
+        }
+        else
+        {
+            PlaceCascade(shadows, cascade, center, half_extent, light_near, light_far);
+            cascade->valid = true;
+
+            shadow_stats.cascades[cascade_index].drawn = true;
+            draw_mask |= 1 << cascade_index;
+        }
+
+        shadow_stats.cascades[cascade_index].far_depth = far_depth;
+    }
+
+    return draw_mask;
+}
+
+void BeginShadowCascade(ShadowMaps *shadows, u32 cascade_index)
+{
+    assert(cascade_index < SHADOW_CASCADE_COUNT);
+
+    glNamedFramebufferTextureLayer(shadows->framebuffer, GL_DEPTH_ATTACHMENT, shadows->depth_array, 0, cascade_index);
+    glBindFramebuffer(GL_FRAMEBUFFER, shadows->framebuffer);
+    glViewport(0, 0, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE);
+
+    BeginGPUQuery(&shadows->cascade_queries[cascade_index]);
+
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glDepthMask(GL_TRUE);
+    glDepthFunc(GL_LESS);
+    glClear(GL_DEPTH_BUFFER_BIT);
+
+    // Thin geometry like the leaves and cloth of sponza is only one sided
+    glDisable(GL_CULL_FACE);
+    glEnable(GL_POLYGON_OFFSET_FILL);
+    glPolygonOffset(SHADOW_DEPTH_BIAS_SLOPE, SHADOW_DEPTH_BIAS_UNITS);
+}
+
+void EndShadowCascade(ShadowMaps *shadows, u32 cascade_index)
+{
+    EndGPUQuery(&shadows->cascade_queries[cascade_index]);
+
+    glDisable(GL_POLYGON_OFFSET_FILL);
+    glEnable(GL_CULL_FACE);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
@@ -0,0 +1,108 @@
+#ifndef SHADOWS_H
+#define SHADOWS_H
+
+#include <stdbool.h>
+
+#include "glad/glad.h"
+#include "model.h" // MAX_TEXTURE_ARRAYS
+#include "gpu_query.h"
+#include "uniform_blocks.h" // DrawBlock, SHADOW_CASCADE_COUNT
+#include "..\gfx_math.h"
+#include "..\defines.h"
+
+/*
+  Cascaded shadow maps of the directional light. The camera frustum, up to the end of the
+  scene, is cut into slices at distances between a logarithmic and a uniform split, and every
+  slice gets an orthographic view from the light into a layer of a depth array.
+
+  A cascade is the square around the bounding sphere of its slice, which keeps its size while
+  the camera turns, and its position is snapped to whole texels of the light view. Edges of
+  shadows then stay on the same texels from frame to frame instead of crawling. The depth range
+  is the scene seen from the light, so every caster between the light and the slice is in it.
+
+  The far cascades cover a larger square than their slice and keep their contents while the
+  slice stays inside of it. They are only drawn again when the slice leaves it, the light moves
+  or the static geometry changes, so most frames draw the near cascades only.
+*/
+
+#define SHADOW_MAP_SIZE 2048
+
+// Cascades from this one on are cached
+#define SHADOW_FIRST_CACHED_CASCADE 2
+
+// Square of a cached cascade to the one of its slice. The camera can move that much further before it is drawn again.
+#define SHADOW_CACHE_MARGIN 1.5f
+
+// Between the uniform (0) and the logarithmic split (1) of the distances
+#define SHADOW_SPLIT_LAMBDA 0.8f
+
+// Casters whose bounding sphere is smaller than this many texels of a cascade are not drawn into it
+#define SHADOW_MIN_CASTER_TEXELS 0.5f
+
+// After the material textures and the pyramid of hiz.h
+#define SHADOW_TEXTURE_UNIT (MAX_TEXTURE_ARRAYS + 1)
+
+typedef struct {
+    mat4x4 view, projection; // The casters are drawn with
+    mat4x4 view_projection;
+    mat4x4 texture_from_world; // To the texture coordinates and depth in [0, 1]
+
+    f32 near_depth, far_depth; // Of the slice, along the view direction of the camera
+    f32 radius;                // Of the bounding sphere of the slice
+
+    vec2 center;      // Of the square in the light view, snapped to texels
+    f32 half_extent;  // Of the square
+    f32 texel_size;   // World units per texel
+
+    bool valid; // Contents are up to date for 'center' and 'half_extent'
+} ShadowCascade;
+
+typedef struct {
+    GLuint depth_array; // GL_DEPTH_COMPONENT32F, a layer per cascade, compared when sampled
+    GLuint framebuffer;
+
+    ShadowCascade cascades[SHADOW_CASCADE_COUNT];
+
+    vec3 light_direction; // The cascades were fitted to
+    mat4x4 light_view;    // Rotation only, the cascades are placed in it
+
+    // Of the casters, set by UploadShadowCasters
+    GLuint caster_draws; // DrawBlock per instance
+    u32 caster_count, caster_capacity;
+    vec3 scene_min, scene_max;
+
+    GPUQuery cascade_queries[SHADOW_CASCADE_COUNT];
+} ShadowMaps;
+
+typedef struct {
+    f32 far_depth;
+    bool drawn;  // This frame, its cached contents were used otherwise
+    u32 casters; // Drawn into it, 0 when it was not drawn
+    f32 cpu_ms;  // Culling the casters and recording the draw
+    f32 gpu_ms;  // Of GPU_QUERY_FRAMES - 1 frames ago
+} ShadowCascadeStats;
+
+typedef struct {
+    ShadowCascadeStats cascades[SHADOW_CASCADE_COUNT];
+} ShadowStats;
+
+extern ShadowStats shadow_stats;
+
+void InitShadowMaps(ShadowMaps *shadows);
+
+// The draw blocks of every instance and the world space bounds of the scene. Called when the
+// static geometry changes, every cascade is drawn again.
+void UploadShadowCasters(ShadowMaps *shadows, DrawBlock *draws, u32 count, vec3 scene_min, vec3 scene_max);
+
+// Fits the cascades to the camera and returns a bit per cascade that has to be drawn this frame.
+// They are valid afterwards, the caller draws every one of them between Begin/EndShadowCascade.
+u32 UpdateShadowCascades(ShadowMaps *shadows, mat4x4 camera_view, f32 fov_y, f32 aspect, f32 near_plane, f32 far_plane,
+                         vec3 light_direction);
+
+// Binds the layer of the cascade, clears it and sets the state of a depth only pass without face culling
+void BeginShadowCascade(ShadowMaps *shadows, u32 cascade_index);
+
+// Puts back the state the scene is drawn with, the framebuffer is left to the caller
+void EndShadowCascade(ShadowMaps *shadows, u32 cascade_index);
+
+#endif
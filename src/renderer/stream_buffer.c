@@ -0,0 +1,120 @@
+#include <assert.h>
+
+#include "stream_buffer.h"
+#include "gl_state.h"
+
+#include "GLFW/glfw3.h" // glfwGetTime
+
+StreamBufferStats stream_buffer_stats;
+
+void ResetStreamBufferStats(void)
+{
+    stream_buffer_stats.fence_waits = 0;
+    stream_buffer_stats.wait_ms = 0.0f;
+    stream_buffer_stats.bytes_allocated = 0;
+    stream_buffer_stats.resizes = 0;
+}
+
+static void CreateStorage(StreamBuffer *stream, size_t region_size)
+{
+    stream->region_size = (region_size + stream->alignment - 1) & ~(stream->alignment - 1);
+
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glCreateBuffers(1, &stream->id);
+    glNamedBufferStorage(stream->id, stream->region_size * STREAM_BUFFER_FRAMES, 0, flags);
+    stream->mapped = (u8*) glMapNamedBufferRange(stream->id, 0, stream->region_size * STREAM_BUFFER_FRAMES, flags);
+    assert(stream->mapped);
+}
+
+void InitStreamBuffer(StreamBuffer *stream, size_t region_size)
+{
+    GLint uniform_alignment, storage_alignment;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniform_alignment);
+    glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &storage_alignment);
+
+    // Both are powers of two, so is the larger one
+    stream->alignment = (uniform_alignment > storage_alignment) ? uniform_alignment : storage_alignment;
+    if(stream->alignment < 16) stream->alignment = 16;
+
+    CreateStorage(stream, region_size);
+    stream->region_index = 0;
+    stream->used = 0;
+    stream->retired_count = 0;
+
+    for(u32 frame = 0; frame < STREAM_BUFFER_FRAMES; frame++) stream->fences[frame] = 0;
+}
+
+void BeginStreamFrame(StreamBuffer *stream)
+{
+    stream->region_index = (stream->region_index + 1) % STREAM_BUFFER_FRAMES;
+    stream->used = 0;
+
+    // Deleting unmaps them, GL keeps the storage until the GPU is done with it
+    for(u32 index = 0; index < stream->retired_count; index++)
+    {
+        StateForgetBuffer(stream->retired[index]);
+        glDeleteBuffers(1, &stream->retired[index]);
+    }
+    stream->retired_count = 0;
+
+    GLsync fence = stream->fences[stream->region_index];
+    if(!fence) return;
+
+    // Usually signaled long ago, anything else means the CPU is running ahead of the GPU
+    GLenum result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+    if(result == GL_TIMEOUT_EXPIRED)
+    {
+        f64 wait_start = glfwGetTime();
+        
+        do result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000); // 1 ms
+        while(result == GL_TIMEOUT_EXPIRED);
+        
+        stream_buffer_stats.fence_waits++;
+        stream_buffer_stats.wait_ms += (f32)((glfwGetTime() - wait_start) * 1000.0);
+    }
+
+    glDeleteSync(fence);
+    stream->fences[stream->region_index] = 0;
+}
+
+void EndStreamFrame(StreamBuffer *stream)
+{
+    assert(!stream->fences[stream->region_index]);
+    stream->fences[stream->region_index] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+StreamAllocation StreamAlloc(StreamBuffer *stream, size_t size)
+{
+    size_t offset = (stream->used + stream->alignment - 1) & ~(stream->alignment - 1);
+
+    if(offset + size > stream->region_size)
+    {
+        size_t region_size = stream->region_size * 2;
+        while(region_size < size) region_size *= 2;
+
+        // Deleting it now would unbind what was allocated from it earlier in the frame
+        assert(stream->retired_count < STREAM_BUFFER_MAX_RETIRED);
+        stream->retired[stream->retired_count++] = stream->id;
+
+        for(u32 frame = 0; frame < STREAM_BUFFER_FRAMES; frame++)
+        {
+            if(stream->fences[frame]) glDeleteSync(stream->fences[frame]);
+            stream->fences[frame] = 0;
+        }
+
+        CreateStorage(stream, region_size);
+        stream_buffer_stats.resizes++;
+
+        offset = 0;
+    }
+
+    stream->used = offset + size;
+    stream_buffer_stats.bytes_allocated += size;
+
+    StreamAllocation result;
+    result.buffer = stream->id;
+    result.offset = stream->region_index * stream->region_size + offset;
+    result.memory = stream->mapped + result.offset;
+
+    return result;
+}
@@ -0,0 +1,68 @@
+#ifndef STREAM_BUFFER_H
+#define STREAM_BUFFER_H
+
+#include <stdbool.h>
+
+#include "glad/glad.h"
+#include "..\defines.h"
+
+/*
+  Ring of per frame regions in one buffer with immutable storage, mapped persistently and
+  coherently once. Data that changes every frame is written straight into the mapping by
+  bumping an offset, no glBufferData or glBufferSubData that could make the driver sync or
+  reallocate. A fence is placed after the last draw of a frame, its region is only written
+  again once the GPU passed it.
+
+  The same buffer can be bound to any target, so uniforms, instance data, indirect commands
+  and vertices for debug geometry can all come from it.
+*/
+
+#define STREAM_BUFFER_FRAMES 3
+#define STREAM_BUFFER_MAX_RETIRED 8 // Buffers replaced by a resize during one frame
+
+typedef struct {
+    GLuint id;
+    u8 *mapped;
+
+    size_t region_size;
+    u32 region_index; // Of the current frame
+    size_t used;      // In the current region
+
+    size_t alignment; // Every allocation, enough for uniform and shader storage bindings
+    GLsync fences[STREAM_BUFFER_FRAMES];
+
+    // Still bound and mapped for what was allocated from them this frame, deleted by the next one
+    GLuint retired[STREAM_BUFFER_MAX_RETIRED];
+    u32 retired_count;
+} StreamBuffer;
+
+typedef struct {
+    GLuint buffer;
+    size_t offset; // From the start of the buffer, for binding or as an indirect offset
+    void *memory;  // Write only, reading from the mapping is slow
+} StreamAllocation;
+
+// Of every stream buffer, summed up until ResetStreamBufferStats. Stalls are rare, per frame they would go unseen.
+typedef struct {
+    u32 fence_waits; // Frames where the CPU got to a region before the GPU was done with it
+    f32 wait_ms;
+    size_t bytes_allocated;
+    u32 resizes; // A frame did not fit into its region
+} StreamBufferStats;
+
+extern StreamBufferStats stream_buffer_stats;
+
+void ResetStreamBufferStats(void);
+
+void InitStreamBuffer(StreamBuffer *stream, size_t region_size);
+
+// Waits until the GPU is done with the region of the frame, then starts allocating from it
+void BeginStreamFrame(StreamBuffer *stream);
+
+// After the last call that reads from the region of this frame
+void EndStreamFrame(StreamBuffer *stream);
+
+// Space for 'size' bytes in the region of this frame. A frame that does not fit moves to a larger buffer.
+StreamAllocation StreamAlloc(StreamBuffer *stream, size_t size);
+
+#endif
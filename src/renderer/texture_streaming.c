@@ -0,0 +1,318 @@
+#include <assert.h>
+#include <stdio.h> // printf
+#include <string.h>
+#include <math.h> // log2f
+
+#include "texture_streaming.h"
+#include "renderer.h"
+#include "model.h" // MAX_TEXTURES
+#include "gl_state.h"
+
+typedef struct {
+    u32 texture; // OpenGL handle
+    bool active; // False once something else specifies the texture
+
+    char cooked_path[512];
+    u32 width, height, mip_count;
+
+    u32 tail_level;     // This level and the smaller ones are always resident
+    u32 resident_level; // Finest level on the GPU, what GL_TEXTURE_BASE_LEVEL is set to
+    u32 wanted_level;   // From the last request
+
+    f32 requested_uv_per_pixel; // Finest request of this frame, 0 when there was none
+    u64 last_used_frame;
+
+    bool file_changed; // The cooked file no longer matches, stays as it is until the texture is reloaded
+} StreamedTexture;
+
+// Slots are never given back, textures stay alive until the program exits
+static StreamedTexture streamed[MAX_TEXTURES];
+static u32 streamed_count;
+
+// Open addressing from the OpenGL handle to its slot + 1, 0 when empty
+#define SLOT_TABLE_SIZE (4 * MAX_TEXTURES)
+static u16 slot_table[SLOT_TABLE_SIZE];
+
+static u64 frame_index;
+static u32 max_level_count; // For the largest texture the GL supports
+
+TextureStreamingStats texture_streaming_stats = {TEXTURE_STREAMING_BUDGET};
+
+static StreamedTexture *FindStreamed(u32 texture)
+{
+    for(u32 probe = (texture * 2654435761u) & (SLOT_TABLE_SIZE - 1);
+        slot_table[probe];
+        probe = (probe + 1) & (SLOT_TABLE_SIZE - 1))
+    {
+        StreamedTexture *result = &streamed[slot_table[probe] - 1];
+        if(result->texture == texture) return result;
+    }
+
+    return 0;
+}
+
+static StreamedTexture *AddStreamed(u32 texture)
+{
+    assert(streamed_count < MAX_TEXTURES);
+
+    u32 probe = (texture * 2654435761u) & (SLOT_TABLE_SIZE - 1);
+    while(slot_table[probe]) probe = (probe + 1) & (SLOT_TABLE_SIZE - 1);
+
+    StreamedTexture *result = &streamed[streamed_count++];
+    memset(result, 0, sizeof(StreamedTexture));
+    result->texture = texture;
+
+    slot_table[probe] = (u16)streamed_count;
+
+    return result;
+}
+
+static size_t LevelSize(StreamedTexture *texture, u32 level)
+{
+    size_t width = (texture->width >> level) ? (texture->width >> level) : 1;
+    size_t height = (texture->height >> level) ? (texture->height >> level) : 1;
+
+    return width * height * 4;
+}
+
+// Of every level from 'level' down to the smallest one
+static size_t ChainSize(StreamedTexture *texture, u32 level)
+{
+    size_t result = 0;
+    for(; level < texture->mip_count; level++) result += LevelSize(texture, level);
+
+    return result;
+}
+
+// Zero sized levels hold no storage
+static void FreeLevel(u32 level)
+{
+    glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+}
+
+void StreamCookedTexture(u32 texture, char *cooked_path, CookedTexture *cooked)
+{
+    if(!max_level_count)
+    {
+        s32 max_size;
+        glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+        for(max_level_count = 1; max_size > 1; max_size /= 2) max_level_count++;
+    }
+
+    StreamedTexture *entry = FindStreamed(texture);
+    if(!entry) entry = AddStreamed(texture);
+
+    if(entry->active) texture_streaming_stats.resident_bytes -= ChainSize(entry, entry->resident_level);
+    else texture_streaming_stats.streamed_count++;
+
+    strncpy(entry->cooked_path, cooked_path, sizeof(entry->cooked_path) - 1);
+    entry->width = cooked->header->width;
+    entry->height = cooked->header->height;
+    entry->mip_count = cooked->header->mip_count;
+    entry->active = true;
+    entry->file_changed = false;
+
+    entry->tail_level = 0;
+    while(entry->tail_level + 1 < entry->mip_count &&
+          (cooked->mip_widths[entry->tail_level] > TEXTURE_STREAMING_TAIL_SIZE ||
+           cooked->mip_heights[entry->tail_level] > TEXTURE_STREAMING_TAIL_SIZE))
+    {
+        entry->tail_level++;
+    }
+
+    entry->resident_level = entry->wanted_level = entry->tail_level;
+    entry->requested_uv_per_pixel = 0.0f;
+
+    // Whatever was there before might have had finer or more levels
+    StateBindTexture(GL_TEXTURE_2D, texture);
+
+    for(u32 level = 0; level < max_level_count; level++)
+    {
+        if(level >= entry->tail_level && level < entry->mip_count)
+            glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, cooked->mip_widths[level], cooked->mip_heights[level], 0,
+                         GL_RGBA, GL_UNSIGNED_BYTE, cooked->mips[level]);
+        else
+            FreeLevel(level);
+    }
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, entry->tail_level);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, entry->mip_count - 1);
+    StateBindTexture(GL_TEXTURE_2D, 0);
+
+    texture_streaming_stats.resident_bytes += ChainSize(entry, entry->resident_level);
+}
+
+bool StopStreamingTexture(u32 texture)
+{
+    StreamedTexture *entry = FindStreamed(texture);
+    if(!entry || !entry->active) return false;
+
+    texture_streaming_stats.resident_bytes -= ChainSize(entry, entry->resident_level);
+    texture_streaming_stats.streamed_count--;
+    entry->active = false;
+
+    StateBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    StateBindTexture(GL_TEXTURE_2D, 0);
+
+    return true;
+}
+
+void RequestTextureDetail(u32 texture, f32 uv_per_pixel)
+{
+    StreamedTexture *entry = FindStreamed(texture);
+    if(!entry || !entry->active) return;
+
+    if(entry->requested_uv_per_pixel == 0.0f || uv_per_pixel < entry->requested_uv_per_pixel)
+        entry->requested_uv_per_pixel = uv_per_pixel;
+}
+
+void SetTextureStreamingBudget(size_t bytes)
+{
+    texture_streaming_stats.budget = bytes;
+}
+
+// Reads the level from the cooked file and makes it the finest resident one
+static bool UploadLevel(StreamedTexture *entry, u32 level)
+{
+    CookedTexture cooked;
+    if(!OpenCookedTexture(entry->cooked_path, &cooked))
+    {
+        entry->file_changed = true;
+        return false;
+    }
+
+    // Rewritten since it was streamed, ReloadTextures will stream it again
+    if(cooked.header->width != entry->width ||
+       cooked.header->height != entry->height ||
+       cooked.header->mip_count != entry->mip_count)
+    {
+        CloseCookedTexture(&cooked);
+        entry->file_changed = true;
+        return false;
+    }
+
+    StateBindTexture(GL_TEXTURE_2D, entry->texture);
+    glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, cooked.mip_widths[level], cooked.mip_heights[level], 0,
+                 GL_RGBA, GL_UNSIGNED_BYTE, cooked.mips[level]);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+    StateBindTexture(GL_TEXTURE_2D, 0);
+
+    CloseCookedTexture(&cooked);
+
+    entry->resident_level = level;
+    texture_streaming_stats.resident_bytes += LevelSize(entry, level);
+    texture_streaming_stats.levels_uploaded++;
+
+    return true;
+}
+
+// Sampling moves to the next level before the finest one is freed
+static void EvictLevel(StreamedTexture *entry)
+{
+    u32 level = entry->resident_level;
+    assert(level < entry->tail_level);
+
+    StateBindTexture(GL_TEXTURE_2D, entry->texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level + 1);
+    FreeLevel(level);
+    StateBindTexture(GL_TEXTURE_2D, 0);
+
+    entry->resident_level = level + 1;
+    texture_streaming_stats.resident_bytes -= LevelSize(entry, level);
+    texture_streaming_stats.levels_evicted++;
+}
+
+// Least recently used texture that has a level it can give up. Textures that were used this
+// frame only give up the levels finer than they asked for. 'forced' also takes those.
+static StreamedTexture *FindEvictionVictim(StreamedTexture *keep, bool forced)
+{
+    StreamedTexture *victim = 0;
+
+    for(u32 index = 0; index < streamed_count; index++)
+    {
+        StreamedTexture *entry = &streamed[index];
+        if(!entry->active || entry == keep || entry->resident_level >= entry->tail_level) continue;
+
+        if(!forced && entry->last_used_frame == frame_index && entry->resident_level >= entry->wanted_level) continue;
+
+        if(!victim ||
+           entry->last_used_frame < victim->last_used_frame ||
+           (entry->last_used_frame == victim->last_used_frame && entry->resident_level < victim->resident_level))
+        {
+            victim = entry;
+        }
+    }
+
+    return victim;
+}
+
+void UpdateTextureStreaming(void)
+{
+    frame_index++;
+    texture_streaming_stats.levels_uploaded = 0;
+    texture_streaming_stats.levels_evicted = 0;
+
+    // Finest level each texture needs: the one where a texel is about the size of a pixel
+    for(u32 index = 0; index < streamed_count; index++)
+    {
+        StreamedTexture *entry = &streamed[index];
+        if(!entry->active || entry->requested_uv_per_pixel == 0.0f) continue;
+
+        u32 size = (entry->width > entry->height) ? entry->width : entry->height;
+        f32 level = floorf(log2f(size * entry->requested_uv_per_pixel));
+
+        entry->wanted_level = (level <= 0.0f) ? 0 : (level >= (f32)entry->tail_level) ? entry->tail_level : (u32)level;
+        entry->last_used_frame = frame_index;
+        entry->requested_uv_per_pixel = 0.0f;
+    }
+
+    // A lowered budget is enforced right away, even on what is visible
+    while(texture_streaming_stats.resident_bytes > texture_streaming_stats.budget)
+    {
+        StreamedTexture *victim = FindEvictionVictim(0, false);
+        if(!victim) victim = FindEvictionVictim(0, true);
+        if(!victim) break;
+
+        EvictLevel(victim);
+    }
+
+    // One level at a time, always for the texture that is furthest from what it needs
+    size_t uploaded = 0;
+    while(uploaded < TEXTURE_STREAMING_UPLOAD_LIMIT)
+    {
+        StreamedTexture *next = 0;
+        for(u32 index = 0; index < streamed_count; index++)
+        {
+            StreamedTexture *entry = &streamed[index];
+            if(!entry->active || entry->file_changed || entry->last_used_frame != frame_index) continue;
+            if(entry->resident_level <= entry->wanted_level) continue;
+
+            if(!next || entry->resident_level - entry->wanted_level > next->resident_level - next->wanted_level)
+                next = entry;
+        }
+
+        if(!next) break;
+
+        u32 level = next->resident_level - 1;
+        size_t level_size = LevelSize(next, level);
+
+        // Make room, or stop when only levels that are needed are left
+        bool fits = true;
+        while(texture_streaming_stats.resident_bytes + level_size > texture_streaming_stats.budget)
+        {
+            StreamedTexture *victim = FindEvictionVictim(next, false);
+            if(!victim)
+            {
+                fits = false;
+                break;
+            }
+
+            EvictLevel(victim);
+        }
+
+        if(!fits) break;
+
+        if(UploadLevel(next, level)) uploaded += level_size;
+    }
+}
@@ -0,0 +1,64 @@
+#ifndef TEXTURE_STREAMING_H
+#define TEXTURE_STREAMING_H
+
+#include <stdbool.h>
+
+#include "cooked.h"
+#include "..\defines.h"
+
+/*
+  Mip level streaming of the cooked textures.
+
+  A streamed texture starts with only its mip tail on the GPU. The renderer reports
+  every frame how finely each texture is sampled, then UpdateTextureStreaming uploads
+  the finer levels that are missing, a few per frame, and takes the finest levels away
+  from the textures that were used least recently once the budget is reached.
+
+  Levels are specified and freed one at a time, GL_TEXTURE_BASE_LEVEL points at the
+  finest one that is resident. GPU memory follows what is on screen, not how many
+  textures were loaded. Textures loaded from source images are fully resident and
+  not counted against the budget.
+
+  With MATERIAL_TEXTURE_ARRAYS the arrays of model.c are streamed instead, a level of all
+  their layers at once, under the same budget and stats. See UpdateArrayStreaming.
+*/
+
+// Default, SetTextureStreamingBudget changes it
+#define TEXTURE_STREAMING_BUDGET MB(256)
+
+// Levels no larger than this are always resident
+#define TEXTURE_STREAMING_TAIL_SIZE 64
+
+// Texel data uploaded per frame at most, so a quick turn does not stall a frame
+#define TEXTURE_STREAMING_UPLOAD_LIMIT MB(16)
+
+typedef struct {
+    size_t budget;
+    size_t resident_bytes; // Of the streamed textures
+
+    u32 streamed_count;
+
+    // During the last update
+    u32 levels_uploaded;
+    u32 levels_evicted;
+} TextureStreamingStats;
+
+extern TextureStreamingStats texture_streaming_stats;
+
+// Takes over 'texture' and uploads the mip tail of 'cooked'. The finer levels are read
+// from 'cooked_path' again when they are needed, so the file does not stay open.
+void StreamCookedTexture(u32 texture, char *cooked_path, CookedTexture *cooked);
+
+// For a texture that gets specified another way from now on, true when it was streamed
+bool StopStreamingTexture(u32 texture);
+
+// 'uv_per_pixel' is how many texture coordinate units one pixel covers where the texture is
+// sampled most finely this frame. Ignored for textures that are not streamed.
+void RequestTextureDetail(u32 texture, f32 uv_per_pixel);
+
+// Once per frame, after the requests
+void UpdateTextureStreaming(void);
+
+void SetTextureStreamingBudget(size_t bytes);
+
+#endif
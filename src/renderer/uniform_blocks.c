@@ -0,0 +1,86 @@
+#include "uniform_blocks.h"
+#include "gl_state.h"
+
+static GLuint material_buffer;
+static u32 material_capacity;
+
+void InitUniformBlocks(void)
+{
+    // Storage blocks need a buffer with something in it, even before the first model loads
+    glCreateBuffers(1, &material_buffer);
+    glNamedBufferData(material_buffer, sizeof(MaterialBlock), 0, GL_STATIC_DRAW);
+    material_capacity = 1;
+    StateBindBufferBase(GL_SHADER_STORAGE_BUFFER, MATERIAL_STORAGE_BINDING, material_buffer);
+}
+
+FrameBlock *PushFrameBlock(StreamBuffer *stream)
+{
+    StreamAllocation allocation = StreamAlloc(stream, sizeof(FrameBlock));
+    StateBindBufferRange(GL_UNIFORM_BUFFER, FRAME_UNIFORM_BINDING, allocation.buffer, allocation.offset, sizeof(FrameBlock));
+
+    return (FrameBlock*) allocation.memory;
+}
+
+void UploadMaterialBlocks(MaterialBlock *materials, u32 count)
+{
+    if(!count) return;
+
+    // Only changes when models load or reload, a new store is fine
+    if(count > material_capacity)
+    {
+        glNamedBufferData(material_buffer, count * sizeof(MaterialBlock), materials, GL_STATIC_DRAW);
+        material_capacity = count;
+    }
+    else glNamedBufferSubData(material_buffer, 0, count * sizeof(MaterialBlock), materials);
+}
+
+DrawBlock *PushDrawBlocks(StreamBuffer *stream, u32 count)
+{
+    // An empty range can not be bound
+    size_t size = (count ? count : 1) * sizeof(DrawBlock);
+
+    StreamAllocation allocation = StreamAlloc(stream, size);
+    StateBindBufferRange(GL_SHADER_STORAGE_BUFFER, DRAW_STORAGE_BINDING, allocation.buffer, allocation.offset, size);
+
+    return (DrawBlock*) allocation.memory;
+}
+
+LightBlock *PushLightBlocks(StreamBuffer *stream, u32 count)
+{
+    size_t size = (count ? count : 1) * sizeof(LightBlock);
+
+    StreamAllocation allocation = StreamAlloc(stream, size);
+    StateBindBufferRange(GL_SHADER_STORAGE_BUFFER, LIGHT_STORAGE_BINDING, allocation.buffer, allocation.offset, size);
+
+    return (LightBlock*) allocation.memory;
+}
+
+ShadowFaceBlock *PushShadowFaceBlocks(StreamBuffer *stream, u32 count)
+{
+    size_t size = (count ? count : 1) * sizeof(ShadowFaceBlock);
+
+    StreamAllocation allocation = StreamAlloc(stream, size);
+    StateBindBufferRange(GL_SHADER_STORAGE_BUFFER, SHADOW_FACE_STORAGE_BINDING, allocation.buffer, allocation.offset, size);
+
+    return (ShadowFaceBlock*) allocation.memory;
+}
+
+ClusterBlock *PushClusterBlocks(StreamBuffer *stream, u32 count)
+{
+    size_t size = (count ? count : 1) * sizeof(ClusterBlock);
+
+    StreamAllocation allocation = StreamAlloc(stream, size);
+    StateBindBufferRange(GL_SHADER_STORAGE_BUFFER, CLUSTER_STORAGE_BINDING, allocation.buffer, allocation.offset, size);
+
+    return (ClusterBlock*) allocation.memory;
+}
+
+u32 *PushClusterLightIndices(StreamBuffer *stream, u32 count)
+{
+    size_t size = (count ? count : 1) * sizeof(u32);
+
+    StreamAllocation allocation = StreamAlloc(stream, size);
+    StateBindBufferRange(GL_SHADER_STORAGE_BUFFER, CLUSTER_LIGHT_STORAGE_BINDING, allocation.buffer, allocation.offset, size);
+
+    return (u32*) allocation.memory;
+}
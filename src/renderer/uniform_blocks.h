@@ -0,0 +1,169 @@
+#ifndef UNIFORM_BLOCKS_H
+#define UNIFORM_BLOCKS_H
+
+#include <stddef.h> // offsetof
+
+#include "glad/glad.h"
+#include "stream_buffer.h"
+#include "..\gfx_math.h"
+#include "..\defines.h"
+
+/*
+  Data shared by every draw, uploaded once instead of set per draw as uniforms. What changes
+  every frame is written into a stream buffer, the materials have a buffer of their own. The structs
+  mirror the frame block (std140) and the draw table (std430) in shaders\common.glsl and the
+  material, light, shadow face and cluster tables in shaders\default.glsl (std430) byte for
+  byte, the asserts below keep them honest. vec3s are stored as vec4s, both layouts would pad
+  them to 16 bytes anyway.
+*/
+
+// Binding points, the shaders get them as defines
+#define FRAME_UNIFORM_BINDING 0
+#define MATERIAL_STORAGE_BINDING 0
+#define DRAW_STORAGE_BINDING 1
+#define LIGHT_STORAGE_BINDING 8       // After the ones of the compute shaders, they are rebound between draws
+#define SHADOW_FACE_STORAGE_BINDING 9
+#define CLUSTER_STORAGE_BINDING 10
+#define CLUSTER_LIGHT_STORAGE_BINDING 11
+
+// Of the directional light, see shadows.h. The frame block keeps their far depths in a vec4.
+#define SHADOW_CASCADE_COUNT 4
+
+typedef struct {
+    vec4 direction; // w unused, same for the rest
+    vec4 diffuse;
+    vec4 specular;
+    vec4 ambient;
+} DirectionalLightBlock;
+
+typedef struct {
+    mat4x4 view;
+    mat4x4 projection;
+    vec4 view_pos;
+    DirectionalLightBlock dir_light;
+
+    // Shadows of dir_light
+    mat4x4 shadow_from_world[SHADOW_CASCADE_COUNT]; // To the texture coordinates and depth of a cascade
+    vec4 cascade_far;        // View depth where each cascade ends
+    vec4 cascade_texel_size; // World units per texel of each cascade
+    s32 shadows_enabled;
+    s32 padding[3];
+
+    // Of the cluster of a fragment, see light_clusters.h. xy: clusters per pixel, zw: scale and
+    // bias of the log of the view depth.
+    vec4 cluster_scale;
+
+    // Inverse of projection * view, the deferred lighting gets positions back from the depth
+    mat4x4 world_from_clip;
+} FrameBlock;
+
+StaticAssert(sizeof(DirectionalLightBlock) == 64);
+StaticAssert(offsetof(FrameBlock, view) == 0);
+StaticAssert(offsetof(FrameBlock, projection) == 64);
+StaticAssert(offsetof(FrameBlock, view_pos) == 128);
+StaticAssert(offsetof(FrameBlock, dir_light) == 144);
+StaticAssert(offsetof(FrameBlock, shadow_from_world) == 208);
+StaticAssert(offsetof(FrameBlock, cascade_far) == 464);
+StaticAssert(offsetof(FrameBlock, cascade_texel_size) == 480);
+StaticAssert(offsetof(FrameBlock, shadows_enabled) == 496);
+StaticAssert(offsetof(FrameBlock, cluster_scale) == 512);
+StaticAssert(offsetof(FrameBlock, world_from_clip) == 528);
+StaticAssert(sizeof(FrameBlock) == 592);
+StaticAssert(SHADOW_CASCADE_COUNT == 4);
+
+// Indexed by the material index of the meshes
+typedef struct {
+    vec4 diffuse; // w unused, same for the rest
+    vec4 specular;
+    vec4 ambient;
+
+    // Array and layer in the texture arrays, the layer is negative when there is no such map
+    s32 diffuse_map[2];
+    s32 specular_map[2];
+    s32 ambient_map[2];
+
+    f32 shininess;
+    f32 padding;
+} MaterialBlock;
+
+StaticAssert(offsetof(MaterialBlock, specular) == 16);
+StaticAssert(offsetof(MaterialBlock, ambient) == 32);
+StaticAssert(offsetof(MaterialBlock, diffuse_map) == 48);
+StaticAssert(offsetof(MaterialBlock, specular_map) == 56);
+StaticAssert(offsetof(MaterialBlock, ambient_map) == 64);
+StaticAssert(offsetof(MaterialBlock, shininess) == 72);
+StaticAssert(sizeof(MaterialBlock) == 80); // Array stride, rounded up to the 16 byte alignment of the struct
+
+// One per draw, indirect draws find theirs through gl_BaseInstance
+typedef struct {
+    mat4x4 model;
+    vec3 position_min; // Positions are quantized relative to the AABB of the mesh
+    u32 material_index;
+    vec3 position_extent;
+    u32 padding;
+} DrawBlock;
+
+StaticAssert(offsetof(DrawBlock, position_min) == 64);
+StaticAssert(offsetof(DrawBlock, material_index) == 76);
+StaticAssert(offsetof(DrawBlock, position_extent) == 80);
+StaticAssert(sizeof(DrawBlock) == 96);
+
+// Point and spot lights, in the order of the lights of the renderer
+typedef struct {
+    vec3 position;
+    f32 range; // Nothing is lit beyond it
+    vec3 color; // Times the intensity
+    s32 shadow_face; // First of its faces in the shadow face table, negative without a shadow
+    vec3 direction; // Of spot lights
+    f32 cos_outer; // Of the cone of a spot light, -1 for point lights
+    f32 cos_inner;
+    u32 type; // LightType of lights.h
+    f32 padding[2];
+} LightBlock;
+
+StaticAssert(offsetof(LightBlock, color) == 16);
+StaticAssert(offsetof(LightBlock, shadow_face) == 28);
+StaticAssert(offsetof(LightBlock, direction) == 32);
+StaticAssert(offsetof(LightBlock, cos_outer) == 44);
+StaticAssert(offsetof(LightBlock, cos_inner) == 48);
+StaticAssert(sizeof(LightBlock) == 64);
+
+// A tile of the shadow atlas, six per point light and one per spot light
+typedef struct {
+    mat4x4 texture_from_world; // To the atlas coordinates of the tile and depth, before the divide by w
+    vec2 tile_min;    // In atlas coordinates
+    f32 tile_size;    // In atlas coordinates
+    f32 texel_slope;  // World size of a texel per unit of distance from the light
+} ShadowFaceBlock;
+
+StaticAssert(offsetof(ShadowFaceBlock, tile_min) == 64);
+StaticAssert(sizeof(ShadowFaceBlock) == 80);
+
+// The lights of a cluster are a range of the cluster light table, which holds indices of the
+// light table
+typedef struct {
+    u32 first_light;
+    u32 light_count;
+} ClusterBlock;
+
+StaticAssert(sizeof(ClusterBlock) == 8);
+
+// Creates the material buffer and binds it
+void InitUniformBlocks(void);
+
+// This frame's copy in the stream buffer, bound to its binding point. The caller fills it in, write only.
+FrameBlock *PushFrameBlock(StreamBuffer *stream);
+
+// Replaces the whole table, the buffer grows when it has to
+void UploadMaterialBlocks(MaterialBlock *materials, u32 count);
+
+// Like PushFrameBlock, for 'count' draws
+DrawBlock *PushDrawBlocks(StreamBuffer *stream, u32 count);
+
+// Like PushDrawBlocks
+LightBlock *PushLightBlocks(StreamBuffer *stream, u32 count);
+ShadowFaceBlock *PushShadowFaceBlocks(StreamBuffer *stream, u32 count);
+ClusterBlock *PushClusterBlocks(StreamBuffer *stream, u32 count);
+u32 *PushClusterLightIndices(StreamBuffer *stream, u32 count);
+
+#endif
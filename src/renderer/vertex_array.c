@@ -1,4 +1,5 @@
 #include "renderer.h"
+#include "gl_state.h"
 #include "vertex_array.h"
 
 VertexArray GenVertArr()
@@ -7,7 +8,7 @@ VertexArray GenVertArr()
     
     GLuint VAO;
     glGenVertexArrays(1, &VAO);    
-    glBindVertexArray(VAO);
+    StateBindVertexArray(VAO);
 
     result.renderer_id = VAO;
     
@@ -41,6 +42,12 @@ void VertLayoutPush(VertexLayout *layout,
         case GL_UNSIGNED_BYTE:
             layout->stride += count * sizeof(u8);
             break;
+
+        case GL_SHORT:
+        case GL_UNSIGNED_SHORT:
+        case GL_HALF_FLOAT:
+            layout->stride += count * sizeof(u16);
+            break;
             
         default:
            glDebugMessageInsert(GL_DEBUG_SOURCE_APPLICATION, GL_DEBUG_TYPE_ERROR, 0,                       
@@ -79,6 +86,12 @@ void VABindLayout(VertexArray *va,
             case GL_UNSIGNED_BYTE:
                 offset += attribute.count * sizeof(u8);
                 break;
+
+            case GL_SHORT:
+            case GL_UNSIGNED_SHORT:
+            case GL_HALF_FLOAT:
+                offset += attribute.count * sizeof(u16);
+                break;
             
             default:
                 glDebugMessageInsert(GL_DEBUG_SOURCE_APPLICATION, GL_DEBUG_TYPE_ERROR, 0,                       
@@ -91,10 +104,10 @@ void VABindLayout(VertexArray *va,
 
 void BindVertArr(VertexArray buf)
 {
-    glBindVertexArray(buf.renderer_id);
+    StateBindVertexArray(buf.renderer_id);
 }
 
 void UnbindVertArr(void)
 {
-    glBindVertexArray(0);
+    StateBindVertexArray(0);
 }
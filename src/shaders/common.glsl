@@ -0,0 +1,95 @@
+// Included in front of every shader, the C side of the blocks is in renderer\uniform_blocks.h
+
+struct FrameLight {
+    vec3 direction;
+    vec3 diffuse;
+    vec3 specular;
+    vec3 ambient;
+};
+
+// Uploaded once per frame
+layout (std140, binding = FRAME_UNIFORM_BINDING) uniform Frame {
+    mat4 view;
+    mat4 projection;
+    vec3 view_pos;
+    FrameLight dir_light;
+
+    // Shadows of dir_light, see renderer\shadows.h
+    mat4 shadow_from_world[SHADOW_CASCADE_COUNT]; // To the texture coordinates and depth of a cascade
+    vec4 cascade_far;        // View depth where each cascade ends
+    vec4 cascade_texel_size; // World units per texel of each cascade
+    int shadows_enabled;
+    vec4 cluster_scale; // xy: clusters per pixel, zw: slice = log(view depth) * z + w
+    mat4 world_from_clip;
+} frame;
+
+// Mirrors DrawBlock in renderer\uniform_blocks.h, one per packet of the render queue
+struct Draw {
+    mat4 model;
+    vec3 position_min; // Positions are quantized relative to the AABB of the mesh
+    uint material_index;
+    vec3 position_extent;
+};
+
+layout (std430, binding = DRAW_STORAGE_BINDING) readonly buffer Draws {
+    Draw draws[];
+};
+
+#ifdef VERTEX_SHADER
+
+// Shared by the depth pre-pass and the shading pass, which then tests for GL_EQUAL depth. Both
+// declare gl_Position invariant, so the same expression gives the same bits.
+vec4 draw_clip_position(Draw draw, vec3 quantized_position)
+{
+    vec3 position = draw.position_min + quantized_position * draw.position_extent;
+    return frame.projection * frame.view * draw.model * vec4(position, 1.0);
+}
+
+#endif
+
+
+#ifdef COMPUTE_SHADER
+
+// True when the box is behind the max-depth pyramid of renderer\hiz.h. 'box_to_clip' takes the
+// box to the clip space of the depth the pyramid was built from, 'depth_size' is its size.
+bool hiz_box_occluded(sampler2D pyramid, mat4 box_to_clip, vec3 box_min, vec3 box_extent, ivec2 depth_size, int level_count)
+{
+    vec2 min_pixel = vec2(1e30), max_pixel = vec2(-1e30);
+    float min_depth = 1.0;
+
+    for(int corner = 0; corner < 8; corner++)
+    {
+        vec3 p = box_min + box_extent * vec3(corner & 1, (corner >> 1) & 1, (corner >> 2) & 1);
+        vec4 clip = box_to_clip * vec4(p, 1.0);
+
+        // In front of the near plane, the projection of the box can not be trusted
+        if(clip.z < -clip.w) return false;
+
+        vec3 ndc = clip.xyz / clip.w;
+        vec2 pixel = (ndc.xy * 0.5 + 0.5) * vec2(depth_size);
+        min_pixel = min(min_pixel, pixel);
+        max_pixel = max(max_pixel, pixel);
+        min_depth = min(min_depth, ndc.z * 0.5 + 0.5);
+    }
+
+    // Outside of the view the pyramid was built from, nothing is known about it
+    ivec2 p0 = max(ivec2(floor(min_pixel)), ivec2(0));
+    ivec2 p1 = min(ivec2(floor(max_pixel)), depth_size - 1);
+    if(any(greaterThan(p0, p1))) return false;
+
+    // Pixel p is in texel min(p >> (level + 1), size - 1) of a level. The finest one where
+    // the box touches 2x2 texels at most.
+    int level = 0;
+    while(level + 1 < level_count && any(greaterThan((p1 >> (level + 1)) - (p0 >> (level + 1)), ivec2(1)))) level++;
+
+    ivec2 size = textureSize(pyramid, level);
+    ivec2 t0 = min(p0 >> (level + 1), size - 1);
+    ivec2 t1 = min(p1 >> (level + 1), size - 1);
+
+    float max_depth = max(max(texelFetch(pyramid, t0, level).r, texelFetch(pyramid, ivec2(t1.x, t0.y), level).r),
+                          max(texelFetch(pyramid, ivec2(t0.x, t1.y), level).r, texelFetch(pyramid, t1, level).r));
+
+    return min_depth > max_depth;
+}
+
+#endif
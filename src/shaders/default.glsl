@@ -1,84 +1,392 @@
+// Built into three programs, see renderer\gbuffer.h:
+//   default:  forward, every fragment that passes the depth test is lit by the lights of its cluster
+//   gbuffer:  GBUFFER_PASS, the surface of the fragment is written into the G-buffer instead
+//   deferred: DEFERRED_LIGHTING, a triangle over the screen lights the surfaces of the G-buffer
+// All of them shade with the same materials and the same lighting code.
+
+vec3 oct_decode(vec2 e)
+{
+    vec3 n = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += (n.x >= 0.0) ? -t : t;
+    n.y += (n.y >= 0.0) ? -t : t;
+    return normalize(n);
+}
+
+// Unit vector to the octahedron folded onto [-1, 1]^2
+vec2 oct_encode(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    if(n.z < 0.0) n.xy = (1.0 - abs(n.yx)) * vec2((n.x >= 0.0) ? 1.0 : -1.0, (n.y >= 0.0) ? 1.0 : -1.0);
+    return n.xy;
+}
+
+// Shininess is stored as log2(shininess) / GBUFFER_MAX_SHININESS_LOG2
+const float GBUFFER_MAX_SHININESS_LOG2 = 11.0;
+
 #ifdef VERTEX_SHADER
-layout (location = 0) in vec3 pos_attr;
-layout (location = 1) in vec3 normal_attr;
-layout (location = 2) in vec2 tex_attr;
+#ifdef DEFERRED_LIGHTING
+
+// Covers the screen with one triangle, drawn without vertex attributes
+void main()
+{
+    vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    gl_Position = vec4(corner * 2.0 - 1.0, 0.0, 1.0);
+}
+
+#else
+layout (location = 0) in vec4 pos_attr;    // unorm16 relative to the mesh AABB
+layout (location = 1) in vec2 normal_attr; // octahedral encoded, snorm16
+layout (location = 2) in vec2 tex_attr;    // half float
 
 out vec2 tex_coord;
 out vec3 frag_normal;
 out vec3 frag_pos;
+flat out uint material_index;
+
+// Negative for indirect draws, they pass the index of their draw as the base instance
+uniform int draw_index;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// Tested for GL_EQUAL against the depth pre-pass
+invariant gl_Position;
 
 void main()
 {
+    Draw draw = draws[(draw_index >= 0) ? uint(draw_index) : uint(gl_BaseInstance)];
+    mat4 model = draw.model;
+    material_index = draw.material_index;
+
+    vec3 position = draw.position_min + pos_attr.xyz * draw.position_extent;
+    vec3 normal = oct_decode(normal_attr);
     
-    frag_pos = vec3(model * vec4(pos_attr, 1.0)); // world-space
-    frag_normal = mat3(transpose(inverse(model))) * normal_attr; // normal of the primitive in world-space
+    frag_pos = vec3(model * vec4(position, 1.0)); // world-space
+    frag_normal = mat3(transpose(inverse(model))) * normal; // normal of the primitive in world-space
     tex_coord = tex_attr;
     
-    gl_Position = projection * view * model * vec4(pos_attr, 1.0);
+    gl_Position = draw_clip_position(draw, pos_attr.xyz);
     
 }
 
+#endif
 #endif
 
 #ifdef FRAGMENT_SHADER
 
+// What the lights see of a fragment, from its material or out of the G-buffer
+struct Surface {
+    vec3 position; // World space
+    vec3 normal;
+    vec3 diffuse;  // The color of the material times its texel, same for the rest
+    vec3 specular;
+    vec3 ambient;
+    float shininess;
+};
+
+#ifndef DEFERRED_LIGHTING
+
+// Mirrors MaterialBlock in renderer\uniform_blocks.h
 struct Material {
     vec3 diffuse;
     vec3 specular;
     vec3 ambient;
 
+    // Array and layer, the layer is negative when the material has no such map
+    ivec2 diffuse_map;
+    ivec2 specular_map;
+    ivec2 ambient_map;
+
     float shininess;
 };
 
-struct DirectionalLight {
-    vec3 direction;
-    
-    vec3 diffuse;
-    vec3 specular;
-    vec3 ambient;    
+layout (std430, binding = MATERIAL_STORAGE_BINDING) readonly buffer Materials {
+    Material materials[];
 };
 
 in vec3 frag_normal;
 in vec3 frag_pos;
 in vec2 tex_coord;
-out vec4 final_color;
+flat in uint material_index;
 
-uniform Material material;
-uniform DirectionalLight dir_light;
-uniform vec3 view_pos;
+#if MATERIAL_TEXTURE_ARRAYS
+uniform sampler2DArray texture_arrays[MAX_TEXTURE_ARRAYS];
 
+// The array index is the same for every invocation of a draw, so it can pick the sampler
+vec3 sample_map(ivec2 map)
+{
+    if(map.y < 0) return vec3(0.0); // Like sampling a texture that is not there
+    return texture(texture_arrays[map.x], vec3(tex_coord, map.y)).rgb;
+}
+#else
 uniform sampler2D diffuse_map;
 uniform sampler2D specular_map;
 uniform sampler2D ambient_map;
+#endif
 
-void main()
+Surface material_surface()
 {
+    Material material = materials[material_index];
 
+#if MATERIAL_TEXTURE_ARRAYS
+    vec3 diffuse_texel = sample_map(material.diffuse_map);
+    vec3 specular_texel = sample_map(material.specular_map);
+    vec3 ambient_texel = sample_map(material.ambient_map);
+#else
     vec3 diffuse_texel = texture(diffuse_map, tex_coord).rgb; 
     vec3 specular_texel = texture(specular_map, tex_coord).rgb;
     vec3 ambient_texel = texture(ambient_map, tex_coord).rgb;
+#endif
+
+    Surface surface;
+    surface.position = frag_pos;
+    // Back faces are only drawn for double sided materials, they are lit from their own side
+    surface.normal = normalize(gl_FrontFacing ? frag_normal : -frag_normal);
+    surface.diffuse = material.diffuse * diffuse_texel;
+    surface.specular = material.specular * specular_texel;
+    surface.ambient = material.ambient * ambient_texel;
+    surface.shininess = material.shininess;
+
+    return surface;
+}
+
+#endif
+
+#ifndef GBUFFER_PASS
+
+uniform sampler2DArrayShadow shadow_map; // A layer per cascade
+
+// Texels of the cascade the position is moved along the normal before the lookup, against acne
+// on surfaces at a grazing angle to the light
+const float SHADOW_NORMAL_OFFSET = 1.5;
+
+// 1 where dir_light reaches the fragment, 0 in shadow. 3x3 taps, every one filtered over 2x2 texels.
+float dir_light_visibility(Surface surface)
+{
+    if(frame.shadows_enabled == 0) return 1.0;
+
+    float view_depth = -(frame.view * vec4(surface.position, 1.0)).z;
+    if(view_depth > frame.cascade_far[SHADOW_CASCADE_COUNT - 1]) return 1.0;
+
+    int cascade = 0;
+    while(cascade < SHADOW_CASCADE_COUNT - 1 && view_depth > frame.cascade_far[cascade]) cascade++;
+
+    vec3 offset_pos = surface.position + surface.normal * (frame.cascade_texel_size[cascade] * SHADOW_NORMAL_OFFSET);
+    vec3 coord = (frame.shadow_from_world[cascade] * vec4(offset_pos, 1.0)).xyz;
+
+    vec2 texel = 1.0 / vec2(textureSize(shadow_map, 0).xy);
+    float visibility = 0.0;
+    for(int y = -1; y <= 1; y++)
+    {
+        for(int x = -1; x <= 1; x++)
+            visibility += texture(shadow_map, vec4(coord.xy + vec2(x, y) * texel, float(cascade), coord.z));
+    }
+
+    return visibility / 9.0;
+}
+
+// Mirrors LightBlock, ShadowFaceBlock and ClusterBlock in renderer\uniform_blocks.h
+struct LocalLight {
+    vec3 position;
+    float range;
+    vec3 color;
+    int shadow_face; // Negative without a shadow
+    vec3 direction;
+    float cos_outer;
+    float cos_inner;
+    uint type;
+};
+
+struct ShadowFace {
+    mat4 texture_from_world;
+    vec2 tile_min;
+    float tile_size;
+    float texel_slope;
+};
+
+const uint LIGHT_POINT = 0u; // LightType in renderer\lights.h
+
+layout (std430, binding = LIGHT_STORAGE_BINDING) readonly buffer Lights {
+    LocalLight lights[];
+};
+
+layout (std430, binding = SHADOW_FACE_STORAGE_BINDING) readonly buffer ShadowFaces {
+    ShadowFace shadow_faces[];
+};
+
+// Range of cluster_lights per cluster, x first, then y, then the depth slice
+layout (std430, binding = CLUSTER_STORAGE_BINDING) readonly buffer Clusters {
+    uvec2 clusters[];
+};
+
+layout (std430, binding = CLUSTER_LIGHT_STORAGE_BINDING) readonly buffer ClusterLights {
+    uint cluster_lights[];
+};
+
+// The lights of the cluster the fragment is in, as the first and count of cluster_lights
+uvec2 fragment_cluster(vec3 position)
+{
+    float view_depth = -(frame.view * vec4(position, 1.0)).z;
+    ivec3 cluster = ivec3(floor(vec3(gl_FragCoord.xy * frame.cluster_scale.xy,
+                                     log(max(view_depth, 1e-4)) * frame.cluster_scale.z + frame.cluster_scale.w)));
+    cluster = clamp(cluster, ivec3(0), ivec3(LIGHT_CLUSTERS_X - 1, LIGHT_CLUSTERS_Y - 1, LIGHT_CLUSTERS_Z - 1));
+
+    return clusters[(cluster.z * LIGHT_CLUSTERS_Y + cluster.y) * LIGHT_CLUSTERS_X + cluster.x];
+}
+
+uniform sampler2DShadow shadow_atlas;
+
+// Like dir_light_visibility, from the tile of the cube face the fragment is in or the one of the
+// spot light. The taps stay inside of the tile.
+float local_light_visibility(LocalLight light, Surface surface)
+{
+    if(light.shadow_face < 0) return 1.0;
+
+    vec3 to_frag = surface.position - light.position;
+    int face = 0;
+    float depth;
+    if(light.type == LIGHT_POINT)
+    {
+        vec3 a = abs(to_frag);
+        if(a.x >= a.y && a.x >= a.z) face = (to_frag.x > 0.0) ? 0 : 1;
+        else if(a.y >= a.z)          face = (to_frag.y > 0.0) ? 2 : 3;
+        else                         face = (to_frag.z > 0.0) ? 4 : 5;
+        depth = max(a.x, max(a.y, a.z));
+    }
+    else depth = dot(to_frag, light.direction);
+
+    ShadowFace shadow = shadow_faces[light.shadow_face + face];
+    vec3 offset_pos = surface.position + surface.normal * (shadow.texel_slope * depth * SHADOW_NORMAL_OFFSET);
+    vec4 clip = shadow.texture_from_world * vec4(offset_pos, 1.0);
+    vec3 coord = clip.xyz / clip.w;
+
+    vec2 texel = 1.0 / vec2(textureSize(shadow_atlas, 0));
+    vec2 tile_low = shadow.tile_min + 1.5 * texel;
+    vec2 tile_high = shadow.tile_min + shadow.tile_size - 1.5 * texel;
+
+    float visibility = 0.0;
+    for(int y = -1; y <= 1; y++)
+    {
+        for(int x = -1; x <= 1; x++)
+            visibility += texture(shadow_atlas, vec3(clamp(coord.xy + vec2(x, y) * texel, tile_low, tile_high), coord.z));
+    }
+
+    return visibility / 9.0;
+}
+
+// Diffuse and specular of a point or spot light, fading out to 0 at its range
+vec3 local_light_color(LocalLight light, Surface surface, vec3 view_dir)
+{
+    vec3 to_light = light.position - surface.position;
+    float distance = length(to_light);
+    if(distance >= light.range) return vec3(0.0);
+
+    vec3 light_dir = to_light / distance;
+    float x = distance / light.range;
+    float window = clamp(1.0 - x * x * x * x, 0.0, 1.0);
+    float attenuation = window * window / (1.0 + 16.0 * x * x);
+    if(light.type != LIGHT_POINT) attenuation *= smoothstep(light.cos_outer, light.cos_inner, dot(-light_dir, light.direction));
+    if(attenuation <= 0.0) return vec3(0.0);
+
+    attenuation *= local_light_visibility(light, surface);
+
+    float diffuse_strength = max(dot(surface.normal, light_dir), 0.0);
+    vec3 reflect_dir = reflect(-light_dir, surface.normal);
+    float specular_strength = pow(max(dot(view_dir, reflect_dir), 0.0), surface.shininess);
+
+    return attenuation * light.color * (diffuse_strength * surface.diffuse + specular_strength * surface.specular);
+}
+
+// dir_light and the lights of the cluster, in linear color
+vec3 shade(Surface surface)
+{
+    FrameLight dir_light = frame.dir_light;
 
     vec3 dir_light_norm = normalize(-dir_light.direction);
-    vec3 view_dir = normalize(view_pos - frag_pos);
+    vec3 view_dir = normalize(frame.view_pos - surface.position);
+    float visibility = dir_light_visibility(surface);
     
-    float diffuse_strength = max(dot(frag_normal, dir_light_norm), 0.0);
+    float diffuse_strength = max(dot(surface.normal, dir_light_norm), 0.0) * visibility;
 
-    vec3 reflect_dir = reflect(-dir_light_norm, frag_normal);
-    float specular_strength = pow(max(dot(view_dir, reflect_dir), 0.0), material.shininess);
+    vec3 reflect_dir = reflect(-dir_light_norm, surface.normal);
+    float specular_strength = pow(max(dot(view_dir, reflect_dir), 0.0), surface.shininess) * visibility;
 
-    vec3 ambient = dir_light.ambient  * material.ambient * ambient_texel;
-    vec3 diffuse = diffuse_strength   * dir_light.diffuse  * material.diffuse * diffuse_texel;
-    vec3 specular = specular_strength * dir_light.specular * material.specular * specular_texel;
+    vec3 ambient = dir_light.ambient  * surface.ambient;
+    vec3 diffuse = diffuse_strength   * dir_light.diffuse  * surface.diffuse;
+    vec3 specular = specular_strength * dir_light.specular * surface.specular;
 
     vec3 color = ambient + diffuse + specular;
-    color = pow(color, vec3(1.0 / 2.2));    
+    uvec2 cluster = fragment_cluster(surface.position);
+    for(uint cluster_index = cluster.x; cluster_index < cluster.x + cluster.y; cluster_index++)
+        color += local_light_color(lights[cluster_lights[cluster_index]], surface, view_dir);
+
+    return color;
+}
+
+#endif
+
+#if defined(GBUFFER_PASS)
+
+// Mirrors the attachments of renderer\gbuffer.h
+layout (location = 0) out vec4 albedo_specular;  // sRGB diffuse, specular intensity in alpha
+layout (location = 1) out vec4 normal_shininess; // Octahedral normal in xy, shininess in z
+layout (location = 2) out vec4 ambient_albedo;   // sRGB
+
+void main()
+{
+    Surface surface = material_surface();
+
+    // The G-buffer has one channel for the specular color, its average keeps the intensity
+    albedo_specular = vec4(clamp(surface.diffuse, 0.0, 1.0), clamp(dot(surface.specular, vec3(1.0 / 3.0)), 0.0, 1.0));
+    normal_shininess = vec4(oct_encode(surface.normal) * 0.5 + 0.5,
+                            log2(max(surface.shininess, 1.0)) / GBUFFER_MAX_SHININESS_LOG2, 0.0);
+    ambient_albedo = vec4(clamp(surface.ambient, 0.0, 1.0), 0.0);
+}
+
+#elif defined(DEFERRED_LIGHTING)
+
+uniform sampler2D gbuffer_albedo_specular;
+uniform sampler2D gbuffer_normal_shininess;
+uniform sampler2D gbuffer_ambient;
+uniform sampler2D gbuffer_depth;
+
+out vec4 final_color;
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+
+    // Nothing was drawn, the clear color stays
+    float depth = texelFetch(gbuffer_depth, pixel, 0).r;
+    if(depth == 1.0) discard;
+
+    // The position back from the pixel and its depth
+    vec2 ndc = gl_FragCoord.xy / vec2(textureSize(gbuffer_depth, 0)) * 2.0 - 1.0;
+    vec4 position = frame.world_from_clip * vec4(ndc, depth * 2.0 - 1.0, 1.0);
+
+    vec4 albedo_specular = texelFetch(gbuffer_albedo_specular, pixel, 0);
+    vec4 normal_shininess = texelFetch(gbuffer_normal_shininess, pixel, 0);
+
+    Surface surface;
+    surface.position = position.xyz / position.w;
+    surface.normal = oct_decode(normal_shininess.xy * 2.0 - 1.0);
+    surface.diffuse = albedo_specular.rgb;
+    surface.specular = vec3(albedo_specular.a);
+    surface.ambient = texelFetch(gbuffer_ambient, pixel, 0).rgb;
+    surface.shininess = exp2(normal_shininess.z * GBUFFER_MAX_SHININESS_LOG2);
+
+    vec3 color = pow(shade(surface), vec3(1.0 / 2.2));
+    final_color = vec4(color, 1.0);
+}
+
+#else
+
+out vec4 final_color;
+
+void main()
+{
+    vec3 color = pow(shade(material_surface()), vec3(1.0 / 2.2));
     final_color = vec4(color, 1.0);
-    
-        
 }
 
 #endif
+
+#endif
@@ -0,0 +1,17 @@
+// Depth pre-pass from the position stream of the model, no fragment shader runs
+
+#ifdef VERTEX_SHADER
+layout (location = 0) in vec4 pos_attr; // unorm16 relative to the mesh AABB
+
+// Like in default.glsl
+uniform int draw_index;
+
+invariant gl_Position;
+
+void main()
+{
+    Draw draw = draws[(draw_index >= 0) ? uint(draw_index) : uint(gl_BaseInstance)];
+    gl_Position = draw_clip_position(draw, pos_attr.xyz);
+}
+
+#endif
@@ -0,0 +1,123 @@
+// Culls every instance and appends the visible ones to the indirect command lists, see renderer\gpu_culling.h
+
+#ifdef COMPUTE_SHADER
+layout (local_size_x = 64) in;
+
+// Mirrors GPUCullInstance in renderer\gpu_culling.h
+struct CullInstance {
+    vec3 world_min;
+    uint index_count;
+    vec3 world_max;
+    uint first_index;
+    int base_vertex;
+    uint face_cull;
+};
+
+// Mirrors DrawElementsIndirectCommand in renderer\render_queue.h
+struct DrawCommand {
+    uint count;
+    uint instance_count;
+    uint first_index;
+    int base_vertex;
+    uint base_instance; // Index of the instance and its draw
+};
+
+layout (std430, binding = GPU_CULL_INSTANCE_BINDING) readonly buffer Instances {
+    CullInstance instances[];
+};
+
+// Set by the first phase for the instances the second one has to test again
+layout (std430, binding = GPU_CULL_PENDING_BINDING) buffer Pending {
+    uint pending[];
+};
+
+// GPU_CULL_LISTS lists of 'instance_capacity' commands
+layout (std430, binding = GPU_CULL_COMMAND_BINDING) writeonly buffer Commands {
+    DrawCommand commands[];
+};
+
+// Mirrors GPUCullCounters in renderer\gpu_culling.h
+layout (std430, binding = GPU_CULL_COUNTER_BINDING) buffer Counters {
+    uint draw_counts[GPU_CULL_LISTS]; // The draw counts of the indirect calls
+    uint frustum_culled;
+    uint occluded;
+} counters;
+
+uniform int instance_count;
+uniform int instance_capacity;
+uniform vec4 frustum_planes[6]; // Pointing inwards, like Frustum in renderer\culling.h
+
+uniform int phase;
+uniform int hiz_enabled;
+
+// Like in hiz_cull.glsl
+uniform sampler2D pyramid;
+uniform mat4 cull_view_projection;
+uniform ivec2 depth_size;
+uniform int level_count;
+
+bool in_frustum(CullInstance instance)
+{
+    for(int plane_index = 0; plane_index < 6; plane_index++)
+    {
+        vec4 plane = frustum_planes[plane_index];
+        vec3 p = mix(instance.world_min, instance.world_max, greaterThanEqual(plane.xyz, vec3(0.0)));
+        if(dot(plane.xyz, p) + plane.w < 0.0) return false;
+    }
+
+    return true;
+}
+
+bool occluded(CullInstance instance)
+{
+    return hiz_enabled != 0 &&
+           hiz_box_occluded(pyramid, cull_view_projection, instance.world_min, instance.world_max - instance.world_min,
+                            depth_size, level_count);
+}
+
+void append(uint instance_index, CullInstance instance)
+{
+    // A list per phase and face cull mode, the cull state can not change within a call
+    uint list = uint(phase) * uint(GPU_CULL_LISTS / 2) + instance.face_cull;
+    uint slot = atomicAdd(counters.draw_counts[list], 1u);
+
+    DrawCommand command;
+    command.count = instance.index_count;
+    command.instance_count = 1u;
+    command.first_index = instance.first_index;
+    command.base_vertex = instance.base_vertex;
+    command.base_instance = instance_index;
+    commands[list * uint(instance_capacity) + slot] = command;
+}
+
+void main()
+{
+    uint instance_index = gl_GlobalInvocationID.x;
+    if(instance_index >= uint(instance_count)) return;
+
+    CullInstance instance = instances[instance_index];
+
+    if(phase == 0)
+    {
+        pending[instance_index] = 0u;
+
+        if(!in_frustum(instance))
+        {
+            atomicAdd(counters.frustum_culled, 1u);
+            return;
+        }
+
+        // Hidden last frame, the second phase decides
+        if(occluded(instance)) pending[instance_index] = 1u;
+        else append(instance_index, instance);
+    }
+    else
+    {
+        if(pending[instance_index] == 0u) return;
+
+        if(occluded(instance)) atomicAdd(counters.occluded, 1u);
+        else append(instance_index, instance);
+    }
+}
+
+#endif
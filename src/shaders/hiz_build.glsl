@@ -0,0 +1,38 @@
+// One level of the max-depth pyramid, see renderer\hiz.h
+
+#ifdef COMPUTE_SHADER
+layout (local_size_x = 8, local_size_y = 8) in;
+
+uniform sampler2D depth_texture; // The source of level 0
+layout (r32f, binding = 0) uniform readonly image2D source_level; // The source of every other level
+layout (r32f, binding = 1) uniform writeonly image2D dest_level;
+
+uniform int from_depth;
+uniform ivec2 source_size;
+
+float source_depth(ivec2 p)
+{
+    p = min(p, source_size - 1);
+    return (from_depth != 0) ? texelFetch(depth_texture, p, 0).r : imageLoad(source_level, p).r;
+}
+
+void main()
+{
+    ivec2 dest = ivec2(gl_GlobalInvocationID.xy);
+    ivec2 dest_size = imageSize(dest_level);
+    if(any(greaterThanEqual(dest, dest_size))) return;
+
+    // Every texel covers 2x2 of the source. The last row and column also take the one that is
+    // left over when the source size is odd, so nothing is ever dropped.
+    ivec2 first = dest * 2;
+    ivec2 extent = ivec2(2) + ivec2(equal(dest, dest_size - 1)) * (source_size - 2 * dest_size);
+
+    float depth = 0.0;
+    for(int y = 0; y < extent.y; y++)
+        for(int x = 0; x < extent.x; x++)
+            depth = max(depth, source_depth(first + ivec2(x, y)));
+
+    imageStore(dest_level, dest, vec4(depth));
+}
+
+#endif
@@ -0,0 +1,64 @@
+// Occlusion test of the indirect commands against the max-depth pyramid, see renderer\hiz.h
+
+#ifdef COMPUTE_SHADER
+layout (local_size_x = 64) in;
+
+// Mirrors DrawElementsIndirectCommand in renderer\render_queue.h
+struct DrawCommand {
+    uint count;
+    uint instance_count;
+    uint first_index;
+    int base_vertex;
+    uint base_instance; // Index of the draw
+};
+
+layout (std430, binding = HIZ_COMMAND_BINDING) buffer Commands {
+    DrawCommand commands[];
+};
+
+// Mirrors HiZStats in renderer\hiz.h
+layout (std430, binding = HIZ_STATS_BINDING) buffer Stats {
+    uint drawn_first;
+    uint drawn_second;
+    uint culled;
+} stats;
+
+uniform sampler2D pyramid;
+uniform mat4 cull_view_projection; // Of the depth the pyramid was built from
+uniform ivec2 depth_size;          // Level 0 of the pyramid is half of it
+uniform int level_count;
+uniform int command_count;
+
+// 0 tests every command against the pyramid of the last frame. 1 tests the ones the first
+// phase culled against the pyramid of what it drew, and takes out the ones it drew already.
+uniform int phase;
+
+bool occluded(Draw draw)
+{
+    return hiz_box_occluded(pyramid, cull_view_projection * draw.model, draw.position_min, draw.position_extent,
+                            depth_size, level_count);
+}
+
+void main()
+{
+    uint command_index = gl_GlobalInvocationID.x;
+    if(command_index >= uint(command_count)) return;
+
+    if(phase == 1 && commands[command_index].instance_count != 0)
+    {
+        commands[command_index].instance_count = 0;
+        atomicAdd(stats.drawn_first, 1u);
+        return;
+    }
+
+    bool visible = !occluded(draws[commands[command_index].base_instance]);
+    commands[command_index].instance_count = visible ? 1u : 0u;
+
+    if(phase == 1)
+    {
+        if(visible) atomicAdd(stats.drawn_second, 1u);
+        else atomicAdd(stats.culled, 1u);
+    }
+}
+
+#endif
@@ -8,7 +8,6 @@ __declspec(dllexport) int AmdPowerXpressRequestHighPerformance = 1;
 
 /*
   TODO:
-  * Cache glGetUniformLocation calls
   * Camera rotation is acting strange, it's like it's not moving around its own axis.
 */
 
@@ -22,9 +21,20 @@ __declspec(dllexport) int AmdPowerXpressRequestHighPerformance = 1;
 #include "renderer/shader_bank.h"
 #include "renderer/renderer.h"
 #include "renderer/camera.h"
+#include "renderer/texture_streaming.h"
+#include "renderer/gl_state.h"
+#include "renderer/stream_buffer.h"
+#include "renderer/occlusion.h"
+#include "renderer/hiz.h"
+#include "renderer/gpu_culling.h"
+#include "renderer/shadows.h"
+#include "renderer/shadow_atlas.h"
+#include "renderer/light_clusters.h"
+#include "renderer/model.h" // MATERIAL_TEXTURE_ARRAYS
 
 #include "GLFW/glfw3.h"
 #include "memory.h"
+#include "platform.h"
 
 #define PRESSED(KEY) (glfwGetKey(window, KEY) == GLFW_PRESS)
 
@@ -36,6 +46,10 @@ extern Camera global_cam;
 void framebuffer_size_callback(GLFWwindow* window, int width, int height)
 {
 	glViewport(0,0, width, height);
+
+    // The render targets follow on the next frame
+    app_state.window_width = width;
+    app_state.window_height = height;
 }
 
 static void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
@@ -76,6 +90,8 @@ static void key_callback(GLFWwindow* window, int key, int scancode, int action,
                     }
                     else
                         printf("Shader reloading failed\n");
+
+                    reload_assets();
         
                     app_state.reloading_shaders = 0;                     
                 }
@@ -92,6 +108,92 @@ static void key_callback(GLFWwindow* window, int key, int scancode, int action,
                     glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
                 break;
             }
+            case GLFW_KEY_2:
+            {
+                app_state.cluster_culling = !app_state.cluster_culling;
+                printf("Frustum culling %s\n", app_state.cluster_culling ? "on" : "off");
+                break;
+            }
+            case GLFW_KEY_3:
+            {
+#if MATERIAL_TEXTURE_ARRAYS
+                app_state.indirect_draws = !app_state.indirect_draws;
+                printf("Indirect draws %s\n", app_state.indirect_draws ? "on" : "off");
+#else
+                printf("Indirect draws need MATERIAL_TEXTURE_ARRAYS, textures are bound per material otherwise\n");
+#endif
+                break;
+            }
+            case GLFW_KEY_4:
+            {
+                app_state.bvh_culling = !app_state.bvh_culling;
+                printf("Instance culling: %s\n", app_state.bvh_culling ? "BVH walk" : "parallel SoA batches");
+                break;
+            }
+            case GLFW_KEY_5:
+            {
+                app_state.occlusion_culling = !app_state.occlusion_culling;
+                printf("Occlusion culling %s\n", app_state.occlusion_culling ? "on" : "off");
+                break;
+            }
+            case GLFW_KEY_6:
+            {
+                app_state.hiz_culling = !app_state.hiz_culling;
+                printf("Hierarchical-Z culling %s%s\n", app_state.hiz_culling ? "on" : "off",
+                       (app_state.hiz_culling && !app_state.indirect_draws) ? ", only with indirect draws" : "");
+                break;
+            }
+            case GLFW_KEY_7:
+            {
+#if MATERIAL_TEXTURE_ARRAYS
+                app_state.gpu_culling = !app_state.gpu_culling;
+                printf("GPU driven culling %s\n", app_state.gpu_culling ? "on" : "off");
+#else
+                printf("GPU driven culling needs MATERIAL_TEXTURE_ARRAYS, textures are bound per material otherwise\n");
+#endif
+                break;
+            }
+            case GLFW_KEY_8:
+            {
+                app_state.depth_prepass = !app_state.depth_prepass;
+                printf("Depth pre-pass %s\n", app_state.depth_prepass ? "on" : "off");
+                break;
+            }
+            case GLFW_KEY_9:
+            {
+                app_state.shadows = !app_state.shadows;
+                printf("Shadows %s\n", app_state.shadows ? "on" : "off");
+                break;
+            }
+            case GLFW_KEY_0:
+            {
+                app_state.local_shadows = !app_state.local_shadows;
+                printf("Point and spot light shadows %s\n", app_state.local_shadows ? "on" : "off");
+                break;
+            }
+            case GLFW_KEY_L:
+            {
+                app_state.light_field++;
+                break;
+            }
+            case GLFW_KEY_G:
+            {
+                app_state.deferred = !app_state.deferred;
+                printf("%s shading\n", app_state.deferred ? "Deferred" : "Forward");
+                break;
+            }
+            case GLFW_KEY_P:
+            {
+                pick_at_crosshair();
+                break;
+            }
+#if DEBUG
+            case GLFW_KEY_M:
+            {
+                check_reload_memory();
+                break;
+            }
+#endif
             default: break;               
         }
     }
@@ -153,6 +255,9 @@ s32 main(void)
     glfwSetScrollCallback(window, scroll_callback);
     glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
 
+    // One worker per core besides the main thread
+    InitWorkQueue(&work_queue, GetProcessorCount() - 1);
+
     render_init();
 
     // Print status
@@ -176,6 +281,16 @@ s32 main(void)
     app_state.sensitivity = 0.1f;
     app_state.camera_control = 1;
     app_state.wireframe_on = 0;
+    app_state.cluster_culling = 1;
+    app_state.bvh_culling = 0;
+    app_state.occlusion_culling = 1;
+    app_state.hiz_culling = 1;
+    app_state.gpu_culling = 0;
+    app_state.depth_prepass = 1;
+    app_state.shadows = 1;
+    app_state.local_shadows = 1;
+    app_state.deferred = 0;
+    app_state.indirect_draws = MATERIAL_TEXTURE_ARRAYS;
     
     f64 reload_time = glfwGetTime();
     s32 frames_elapsed = 0;
@@ -228,7 +343,61 @@ s32 main(void)
         if(elapsed >= 1.0f)
         {
             reload_shader_bank();
+            reload_assets();
             reload_time = end_time;
+
+#if PERF
+            printf("Meshlets visible: %u/%u\n", render_stats.meshlets_visible, render_stats.meshlets_tested);
+            printf("Instances (%s): %u tested, %u visible, %u culled in %.3f ms, BVH nodes tested: %u\n",
+                   app_state.bvh_culling ? "BVH" : "flat", render_stats.instances_tested, render_stats.instances_visible,
+                   render_stats.instances_culled, render_stats.instance_cull_ms,
+                   render_stats.bvh_nodes_tested);
+            printf("Occlusion: %u occluders, %u triangles rasterized in %.3f ms, %u/%u instances occluded\n",
+                   occlusion_stats.occluder_count, occlusion_stats.triangles_rasterized, occlusion_stats.raster_ms,
+                   occlusion_stats.instances_occluded, occlusion_stats.instances_tested);
+            if(app_state.gpu_culling)
+                printf("GPU culling: %u instances, %u drawn in the first phase, %u in the second, %u outside the frustum, %u occluded\n",
+                       gpu_cull_stats.instances, gpu_cull_stats.drawn_first, gpu_cull_stats.drawn_second,
+                       gpu_cull_stats.frustum_culled, gpu_cull_stats.occluded);
+            else if(app_state.hiz_culling && app_state.indirect_draws)
+                printf("Hierarchical-Z: %u commands drawn in the first phase, %u in the second, %u culled\n",
+                       hiz_stats.drawn_first, hiz_stats.drawn_second, hiz_stats.culled);
+            printf("State changes: %u programs, %u materials, %u vertex arrays\n",
+                   render_stats.program_changes, render_stats.material_changes, render_stats.vertex_array_changes);
+            printf("Submit (%s): %u draw calls, %.3f ms\n", app_state.indirect_draws ? "indirect" : "per packet",
+                   render_stats.draw_calls, render_stats.submit_ms);
+            printf("Scene on the GPU (depth pre-pass %s): %.3f ms, %llu fragments shaded, %.2f per pixel\n",
+                   app_state.depth_prepass ? "on" : "off", render_stats.scene_gpu_ms,
+                   (unsigned long long)render_stats.fragments_shaded,
+                   (f64)render_stats.fragments_shaded / ((f64)app_state.window_width * app_state.window_height));
+            printf("Shading: %s, last measured %.3f ms forward, %.3f ms deferred\n", app_state.deferred ? "deferred" : "forward",
+                   render_stats.forward_gpu_ms, render_stats.deferred_gpu_ms);
+            for(u32 cascade_index = 0; app_state.shadows && cascade_index < SHADOW_CASCADE_COUNT; cascade_index++)
+            {
+                ShadowCascadeStats *cascade = &shadow_stats.cascades[cascade_index];
+                printf("Shadow cascade %u (to %.1f): %s, %u casters, %.3f ms CPU, %.3f ms GPU\n", cascade_index,
+                       cascade->far_depth, cascade->drawn ? "drawn" : "cached", cascade->casters, cascade->cpu_ms, cascade->gpu_ms);
+            }
+            if(app_state.local_shadows)
+                printf("Shadow atlas: %u lights, %.0f%% used, %u faces drawn (%u casters), %u lights waiting, %.3f ms CPU, %.3f ms GPU\n",
+                       shadow_atlas_stats.shadowed_lights, shadow_atlas_stats.atlas_used * 100.0f, shadow_atlas_stats.faces_drawn,
+                       shadow_atlas_stats.casters_drawn, shadow_atlas_stats.lights_waiting, shadow_atlas_stats.cpu_ms, shadow_atlas_stats.gpu_ms);
+            printf("Light clusters: %u lights, %u indices, at most %u per cluster, %u dropped, %.3f ms CPU\n",
+                   light_cluster_stats.light_count, light_cluster_stats.index_count, light_cluster_stats.max_cluster_lights,
+                   light_cluster_stats.dropped, light_cluster_stats.cpu_ms);
+            printf("GL calls issued/elided: programs %u/%u, vertex arrays %u/%u, textures %u/%u, buffers %u/%u, uniforms %u/%u\n",
+                   gl_state_counters.programs.issued, gl_state_counters.programs.elided,
+                   gl_state_counters.vertex_arrays.issued, gl_state_counters.vertex_arrays.elided,
+                   gl_state_counters.textures.issued, gl_state_counters.textures.elided,
+                   gl_state_counters.buffers.issued, gl_state_counters.buffers.elided,
+                   gl_state_counters.uniforms.issued, gl_state_counters.uniforms.elided);
+            printf("Streamed textures: %u, %.1f/%.1f MB resident\n", texture_streaming_stats.streamed_count,
+                   texture_streaming_stats.resident_bytes / (1024.0 * 1024.0), texture_streaming_stats.budget / (1024.0 * 1024.0));
+            printf("Stream buffer: %.1f MB written, %u fence waits (%.3f ms), %u resizes\n",
+                   stream_buffer_stats.bytes_allocated / (1024.0 * 1024.0), stream_buffer_stats.fence_waits,
+                   stream_buffer_stats.wait_ms, stream_buffer_stats.resizes);
+            ResetStreamBufferStats();
+#endif
         }
         
         f64 work_time = app_state.delta_time*1000.0f;
@@ -23,6 +23,17 @@ typedef struct
 
     s32 reloading_shaders;
     s32 wireframe_on;
+    s32 cluster_culling;
+    s32 bvh_culling; // Instances are culled by walking the scene BVH instead of testing them all in parallel
+    s32 occlusion_culling;
+    s32 hiz_culling; // The indirect commands are tested against a depth pyramid on the GPU
+    s32 gpu_culling; // Every instance is culled in a compute shader instead, the CPU culling is skipped
+    s32 depth_prepass; // Depth only from the position stream first, then shaded with GL_EQUAL
+    s32 shadows; // Cascaded shadow maps of the directional light
+    s32 local_shadows; // Point and spot light shadows from the atlas
+    s32 light_field; // Index of the count of small lights all over the scene, see renderer.c
+    s32 deferred; // The scene is drawn into a G-buffer and lit in one pass over the screen
+    s32 indirect_draws; // One multi-draw indirect call instead of a call per packet
     
 } AppState;
 
@@ -0,0 +1,255 @@
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <intrin.h> // _WriteBarrier
+#include <stdio.h> // printf, snprintf
+#include <string.h> // strcmp, strcpy, strlen
+#include <assert.h>
+
+#include "platform.h"
+
+WorkQueue work_queue;
+
+//----------------------
+// FILES
+//----------------------
+bool MapFileReadOnly(char *path, MappedFile *file)
+{
+    file->data = 0;
+    file->size = 0;
+    file->file_handle = 0;
+    file->mapping_handle = 0;
+
+    HANDLE file_handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, 0,
+                                     OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+    if(file_handle == INVALID_HANDLE_VALUE)
+    {
+        printf("Could not open file: %s\n", path);
+        return false;
+    }
+
+    LARGE_INTEGER file_size;
+    if(!GetFileSizeEx(file_handle, &file_size) || file_size.QuadPart == 0)
+    {
+        printf("Could not map empty file: %s\n", path);
+        CloseHandle(file_handle);
+        return false;
+    }
+
+    HANDLE mapping_handle = CreateFileMappingA(file_handle, 0, PAGE_READONLY, 0, 0, 0);
+    if(!mapping_handle)
+    {
+        printf("Could not create a file mapping for: %s\n", path);
+        CloseHandle(file_handle);
+        return false;
+    }
+
+    file->data = (u8*) MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0);
+    if(!file->data)
+    {
+        printf("Could not map a view of: %s\n", path);
+        CloseHandle(mapping_handle);
+        CloseHandle(file_handle);
+        return false;
+    }
+
+    file->size = (size_t)file_size.QuadPart;
+    file->file_handle = file_handle;
+    file->mapping_handle = mapping_handle;
+
+    return true;
+}
+
+void UnmapFile(MappedFile *file)
+{
+    if(file->data) UnmapViewOfFile(file->data);
+    if(file->mapping_handle) CloseHandle((HANDLE)file->mapping_handle);
+    if(file->file_handle) CloseHandle((HANDLE)file->file_handle);
+
+    file->data = 0;
+    file->size = 0;
+    file->file_handle = 0;
+    file->mapping_handle = 0;
+}
+
+void WalkDirectory(char *path, DirectoryVisitor *visitor, void *data)
+{
+    char pattern[MAX_PATH];
+    snprintf(pattern, sizeof(pattern), "%s\\*", path);
+
+    WIN32_FIND_DATAA find_data;
+    HANDLE find_handle = FindFirstFileA(pattern, &find_data);
+    if(find_handle == INVALID_HANDLE_VALUE) return;
+
+    do
+    {
+        if(!strcmp(find_data.cFileName, ".") || !strcmp(find_data.cFileName, "..")) continue;
+
+        char child_path[MAX_PATH];
+        snprintf(child_path, sizeof(child_path), "%s\\%s", path, find_data.cFileName);
+
+        if(find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+            WalkDirectory(child_path, visitor, data);
+        else
+            visitor(child_path, data);
+    }
+    while(FindNextFileA(find_handle, &find_data));
+
+    FindClose(find_handle);
+}
+
+bool CreateDirectoriesForFile(char *file_path)
+{
+    char directory[MAX_PATH];
+    size_t length = strlen(file_path);
+    if(length >= sizeof(directory)) return false;
+
+    strcpy(directory, file_path);
+
+    // Create every prefix that ends on a separator, the file name itself is left out
+    for(char *at = directory; *at; at++)
+    {
+        if(*at != '\\' && *at != '/') continue;
+
+        char separator = *at;
+        *at = '\0';
+
+        if(at != directory && !CreateDirectoryA(directory, 0) && GetLastError() != ERROR_ALREADY_EXISTS)
+        {
+            printf("Could not create directory: %s\n", directory);
+            return false;
+        }
+
+        *at = separator;
+    }
+
+    return true;
+}
+
+//----------------------
+// WORK QUEUE
+//----------------------
+
+// Returns true when there was nothing to do
+static bool DoNextWorkEntry(WorkQueue *queue)
+{
+    bool should_sleep = false;
+
+    u32 original_next_entry = queue->next_entry_to_read;
+    u32 new_next_entry = (original_next_entry + 1) % ArrayCount(queue->entries);
+
+    if(original_next_entry != queue->next_entry_to_write)
+    {
+        u32 index = InterlockedCompareExchange((LONG volatile *)&queue->next_entry_to_read,
+                                               new_next_entry, original_next_entry);
+        if(index == original_next_entry)
+        {
+            WorkQueueEntry entry = queue->entries[index];
+            entry.callback(queue, entry.data);
+
+            InterlockedIncrement((LONG volatile *)&queue->completion_count);
+        }
+    }
+    else
+    {
+        should_sleep = true;
+    }
+
+    return should_sleep;
+}
+
+static DWORD WINAPI WorkerThreadProc(LPVOID parameter)
+{
+    WorkQueue *queue = (WorkQueue*)parameter;
+
+    for(;;)
+    {
+        if(DoNextWorkEntry(queue))
+        {
+            WaitForSingleObjectEx((HANDLE)queue->semaphore_handle, INFINITE, FALSE);
+        }
+    }
+}
+
+void InitWorkQueue(WorkQueue *queue, u32 thread_count)
+{
+    queue->completion_goal = 0;
+    queue->completion_count = 0;
+    queue->next_entry_to_write = 0;
+    queue->next_entry_to_read = 0;
+    queue->thread_count = thread_count;
+
+    queue->semaphore_handle = CreateSemaphoreEx(0, 0, thread_count, 0, 0, SEMAPHORE_ALL_ACCESS);
+
+    for(u32 thread_index = 0; thread_index < thread_count; thread_index++)
+    {
+        DWORD thread_id;
+        HANDLE thread_handle = CreateThread(0, 0, WorkerThreadProc, queue, 0, &thread_id);
+        CloseHandle(thread_handle);
+    }
+}
+
+void AddWorkEntry(WorkQueue *queue, WorkQueueCallback *callback, void *data)
+{
+    u32 new_next_entry_to_write = (queue->next_entry_to_write + 1) % ArrayCount(queue->entries);
+    assert(new_next_entry_to_write != queue->next_entry_to_read);
+
+    WorkQueueEntry *entry = &queue->entries[queue->next_entry_to_write];
+    entry->callback = callback;
+    entry->data = data;
+
+    queue->completion_goal++;
+
+    // The entry has to be visible before the workers see the new write index
+    _WriteBarrier();
+
+    queue->next_entry_to_write = new_next_entry_to_write;
+    ReleaseSemaphore((HANDLE)queue->semaphore_handle, 1, 0);
+}
+
+void CompleteAllWork(WorkQueue *queue)
+{
+    while(queue->completion_goal != queue->completion_count)
+    {
+        DoNextWorkEntry(queue);
+    }
+
+    queue->completion_goal = 0;
+    queue->completion_count = 0;
+}
+
+u32 GetProcessorCount(void)
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+
+    return (u32)info.dwNumberOfProcessors;
+}
+
+u32 AtomicIncrement(u32 volatile *value)
+{
+    return (u32)InterlockedIncrement((LONG volatile *)value);
+}
+
+u32 AtomicAdd(u32 volatile *value, u32 addend)
+{
+    return (u32)InterlockedExchangeAdd((LONG volatile *)value, (LONG)addend) + addend;
+}
+
+//----------------------
+// TIMING
+//----------------------
+u64 GetWallClock(void)
+{
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+
+    return (u64)counter.QuadPart;
+}
+
+f64 GetSecondsElapsed(u64 start, u64 end)
+{
+    static LARGE_INTEGER frequency;
+    if(!frequency.QuadPart) QueryPerformanceFrequency(&frequency);
+
+    return (f64)(end - start) / (f64)frequency.QuadPart;
+}